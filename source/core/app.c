@@ -19,6 +19,10 @@
 #include "settings.h"
 #include "../logger.h"
 #include "../ui/ui_data.h"
+#include "../net/download_manager.h"
+#include "../net/net_loop.h"
+#include "../net/simple_http.h"
+#include "../net/tls_conn.h"
 
 static AppState current_state = APP_STATE_FILE_BROWSER;
 static bool running = true;
@@ -110,6 +114,14 @@ Result app_init(void) {
     task_queue_init();
     printf("app_init: task_queue_init OK\n"); write_init_log("task_queue_init OK");
 
+    // Network thread first: the download manager hands http jobs to it
+    printf("app_init: net_loop_start()\n"); write_init_log("app_init: net_loop_start()");
+    if (net_loop_start() != 0) write_init_log("net_loop_start failed; downloads use worker threads");
+
+    printf("app_init: dlmgr_init()\n"); write_init_log("app_init: dlmgr_init()");
+    // Concurrency comes from the settings once they are loaded
+    if (dlmgr_init(dlmgr_get_concurrency()) != 0) write_init_log("dlmgr_init failed; downloads start on first use");
+
     printf("app_init: hbstore_init()\n"); write_init_log("app_init: hbstore_init()");
     rc = hbstore_init();
     if (R_FAILED(rc)) { printf("app_init: hbstore_init failed: 0x%x\n", rc); write_init_log("hbstore_init failed: 0x%x", rc); return rc; }
@@ -148,6 +160,10 @@ Result app_init(void) {
 
 void app_exit(void) {
     // Clean up subsystems
+    dlmgr_exit();
+    net_loop_stop();
+    simple_http_close_idle();
+    tls_cleanup();
     hbstore_exit();
     task_queue_clear();
     system_manager_exit();
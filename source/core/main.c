@@ -11,6 +11,7 @@
 #include "app.h"
 #include "crypto.h"
 #include "secure_validation.h"
+#include "hash_db.h"
 #include "security_audit.h"
 #include "security_tests.h"
 #include "ui.h"
@@ -89,6 +90,7 @@ static Result init_security(void) {
 
 // Cleanup security subsystems
 static void exit_security(void) {
+    hash_db_close();
     if (g_security_ctx.audit_initialized)
         audit_exit();
     if (g_security_ctx.validation_initialized)
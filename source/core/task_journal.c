@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "task_journal.h"
+#include "../logger.h"
+
+static FILE *journal_file = NULL;
+static size_t journal_records = 0;   // records appended since the last compaction
+
+// Flush a record all the way to the SD card; the journal is only useful if
+// what it claims is actually on disk when the console loses power.
+static void journal_sync(FILE *f) {
+    fflush(f);
+    fsync(fileno(f));
+}
+
+static TaskJournalEntry *find_entry(TaskJournalEntry *entries, size_t count, u32 id) {
+    // Most records refer to recently enqueued tasks, so search from the back
+    for (size_t i = count; i > 0; i--) {
+        if (entries[i - 1].id == id) return &entries[i - 1];
+    }
+    return NULL;
+}
+
+static void write_enqueue(FILE *f, const Task *task) {
+    fprintf(f, "E %u %d %s\t%s\n", task->id, (int)task->type, task->src_path, task->dst_path);
+    if (task->priority != TASK_PRIORITY_NORMAL) fprintf(f, "P %u %d\n", task->id, (int)task->priority);
+}
+
+int task_journal_replay(TaskJournalEntry **out_entries, size_t *out_count, u32 *out_max_id) {
+    if (!out_entries || !out_count) return -EINVAL;
+    *out_entries = NULL;
+    *out_count = 0;
+    if (out_max_id) *out_max_id = 0;
+
+    FILE *f = fopen(TASK_JOURNAL_PATH, "r");
+    if (!f) {
+        // A crash between remove() and rename() during compaction leaves only the temp file
+        if (rename(TASK_JOURNAL_TMP, TASK_JOURNAL_PATH) == 0) f = fopen(TASK_JOURNAL_PATH, "r");
+        if (!f) return 0;
+    }
+
+    size_t line_size = 2 * PATH_MAX + 64;
+    char *line = malloc(line_size);
+    if (!line) { fclose(f); return -ENOMEM; }
+
+    TaskJournalEntry *entries = NULL;
+    size_t count = 0, cap = 0;
+    u32 max_id = 0;
+    int rc = 0;
+
+    while (fgets(line, (int)line_size, f)) {
+        size_t len = strlen(line);
+        if (len == 0 || line[len - 1] != '\n') break; // torn write at the tail
+        line[len - 1] = '\0';
+
+        char kind = line[0];
+        unsigned int id = 0;
+        int consumed = 0;
+        if (sscanf(line + 1, " %u%n", &id, &consumed) != 1) continue;
+        const char *rest = line + 1 + consumed;
+        if (id > max_id) max_id = id;
+
+        if (kind == 'E') {
+            int type = 0, type_len = 0;
+            if (sscanf(rest, " %d %n", &type, &type_len) != 1) continue;
+            const char *src = rest + type_len;
+            const char *tab = strchr(src, '\t');
+            if (!tab) continue;
+            if (count == cap) {
+                size_t ncap = cap ? cap * 2 : 32;
+                TaskJournalEntry *n = realloc(entries, ncap * sizeof(*entries));
+                if (!n) { rc = -ENOMEM; break; }
+                entries = n; cap = ncap;
+            }
+            TaskJournalEntry *e = &entries[count++];
+            memset(e, 0, sizeof(*e));
+            e->id = id;
+            e->type = (TaskType)type;
+            e->priority = TASK_PRIORITY_NORMAL;
+            size_t src_len = (size_t)(tab - src);
+            if (src_len >= sizeof(e->src_path)) src_len = sizeof(e->src_path) - 1;
+            memcpy(e->src_path, src, src_len);
+            strncpy(e->dst_path, tab + 1, sizeof(e->dst_path) - 1);
+        } else if (kind == 'P') {
+            int priority = 0;
+            TaskJournalEntry *e = find_entry(entries, count, id);
+            if (e && sscanf(rest, " %d", &priority) == 1) e->priority = (TaskPriority)priority;
+        } else if (kind == 'C') {
+            unsigned long long offset = 0;
+            TaskJournalEntry *e = find_entry(entries, count, id);
+            if (e && sscanf(rest, " %llu", &offset) == 1) e->checkpoint = offset;
+        } else if (kind == 'D') {
+            TaskJournalEntry *e = find_entry(entries, count, id);
+            if (e) {
+                size_t idx = (size_t)(e - entries);
+                memmove(e, e + 1, (count - idx - 1) * sizeof(*entries));
+                count--;
+            }
+        }
+    }
+
+    free(line);
+    fclose(f);
+    if (rc != 0) { free(entries); return rc; }
+
+    if (count == 0) { free(entries); entries = NULL; }
+    *out_entries = entries;
+    *out_count = count;
+    if (out_max_id) *out_max_id = max_id;
+    log_event(LOG_INFO, "task_journal: replayed %zu unfinished task(s)", count);
+    return 0;
+}
+
+int task_journal_open(void) {
+    if (journal_file) return 0;
+    mkdir("sdmc:/dbfm", 0777);
+    mkdir(TASK_JOURNAL_DIR, 0777);
+    journal_file = fopen(TASK_JOURNAL_PATH, "a");
+    if (!journal_file) {
+        log_event(LOG_WARN, "task_journal: cannot open %s (errno=%d), queue will not survive restarts", TASK_JOURNAL_PATH, errno);
+        return -errno;
+    }
+    return 0;
+}
+
+void task_journal_close(void) {
+    if (!journal_file) return;
+    journal_sync(journal_file);
+    fclose(journal_file);
+    journal_file = NULL;
+}
+
+void task_journal_enqueue(const Task *task) {
+    if (!journal_file || !task) return;
+    write_enqueue(journal_file, task);
+    journal_sync(journal_file);
+    journal_records++;
+}
+
+void task_journal_checkpoint(u32 id, u64 offset) {
+    if (!journal_file) return;
+    fprintf(journal_file, "C %u %llu\n", id, (unsigned long long)offset);
+    journal_sync(journal_file);
+    journal_records++;
+}
+
+void task_journal_complete(u32 id) {
+    if (!journal_file) return;
+    fprintf(journal_file, "D %u\n", id);
+    journal_sync(journal_file);
+    journal_records++;
+}
+
+bool task_journal_needs_compaction(void) {
+    return journal_records >= TASK_JOURNAL_COMPACT_RECORDS;
+}
+
+int task_journal_compact(const Task *head) {
+    bool was_open = journal_file != NULL;
+    task_journal_close();
+
+    mkdir("sdmc:/dbfm", 0777);
+    mkdir(TASK_JOURNAL_DIR, 0777);
+    FILE *f = fopen(TASK_JOURNAL_TMP, "w");
+    if (!f) {
+        int e = -errno;
+        if (was_open) task_journal_open();
+        return e;
+    }
+    for (const Task *t = head; t; t = t->next) {
+        write_enqueue(f, t);
+        if (t->last_checkpoint > 0) fprintf(f, "C %u %llu\n", t->id, (unsigned long long)t->last_checkpoint);
+    }
+    journal_sync(f);
+    int failed = ferror(f);
+    fclose(f);
+    if (failed) {
+        remove(TASK_JOURNAL_TMP);
+        if (was_open) task_journal_open();
+        return -EIO;
+    }
+
+    // FAT does not replace on rename, so drop the old journal first; replay
+    // falls back to the temp file if we die in between.
+    remove(TASK_JOURNAL_PATH);
+    int rc = 0;
+    if (rename(TASK_JOURNAL_TMP, TASK_JOURNAL_PATH) != 0) rc = -errno;
+    journal_records = 0;
+    if (was_open) task_journal_open();
+    return rc;
+}
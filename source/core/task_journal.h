@@ -0,0 +1,55 @@
+#ifndef TASK_JOURNAL_H
+#define TASK_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "task_queue.h"
+
+// Append-only on-SD journal of task queue state so pending work survives a
+// crash or the app being closed. Three record kinds are written, one per line:
+//   E <id> <type> <src>\t<dst>   task enqueued
+//   P <id> <priority>            non-default priority of an enqueued task
+//   C <id> <offset>              progress checkpoint (bytes durably written)
+//   D <id>                       task finished (success, error or cancel)
+// A torn final line (no trailing newline) is ignored on replay.
+#define TASK_JOURNAL_DIR  "sdmc:/dbfm/queue"
+#define TASK_JOURNAL_PATH TASK_JOURNAL_DIR "/tasks.journal"
+#define TASK_JOURNAL_TMP  TASK_JOURNAL_DIR "/tasks.journal.tmp"
+
+// Rewrite the journal once this many records have been appended since the last compaction
+#define TASK_JOURNAL_COMPACT_RECORDS 256
+// Journal a checkpoint after this many bytes of progress on resumable tasks
+#define TASK_JOURNAL_CHECKPOINT_BYTES (4ull * 1024 * 1024)
+
+// A task recovered from the journal that never reached its 'D' record
+typedef struct {
+    u32 id;
+    TaskType type;
+    TaskPriority priority;
+    char src_path[PATH_MAX];
+    char dst_path[PATH_MAX];
+    u64 checkpoint;             // last journaled byte offset, 0 if none
+} TaskJournalEntry;
+
+// Replay the journal. Allocates *out_entries (caller frees) with the unfinished
+// tasks in enqueue order and reports the highest task id seen in *out_max_id.
+// Returns 0 on success (including "no journal"), negative errno-style on failure.
+int task_journal_replay(TaskJournalEntry **out_entries, size_t *out_count, u32 *out_max_id);
+
+// Open the journal for appending. Returns 0 on success.
+int task_journal_open(void);
+void task_journal_close(void);
+
+// Record writers; no-ops when the journal is not open.
+void task_journal_enqueue(const Task *task);
+void task_journal_checkpoint(u32 id, u64 offset);
+void task_journal_complete(u32 id);
+
+// Rewrite the journal so it only describes the live tasks starting at 'head'
+// (NULL for an empty queue). Crash-safe: written to a temp file first.
+int task_journal_compact(const Task *head);
+
+// True once enough records have accumulated that a compaction is worthwhile
+bool task_journal_needs_compaction(void);
+
+#endif // TASK_JOURNAL_H
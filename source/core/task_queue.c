@@ -4,13 +4,80 @@
 #include "task_queue.h"
 #include <stdio.h>
 #include <errno.h>
+#include <sys/stat.h>
 #include "../file/fs_ops.h"
+#include "../ui/dialog.h"
+#include "../logger.h"
+#include "task_journal.h"
+#include "../net/download_manager.h"
+#include "../settings.h"
+#include "../security/hash_db.h"
+#include "../security/secure.h"
+#include "../security/manifest.h"
+#include "../verify.h"
 
 static Task* task_queue_head = NULL;
 static Task* task_queue_current = NULL;
+static u32 task_next_id = 1;
+static Task* task_queue_last_run = NULL;   // task stepped on the previous frame
+
+static void task_queue_free_all(void) {
+    task_queue_last_run = NULL;
+    while (task_queue_head) {
+        Task* next = task_queue_head->next;
+        free(task_queue_head);
+        task_queue_head = next;
+    }
+    task_queue_current = NULL;
+}
+
+// Keep the list ordered by priority (FIFO within a class) so the head is always
+// the task to step next. A task inserted in front of a running one preempts it;
+// the preempted task keeps its op_ctx and continues once it is the head again.
+static void task_queue_append(Task* new_task) {
+    Task** link = &task_queue_head;
+    while (*link && (*link)->priority <= new_task->priority) link = &(*link)->next;
+    new_task->next = *link;
+    *link = new_task;
+    task_queue_current = task_queue_head;
+}
 
 void task_queue_init(void) {
-    task_queue_clear();
+    task_queue_free_all();
+
+    TaskJournalEntry *entries = NULL;
+    size_t count = 0;
+    u32 max_id = 0;
+    if (task_journal_replay(&entries, &count, &max_id) != 0) count = 0;
+    task_next_id = max_id + 1;
+
+    if (count > 0) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "%zu unfinished task(s) from the last session were found.\nResume them? Completed work will not be repeated.", count);
+        if (dialog_show("Resume Task Queue", msg, DIALOG_TYPE_CONFIRM) == DIALOG_YES) {
+            for (size_t i = 0; i < count; i++) {
+                Task* t = (Task*)calloc(1, sizeof(Task));
+                if (!t) break;
+                t->id = entries[i].id;
+                t->type = entries[i].type;
+                t->priority = entries[i].priority;
+                memcpy(t->src_path, entries[i].src_path, sizeof(t->src_path));
+                memcpy(t->dst_path, entries[i].dst_path, sizeof(t->dst_path));
+                t->resumed = true;
+                t->resume_offset = entries[i].checkpoint;
+                t->last_checkpoint = entries[i].checkpoint;
+                task_queue_append(t);
+            }
+            log_event(LOG_INFO, "task_queue: resumed %zu task(s) from journal", count);
+        } else {
+            log_event(LOG_INFO, "task_queue: discarded %zu task(s) from journal", count);
+        }
+    }
+    free(entries);
+
+    // Start the new session from a journal that only describes the live queue
+    task_journal_compact(task_queue_head);
+    task_journal_open();
 }
 
 int task_queue_get_aggregate_progress(void) {
@@ -46,10 +113,16 @@ void task_queue_cancel_pending(void) {
 }
 
 void task_queue_add(TaskType type, const char* src, const char* dst) {
-    Task* new_task = (Task*)malloc(sizeof(Task));
+    task_queue_add_priority(type, src, dst, TASK_PRIORITY_NORMAL);
+}
+
+void task_queue_add_priority(TaskType type, const char* src, const char* dst, TaskPriority priority) {
+    Task* new_task = (Task*)calloc(1, sizeof(Task));
     if (!new_task) return;
 
     new_task->type = type;
+    new_task->priority = priority;
+    new_task->id = task_next_id++;
     strncpy(new_task->src_path, src, PATH_MAX - 1);
     strncpy(new_task->dst_path, dst ? dst : "", PATH_MAX - 1);
     new_task->status.progress = 0;
@@ -58,14 +131,8 @@ void task_queue_add(TaskType type, const char* src, const char* dst) {
     new_task->cancel = false;
     new_task->next = NULL;
 
-    if (!task_queue_head) {
-        task_queue_head = new_task;
-        task_queue_current = new_task;
-    } else {
-        Task* last = task_queue_head;
-        while (last->next) last = last->next;
-        last->next = new_task;
-    }
+    task_queue_append(new_task);
+    task_journal_enqueue(new_task);
 }
 
 bool task_queue_is_empty(void) {
@@ -81,6 +148,129 @@ static void task_set_error(Task* task, const char* error) {
     strncpy(task->status.error_msg, error, sizeof(task->status.error_msg) - 1);
 }
 
+// Journal how far a copy/move got once enough new data is durably on disk, so
+// a resumed task only redoes the bytes written after the last checkpoint.
+static void task_checkpoint(Task* task, FsCopyCtx* ctx) {
+    u64 offset = (u64)fs_copy_get_offset(ctx);
+    if (offset < task->last_checkpoint + TASK_JOURNAL_CHECKPOINT_BYTES) return;
+    if (fs_copy_sync(ctx) != 0) return;
+    task_journal_checkpoint(task->id, offset);
+    task->last_checkpoint = offset;
+}
+
+// The manifest covering 'path': the path itself if it is one, otherwise the
+// one a dump writes next to its data file
+static bool task_manifest_path(const char* path, char* out) {
+    size_t len = strlen(path), ext = strlen(MANIFEST_EXT);
+    if (len > ext && strcasecmp(path + len - ext, MANIFEST_EXT) == 0) {
+        snprintf(out, PATH_MAX, "%s", path);
+        return true;
+    }
+    struct stat st;
+    return snprintf(out, PATH_MAX, "%s" MANIFEST_EXT, path) < PATH_MAX && stat(out, &st) == 0;
+}
+
+// Bytes a hashing task reads per frame
+#define TASK_HASH_STEP_BYTES (512 * 1024)
+
+// What a running TASK_VALIDATE_FILE keeps in op_ctx between frames: the
+// state of whichever check applies to the file
+typedef struct {
+    char manifest[PATH_MAX];    // empty unless the file has a manifest
+    ManifestVerify* verify;
+    NspDeepVerify* nsp;
+    NspVerifyResult nsp_result;
+    HashDbUpdate* hash;
+} ValidateCtx;
+
+// One batch of manifest chunks per frame, spread over the hashing cores.
+// Returns true while there is more to do.
+static bool task_verify_manifest(Task* task, ValidateCtx* ctx, int* rc) {
+    if (!ctx->verify) {
+        task->status.progress = 0;
+        *rc = manifest_verify_begin(ctx->manifest, task->resume_offset, &ctx->verify);
+        if (*rc != 0) return false;
+    }
+    ManifestVerify* v = ctx->verify;
+    *rc = manifest_verify_step(v, &task->cancel);
+    task->status.progress = manifest_verify_progress(v);
+    // Journal how far the data is known good, so a resumed check skips it
+    u64 pos = manifest_verify_position(v);
+    if (pos >= task->last_checkpoint + TASK_JOURNAL_CHECKPOINT_BYTES) {
+        task_journal_checkpoint(task->id, pos);
+        task->last_checkpoint = pos;
+    }
+    if (*rc == 0) return true;
+
+    size_t count = 0;
+    const ManifestDamage* damage = manifest_verify_damage(v, &count);
+    if (*rc == 1) {
+        for (size_t i = 0; i < count; i++) {
+            log_event(LOG_WARN, "task_queue: %s: damaged bytes 0x%llx-0x%llx", damage[i].name,
+                      (unsigned long long)damage[i].offset, (unsigned long long)(damage[i].offset + damage[i].size));
+        }
+        if (count > 0) {
+            char error[256];
+            snprintf(error, sizeof(error), "%zu damaged range(s), first in %s at 0x%llx; see the log",
+                     count, damage[0].name, (unsigned long long)damage[0].offset);
+            task_set_error(task, error);
+        } else {
+            log_event(LOG_INFO, "task_queue: %s verified", ctx->manifest);
+            task->status.progress = 100;
+        }
+        *rc = 0;
+    } else if (*rc == -EINTR) {
+        *rc = -ECANCELED;
+    }
+    manifest_verify_finish(v);
+    ctx->verify = NULL;
+    return false;
+}
+
+// Deep NSP check, a slice of NCA data per frame. NCAs already hashed while
+// the NSP was unchanged come from the hash database.
+static bool task_verify_nsp(Task* task, ValidateCtx* ctx, int* rc) {
+    Result vr = 0;
+    bool done = false;
+    if (!ctx->nsp) {
+        // Headers and cached digests only; hashing starts next frame
+        vr = verify_nsp_deep_begin(task->src_path, &ctx->nsp_result, &ctx->nsp);
+        if (R_SUCCEEDED(vr)) return true;
+    } else if (task->cancel) {
+        *rc = -ECANCELED;
+    } else {
+        vr = verify_nsp_deep_step(ctx->nsp, TASK_HASH_STEP_BYTES, &done);
+        task->status.progress = verify_nsp_deep_progress(ctx->nsp);
+        if (R_SUCCEEDED(vr) && !done) return true;
+    }
+    verify_nsp_deep_finish(ctx->nsp);
+    ctx->nsp = NULL;
+    verify_free_nsp_result(&ctx->nsp_result);
+    if (R_FAILED(vr)) task_set_error(task, verify_get_error_message(vr));
+    else if (done) task->status.progress = 100;
+    return false;
+}
+
+// SHA-256 of any other file, kept in the hash database; a slice per frame
+static bool task_verify_sha256(Task* task, ValidateCtx* ctx, int* rc) {
+    if (!ctx->hash) {
+        *rc = hash_db_update_begin(task->src_path, &ctx->hash);
+        if (*rc != 0) return false;
+    }
+    *rc = hash_db_update_step(ctx->hash, TASK_HASH_STEP_BYTES, &task->cancel);
+    task->status.progress = hash_db_update_progress(ctx->hash);
+    if (*rc == 0) return true;
+    hash_db_update_finish(ctx->hash, NULL);
+    ctx->hash = NULL;
+    if (*rc == 1) {
+        task->status.progress = 100;
+        *rc = 0;
+    } else if (*rc == -EINTR) {
+        *rc = -ECANCELED;
+    }
+    return false;
+}
+
 static void task_execute(Task* task) {
     int rc = 0;
     
@@ -94,7 +284,7 @@ static void task_execute(Task* task) {
                 if (!h) { rc = -ENOMEM; break; }
                 h->progress = &task->status.progress; h->cancel = &task->cancel;
                 FsCopyCtx *ctx = NULL;
-                rc = fs_copy_begin(task->src_path, task->dst_path, &ctx, h);
+                rc = fs_copy_begin_at(task->src_path, task->dst_path, (size_t)task->resume_offset, &ctx, h);
                 if (rc == 0) {
                     task->op_ctx = ctx;
                     // store the FsProgressHandle pointer in op_ctx? ctx contains a copy already, so free h
@@ -109,6 +299,7 @@ static void task_execute(Task* task) {
             if (task->op_ctx) {
                 FsCopyCtx *ctx = (FsCopyCtx*)task->op_ctx;
                 rc = fs_copy_step(ctx, 64 * 1024); // step up to 64KiB per frame
+                if (rc == 0) task_checkpoint(task, ctx);
                 if (rc == 1) {
                     // complete
                     fs_copy_finish(ctx);
@@ -142,7 +333,13 @@ static void task_execute(Task* task) {
                 if (!h) { rc = -ENOMEM; break; }
                 h->progress = &task->status.progress; h->cancel = &task->cancel;
                 FsCopyCtx *ctx = NULL;
-                rc = fs_copy_begin(task->src_path, task->dst_path, &ctx, h);
+                // A resumed move whose source is already gone finished before the restart
+                if (task->resumed && fs_get_props(task->src_path, NULL, NULL) != 0 && fs_get_props(task->dst_path, NULL, NULL) == 0) {
+                    free(h);
+                    task->status.progress = 100;
+                    break;
+                }
+                rc = fs_copy_begin_at(task->src_path, task->dst_path, (size_t)task->resume_offset, &ctx, h);
                 free(h);
                 if (rc == 0) {
                     task->op_ctx = ctx;
@@ -152,6 +349,7 @@ static void task_execute(Task* task) {
             if (task->op_ctx) {
                 FsCopyCtx *ctx = (FsCopyCtx*)task->op_ctx;
                 rc = fs_copy_step(ctx, 64 * 1024);
+                if (rc == 0) task_checkpoint(task, ctx);
                 if (rc == 1) {
                     fs_copy_finish(ctx); task->op_ctx = NULL;
                     // remove source
@@ -168,7 +366,12 @@ static void task_execute(Task* task) {
             task->status.progress = 0;
             task->status.has_error = false;
             rc = fs_delete(task->src_path);
-            if (rc == 0) task->status.progress = 100;
+            // Deleting is idempotent; a resumed delete may already have happened
+            if (rc == -ENOENT && task->resumed) rc = 0;
+            if (rc == 0) {
+                hash_db_forget(task->src_path);
+                task->status.progress = 100;
+            }
             break;
         }
             
@@ -196,9 +399,101 @@ static void task_execute(Task* task) {
             // TODO: Implement system restore
             break;
             
-        case TASK_DOWNLOAD_HB:
-            // TODO: Implement homebrew download
+        case TASK_DOWNLOAD_HB: {
+            // The transfer itself runs on the download manager's workers;
+            // the queue only hands it over so it never blocks a frame.
+            DownloadPriority prio = task->priority == TASK_PRIORITY_INTERACTIVE ? DOWNLOAD_PRIORITY_INTERACTIVE :
+                                    task->priority == TASK_PRIORITY_BACKGROUND ? DOWNLOAD_PRIORITY_BACKGROUND : DOWNLOAD_PRIORITY_NORMAL;
+            u32 rate_limit = g_settings.download_job_limit_kib * 1024u;
+            if (dlmgr_enqueue(task->src_path, task->dst_path[0] ? task->dst_path : NULL, prio, rate_limit) == 0) rc = -ENOMEM;
+            else task->status.progress = 100;
             break;
+        }
+        
+        case TASK_VALIDATE_FILE: {
+            task->status.has_error = false;
+            ValidateCtx* ctx = (ValidateCtx*)task->op_ctx;
+            if (!ctx) {
+                task->status.progress = 0;
+                ctx = calloc(1, sizeof(ValidateCtx));
+                if (!ctx) { rc = -ENOMEM; break; }
+                // Dumps and backups carry a manifest; check that chunk by chunk
+                if (!task_manifest_path(task->src_path, ctx->manifest)) ctx->manifest[0] = '\0';
+                task->op_ctx = ctx;
+            }
+            const char *ext = strrchr(task->src_path, '.');
+            bool running;
+            if (ctx->manifest[0]) running = task_verify_manifest(task, ctx, &rc);
+            else if (ext && strcasecmp(ext, ".nsp") == 0) running = task_verify_nsp(task, ctx, &rc);
+            else running = task_verify_sha256(task, ctx, &rc);
+            if (running) return;
+            free(ctx);
+            task->op_ctx = NULL;
+            break;
+        }
+        
+        case TASK_UPDATE_HASHES: {
+            // The walk happens once up front; after that only new or changed
+            // files are read, a slice per frame
+            task->status.has_error = false;
+            if (!task->op_ctx) {
+                task->status.progress = 0;
+                HashDbUpdate *u = NULL;
+                rc = hash_db_update_begin(task->src_path, &u);
+                if (rc != 0) break;
+                task->op_ctx = u;
+            }
+            HashDbUpdate *u = (HashDbUpdate*)task->op_ctx;
+            rc = hash_db_update_step(u, TASK_HASH_STEP_BYTES, &task->cancel);
+            task->status.progress = hash_db_update_progress(u);
+            if (rc == 0) return; // still running
+            HashDbUpdateStats stats;
+            hash_db_update_finish(u, &stats);
+            task->op_ctx = NULL;
+            if (rc == 1) {
+                log_event(LOG_INFO, "task_queue: hash database updated for %s (%zu file(s), %zu hashed, %zu removed)",
+                          task->src_path, stats.files_seen, stats.files_hashed, stats.files_removed);
+                task->status.progress = 100;
+                rc = 0;
+            } else if (rc == -EINTR) {
+                rc = -ECANCELED;
+            }
+            break;
+        }
+
+        case TASK_SECURE_WIPE: {
+            // Overwrite then remove src_path (a file or a whole tree), one
+            // buffer per frame; progress counts bytes over all passes
+            task->status.has_error = false;
+            if (!task->op_ctx) {
+                task->status.progress = 0;
+                SecureWipe *w = NULL;
+                rc = secure_wipe_begin(task->src_path, true, &w);
+                // A resumed wipe may have finished before the restart
+                if (rc == -ENOENT && task->resumed) {
+                    task->status.progress = 100;
+                    rc = 0;
+                    break;
+                }
+                if (rc != 0) break;
+                task->op_ctx = w;
+            }
+            SecureWipe *w = (SecureWipe*)task->op_ctx;
+            rc = secure_wipe_step(w, SECURE_WIPE_BUFFER, &task->cancel);
+            task->status.progress = secure_wipe_progress(w);
+            if (rc == 0) return; // still running
+            secure_wipe_finish(w);
+            task->op_ctx = NULL;
+            if (rc == 1) {
+                hash_db_forget(task->src_path);
+                log_event(LOG_INFO, "task_queue: securely wiped %s", task->src_path);
+                task->status.progress = 100;
+                rc = 0;
+            } else if (rc == -EINTR) {
+                rc = -ECANCELED;
+            }
+            break;
+        }
     }
     
     if (rc != 0) {
@@ -210,8 +505,15 @@ static void task_execute(Task* task) {
 }
 
 void task_queue_process(void) {
+    task_queue_current = task_queue_head;
     if (!task_queue_current) return;
 
+    if (task_queue_last_run && task_queue_last_run != task_queue_current && task_queue_last_run->op_ctx) {
+        log_event(LOG_INFO, "task_queue: task %u yielded to higher priority task %u",
+                  task_queue_last_run->id, task_queue_current->id);
+    }
+    task_queue_last_run = task_queue_current;
+
     // Execute a single step for the current task; task_execute will return
     // early if the task is still running.
     task_execute(task_queue_current);
@@ -221,17 +523,16 @@ void task_queue_process(void) {
         Task* completed = task_queue_current;
         task_queue_current = task_queue_current->next;
         if (completed == task_queue_head) task_queue_head = task_queue_current;
+        task_journal_complete(completed->id);
+        if (completed == task_queue_last_run) task_queue_last_run = NULL;
         free(completed);
+        if (task_journal_needs_compaction()) task_journal_compact(task_queue_head);
     }
 }
 
 void task_queue_clear(void) {
-    while (task_queue_head) {
-        Task* next = task_queue_head->next;
-        free(task_queue_head);
-        task_queue_head = next;
-    }
-    task_queue_current = NULL;
+    task_queue_free_all();
+    task_journal_compact(NULL);
 }
 
 int task_get_progress(Task* task) {
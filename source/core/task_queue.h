@@ -38,6 +38,14 @@ typedef enum {
     TASK_SCAN_THREATS          // Scan for security threats
 } TaskType;
 
+// Scheduling class. The queue runs the highest class first; a running task of
+// a lower class yields at its next step boundary when a higher one arrives.
+typedef enum {
+    TASK_PRIORITY_INTERACTIVE,   // Small jobs the user is actively waiting on
+    TASK_PRIORITY_NORMAL,        // Default for queued work
+    TASK_PRIORITY_BACKGROUND     // Long dumps/backups that may be preempted
+} TaskPriority;
+
 // Security task parameters
 typedef struct {
     ValidationFlags validation_flags;     // Validation flags for file checks
@@ -60,6 +68,7 @@ typedef struct {
 
 typedef struct Task {
     TaskType type;
+    TaskPriority priority;
     char src_path[PATH_MAX];
     char dst_path[PATH_MAX];
     TaskStatus status;
@@ -69,6 +78,10 @@ typedef struct Task {
     bool cancel;                          // Request cancellation from UI
     struct Task* next;
     void *op_ctx;                          // opaque per-task operation context
+    u32 id;                               // Stable id used by the on-SD journal
+    bool resumed;                         // Recovered from the journal after a restart
+    u64 resume_offset;                    // Byte offset to resume a copy/move from
+    u64 last_checkpoint;                  // Offset of the last journaled checkpoint
 } Task;
 
 // Aggregated operations across the queue
@@ -77,8 +90,11 @@ void task_queue_cancel_all(void); // request cancel for all tasks (current + pen
 void task_queue_cancel_pending(void); // request cancel for pending tasks only
 
 // Queue management
+// Replays the on-SD journal and offers to resume tasks left over from a
+// previous session before starting with a fresh queue.
 void task_queue_init(void);
 void task_queue_add(TaskType type, const char* src, const char* dst);
+void task_queue_add_priority(TaskType type, const char* src, const char* dst, TaskPriority priority);
 void task_queue_add_secure(TaskType type, const char* src, const char* dst,
                           const SecurityTaskParams* security_params);
 bool task_queue_is_empty(void);
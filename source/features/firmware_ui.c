@@ -67,7 +67,7 @@ static void _start_firmware_export(void) {
     // generic task type and store the path in the src field. This is a
     // minimal compatibility adjustment; a real task queue that accepts
     // function pointers would be preferable.
-    task_queue_add(TASK_DUMP_SYSTEM, task_path, "");
+    task_queue_add_priority(TASK_DUMP_SYSTEM, task_path, "", TASK_PRIORITY_BACKGROUND);
 }
 
 static void _extract_content(void) {
@@ -11,6 +11,7 @@
 #include "../fs.h"
 #include "auto_folders.h"
 #include "../ui/system_diagnostics.h"
+#include "../ui/ui_data.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -68,6 +69,49 @@ static void _verify_nsp_file(void) {
     free(path);
 }
 
+static void _deep_verify_progress(size_t current, size_t total) {
+    ui_set_task("Hashing NSP contents", total ? (int)((u64)current * 100 / total) : 100);
+}
+
+static void _deep_verify_nsp_file(void) {
+    char* path = fs_open_file_picker("Select NSP file", "NSP files (*.nsp)");
+    if (!path) return;
+
+    NspVerifyResult verify_result;
+    memset(&verify_result, 0, sizeof(verify_result));
+    Result rc = verify_nsp_file_deep(path, &verify_result, _deep_verify_progress);
+    ui_clear_task();
+
+    if (verify_result.hash_results) {
+        char info[2048];
+        size_t len = (size_t)snprintf(info, sizeof(info), "%zu NCA(s) checked (%zu unchanged since last time), %zu mismatched\n\n",
+                                      verify_result.hash_count, verify_result.hash_cached, verify_result.hash_failures);
+        for (size_t i = 0; i < verify_result.hash_count && len < sizeof(info); i++) {
+            const NcaHashResult* r = &verify_result.hash_results[i];
+            const char* status = r->status == NcaHash_Match ? (r->full_hash ? "OK (CNMT hash)" : "OK") :
+                                 r->status == NcaHash_Mismatch ? "CORRUPTED" : "no reference hash";
+            len += (size_t)snprintf(info + len, sizeof(info) - len, "%s: %s\n", r->name, status);
+        }
+        if (R_SUCCEEDED(rc)) ui_show_message("NSP Deep Verification", "%s", info);
+        else ui_show_error("NSP Deep Verification", "%s", info);
+    } else {
+        ui_show_error("Verification Error", verify_get_error_message(rc));
+    }
+
+    verify_free_nsp_result(&verify_result);
+    free(path);
+}
+
+static void _update_hash_database(void) {
+    char* dir = fs_select_directory("Select folder to index");
+    if (!dir) return;
+    // Only new or changed files are read; the rest keep their stored digests
+    task_queue_add_priority(TASK_UPDATE_HASHES, dir, "", TASK_PRIORITY_BACKGROUND);
+    ui_show_message("Hash Database", "Queued an update of the hash database for %s.\n"
+                    "Files already indexed and unchanged are skipped.", dir);
+    free(dir);
+}
+
 static void _manage_title_keys(void) {
     TitleKeyInfo* keys;
     size_t count;
@@ -223,6 +267,8 @@ void goldleaf_show_menu(void) {
     MenuItem items[] = {
         {"USB Connection", true},
         {"Verify NSP/NCA", true},
+        {"Deep Verify NSP (hash contents)", true},
+        {"Update Hash Database", true},
         {"Title Key Management", true},
         {"Import Title Key", true},
         {"Web Browser", true},
@@ -252,27 +298,33 @@ void goldleaf_show_menu(void) {
                 _verify_nsp_file();
                 break;
             case 2:
-                _manage_title_keys();
+                _deep_verify_nsp_file();
                 break;
             case 3:
-                _import_title_key();
+                _update_hash_database();
                 break;
             case 4:
-                _browse_url();
+                _manage_title_keys();
                 break;
             case 5:
-                auto_folders_show_menu();
+                _import_title_key();
                 break;
             case 6:
-                system_diagnostics_show();
+                _browse_url();
                 break;
             case 7:
-                logger_show_viewer();
+                auto_folders_show_menu();
                 break;
             case 8:
-                security_show_settings();
+                system_diagnostics_show();
                 break;
             case 9:
+                logger_show_viewer();
+                break;
+            case 10:
+                security_show_settings();
+                break;
+            case 11:
             default:
                 return;
         }
@@ -80,6 +80,7 @@ void hbstore_ui_update(void) {
             break;
             
         case MENU_ACTION_REFRESH:
+            hbstore_update_repositories(NULL);
             refresh_app_list();
             break;
             
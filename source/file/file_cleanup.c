@@ -8,6 +8,9 @@
 #include "file_cleanup.h"
 #include "task_queue.h"
 #include "nsp_manager.h"
+#include "verify.h"
+#include "hash_db.h"
+#include "libnx_errors.h"
 
 static size_t total_freed = 0;
 
@@ -93,6 +96,14 @@ static void installed_nsp_callback(const char* path, const struct stat* st, void
     }
 }
 
+static void corrupt_file_callback(const char* path, const struct stat* st, void* user_data) {
+    const CleanupConfig* config = (const CleanupConfig*)user_data;
+    if (cleanup_is_corrupt_file(path, config->validation_flags)) {
+        task_queue_add(TASK_DELETE, path, NULL);
+        total_freed += (size_t)st->st_size;
+    }
+}
+
 Result cleanup_scan_directory(const char* path, const CleanupConfig* config, CleanupStats* stats) {
     Result rc = 0;
     total_freed = 0;
@@ -121,6 +132,11 @@ Result cleanup_scan_directory(const char* path, const CleanupConfig* config, Cle
         if (R_FAILED(rc)) return rc;
     }
 
+    if (config->flags & CLEANUP_CORRUPT_FILES) {
+        rc = process_directory(path, config, corrupt_file_callback, (void*)config);
+        if (R_FAILED(rc)) return rc;
+    }
+
     return rc;
 }
 
@@ -159,6 +175,14 @@ Result cleanup_installed_packages(const char* path, void (*progress_cb)(const ch
     return cleanup_scan_directory(path, &config, NULL);
 }
 
+Result cleanup_corrupt_files(const char* path, ValidationFlags flags) {
+    CleanupConfig config;
+    cleanup_config_init(&config);
+    config.flags = CLEANUP_CORRUPT_FILES;
+    config.validation_flags = flags;
+    return cleanup_scan_directory(path, &config, NULL);
+}
+
 bool cleanup_is_installed_title(const char* nsp_path) {
     // Extract title ID from NSP filename (assumes format: titleid.nsp)
     const char* title_start = strrchr(nsp_path, '/');
@@ -196,4 +220,31 @@ bool cleanup_is_partial_dump(const char* path) {
     const char *ext = strrchr(path, '.');
     if (!ext) return false;
     return (strcasecmp(ext, ".part") == 0) || (strcasecmp(ext, ".partial") == 0);
-}
\ No newline at end of file
+}
+
+// Only packages that carry their own hashes can be told to be corrupt, and
+// only a failed check counts: an unreadable file is left alone. Verdicts
+// come from the hash database when the file has not changed since it was
+// last checked, so a rescan does not re-read the whole library.
+bool cleanup_is_corrupt_file(const char* path, ValidationFlags flags) {
+    const char *ext = strrchr(path, '.');
+    if (!ext) return false;
+
+    if (strcasecmp(ext, ".nsp") == 0) {
+        HashDbEntry entry;
+        if (hash_db_lookup(path, NULL, &entry) && entry.verdict != HASH_DB_UNVERIFIED) {
+            return entry.verdict == HASH_DB_VERIFIED_BAD;
+        }
+        NspVerifyResult result;
+        memset(&result, 0, sizeof(result));
+        Result rc = (flags & VALIDATE_HASH) ? verify_nsp_file_deep(path, &result, NULL) : verify_nsp_file(path, &result);
+        verify_free_nsp_result(&result);
+        return rc == MAKERESULT(Module_Libnx, LibnxError_VerificationFailed) ||
+               rc == MAKERESULT(Module_Libnx, LibnxError_BadMagic);
+    }
+    if (strcasecmp(ext, ".nca") == 0) {
+        NcaVerifyResult result;
+        return verify_nca_file(path, &result) == MAKERESULT(Module_Libnx, LibnxError_BadMagic);
+    }
+    return false;
+}
@@ -656,9 +656,9 @@ Result file_explorer_open(const char *start_dir, int view_rows, int view_cols) {
                 if (selected_count == 0) {
                     ui_show_message("Bulk Ops", "No items selected. Use Y to toggle selection.");
                 } else {
-                    MenuItem items[] = {{"Copy", true}, {"Move", true}, {"Delete", true}, {"Cancel", true}};
-                    int choice = ui_show_menu("Bulk Operations", items, 4);
-                    if (choice >= 0 && choice <= 2) {
+                    MenuItem items[] = {{"Copy", true}, {"Move", true}, {"Delete", true}, {"Secure Delete", true}, {"Verify", true}, {"Cancel", true}};
+                    int choice = ui_show_menu("Bulk Operations", items, 6);
+                    if (choice >= 0 && choice <= 4) {
                         char dstbuf[PATH_MAX] = {0};
                         if (choice == 0 || choice == 1) {
                             // ask destination path
@@ -678,7 +678,15 @@ Result file_explorer_open(const char *start_dir, int view_rows, int view_cols) {
                             char src[PATH_MAX]; snprintf(src, sizeof(src), "%s%s", cur_dir, name);
                             if (choice == 2) {
                                 // Delete
-                                task_queue_add(TASK_DELETE, src, NULL);
+                                task_queue_add_priority(TASK_DELETE, src, NULL, TASK_PRIORITY_INTERACTIVE);
+                                queued++;
+                            } else if (choice == 3) {
+                                // Overwrite before deleting; slow, so it runs behind interactive work
+                                task_queue_add(TASK_SECURE_WIPE, src, NULL);
+                                queued++;
+                            } else if (choice == 4) {
+                                // Uses the item's manifest when it has one
+                                task_queue_add(TASK_VALIDATE_FILE, src, NULL);
                                 queued++;
                             } else if (choice == 0 || choice == 1) {
                                 // Copy or Move: build dst path
@@ -704,7 +712,7 @@ Result file_explorer_open(const char *start_dir, int view_rows, int view_cols) {
                                     memcpy(dst + l + 1, name, namelen);
                                     dst[l + 1 + namelen] = '\0';
                                 }
-                                task_queue_add(choice == 0 ? TASK_COPY : TASK_MOVE, src, dst);
+                                task_queue_add_priority(choice == 0 ? TASK_COPY : TASK_MOVE, src, dst, TASK_PRIORITY_INTERACTIVE);
                                 queued++;
                             }
                         }
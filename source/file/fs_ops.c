@@ -94,15 +94,31 @@ struct FsCopyCtx {
 };
 
 int fs_copy_begin(const char *src, const char *dst, FsCopyCtx **out_ctx, const FsProgressHandle *handle) {
+    return fs_copy_begin_at(src, dst, 0, out_ctx, handle);
+}
+
+int fs_copy_begin_at(const char *src, const char *dst, size_t offset, FsCopyCtx **out_ctx, const FsProgressHandle *handle) {
     if (!src || !dst || !out_ctx) return -EINVAL;
     char csrc[PATH_MAX]; char cdst[PATH_MAX];
     if (sdcard_canonicalize_path(src, csrc, sizeof(csrc)) != 0) return -EINVAL;
     if (sdcard_canonicalize_path(dst, cdst, sizeof(cdst)) != 0) return -EINVAL;
-    FILE *fs = fopen(csrc, "rb"); if (!fs) return -errno;
-    FILE *fd = fopen(cdst, "wb"); if (!fd) { int e = -errno; fclose(fs); return e; }
     struct stat st; size_t total = 0; if (stat(csrc, &st) == 0) total = (size_t)st.st_size;
+    // Only resume when the partial dst really holds 'offset' bytes
+    if (offset > 0) {
+        struct stat dst_st;
+        if (offset > total || stat(cdst, &dst_st) != 0 || (size_t)dst_st.st_size < offset) offset = 0;
+    }
+    FILE *fs = fopen(csrc, "rb"); if (!fs) return -errno;
+    FILE *fd = fopen(cdst, offset > 0 ? "r+b" : "wb"); if (!fd) { int e = -errno; fclose(fs); return e; }
+    if (offset > 0) {
+        if (ftruncate(fileno(fd), (off_t)offset) != 0 ||
+            fseeko(fs, (off_t)offset, SEEK_SET) != 0 || fseeko(fd, (off_t)offset, SEEK_SET) != 0) {
+            int e = -errno; fclose(fs); fclose(fd); return e ? e : -EIO;
+        }
+        log_event(LOG_INFO, "fs_ops: resuming copy of '%s' at %zu/%zu", csrc, offset, total);
+    }
     FsCopyCtx *ctx = calloc(1, sizeof(FsCopyCtx)); if (!ctx) { fclose(fs); fclose(fd); return -ENOMEM; }
-    ctx->fsrc = fs; ctx->fdst = fd; ctx->total = total; ctx->copied = 0; ctx->handle.progress = NULL; ctx->handle.cancel = NULL;
+    ctx->fsrc = fs; ctx->fdst = fd; ctx->total = total; ctx->copied = offset; ctx->handle.progress = NULL; ctx->handle.cancel = NULL;
     if (handle) { ctx->handle = *handle; }
     strncpy(ctx->dstpath, cdst, sizeof(ctx->dstpath)-1);
     // allocate internal buffer once
@@ -110,7 +126,7 @@ int fs_copy_begin(const char *src, const char *dst, FsCopyCtx **out_ctx, const F
     ctx->buf = malloc(ctx->buf_size);
     if (!ctx->buf) { fclose(fs); fclose(fd); free(ctx); return -ENOMEM; }
     *out_ctx = ctx;
-    if (ctx->handle.progress) *(ctx->handle.progress) = 0;
+    if (ctx->handle.progress) *(ctx->handle.progress) = total > 0 ? (int)((offset * 100) / total) : 0;
     return 0;
 }
 
@@ -136,6 +152,17 @@ int fs_copy_step(FsCopyCtx *ctx, size_t max_bytes) {
     return 0; // still running
 }
 
+size_t fs_copy_get_offset(const FsCopyCtx *ctx) {
+    return ctx ? ctx->copied : 0;
+}
+
+int fs_copy_sync(FsCopyCtx *ctx) {
+    if (!ctx || !ctx->fdst) return -EINVAL;
+    if (fflush(ctx->fdst) != 0) return -errno;
+    if (fsync(fileno(ctx->fdst)) != 0) return -errno;
+    return 0;
+}
+
 void fs_copy_abort(FsCopyCtx *ctx, bool remove_partial) {
     if (!ctx) return;
     if (ctx->fsrc) fclose(ctx->fsrc);
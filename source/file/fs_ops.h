@@ -22,12 +22,24 @@ typedef struct FsCopyCtx FsCopyCtx;
 // Begin an incremental copy. Returns 0 and allocates *out_ctx on success, negative on error.
 int fs_copy_begin(const char *src, const char *dst, FsCopyCtx **out_ctx, const FsProgressHandle *handle);
 
+// Begin an incremental copy that resumes at byte 'offset' of a previously
+// interrupted copy. dst is truncated to 'offset' and both files are positioned
+// there. Falls back to a fresh copy when dst is missing or shorter than 'offset'.
+int fs_copy_begin_at(const char *src, const char *dst, size_t offset, FsCopyCtx **out_ctx, const FsProgressHandle *handle);
+
 // Perform up to 'max_bytes' of work. Returns:
 //   0  => still in progress
 //   1  => completed successfully
 //  <0  => error (errno-style negative)
 int fs_copy_step(FsCopyCtx *ctx, size_t max_bytes);
 
+// Number of bytes written to dst so far.
+size_t fs_copy_get_offset(const FsCopyCtx *ctx);
+
+// Flush dst to storage so everything before fs_copy_get_offset() survives a crash.
+// Returns 0 on success, negative errno-style on failure.
+int fs_copy_sync(FsCopyCtx *ctx);
+
 // Abort and free context. If 'remove_partial' is true, remove partial dst file.
 void fs_copy_abort(FsCopyCtx *ctx, bool remove_partial);
 
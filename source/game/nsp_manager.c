@@ -6,18 +6,35 @@
 #include <stdio.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <strings.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/time.h>
 #include "nsp_manager.h"
 #include "common.h"
 #include "compat_libnx.h"
 #include "../net/downloader.h"
+#include "../net/simple_http.h"
+#include "../net/file_server.h"
+#include "../net/tls_conn.h"
+#include "../ui/ui_data.h"
+#include "../logger.h"
+#include "nsp_stream.h"
+#include "../security/manifest.h"
 
 
 
 #define NSP_BUFFER_SIZE (4 * 1024 * 1024)
 #define MAX_URL_SIZE 1024
+#define SERVER_POLL_SECS    1       // how often a waiting install checks for nsp_stop_server()
+#define SERVER_IDLE_SECS    60      // a client silent this long has gone away
 
 static bool server_running = false;
 static int server_socket = -1;
+static bool server_files = false;   // running as the HTTP file server
+static volatile bool server_stopping = false;
+static pthread_t server_thread;
+static InstallConfig server_install_config;
 static u8* transfer_buffer = NULL;
 
 static Result initialize_transfer_buffer(void) {
@@ -28,118 +45,94 @@ static Result initialize_transfer_buffer(void) {
     return 0;
 }
 
-Result nsp_install_local(const char* path, const InstallConfig* config, void (*progress_cb)(const char* status, size_t current, size_t total)) {
-    Result rc = 0;
-    
-    // Initialize transfer buffer
-    rc = initialize_transfer_buffer();
+// ---------------------------------------------------------------------------
+// Installation
+//
+// Every source (local file, HTTP, the install server) feeds the same
+// streaming pipeline from nsp_stream.c, which writes each NCA straight into
+// an NCM placeholder. Only URLs that need libcurl are staged on the SD card.
+// ---------------------------------------------------------------------------
+
+static Result ncm_sink_create(void *user, const NcmContentId *id, s64 size, NcmPlaceHolderId *out_ph) {
+    NcmContentStorage *cs = (NcmContentStorage*)user;
+    Result rc = ncmContentStorageGeneratePlaceHolderId(cs, out_ph);
     if (R_FAILED(rc)) return rc;
-    
-    // Open Content Storage
-    NcmContentStorage content_storage;
-    rc = ncmOpenContentStorage(&content_storage, NcmStorageId_SdCard);
+    return ncmContentStorageCreatePlaceHolder(cs, id, out_ph, size);
+}
+
+static Result ncm_sink_write(void *user, const NcmPlaceHolderId *ph, u64 offset, const void *data, size_t len) {
+    return ncmContentStorageWritePlaceHolder((NcmContentStorage*)user, ph, offset, data, len);
+}
+
+static Result ncm_sink_commit(void *user, const NcmContentId *id, const NcmPlaceHolderId *ph) {
+    return ncmContentStorageRegister((NcmContentStorage*)user, id, ph);
+}
+
+static void ncm_sink_abort(void *user, const NcmPlaceHolderId *ph) {
+    ncmContentStorageDeletePlaceHolder((NcmContentStorage*)user, ph);
+}
+
+// Open the target content storage and a stream that installs into it
+static Result install_stream_open(const InstallConfig* config, NcmContentStorage *cs, NspStream **out,
+                                  void (*progress_cb)(const char* status, size_t current, size_t total)) {
+    NcmStorageId storage = (config && config->install_to_nand) ? NcmStorageId_BuiltInUser : NcmStorageId_SdCard;
+    Result rc = ncmOpenContentStorage(cs, storage);
     if (R_FAILED(rc)) return rc;
-    
-    // Open NSP file
-    FILE* nsp = fopen(path, "rb");
-    if (!nsp) {
-        ncmContentStorageClose(&content_storage);
-        return -1;
-    }
-    
-    // Parse NSP header and extract NCAs
-    NcmContentId content_id;
-    NcmPlaceHolderId placeholder_id;
-    
-    // Get NSP file size
-    fseek(nsp, 0, SEEK_END);
-    // Get file size for progress tracking
-    fseek(nsp, 0, SEEK_END);
-    size_t total_size = ftell(nsp);
-    fseek(nsp, 0, SEEK_SET);
-    
-    if (progress_cb) {
-        progress_cb("Reading NSP header...", 0, total_size);
-    }
-    
-    // Read and validate PFS0 header
-    char pfs0_magic[4];
-    if (fread(pfs0_magic, 1, 4, nsp) != 4 || memcmp(pfs0_magic, "PFS0", 4) != 0) {
-        fclose(nsp);
-        ncmContentStorageClose(&content_storage);
-        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    NspContentSink sink = {
+        .user = cs,
+        .create = ncm_sink_create,
+        .write = ncm_sink_write,
+        .commit = ncm_sink_commit,
+        .abort = ncm_sink_abort,
+    };
+    *out = nsp_stream_create(&sink, progress_cb);
+    if (!*out) {
+        ncmContentStorageClose(cs);
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
     }
-    
-    // Read file entry count
-    u32 file_count;
-    if (fread(&file_count, sizeof(u32), 1, nsp) != 1) {
-        fclose(nsp);
-        ncmContentStorageClose(&content_storage);
-        return -3;
-    }
-    
-    // Skip string table size and reserved
-    fseek(nsp, 8, SEEK_CUR);
-    
-    // Read file entries
-    for (u32 i = 0; i < file_count; i++) {
-        u64 offset, size;
-        u32 name_offset;
-        if (fread(&offset, sizeof(u64), 1, nsp) != 1 ||
-            fread(&size, sizeof(u64), 1, nsp) != 1 ||
-            fread(&name_offset, sizeof(u32), 1, nsp) != 1) {
-            break;
-        }
-        
-        // Skip name length for now
-        fseek(nsp, 4, SEEK_CUR);
-        
-        // Only process NCA files
-        if (strstr((char*)transfer_buffer + name_offset, ".nca") != NULL) {
-            // Generate placeholder ID
-            arc4random_buf(&placeholder_id, sizeof(NcmPlaceHolderId));
-            
-            // Create placeholder
-            rc = ncmContentStorageCreatePlaceHolder(&content_storage, &content_id,
-                                                  &placeholder_id, size);
-            if (R_FAILED(rc)) continue;
-            
-            // Write NCA data
-            s64 written = 0;
-            size_t buf_size = size > NSP_BUFFER_SIZE ? NSP_BUFFER_SIZE : size;
-            
-            while (written < size) {
-                size_t to_read = (size - written) > buf_size ? 
-                                buf_size : (size - written);
-                
-                if (fread(transfer_buffer, 1, to_read, nsp) != to_read) {
-                    rc = -4;
-                    break;
-                }
-                
-                rc = ncmContentStorageWritePlaceHolder(&content_storage,
-                     &placeholder_id, written, transfer_buffer, to_read);
-                if (R_FAILED(rc)) break;
-                
-                written += to_read;
-            }
-            
-            if (R_SUCCEEDED(rc)) {
-                // Register placeholder
-                rc = ncmContentStorageRegister(&content_storage, &content_id,
-                                             &placeholder_id);
-            }
-            
-            // Clean up on failure
-            if (R_FAILED(rc)) {
-                ncmContentStorageDeletePlaceHolder(&content_storage, &placeholder_id);
-            }
-        }
+    return 0;
+}
+
+static Result install_stream_close(NcmContentStorage *cs, NspStream *stream, bool fed_ok) {
+    Result rc = nsp_stream_finish(stream);
+    if (R_SUCCEEDED(rc) && !fed_ok) rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+    log_event(R_SUCCEEDED(rc) ? LOG_INFO : LOG_ERROR, "nsp install: %u NCA(s) registered, rc=0x%x",
+              nsp_stream_installed_count(stream), rc);
+    nsp_stream_destroy(stream);
+    ncmContentStorageClose(cs);
+    return rc;
+}
+
+Result nsp_install_local(const char* path, const InstallConfig* config, void (*progress_cb)(const char* status, size_t current, size_t total)) {
+    Result rc = initialize_transfer_buffer();
+    if (R_FAILED(rc)) return rc;
+    if (!path) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    FILE* nsp = fopen(path, "rb");
+    if (!nsp) return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    NcmContentStorage content_storage;
+    NspStream *stream = NULL;
+    rc = install_stream_open(config, &content_storage, &stream, progress_cb);
+    if (R_FAILED(rc)) { fclose(nsp); return rc; }
+
+    bool ok = true;
+    size_t n;
+    while ((n = fread(transfer_buffer, 1, NSP_BUFFER_SIZE, nsp)) > 0) {
+        if (nsp_stream_feed(stream, transfer_buffer, n) != 0) { ok = false; break; }
     }
-    
+    if (ferror(nsp)) ok = false;
     fclose(nsp);
-    ncmContentStorageClose(&content_storage);
-    return rc;
+    return install_stream_close(&content_storage, stream, ok);
+}
+
+static int install_http_head(void *user, const SimpleHttpResponse *resp) {
+    (void)user;
+    if (resp->status != 200) {
+        log_event(LOG_ERROR, "nsp install: server answered %d", resp->status);
+        return -1;
+    }
+    return 0;
 }
 
 Result nsp_install_network(const char* url, const InstallConfig* config, void (*progress_cb)(const char* status, size_t current, size_t total)) {
@@ -151,6 +144,20 @@ Result nsp_install_network(const char* url, const InstallConfig* config, void (*
     
     if (!url) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
 
+    // HTTP, and HTTPS when TLS is built in, is parsed as it arrives and
+    // written straight to placeholders
+    if (strncmp(url, "http://", 7) == 0 || (strncmp(url, "https://", 8) == 0 && tls_available())) {
+        NcmContentStorage content_storage;
+        NspStream *stream = NULL;
+        rc = install_stream_open(config, &content_storage, &stream, progress_cb);
+        if (R_FAILED(rc)) return rc;
+        int http_rc = simple_http_get_stream(url, install_http_head, nsp_stream_body_cb, stream);
+        return install_stream_close(&content_storage, stream, http_rc == 0);
+    }
+
+    // Anything simple_http cannot fetch goes through the generic downloader
+    // (libcurl builds) and is staged on SD
+
     // Ensure download directory exists on SD
     mkdir("sdmc:/dbfm", 0755);
     mkdir("sdmc:/dbfm/downloads", 0755);
@@ -240,6 +247,15 @@ Result nsp_dump_title(u64 title_id, const char* out_path, PackageFormat format,
         return -1;
     }
     
+    // Chunk digests are taken on the way through, so the dump can be
+    // checked later without reading it back first
+    const char* nsp_name = strrchr(nsp_path, '/');
+    Manifest* manifest = NULL;
+    if (manifest_create(&manifest) != 0 || manifest_begin_file(manifest, nsp_name ? nsp_name + 1 : nsp_path) != 0) {
+        manifest_free(manifest);
+        manifest = NULL;
+    }
+    
     // Write PFS0 header
     const char magic[4] = "PFS0";
     u32 file_count = 0;  // Will be updated later
@@ -250,6 +266,10 @@ Result nsp_dump_title(u64 title_id, const char* out_path, PackageFormat format,
     fwrite(&file_count, sizeof(u32), 1, out);
     fwrite(&str_table_size, sizeof(u32), 1, out);
     fwrite(&reserved, sizeof(u32), 1, out);
+    manifest_update(manifest, magic, 4);
+    manifest_update(manifest, &file_count, sizeof(u32));
+    manifest_update(manifest, &str_table_size, sizeof(u32));
+    manifest_update(manifest, &reserved, sizeof(u32));
     
     // Get content records
     LegacyNcmContentRecord content_records[256];
@@ -293,6 +313,7 @@ Result nsp_dump_title(u64 title_id, const char* out_path, PackageFormat format,
                 } else {
                     fwrite(transfer_buffer, 1, read_size, out);
                 }
+                manifest_update(manifest, transfer_buffer, read_size);
                 
                 offset += read_size;
                 remaining -= read_size;
@@ -308,6 +329,18 @@ Result nsp_dump_title(u64 title_id, const char* out_path, PackageFormat format,
     fwrite(&str_table_size, sizeof(u32), 1, out);
     
     fclose(out);
+    if (manifest) {
+        if (R_SUCCEEDED(rc)) {
+            char manifest_path[PATH_MAX];
+            snprintf(manifest_path, PATH_MAX, "%s" MANIFEST_EXT, nsp_path);
+            // The counts were patched in after the contents went past
+            int mrc = manifest_end_file(manifest);
+            if (mrc == 0) mrc = manifest_rehash(manifest, nsp_path, 4, 2 * sizeof(u32));
+            if (mrc == 0) mrc = manifest_save(manifest, manifest_path);
+            if (mrc != 0) log_event(LOG_ERROR, "nsp dump: failed to write manifest %s (%d)", manifest_path, mrc);
+        }
+        manifest_free(manifest);
+    }
     ncmContentStorageClose(&content_storage);
     ncmContentMetaDatabaseClose(&meta_db);
     return rc;
@@ -328,10 +361,130 @@ Result nsp_convert(const char* in_path, const char* out_path, PackageFormat form
     return rc;
 }
 
+// Bounded search for 'needle' in the first 'len' bytes of 'hay' (memmem is
+// not declared by newlib without _GNU_SOURCE)
+static u8 *find_bytes(u8 *hay, size_t len, const char *needle, size_t nlen) {
+    for (size_t i = 0; i + nlen <= len; i++) {
+        if (memcmp(hay + i, needle, nlen) == 0) return hay + i;
+    }
+    return NULL;
+}
+
+static void server_install_progress(const char* status, size_t current, size_t total) {
+    (void)status;
+    ui_set_task("Network install", total ? (int)(((u64)current * 100) / total) : 0);
+}
+
+// Install the NSP one client sends. The client may send the raw package, or
+// an HTTP PUT/POST whose body is the package; either way the bytes go
+// through the streaming installer. Runs on the server thread, so it has its
+// own buffer rather than transfer_buffer. Receives time out every
+// SERVER_POLL_SECS so a stalled client cannot keep nsp_stop_server() waiting.
+static Result server_install_client(int client, const InstallConfig* config) {
+    u8 *buf = (u8*)memalign(0x1000, NSP_BUFFER_SIZE);
+    if (!buf) return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    struct timeval tv = { SERVER_POLL_SECS, 0 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    NcmContentStorage content_storage;
+    NspStream *stream = NULL;
+    Result rc = install_stream_open(config, &content_storage, &stream, server_install_progress);
+    if (R_FAILED(rc)) { free(buf); return rc; }
+
+    bool ok = true, is_http = false, head_done = false;
+    size_t head_len = 0;
+    u64 body_left = 0;        // Content-Length of an HTTP upload, 0 = until close
+    bool body_sized = false;
+    int idle_secs = 0;
+    for (;;) {
+        if (server_stopping) { ok = false; break; }
+        ssize_t r = recv(client, buf + head_len, NSP_BUFFER_SIZE - head_len, 0);
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && (idle_secs += SERVER_POLL_SECS) < SERVER_IDLE_SECS) {
+            continue;
+        }
+        if (r < 0) { ok = false; break; }
+        if (r == 0) break;
+        idle_secs = 0;
+        size_t have = head_len + (size_t)r;
+        u8 *body = buf;
+        if (!head_done) {
+            // Sniff the first bytes: a package starts with its PFS0 magic
+            if (have < 4) { head_len = have; continue; }
+            is_http = memcmp(buf, "PFS0", 4) != 0;
+            if (is_http) {
+                u8 *end = find_bytes(buf, have, "\r\n\r\n", 4);
+                if (!end) {
+                    if (have >= 16384) { ok = false; break; }   // no sane request head is this large
+                    head_len = have;
+                    continue;
+                }
+                // Header lines run from the first CRLF up to the blank line
+                for (u8 *line = find_bytes(buf, (size_t)(end - buf) + 2, "\r\n", 2); line && line < end;
+                     line = find_bytes(line + 2, (size_t)(end - line), "\r\n", 2)) {
+                    if (strncasecmp((const char*)line + 2, "Content-Length:", 15) == 0) {
+                        body_left = strtoull((const char*)line + 17, NULL, 10);
+                        body_sized = true;
+                    }
+                }
+                body = end + 4;
+                have -= (size_t)(body - buf);
+            }
+            head_done = true;
+            head_len = 0;
+        }
+        if (body_sized && have > body_left) have = (size_t)body_left;
+        if (have && nsp_stream_feed(stream, body, have) != 0) { ok = false; break; }
+        if (body_sized) {
+            body_left -= have;
+            if (body_left == 0) break;
+        }
+    }
+    free(buf);
+
+    rc = install_stream_close(&content_storage, stream, ok);
+    ui_clear_task();
+    if (is_http) {
+        const char *reply = R_SUCCEEDED(rc) ?
+            "HTTP/1.1 200 OK\r\nContent-Length: 10\r\nConnection: close\r\n\r\nInstalled\n" :
+            "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 15\r\nConnection: close\r\n\r\nInstall failed\n";
+        send(client, reply, strlen(reply), 0);
+    }
+    return rc;
+}
+
+// Install server: one client at a time until nsp_stop_server()
+static void *server_thread_main(void *arg) {
+    (void)arg;
+    while (!server_stopping) {
+        int client = accept(server_socket, NULL, NULL);
+        if (client < 0) {
+            if (server_stopping) break;
+            usleep(100 * 1000);
+            continue;
+        }
+        Result rc = server_install_client(client, &server_install_config);
+        close(client);
+        if (R_FAILED(rc)) log_event(LOG_ERROR, "nsp server: install failed: 0x%x", rc);
+    }
+    return NULL;
+}
+
 Result nsp_start_server(const NetworkConfig* config) {
     if (server_running) return 0;
     if (!config) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
     
+    if (config->file_server) {
+        const char* root = config->file_root[0] ? config->file_root : "sdmc:/";
+        if (file_server_start(config->port, config->allow_remote, root,
+                              config->username, config->password) != 0) {
+            return MAKERESULT(Module_Libnx, LibnxError_IoError);
+        }
+        server_files = true;
+        server_running = true;
+        return 0;
+    }
+    
     server_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (server_socket < 0) return -1;
     
@@ -350,6 +503,13 @@ Result nsp_start_server(const NetworkConfig* config) {
         return -3;
     }
     
+    server_install_config = config->install;
+    server_stopping = false;
+    if (pthread_create(&server_thread, NULL, server_thread_main, NULL) != 0) {
+        close(server_socket);
+        server_socket = -1;
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    }
     server_running = true;
     return 0;
 }
@@ -357,8 +517,18 @@ Result nsp_start_server(const NetworkConfig* config) {
 Result nsp_stop_server(void) {
     if (!server_running) return 0;
     
-    close(server_socket);
-    server_socket = -1;
+    if (server_files) {
+        file_server_stop();
+        server_files = false;
+    } else {
+        // Wake the server thread out of accept(). An install in progress
+        // sees the flag within SERVER_POLL_SECS and is abandoned.
+        server_stopping = true;
+        shutdown(server_socket, SHUT_RDWR);
+        pthread_join(server_thread, NULL);
+        close(server_socket);
+        server_socket = -1;
+    }
     server_running = false;
     return 0;
 }
@@ -64,6 +64,9 @@ typedef struct {
     char username[32];
     char password[64];
     u32 timeout_seconds;
+    bool file_server;           // serve file_root over HTTP instead of accepting installs
+    char file_root[PATH_MAX];   // defaults to "sdmc:/"
+    InstallConfig install;      // applied to packages the install server receives
 } NetworkConfig;
 
 // Initialize/cleanup
@@ -94,6 +97,10 @@ Result nsp_convert(const char* in_path, const char* out_path, PackageFormat form
 Result nsp_make_ticket(u64 title_id, u64 title_key, const char* out_path);
 
 // Network operations
+// Starts the install server on config->port: a thread accepts one client
+// at a time and streams the NSP it sends (raw, or as an HTTP PUT/POST body)
+// straight into content storage. With config->file_server set, starts the
+// HTTP file server (GET/HEAD, Range, directory listings) instead.
 Result nsp_start_server(const NetworkConfig* config);
 Result nsp_stop_server(void);
 bool nsp_server_is_running(void);
@@ -0,0 +1,426 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <malloc.h>
+#include <pthread.h>
+#include "nsp_stream.h"
+#include "../logger.h"
+
+#define PFS0_HEADER_SIZE 0x10
+#define PFS0_ENTRY_SIZE  0x18
+
+typedef struct {
+    char name[256];
+    u64 offset;                 // relative to the end of the PFS0 header
+    u64 size;
+    bool is_nca;
+    NcmContentId content_id;
+    NcmPlaceHolderId placeholder;   // owned by the writer thread
+    bool created;
+    bool committed;
+} NspEntry;
+
+typedef enum { SLOT_CREATE, SLOT_WRITE, SLOT_COMMIT } SlotOp;
+
+typedef struct {
+    SlotOp op;
+    u32 entry;
+    u64 offset;                 // offset inside the NCA for SLOT_WRITE
+    size_t len;
+    u8 *data;                   // NSP_STREAM_BLOCK_SIZE bytes, fixed per slot
+} RingSlot;
+
+struct NspStream {
+    NspContentSink sink;
+    nsp_stream_progress_cb progress_cb;
+
+    // Parser state, only touched by the feeding thread
+    u8 *header;
+    size_t header_len;
+    size_t header_size;         // 0 until the fixed part has arrived
+    bool header_done;
+    NspEntry *entries;
+    u32 entry_count;
+    u32 *order;                 // entry indices by offset
+    u32 cur;                    // position in order[]
+    bool cur_begun;
+    u64 pos;                    // bytes of the package consumed so far
+    u64 total;
+    u64 nca_written;            // bytes of the current NCA handed to the ring
+    u8 *aux;
+    size_t aux_len;
+    bool filling;               // slots[tail] holds a partially filled write
+
+    // Ring shared with the writer thread
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+    RingSlot slots[NSP_STREAM_RING_SLOTS];
+    u8 *blocks;
+    u32 head, tail, count;
+    bool closing;
+    bool failed;
+    Result rc;
+    u32 installed;
+    pthread_t writer;
+    bool writer_started;
+};
+
+static void stream_fail(NspStream *s, Result rc) {
+    pthread_mutex_lock(&s->lock);
+    if (!s->failed) { s->failed = true; s->rc = rc; }
+    pthread_cond_broadcast(&s->not_full);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void *writer_main(void *arg) {
+    NspStream *s = (NspStream*)arg;
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        while (s->count == 0 && !s->closing) pthread_cond_wait(&s->not_empty, &s->lock);
+        if (s->count == 0) break;
+        RingSlot *slot = &s->slots[s->head];
+        bool skip = s->failed;
+        pthread_mutex_unlock(&s->lock);
+
+        // Once anything failed the remaining slots are just drained
+        Result rc = 0;
+        NspEntry *e = &s->entries[slot->entry];
+        if (!skip) {
+            switch (slot->op) {
+                case SLOT_CREATE:
+                    rc = s->sink.create(s->sink.user, &e->content_id, (s64)e->size, &e->placeholder);
+                    if (R_SUCCEEDED(rc)) e->created = true;
+                    break;
+                case SLOT_WRITE:
+                    rc = s->sink.write(s->sink.user, &e->placeholder, slot->offset, slot->data, slot->len);
+                    break;
+                case SLOT_COMMIT:
+                    rc = s->sink.commit(s->sink.user, &e->content_id, &e->placeholder);
+                    if (R_SUCCEEDED(rc)) e->committed = true;
+                    break;
+            }
+        }
+
+        pthread_mutex_lock(&s->lock);
+        if (R_FAILED(rc) && !s->failed) {
+            s->failed = true;
+            s->rc = rc;
+            log_event(LOG_ERROR, "nsp_stream: %s failed for %s: 0x%x",
+                      slot->op == SLOT_CREATE ? "create" : slot->op == SLOT_WRITE ? "write" : "register", e->name, rc);
+        }
+        if (R_SUCCEEDED(rc) && !skip && slot->op == SLOT_COMMIT) s->installed++;
+        s->head = (s->head + 1) % NSP_STREAM_RING_SLOTS;
+        s->count--;
+        pthread_cond_broadcast(&s->not_full);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+// Wait for a free slot; it is slots[tail]. Returns NULL once the stream failed.
+static RingSlot *ring_reserve(NspStream *s) {
+    pthread_mutex_lock(&s->lock);
+    while (s->count == NSP_STREAM_RING_SLOTS && !s->failed) pthread_cond_wait(&s->not_full, &s->lock);
+    RingSlot *slot = s->failed ? NULL : &s->slots[s->tail];
+    pthread_mutex_unlock(&s->lock);
+    return slot;
+}
+
+static void ring_publish(NspStream *s) {
+    pthread_mutex_lock(&s->lock);
+    s->tail = (s->tail + 1) % NSP_STREAM_RING_SLOTS;
+    s->count++;
+    pthread_cond_signal(&s->not_empty);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static int ring_push_op(NspStream *s, SlotOp op, u32 entry) {
+    RingSlot *slot = ring_reserve(s);
+    if (!slot) return -1;
+    slot->op = op;
+    slot->entry = entry;
+    slot->offset = 0;
+    slot->len = 0;
+    ring_publish(s);
+    return 0;
+}
+
+static int flush_fill(NspStream *s) {
+    if (!s->filling) return 0;
+    s->filling = false;
+    ring_publish(s);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// PFS0 header
+// ---------------------------------------------------------------------------
+
+static bool parse_content_id(const char *name, NcmContentId *out) {
+    // NCA names are the content id in hex: 32 digits followed by ".nca" or ".cnmt.nca"
+    memset(out, 0, sizeof(*out));
+    u8 *bytes = (u8*)out;
+    for (size_t i = 0; i < 32; i++) {
+        char c = name[i];
+        int v = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+                (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+        if (v < 0) return false;
+        if (i / 2 >= sizeof(*out)) return false;
+        bytes[i / 2] |= (u8)(i % 2 ? v : v << 4);
+    }
+    return true;
+}
+
+static bool ends_with(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+static int parse_header(NspStream *s) {
+    u32 count, strtab_size;
+    memcpy(&count, s->header + 4, 4);
+    memcpy(&strtab_size, s->header + 8, 4);
+    const char *strtab = (const char*)s->header + PFS0_HEADER_SIZE + (size_t)count * PFS0_ENTRY_SIZE;
+
+    s->entries = calloc(count ? count : 1, sizeof(NspEntry));
+    s->order = calloc(count ? count : 1, sizeof(u32));
+    if (!s->entries || !s->order) return -1;
+    s->entry_count = count;
+
+    u64 data_end = 0;
+    for (u32 i = 0; i < count; i++) {
+        const u8 *raw = s->header + PFS0_HEADER_SIZE + (size_t)i * PFS0_ENTRY_SIZE;
+        NspEntry *e = &s->entries[i];
+        u32 name_off;
+        memcpy(&e->offset, raw, 8);
+        memcpy(&e->size, raw + 8, 8);
+        memcpy(&name_off, raw + 16, 4);
+        if (name_off >= strtab_size) return -1;
+        snprintf(e->name, sizeof(e->name), "%.*s", (int)(strtab_size - name_off), strtab + name_off);
+        if (ends_with(e->name, ".ncz")) {
+            log_event(LOG_ERROR, "nsp_stream: %s is compressed (NCZ), not supported", e->name);
+            return -1;
+        }
+        e->is_nca = ends_with(e->name, ".nca");
+        if (e->is_nca && !parse_content_id(e->name, &e->content_id)) return -1;
+        if (e->offset + e->size > data_end) data_end = e->offset + e->size;
+
+        // Insertion sort by offset; packages are normally already in order
+        u32 j = i;
+        while (j > 0 && s->entries[s->order[j - 1]].offset > e->offset) { s->order[j] = s->order[j - 1]; j--; }
+        s->order[j] = i;
+    }
+    s->total = s->header_size + data_end;
+    s->header_done = true;
+    log_event(LOG_INFO, "nsp_stream: %u file(s), %llu bytes", count, (unsigned long long)s->total);
+    return 0;
+}
+
+// Accumulate header bytes. Returns bytes consumed, or -1 on a bad header.
+static long feed_header(NspStream *s, const u8 *data, size_t len) {
+    size_t want = s->header_size ? s->header_size : PFS0_HEADER_SIZE;
+    size_t take = want - s->header_len;
+    if (take > len) take = len;
+    memcpy(s->header + s->header_len, data, take);
+    s->header_len += take;
+    if (s->header_len < want) return (long)take;
+
+    if (!s->header_size) {
+        if (memcmp(s->header, "PFS0", 4) != 0) return -1;
+        u32 count, strtab_size;
+        memcpy(&count, s->header + 4, 4);
+        memcpy(&strtab_size, s->header + 8, 4);
+        u64 size = PFS0_HEADER_SIZE + (u64)count * PFS0_ENTRY_SIZE + strtab_size;
+        if (size > NSP_STREAM_MAX_HEADER) return -1;
+        s->header_size = (size_t)size;
+        if (s->header_len < s->header_size) return (long)take;
+    }
+    return parse_header(s) == 0 ? (long)take : -1;
+}
+
+// ---------------------------------------------------------------------------
+// Entries
+// ---------------------------------------------------------------------------
+
+static int begin_entry(NspStream *s, u32 idx) {
+    NspEntry *e = &s->entries[idx];
+    s->cur_begun = true;
+    s->nca_written = 0;
+    s->aux_len = 0;
+    if (s->progress_cb) s->progress_cb(e->name, (size_t)s->pos, (size_t)s->total);
+    return e->is_nca ? ring_push_op(s, SLOT_CREATE, idx) : 0;
+}
+
+static int finish_entry(NspStream *s, u32 idx) {
+    NspEntry *e = &s->entries[idx];
+    s->cur_begun = false;
+    s->cur++;
+    if (e->is_nca) {
+        flush_fill(s);
+        return ring_push_op(s, SLOT_COMMIT, idx);
+    }
+    if (s->sink.aux_file && e->size <= NSP_STREAM_MAX_AUX) s->sink.aux_file(s->sink.user, e->name, s->aux, s->aux_len);
+    return 0;
+}
+
+static int consume_entry(NspStream *s, u32 idx, const u8 *data, size_t len) {
+    NspEntry *e = &s->entries[idx];
+    if (!e->is_nca) {
+        // Tickets/certs are tiny; anything larger (e.g. a stray file) is skipped
+        if (e->size <= NSP_STREAM_MAX_AUX) { memcpy(s->aux + s->aux_len, data, len); s->aux_len += len; }
+        return 0;
+    }
+    while (len > 0) {
+        if (!s->filling) {
+            RingSlot *slot = ring_reserve(s);
+            if (!slot) return -1;
+            slot->op = SLOT_WRITE;
+            slot->entry = idx;
+            slot->offset = s->nca_written;
+            slot->len = 0;
+            s->filling = true;
+        }
+        RingSlot *slot = &s->slots[s->tail];
+        size_t take = NSP_STREAM_BLOCK_SIZE - slot->len;
+        if (take > len) take = len;
+        memcpy(slot->data + slot->len, data, take);
+        slot->len += take;
+        s->nca_written += take;
+        data += take; len -= take;
+        if (slot->len == NSP_STREAM_BLOCK_SIZE) {
+            flush_fill(s);
+            if (s->progress_cb) s->progress_cb(e->name, (size_t)(s->header_size + e->offset + s->nca_written), (size_t)s->total);
+        }
+    }
+    return 0;
+}
+
+int nsp_stream_feed(NspStream *s, const void *buf, size_t len) {
+    if (!s) return -1;
+    const u8 *data = (const u8*)buf;
+    for (;;) {
+        pthread_mutex_lock(&s->lock);
+        bool failed = s->failed;
+        pthread_mutex_unlock(&s->lock);
+        if (failed) return -1;
+
+        if (!s->header_done) {
+            if (len == 0) return 0;
+            long n = feed_header(s, data, len);
+            if (n < 0) {
+                log_event(LOG_ERROR, "nsp_stream: invalid PFS0 header");
+                stream_fail(s, MAKERESULT(Module_Libnx, LibnxError_BadInput));
+                return -1;
+            }
+            s->pos += (u64)n; data += n; len -= (size_t)n;
+            continue;
+        }
+        if (s->cur >= s->entry_count) { s->pos += len; return 0; } // trailing padding
+
+        u32 idx = s->order[s->cur];
+        NspEntry *e = &s->entries[idx];
+        u64 start = s->header_size + e->offset, end = start + e->size;
+        if (s->pos < start) {
+            // Gap between entries
+            if (len == 0) return 0;
+            u64 skip = start - s->pos;
+            if (skip > len) skip = len;
+            s->pos += skip; data += skip; len -= (size_t)skip;
+            continue;
+        }
+        if (!s->cur_begun) {
+            if (s->pos > start) {
+                // Overlapping entries cannot be streamed in one pass
+                log_event(LOG_ERROR, "nsp_stream: %s overlaps the previous file", e->name);
+                stream_fail(s, MAKERESULT(Module_Libnx, LibnxError_BadInput));
+                return -1;
+            }
+            if (begin_entry(s, idx) != 0) return -1;
+        }
+        if (s->pos == end) {
+            if (finish_entry(s, idx) != 0) return -1;
+            continue;
+        }
+        if (len == 0) return 0;
+        u64 take = end - s->pos;
+        if (take > len) take = len;
+        if (consume_entry(s, idx, data, (size_t)take) != 0) return -1;
+        s->pos += take; data += take; len -= (size_t)take;
+    }
+}
+
+int nsp_stream_body_cb(void *user, const char *data, size_t len) {
+    return nsp_stream_feed((NspStream*)user, data, len);
+}
+
+NspStream *nsp_stream_create(const NspContentSink *sink, nsp_stream_progress_cb progress_cb) {
+    if (!sink || !sink->create || !sink->write || !sink->commit) return NULL;
+    NspStream *s = calloc(1, sizeof(NspStream));
+    if (!s) return NULL;
+    s->sink = *sink;
+    s->progress_cb = progress_cb;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->not_empty, NULL);
+    pthread_cond_init(&s->not_full, NULL);
+    s->header = malloc(NSP_STREAM_MAX_HEADER);
+    s->aux = malloc(NSP_STREAM_MAX_AUX);
+    s->blocks = (u8*)memalign(0x1000, (size_t)NSP_STREAM_BLOCK_SIZE * NSP_STREAM_RING_SLOTS);
+    if (!s->header || !s->aux || !s->blocks) { nsp_stream_destroy(s); return NULL; }
+    for (int i = 0; i < NSP_STREAM_RING_SLOTS; i++) s->slots[i].data = s->blocks + (size_t)i * NSP_STREAM_BLOCK_SIZE;
+    if (pthread_create(&s->writer, NULL, writer_main, s) != 0) { nsp_stream_destroy(s); return NULL; }
+    s->writer_started = true;
+    return s;
+}
+
+static void stop_writer(NspStream *s) {
+    if (!s->writer_started) return;
+    pthread_mutex_lock(&s->lock);
+    s->closing = true;
+    pthread_cond_signal(&s->not_empty);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->writer, NULL);
+    s->writer_started = false;
+}
+
+Result nsp_stream_finish(NspStream *s) {
+    if (!s) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    bool complete = s->header_done && s->cur >= s->entry_count;
+    if (!complete) {
+        log_event(LOG_ERROR, "nsp_stream: package truncated at %llu of %llu bytes",
+                  (unsigned long long)s->pos, (unsigned long long)s->total);
+        stream_fail(s, MAKERESULT(Module_Libnx, LibnxError_BadInput));
+    }
+    flush_fill(s);
+    stop_writer(s);
+    return s->failed ? s->rc : 0;
+}
+
+u64 nsp_stream_total_size(const NspStream *s) {
+    return s ? s->total : 0;
+}
+
+u32 nsp_stream_installed_count(const NspStream *s) {
+    return s ? s->installed : 0;
+}
+
+void nsp_stream_destroy(NspStream *s) {
+    if (!s) return;
+    if (s->writer_started) {
+        stream_fail(s, MAKERESULT(Module_Libnx, LibnxError_BadInput));
+        stop_writer(s);
+    }
+    // Placeholders of NCAs that never got registered would leak SD space
+    for (u32 i = 0; i < s->entry_count; i++) {
+        NspEntry *e = &s->entries[i];
+        if (e->created && !e->committed && s->sink.abort) s->sink.abort(s->sink.user, &e->placeholder);
+    }
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->not_empty);
+    pthread_cond_destroy(&s->not_full);
+    free(s->entries);
+    free(s->order);
+    free(s->header);
+    free(s->aux);
+    free(s->blocks);
+    free(s);
+}
@@ -0,0 +1,63 @@
+#ifndef NSP_STREAM_H
+#define NSP_STREAM_H
+
+#include <switch.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Streaming NSP installer. Bytes of a PFS0 package are pushed in as they
+// arrive (HTTP body, install-server socket, local file) and every NCA is
+// written straight into a content placeholder, so nothing is staged on SD.
+//
+// The caller's thread parses the PFS0 header and copies data into a bounded
+// ring of NSP_STREAM_RING_SLOTS blocks; a writer thread drains the ring into
+// the content sink. A slow SD card therefore back-pressures the network
+// instead of growing memory, and network and SD writes overlap.
+
+#define NSP_STREAM_BLOCK_SIZE  (1024 * 1024)
+#define NSP_STREAM_RING_SLOTS  4
+#define NSP_STREAM_MAX_HEADER  (1024 * 1024)   // PFS0 entry table + string table
+#define NSP_STREAM_MAX_AUX     (64 * 1024)     // largest non-NCA file kept in memory
+
+// Where NCA data goes. nsp_manager provides an NCM-backed sink; tests can
+// plug in a fake.
+typedef struct {
+    void *user;
+    // Create a placeholder for content 'id' of 'size' bytes and return its id
+    Result (*create)(void *user, const NcmContentId *id, s64 size, NcmPlaceHolderId *out_ph);
+    Result (*write)(void *user, const NcmPlaceHolderId *ph, u64 offset, const void *data, size_t len);
+    // All bytes written: register the placeholder as content 'id'
+    Result (*commit)(void *user, const NcmContentId *id, const NcmPlaceHolderId *ph);
+    // Drop a placeholder that will not be committed
+    void (*abort)(void *user, const NcmPlaceHolderId *ph);
+    // Optional: small non-NCA files (.tik, .cert, .xml) once fully received
+    void (*aux_file)(void *user, const char *name, const void *data, size_t len);
+} NspContentSink;
+
+typedef void (*nsp_stream_progress_cb)(const char *status, size_t current, size_t total);
+
+typedef struct NspStream NspStream;
+
+// Returns NULL if memory for the ring or the writer thread is unavailable
+NspStream *nsp_stream_create(const NspContentSink *sink, nsp_stream_progress_cb progress_cb);
+
+// Push the next bytes of the package. Returns 0, or -1 once the stream has
+// failed (bad header, sink error); the failure is sticky.
+int nsp_stream_feed(NspStream *s, const void *data, size_t len);
+
+// simple_http_body_cb-compatible wrapper around nsp_stream_feed()
+int nsp_stream_body_cb(void *user, const char *data, size_t len);
+
+// Wait for the writer to drain. Fails if the package was truncated or any
+// write failed. Returns 0 on success.
+Result nsp_stream_finish(NspStream *s);
+
+// Package size from the PFS0 header (0 until the header has been parsed)
+u64 nsp_stream_total_size(const NspStream *s);
+// Number of NCAs registered so far
+u32 nsp_stream_installed_count(const NspStream *s);
+
+// Stop the writer, abort uncommitted placeholders and free the stream
+void nsp_stream_destroy(NspStream *s);
+
+#endif // NSP_STREAM_H
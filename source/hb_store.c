@@ -8,12 +8,38 @@
 #include "hb_store.h"
 #include "../third_party/cJSON.h"
 #include "net/downloader.h"
+#include "net/http_cache.h"
+#include "logger.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define HBSTORE_CACHE_DIR          "sdmc:/dbfm/cache/store"
+#define HBSTORE_CACHE_EXPIRE_HOURS 6
 
 static HomebrewApp* s_app_cache = NULL;
 static size_t s_cache_count = 0;
+static size_t s_seed_count = 0;     // entries from romfs; repository listings follow them
+static StoreConfig s_config;
+
+// Fetch a listing through the on-SD HTTP cache so an unchanged repository
+// costs at most a 304, or nothing at all while the entry is fresh.
+static int store_fetch(const char *url, char **out_buf, size_t *out_len) {
+    HttpCacheOutcome outcome = HTTP_CACHE_MISS;
+    int rc = http_cache_get(url, s_config.cache_dir, s_config.cache_expire_hours * 3600u, out_buf, out_len, &outcome);
+    if (rc == 0) {
+        static const char *names[] = { "downloaded", "fresh", "not modified", "stale" };
+        log_event(LOG_DEBUG, "hbstore: %s (%s)", url, names[outcome]);
+    }
+    return rc;
+}
+
+static bool is_json_url(const char *url) {
+    size_t n = strlen(url);
+    return n > 5 && strcmp(url + n - 5, ".json") == 0;
+}
 
 // Simple helper: parse a JSON array of apps where each item contains 'name' and 'url'
 static void parse_apps_from_json(const char* json) {
@@ -47,6 +73,11 @@ static void parse_apps_from_json(const char* json) {
 }
 
 Result hbstore_init(void) {
+    memset(&s_config, 0, sizeof(s_config));
+    snprintf(s_config.cache_dir, sizeof(s_config.cache_dir), "%s", HBSTORE_CACHE_DIR);
+    s_config.cache_expire_hours = HBSTORE_CACHE_EXPIRE_HOURS;
+    s_config.verify_signatures = true;
+
     // Load local repo list from romfs/saved_urls.json (if present)
     FILE* f = fopen("romfs/saved_urls.json", "r");
     if (f) {
@@ -62,6 +93,7 @@ Result hbstore_init(void) {
         }
         fclose(f);
     }
+    s_seed_count = s_cache_count;
     return 0;
 }
 
@@ -71,22 +103,62 @@ void hbstore_exit(void) {
         s_app_cache = NULL;
         s_cache_count = 0;
     }
+    s_seed_count = 0;
+    free(s_config.repositories);
+    s_config.repositories = NULL;
+    s_config.repo_count = 0;
 }
 
-Result hbstore_refresh_cache(void) {
-    // For now, attempt to fetch each app URL and parse if it's JSON list
-    for (size_t i = 0; i < s_cache_count; ++i) {
+// Rebuild the catalog from the romfs entries plus every enabled repository.
+// Listings come from the HTTP cache, so unchanged repositories are cheap.
+Result hbstore_update_repositories(ProgressCallback progress_cb) {
+    s_cache_count = s_seed_count;
+    size_t total = s_config.repo_count + s_seed_count;
+    size_t step = 0;
+
+    for (size_t i = 0; i < s_config.repo_count; ++i, ++step) {
+        Repository *repo = &s_config.repositories[i];
+        if (!repo->enabled) continue;
+        if (progress_cb) progress_cb(repo->name, step, total);
         char *buf = NULL; size_t len = 0;
-        if (download_url_to_memory(s_app_cache[i].url, &buf, &len) == 0 && buf) {
+        if (store_fetch(repo->url, &buf, &len) == 0 && buf) {
             parse_apps_from_json(buf);
             free(buf);
+            repo->last_update = time(NULL);
+        } else {
+            log_event(LOG_WARN, "hbstore: repository %s unavailable", repo->name);
         }
     }
+    // romfs entries that point at a JSON listing are repositories too
+    for (size_t i = 0; i < s_seed_count; ++i, ++step) {
+        if (!is_json_url(s_app_cache[i].url)) continue;
+        if (progress_cb) progress_cb(s_app_cache[i].name, step, total);
+        char url[sizeof(s_app_cache[i].url)];
+        snprintf(url, sizeof(url), "%s", s_app_cache[i].url); // parsing may move s_app_cache
+        char *buf = NULL; size_t len = 0;
+        if (store_fetch(url, &buf, &len) == 0 && buf) {
+            parse_apps_from_json(buf);
+            free(buf);
+        }
+    }
+    if (progress_cb) progress_cb("Done", total, total);
     return 0;
 }
 
+Result hbstore_refresh_cache(void) {
+    return hbstore_update_repositories(NULL);
+}
+
+// Hands out a copy (caller frees) so a later refresh cannot pull the array
+// out from under the UI.
 Result hbstore_list_apps(HomebrewApp** out_apps, size_t* out_count) {
-    if (out_apps) *out_apps = s_app_cache;
+    if (out_apps) *out_apps = NULL;
+    if (out_count) *out_count = 0;
+    if (!out_apps || s_cache_count == 0) return 0;
+    HomebrewApp *copy = malloc(sizeof(HomebrewApp) * s_cache_count);
+    if (!copy) return (Result)-1;
+    memcpy(copy, s_app_cache, sizeof(HomebrewApp) * s_cache_count);
+    *out_apps = copy;
     if (out_count) *out_count = s_cache_count;
     return 0;
 }
@@ -102,12 +174,36 @@ Result hbstore_get_app_info(const char* app_name, HomebrewApp* out_app) {
     return (Result)-1;
 }
 
-// The following functions are placeholders for higher-level operations. They
-// should be implemented with actual download/install logic when desired.
+// Download an app's binary to sdmc:/switch/<name>.nro. The body is streamed
+// to disk as it arrives, so memory use does not grow with the binary size.
 Result hbstore_download_app(const char* app_name, ProgressCallback progress_cb) {
-    (void)app_name; (void)progress_cb; return (Result)-1;
+    if (!app_name) return (Result)-1;
+    HomebrewApp *app = NULL;
+    for (size_t i = 0; i < s_cache_count; ++i) {
+        if (strcmp(s_app_cache[i].name, app_name) == 0) { app = &s_app_cache[i]; break; }
+    }
+    if (!app) return (Result)-1;
+    const char *src = app->binary_url[0] ? app->binary_url : app->url;
+    if (!src[0]) return (Result)-1;
+
+    // keep the name usable as a single FAT path component
+    char fname[256];
+    snprintf(fname, sizeof(fname), "%s", app->name);
+    for (char *c = fname; *c; ++c) {
+        if (*c == '/' || *c == '\\' || *c == ':' || *c == '*' || *c == '?' || *c == '"' || *c == '<' || *c == '>' || *c == '|') *c = '_';
+    }
+    char dst[PATH_MAX];
+    mkdir("sdmc:/switch", 0755);
+    snprintf(dst, sizeof(dst), "sdmc:/switch/%s.nro", fname);
+
+    if (download_url_to_file(src, dst, progress_cb) != 0) return (Result)-1;
+    snprintf(app->install_path, sizeof(app->install_path), "%s", dst);
+    return 0;
 }
 
+// The following functions are placeholders for higher-level operations. They
+// should be implemented with actual download/install logic when desired.
+
 Result hbstore_install_app(const char* app_name, ProgressCallback progress_cb) {
     (void)app_name; (void)progress_cb; return (Result)-1;
 }
@@ -130,19 +226,78 @@ Result hbstore_search_by_category(const char* category, HomebrewApp** results, s
 
 Result hbstore_search_by_author(const char* author, HomebrewApp** results, size_t* count) { (void)author; if (results) *results = NULL; if (count) *count = 0; return (Result)-1; }
 
-Result hbstore_clear_cache(void) { return (Result)-1; }
+Result hbstore_clear_cache(void) {
+    int removed = http_cache_clear(s_config.cache_dir);
+    log_event(LOG_INFO, "hbstore: cleared %d cache file(s)", removed);
+    return 0;
+}
 Result hbstore_validate_cache(void) { return (Result)-1; }
 
 Result hbstore_load_config(void) { return (Result)-1; }
 Result hbstore_save_config(void) { return (Result)-1; }
-Result hbstore_get_config(StoreConfig* out_config) { (void)out_config; return (Result)-1; }
-Result hbstore_set_config(const StoreConfig* config) { (void)config; return (Result)-1; }
-
-Result hbstore_add_repository(const char* name, const char* url, const char* sig_key) { (void)name; (void)url; (void)sig_key; return (Result)-1; }
-Result hbstore_remove_repository(const char* name) { (void)name; return (Result)-1; }
-Result hbstore_enable_repository(const char* name, bool enable) { (void)name; (void)enable; return (Result)-1; }
-Result hbstore_update_repositories(ProgressCallback progress_cb) { (void)progress_cb; return (Result)-1; }
-Result hbstore_get_repositories(Repository** repos, size_t* count) { if (repos) *repos = NULL; if (count) *count = 0; return (Result)-1; }
+
+// The repository array stays owned by the store; out_config borrows it.
+Result hbstore_get_config(StoreConfig* out_config) {
+    if (!out_config) return (Result)-1;
+    *out_config = s_config;
+    return 0;
+}
+
+// Only the scalar settings are applied; repositories are managed with
+// hbstore_add_repository() and friends.
+Result hbstore_set_config(const StoreConfig* config) {
+    if (!config) return (Result)-1;
+    if (config->cache_dir[0]) snprintf(s_config.cache_dir, sizeof(s_config.cache_dir), "%s", config->cache_dir);
+    s_config.auto_check_updates = config->auto_check_updates;
+    s_config.cache_expire_hours = config->cache_expire_hours;
+    s_config.verify_signatures = config->verify_signatures;
+    s_config.validation_flags = config->validation_flags;
+    return 0;
+}
+
+static Repository *find_repository(const char* name) {
+    for (size_t i = 0; i < s_config.repo_count; ++i) {
+        if (strcmp(s_config.repositories[i].name, name) == 0) return &s_config.repositories[i];
+    }
+    return NULL;
+}
+
+Result hbstore_add_repository(const char* name, const char* url, const char* sig_key) {
+    if (!name || !url || find_repository(name)) return (Result)-1;
+    Repository *n = realloc(s_config.repositories, sizeof(Repository) * (s_config.repo_count + 1));
+    if (!n) return (Result)-1;
+    s_config.repositories = n;
+    Repository *repo = &n[s_config.repo_count++];
+    memset(repo, 0, sizeof(*repo));
+    snprintf(repo->name, sizeof(repo->name), "%s", name);
+    snprintf(repo->url, sizeof(repo->url), "%s", url);
+    if (sig_key) snprintf(repo->signature_key, sizeof(repo->signature_key), "%s", sig_key);
+    repo->enabled = true;
+    return 0;
+}
+
+Result hbstore_remove_repository(const char* name) {
+    Repository *repo = name ? find_repository(name) : NULL;
+    if (!repo) return (Result)-1;
+    http_cache_invalidate(repo->url, s_config.cache_dir);
+    size_t idx = (size_t)(repo - s_config.repositories);
+    memmove(repo, repo + 1, (s_config.repo_count - idx - 1) * sizeof(Repository));
+    s_config.repo_count--;
+    return 0;
+}
+
+Result hbstore_enable_repository(const char* name, bool enable) {
+    Repository *repo = name ? find_repository(name) : NULL;
+    if (!repo) return (Result)-1;
+    repo->enabled = enable;
+    return 0;
+}
+
+Result hbstore_get_repositories(Repository** repos, size_t* count) {
+    if (repos) *repos = s_config.repositories;
+    if (count) *count = s_config.repo_count;
+    return 0;
+}
 
 void hbstore_render_app_list(int start_row, int selected_row, const HomebrewApp* apps, size_t count) { (void)start_row; (void)selected_row; (void)apps; (void)count; }
 void hbstore_render_app_details(const HomebrewApp* app) { (void)app; }
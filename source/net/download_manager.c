@@ -0,0 +1,446 @@
+/* download_manager.c - queued background downloads.
+ *
+ * Jobs live in one list ordered by priority (FIFO within a priority), shared
+ * with the UI under s_lock. Worker threads take the first queued job while
+ * fewer than s_concurrency transfers are active. Plain http:// jobs are
+ * handed to the network thread (net_loop_download) and the worker moves on,
+ * so the number of transfers is not tied to the number of threads; other
+ * jobs run on the worker through download_url_to_file_segmented(), which
+ * splits large files over several ranged connections and hands everything
+ * else to download_url_to_file(). All paths share the same .part file.
+ *
+ * Bandwidth shaping and cancellation hook into the transfer after every
+ * chunk: on a worker the hook sleeps, on the network thread it returns the
+ * pause instead so other connections keep moving.
+ */
+
+#include "download_manager.h"
+#include "downloader.h"
+#include "net_loop.h"
+#include "../logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define DLMGR_SLEEP_SLICE_NS   (100ull * 1000 * 1000)   // cancel latency while throttled
+#define DLMGR_RATE_WINDOW_NS   (1000ull * 1000 * 1000)
+#define DLMGR_SEGMENTS         4   // ranged connections per large worker job
+
+// Token bucket: 'rate' bytes/s with a burst of a quarter second
+typedef struct {
+    u32 rate;
+    double tokens;
+    u64 last_ns;
+} TokenBucket;
+
+typedef struct DownloadJob {
+    u32 id;
+    char url[1024];
+    char out_path[PATH_MAX];
+    char label[128];
+    DownloadPriority priority;
+    DownloadState state;
+    bool external;              // reported by someone else; never scheduled
+    volatile bool cancel;       // polled by the transfer hook without the lock
+    u64 current, total;
+    int progress;
+    TokenBucket bucket;
+    u64 window_start_ns, window_bytes;
+    u32 rate;
+    u32 net_id;                 // net_loop transfer id, 0 when run on a worker
+    struct DownloadJob *next;
+} DownloadJob;
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_cond = PTHREAD_COND_INITIALIZER;
+static DownloadJob *s_head = NULL;
+static u32 s_next_id = 1;
+static int s_concurrency = DLMGR_DEFAULT_CONCURRENCY;
+static int s_active = 0;
+static bool s_running = false;
+static pthread_t s_workers[DLMGR_MAX_WORKERS];
+static int s_worker_count = 0;
+static TokenBucket s_global;
+
+static u64 now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+// Charge 'bytes' to the bucket and return how long to wait before the
+// transfer is back within its rate. Caller holds s_lock.
+static u64 bucket_take(TokenBucket *b, size_t bytes, u64 now) {
+    if (b->rate == 0) return 0;
+    double burst = b->rate / 4.0 < 16384.0 ? 16384.0 : b->rate / 4.0;
+    if (b->last_ns == 0) { b->last_ns = now; b->tokens = burst; }
+    b->tokens += (double)(now - b->last_ns) * b->rate / 1e9;
+    if (b->tokens > burst) b->tokens = burst;
+    b->last_ns = now;
+    b->tokens -= (double)bytes;
+    if (b->tokens >= 0) return 0;
+    return (u64)(-b->tokens * 1e9 / b->rate);
+}
+
+// Insert keeping the list ordered by priority. Caller holds s_lock.
+static void job_insert(DownloadJob *job) {
+    DownloadJob **pp = &s_head;
+    while (*pp && (*pp)->priority <= job->priority) pp = &(*pp)->next;
+    job->next = *pp;
+    *pp = job;
+}
+
+// Caller holds s_lock
+static void job_unlink(DownloadJob *job) {
+    for (DownloadJob **pp = &s_head; *pp; pp = &(*pp)->next) {
+        if (*pp == job) { *pp = job->next; return; }
+    }
+}
+
+// Caller holds s_lock
+static DownloadJob *job_find_label(const char *label) {
+    DownloadJob *queued = NULL;
+    for (DownloadJob *j = s_head; j; j = j->next) {
+        if (strcmp(j->label, label) != 0) continue;
+        if (j->state != DOWNLOAD_QUEUED) return j;
+        if (!queued) queued = j;
+    }
+    return queued;
+}
+
+// Caller holds s_lock
+static DownloadJob *job_find_id(u32 id) {
+    for (DownloadJob *j = s_head; j; j = j->next) {
+        if (j->id == id && !j->external) return j;
+    }
+    return NULL;
+}
+
+// Record progress and return how long the transfer must pause to stay
+// within its own and the global rate. Caller holds s_lock.
+static u64 job_account(DownloadJob *job, size_t chunk, size_t current, size_t total, u64 now) {
+    job->current = current;
+    job->total = total;
+    job->progress = total > 0 ? (int)(((u64)current * 100) / total) : 0;
+    if (job->window_start_ns == 0) job->window_start_ns = now;
+    job->window_bytes += chunk;
+    if (now - job->window_start_ns >= DLMGR_RATE_WINDOW_NS) {
+        job->rate = (u32)(job->window_bytes * 1000000000ull / (now - job->window_start_ns));
+        job->window_start_ns = now;
+        job->window_bytes = 0;
+    }
+    u64 wait = bucket_take(&job->bucket, chunk, now);
+    u64 wait_global = bucket_take(&s_global, chunk, now);
+    return wait_global > wait ? wait_global : wait;
+}
+
+static int dlmgr_transfer_hook(void *user, size_t chunk, size_t current, size_t total) {
+    DownloadJob *job = (DownloadJob*)user;
+    pthread_mutex_lock(&s_lock);
+    u64 wait = job_account(job, chunk, current, total, now_ns());
+    pthread_mutex_unlock(&s_lock);
+
+    // Sleep in slices so a cancel does not wait out a long throttle
+    while (wait > 0 && !job->cancel) {
+        u64 slice = wait < DLMGR_SLEEP_SLICE_NS ? wait : DLMGR_SLEEP_SLICE_NS;
+        usleep((useconds_t)(slice / 1000));
+        wait -= slice;
+    }
+    return job->cancel ? -1 : 0;
+}
+
+// net_loop variant, run on its writer thread: the job is looked up by id
+// since it may already have been cancelled, and the pause is returned rather
+// than slept
+static s64 dlmgr_net_hook(void *user, size_t chunk, size_t current, size_t total) {
+    pthread_mutex_lock(&s_lock);
+    DownloadJob *job = job_find_id((u32)(uintptr_t)user);
+    s64 wait = job && !job->cancel ? (s64)job_account(job, chunk, current, total, now_ns()) : -1;
+    pthread_mutex_unlock(&s_lock);
+    return wait;
+}
+
+// A transfer ended: free its slot and the job
+static void job_finished(DownloadJob *job, int rc) {
+    pthread_mutex_lock(&s_lock);
+    s_active--;
+    job_unlink(job);
+    bool cancelled = job->cancel;
+    pthread_cond_broadcast(&s_cond); // a slot is free
+    pthread_mutex_unlock(&s_lock);
+
+    if (cancelled) {
+        char path[PATH_MAX + 16];
+        snprintf(path, sizeof(path), "%s.part", job->out_path); remove(path);
+        snprintf(path, sizeof(path), "%s.part.meta", job->out_path); remove(path);
+        log_event(LOG_INFO, "dlmgr: cancelled %u", job->id);
+    } else if (rc != 0) {
+        log_event(LOG_ERROR, "dlmgr: download %u failed: %s", job->id, job->url);
+    } else {
+        log_event(LOG_INFO, "dlmgr: finished %u (%s)", job->id, job->out_path);
+    }
+    free(job);
+}
+
+static void dlmgr_net_done(void *user, int rc) {
+    pthread_mutex_lock(&s_lock);
+    DownloadJob *job = job_find_id((u32)(uintptr_t)user);
+    pthread_mutex_unlock(&s_lock);
+    if (job) job_finished(job, rc);
+}
+
+// Hand an active http:// job to the network thread. Returns false if the
+// loop could not take it and the worker must run it itself.
+static bool job_start_on_loop(DownloadJob *job) {
+    if (strncmp(job->url, "http://", 7) != 0 || !net_loop_running()) return false;
+    u32 id = job->id;
+    u32 net_id = net_loop_download(job->url, job->out_path, dlmgr_net_hook, dlmgr_net_done, (void*)(uintptr_t)id);
+    if (!net_id) return false;
+    // The job may already have finished and been freed; look it up again
+    pthread_mutex_lock(&s_lock);
+    DownloadJob *j = job_find_id(id);
+    bool cancel = j && j->cancel;
+    if (j) j->net_id = net_id;
+    pthread_mutex_unlock(&s_lock);
+    if (cancel) net_loop_cancel(net_id);
+    return true;
+}
+
+static void *dlmgr_worker(void *arg) {
+    int index = (int)(intptr_t)arg;
+    pthread_mutex_lock(&s_lock);
+    while (s_running) {
+        // Workers above the current concurrency idle until it is raised again
+        DownloadJob *job = NULL;
+        if (index < s_concurrency && s_active < s_concurrency) {
+            for (DownloadJob *j = s_head; j; j = j->next) {
+                if (!j->external && j->state == DOWNLOAD_QUEUED) { job = j; break; }
+            }
+        }
+        if (!job) { pthread_cond_wait(&s_cond, &s_lock); continue; }
+
+        job->state = DOWNLOAD_ACTIVE;
+        s_active++;
+        pthread_mutex_unlock(&s_lock);
+
+        log_event(LOG_INFO, "dlmgr: start %u %s -> %s", job->id, job->url, job->out_path);
+        if (!job_start_on_loop(job)) {
+            // The job's own flag, so cancelling it leaves other transfers alone
+            downloader_set_thread_cancel(&job->cancel);
+            downloader_set_thread_hook(dlmgr_transfer_hook, job);
+            int rc = download_url_to_file_segmented(job->url, job->out_path, DLMGR_SEGMENTS, NULL);
+            downloader_set_thread_hook(NULL, NULL);
+            downloader_set_thread_cancel(NULL);
+            job_finished(job, rc);
+        }
+        pthread_mutex_lock(&s_lock);
+    }
+    pthread_mutex_unlock(&s_lock);
+    return NULL;
+}
+
+// Make sure 'count' workers exist (at most DLMGR_MAX_WORKERS). Caller holds s_lock.
+static void spawn_workers(int count) {
+    if (count > DLMGR_MAX_WORKERS) count = DLMGR_MAX_WORKERS;
+    while (s_worker_count < count) {
+        if (pthread_create(&s_workers[s_worker_count], NULL, dlmgr_worker, (void*)(intptr_t)s_worker_count) != 0) {
+            log_event(LOG_WARN, "dlmgr: could not start worker %d", s_worker_count);
+            break;
+        }
+        s_worker_count++;
+    }
+}
+
+int dlmgr_init(int concurrency) {
+    pthread_mutex_lock(&s_lock);
+    if (concurrency < 1) concurrency = DLMGR_DEFAULT_CONCURRENCY;
+    if (concurrency > DLMGR_MAX_CONCURRENCY) concurrency = DLMGR_MAX_CONCURRENCY;
+    s_concurrency = concurrency;
+    s_running = true;
+    spawn_workers(s_concurrency);
+    int rc = s_worker_count > 0 ? 0 : -1;
+    pthread_mutex_unlock(&s_lock);
+    return rc;
+}
+
+void dlmgr_exit(void) {
+    u32 net_ids[DLMGR_MAX_CONCURRENCY];
+    int net_count = 0;
+    pthread_mutex_lock(&s_lock);
+    s_running = false;
+    DownloadJob **pp = &s_head;
+    while (*pp) {
+        DownloadJob *j = *pp;
+        if (j->state == DOWNLOAD_QUEUED || j->external) { *pp = j->next; free(j); continue; }
+        j->cancel = true; // its worker or the network thread frees it
+        if (j->net_id && net_count < DLMGR_MAX_CONCURRENCY) net_ids[net_count++] = j->net_id;
+        pp = &j->next;
+    }
+    pthread_cond_broadcast(&s_cond);
+    int workers = s_worker_count;
+    pthread_mutex_unlock(&s_lock);
+
+    for (int i = 0; i < net_count; i++) net_loop_cancel(net_ids[i]);
+    for (int i = 0; i < workers; i++) pthread_join(s_workers[i], NULL);
+    pthread_mutex_lock(&s_lock);
+    s_worker_count = 0;
+    pthread_mutex_unlock(&s_lock);
+}
+
+u32 dlmgr_enqueue(const char *url, const char *out_path, DownloadPriority priority, u32 rate_limit) {
+    if (!url || !url[0]) return 0;
+    DownloadJob *job = calloc(1, sizeof(DownloadJob));
+    if (!job) return 0;
+    snprintf(job->url, sizeof(job->url), "%s", url);
+    if (out_path && out_path[0]) {
+        snprintf(job->out_path, sizeof(job->out_path), "%s", out_path);
+    } else {
+        // Name the file after the last path segment, without any query string
+        const char *base = strrchr(url, '/');
+        base = base && base[1] ? base + 1 : "download.bin";
+        size_t len = strcspn(base, "?#");
+        mkdir("sdmc:/dbfm", 0777);
+        mkdir(DLMGR_DEFAULT_DIR, 0777);
+        snprintf(job->out_path, sizeof(job->out_path), "%s/%.*s", DLMGR_DEFAULT_DIR, (int)len, base);
+    }
+    // Match the label download_url_to_file() reports, so its updates land here
+    const char *slash = strrchr(job->out_path, '/');
+    snprintf(job->label, sizeof(job->label), "%s", slash ? slash + 1 : job->out_path);
+    job->priority = priority;
+    job->state = DOWNLOAD_QUEUED;
+    job->bucket.rate = rate_limit;
+
+    pthread_mutex_lock(&s_lock);
+    job->id = s_next_id++;
+    u32 id = job->id;
+    job_insert(job);
+    if (!s_running) {
+        s_running = true;
+        spawn_workers(s_concurrency);
+    }
+    pthread_cond_broadcast(&s_cond);
+    pthread_mutex_unlock(&s_lock);
+    log_event(LOG_INFO, "dlmgr: queued %u %s (priority %d)", id, url, (int)priority);
+    return id;
+}
+
+int dlmgr_cancel(u32 id) {
+    int rc = -1;
+    u32 net_id = 0;
+    pthread_mutex_lock(&s_lock);
+    for (DownloadJob *j = s_head; j; j = j->next) {
+        if (j->id != id || j->external) continue;
+        if (j->state == DOWNLOAD_QUEUED) {
+            job_unlink(j);
+            free(j);
+        } else {
+            j->cancel = true;
+            j->state = DOWNLOAD_CANCELLING;
+            net_id = j->net_id;
+        }
+        rc = 0;
+        break;
+    }
+    pthread_mutex_unlock(&s_lock);
+    // A stalled or throttled connection would not notice the flag soon
+    if (net_id) net_loop_cancel(net_id);
+    return rc;
+}
+
+void dlmgr_set_concurrency(int concurrency) {
+    if (concurrency < 1) concurrency = 1;
+    if (concurrency > DLMGR_MAX_CONCURRENCY) concurrency = DLMGR_MAX_CONCURRENCY;
+    pthread_mutex_lock(&s_lock);
+    s_concurrency = concurrency;
+    if (s_running) spawn_workers(concurrency);
+    pthread_cond_broadcast(&s_cond);
+    pthread_mutex_unlock(&s_lock);
+}
+
+int dlmgr_get_concurrency(void) {
+    return s_concurrency;
+}
+
+void dlmgr_set_global_limit(u32 bytes_per_sec) {
+    pthread_mutex_lock(&s_lock);
+    s_global.rate = bytes_per_sec;
+    s_global.last_ns = 0;
+    pthread_mutex_unlock(&s_lock);
+}
+
+u32 dlmgr_get_global_limit(void) {
+    return s_global.rate;
+}
+
+size_t dlmgr_snapshot(DownloadInfo **out) {
+    if (!out) return 0;
+    *out = NULL;
+    pthread_mutex_lock(&s_lock);
+    size_t count = 0;
+    for (DownloadJob *j = s_head; j; j = j->next) count++;
+    DownloadInfo *info = count ? calloc(count, sizeof(DownloadInfo)) : NULL;
+    if (info) {
+        size_t i = 0;
+        for (DownloadJob *j = s_head; j; j = j->next, i++) {
+            info[i].id = j->external ? 0 : j->id;
+            snprintf(info[i].label, sizeof(info[i].label), "%s", j->label);
+            info[i].priority = j->priority;
+            info[i].state = j->state;
+            info[i].current = j->current;
+            info[i].total = j->total;
+            info[i].progress = j->progress;
+            info[i].rate = j->rate;
+            info[i].rate_limit = j->bucket.rate;
+        }
+    } else {
+        count = 0;
+    }
+    pthread_mutex_unlock(&s_lock);
+    *out = info;
+    return count;
+}
+
+size_t dlmgr_count(void) {
+    pthread_mutex_lock(&s_lock);
+    size_t count = 0;
+    for (DownloadJob *j = s_head; j; j = j->next) count++;
+    pthread_mutex_unlock(&s_lock);
+    return count;
+}
+
+void dlmgr_report(const char *label, int progress) {
+    if (!label) return;
+    pthread_mutex_lock(&s_lock);
+    DownloadJob *j = job_find_label(label);
+    if (!j) {
+        j = calloc(1, sizeof(DownloadJob));
+        if (j) {
+            snprintf(j->label, sizeof(j->label), "%s", label);
+            j->external = true;
+            j->state = DOWNLOAD_ACTIVE;
+            j->priority = DOWNLOAD_PRIORITY_INTERACTIVE;
+            job_insert(j);
+        }
+    }
+    if (j) j->progress = progress;
+    pthread_mutex_unlock(&s_lock);
+}
+
+void dlmgr_report_done(const char *label) {
+    if (!label) return;
+    pthread_mutex_lock(&s_lock);
+    for (DownloadJob *j = s_head; j; j = j->next) {
+        if (j->external && strcmp(j->label, label) == 0) {
+            job_unlink(j);
+            free(j);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+}
@@ -0,0 +1,76 @@
+// download_manager.h - queued background downloads with bandwidth shaping
+#ifndef DOWNLOAD_MANAGER_H
+#define DOWNLOAD_MANAGER_H
+
+#include <switch.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Downloads are queued without limit. Plain http:// jobs run on the shared
+// network thread (net_loop.c) when it is up; everything else runs on a small
+// pool of worker threads. At most 'concurrency' transfers are active at once;
+// the queue is served highest priority first, FIFO within a priority.
+// Bandwidth can be capped per transfer and globally (token buckets), so a
+// background download leaves room for a network install.
+
+#define DLMGR_MAX_WORKERS          8
+#define DLMGR_MAX_CONCURRENCY      32
+#define DLMGR_DEFAULT_CONCURRENCY  2
+#define DLMGR_DEFAULT_DIR          "sdmc:/dbfm/downloads"
+
+// Same ordering as TaskPriority: lower value runs first
+typedef enum {
+    DOWNLOAD_PRIORITY_INTERACTIVE,
+    DOWNLOAD_PRIORITY_NORMAL,
+    DOWNLOAD_PRIORITY_BACKGROUND
+} DownloadPriority;
+
+typedef enum {
+    DOWNLOAD_QUEUED,
+    DOWNLOAD_ACTIVE,
+    DOWNLOAD_CANCELLING
+} DownloadState;
+
+// Snapshot of one entry for the UI
+typedef struct {
+    u32 id;                     // 0 for transfers reported from outside the manager
+    char label[128];
+    DownloadPriority priority;
+    DownloadState state;
+    u64 current;
+    u64 total;                  // 0 if unknown
+    int progress;               // 0-100
+    u32 rate;                   // recent throughput in bytes/s
+    u32 rate_limit;             // per-transfer cap in bytes/s, 0 = none
+} DownloadInfo;
+
+// Start the worker pool. Safe to call more than once.
+int dlmgr_init(int concurrency);
+// Cancel everything and join the workers.
+void dlmgr_exit(void);
+
+// Queue url for download to out_path (NULL: DLMGR_DEFAULT_DIR/<basename>).
+// rate_limit is bytes/s, 0 for no per-transfer cap. Returns the job id, 0 on failure.
+u32 dlmgr_enqueue(const char *url, const char *out_path, DownloadPriority priority, u32 rate_limit);
+
+// Cancel a queued or running download. Returns 0 if the id was found.
+int dlmgr_cancel(u32 id);
+
+void dlmgr_set_concurrency(int concurrency);
+int dlmgr_get_concurrency(void);
+// Cap for all managed transfers together in bytes/s, 0 for none
+void dlmgr_set_global_limit(u32 bytes_per_sec);
+u32 dlmgr_get_global_limit(void);
+
+// Copy the current entries (queued and active, highest priority first) into
+// a new array the caller frees. Returns the number of entries.
+size_t dlmgr_snapshot(DownloadInfo **out);
+size_t dlmgr_count(void);
+
+// Progress reported by transfers the manager did not start (installs,
+// direct download_url_to_file calls). Managed entries with the same label
+// are updated instead.
+void dlmgr_report(const char *label, int progress);
+void dlmgr_report_done(const char *label);
+
+#endif // DOWNLOAD_MANAGER_H
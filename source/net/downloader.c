@@ -1,14 +1,23 @@
-/* downloader.c - simple file/romfs loader with optional libcurl support.
- * This implementation will read local files (romfs or file paths). If libcurl
- * support is required, you can add it later (and update the Makefile to link
- * against libcurl). For now, HTTP(S) URLs are not fetched and will return -1.
+/* downloader.c - fetches URLs into memory or into files.
+ * romfs:/ and plain paths are read from disk. http:// goes through
+ * simple_http, https:// too when mbedTLS is built in (tls_conn.c); with
+ * USE_LIBCURL both go through libcurl instead.
+ *
+ * download_url_to_file() streams the body into a resumable "<out_path>.part"
+ * (see "Resumable downloads" below) and retries dropped transfers from where
+ * they stopped. The same sink is exposed to net_loop.c through
+ * download_sink_open(), and segmented_download.c shares its part format.
  */
 
 #include "downloader.h"
 #include "../ui/ui_data.h"
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
@@ -19,15 +28,8 @@
 #include <curl/curl.h>
 #endif
 #include "simple_http.h"
-
-#ifdef USE_MBEDTLS
-#include <mbedtls/net_sockets.h>
-#include <mbedtls/ssl.h>
-#include <mbedtls/entropy.h>
-#include <mbedtls/ctr_drbg.h>
-#include <mbedtls/error.h>
-#include <mbedtls/x509_crt.h>
-#endif
+#include "http_inflate.h"
+#include "tls_conn.h"
 
 #ifdef USE_LIBCURL
 struct mem_block { char *data; size_t size; };
@@ -44,52 +46,43 @@ static size_t downloader_curl_write_cb(void *ptr, size_t size, size_t nmemb, voi
 }
 #endif
 
-#ifdef USE_LIBCURL
-// curl progress callback wrapper
-struct curl_progress_data { download_progress_cb cb; FILE *f; char label[128]; };
-static int curl_progress_func(void *p, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
-    struct curl_progress_data *pd = (struct curl_progress_data*)p;
-    if (pd && pd->cb) {
-        pd->cb("Downloading", (size_t)dlnow, (size_t)dltotal);
-        // Update UI downloads queue
-        if (pd->label && pd->label[0]) {
-            int pct = 0; if (dltotal > 0) pct = (int)((dlnow * 100) / dltotal);
-            ui_downloads_push_update(pd->label, pct);
-        }
-    }
-    return 0;
+// Cancellation. Downloads on a thread that set its own flag poll only that
+// one; all others share downloader_cancel_flag.
+static volatile bool downloader_cancel_flag = false;
+static __thread volatile bool *s_thread_cancel = NULL;
+
+void downloader_cancel_current(void) {
+    downloader_cancel_flag = true;
 }
-// Older curl progress function (double args)
-static int curl_progress_func_old(void *p, double dltotal, double dlnow, double ultotal, double ulnow) {
-    struct curl_progress_data *pd = (struct curl_progress_data*)p;
-    if (pd && pd->cb) {
-        pd->cb("Downloading", (size_t)dlnow, (size_t)dltotal);
-        if (pd->label && pd->label[0]) {
-            int pct = 0; if (dltotal > 0.0) pct = (int)((dlnow * 100.0) / dltotal);
-            ui_downloads_push_update(pd->label, pct);
-        }
-    }
-    return 0;
+
+bool downloader_cancel_requested(void) {
+    return *downloader_thread_cancel();
 }
-#endif
 
-// Cancellation flag for current download.
-static volatile int downloader_cancel_flag = 0;
+void downloader_cancel_reset(void) {
+    if (!s_thread_cancel) downloader_cancel_flag = false;
+}
 
-void downloader_cancel_current(void) {
-    downloader_cancel_flag = 1;
+void downloader_set_thread_cancel(volatile bool *flag) {
+    s_thread_cancel = flag;
 }
 
-#ifdef USE_LIBCURL
-// curl write callback: write data directly to FILE* passed via userdata
-static size_t curl_write_to_file_cb(void *ptr, size_t size, size_t nmemb, void *userdata) {
-    size_t realsize = size * nmemb;
-    if (downloader_cancel_flag) return 0; // returning 0 aborts curl transfer
-    FILE *f = (FILE*)userdata;
-    size_t written = fwrite(ptr, 1, realsize, f);
-    return written;
+volatile bool *downloader_thread_cancel(void) {
+    return s_thread_cancel ? s_thread_cancel : &downloader_cancel_flag;
+}
+
+static __thread download_transfer_hook s_thread_hook = NULL;
+static __thread void *s_thread_hook_user = NULL;
+
+void downloader_set_thread_hook(download_transfer_hook hook, void *user) {
+    s_thread_hook = hook;
+    s_thread_hook_user = user;
+}
+
+void downloader_get_thread_hook(download_transfer_hook *hook, void **user) {
+    if (hook) *hook = s_thread_hook;
+    if (user) *user = s_thread_hook_user;
 }
-#endif
 
 int download_url_to_memory(const char *url, char **out_buf, size_t *out_len) {
     if (!url || !out_buf || !out_len) return -1;
@@ -109,6 +102,8 @@ int download_url_to_memory(const char *url, char **out_buf, size_t *out_len) {
         curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
         curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
         curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+        // "" offers every encoding curl can decode; bodies arrive inflated
+        curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
 
         curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, downloader_curl_write_cb);
         curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&chunk);
@@ -123,8 +118,8 @@ int download_url_to_memory(const char *url, char **out_buf, size_t *out_len) {
         *out_len = chunk.size;
         return 0;
 #else
-        // plain HTTP can be handled by our simple client; HTTPS is unsupported
-        if (strncmp(url, "http://", 7) == 0) {
+        // Our simple client handles plain HTTP, and HTTPS when mbedTLS is built in
+        if (strncmp(url, "http://", 7) == 0 || tls_available()) {
             return simple_http_get(url, out_buf, out_len);
         }
         return -1; // HTTPS not available without libcurl/mbedtls
@@ -153,308 +148,392 @@ int download_url_to_memory(const char *url, char **out_buf, size_t *out_len) {
     return 0;
 }
 
-// Stream the given URL directly to a file on disk and call progress_cb.
-// Returns 0 on success.
-int download_url_to_file(const char *url, const char *out_path, download_progress_cb progress_cb) {
-    if (!url || !out_path) return -1;
+// ---------------------------------------------------------------------------
+// Resumable downloads
+//
+// Data is written to "<out_path>.part" and only renamed to out_path once the
+// whole body has arrived. "<out_path>.part.meta" records the URL, the
+// validator (strong ETag, else Last-Modified) and the full size, so a later
+// attempt can ask for the missing tail with Range/If-Range. If the resource
+// changed, the server answers 200 with the full body and the part file is
+// started over. A fourth line marks a sparse part left by the segmented
+// downloader and holds how many leading bytes of it are good.
+// ---------------------------------------------------------------------------
+
+#define DOWNLOAD_MAX_ATTEMPTS   5
+#define DOWNLOAD_RETRY_DELAY_MS 1000   // doubled after every failed attempt
+
+// State of one download attempt shared by the curl, mbedTLS and socket paths
+struct file_sink {
+    FILE *f;
+    const char *meta_path;
+    download_progress_cb cb;
+    const char *label;
+    DownloadPartMeta meta;
+    long long offset;       // bytes already in the part file when the request was sent
+    long long written;      // bytes written by this attempt
+    long long total;        // full size, 0 if unknown
+    bool begun;             // response head has been accepted
+    bool fatal;             // retrying will not help (4xx, disk error)
+    int last_pct;
+    download_transfer_hook hook;
+    void *hook_user;
+    volatile bool *cancel;  // NULL when the owner cancels through the hook
+};
+
+int download_part_meta_load(const char *meta_path, DownloadPartMeta *meta) {
+    memset(meta, 0, sizeof(*meta));
+    FILE *f = fopen(meta_path, "r");
+    if (!f) return -1;
+    char total_line[32] = {0}, valid_line[32] = {0};
+    int ok = fgets(meta->url, sizeof(meta->url), f) && fgets(meta->validator, sizeof(meta->validator), f) &&
+             fgets(total_line, sizeof(total_line), f);
+    if (ok && fgets(valid_line, sizeof(valid_line), f)) {
+        meta->sparse = true;
+        meta->valid = atoll(valid_line);
+    }
+    fclose(f);
+    if (!ok) return -1;
+    meta->url[strcspn(meta->url, "\r\n")] = '\0';
+    meta->validator[strcspn(meta->validator, "\r\n")] = '\0';
+    meta->total = atoll(total_line);
+    return 0;
+}
 
-    // Derive short filename label for UI use
-    const char *slash_name = strrchr(out_path, '/');
-    const char *fname = slash_name ? slash_name + 1 : out_path;
+void download_part_meta_save(const char *meta_path, const DownloadPartMeta *meta) {
+    FILE *f = fopen(meta_path, "w");
+    if (!f) return;
+    fprintf(f, "%s\n%s\n%lld\n", meta->url, meta->validator, meta->total);
+    if (meta->sparse) fprintf(f, "%lld\n", meta->valid);
+    fclose(f);
+}
+
+// If-Range needs a strong validator; weak ETags fall back to Last-Modified
+static void pick_validator(const SimpleHttpResponse *resp, char *out, size_t out_size) {
+    if (resp->etag[0] && strncmp(resp->etag, "W/", 2) != 0) snprintf(out, out_size, "%s", resp->etag);
+    else snprintf(out, out_size, "%s", resp->last_modified);
+}
+
+// Open the part file and work out how much of it can be kept. Returns the
+// resume offset, or -1 if the part file cannot be opened.
+static long long part_open(const char *url, const char *part_path, struct file_sink *s) {
+    DownloadPartMeta meta;
+    long long offset = 0;
+    struct stat st;
+    if (download_part_meta_load(s->meta_path, &meta) == 0 && strcmp(meta.url, url) == 0 &&
+        (meta.validator[0] || meta.total > 0) && stat(part_path, &st) == 0) {
+        offset = (long long)st.st_size;
+        // Past its good head a sparse part only holds preallocated space
+        if (meta.sparse && offset > meta.valid) offset = meta.valid;
+        if (meta.total > 0 && offset > meta.total) offset = 0;
+    }
+    if (offset > 0) {
+        s->meta = meta;
+        s->meta.sparse = false;
+        s->f = fopen(part_path, "r+b");
+        if (s->f && (ftruncate(fileno(s->f), (off_t)offset) != 0 || fseeko(s->f, (off_t)offset, SEEK_SET) != 0)) {
+            fclose(s->f);
+            s->f = NULL;
+        }
+    }
+    if (!s->f) {
+        offset = 0;
+        memset(&s->meta, 0, sizeof(s->meta));
+        s->f = fopen(part_path, "w+b");
+        if (!s->f) return -1;
+    }
+    snprintf(s->meta.url, sizeof(s->meta.url), "%s", url);
+    s->offset = offset;
+    return offset;
+}
+
+// Build the Range/If-Range request lines for the current resume offset
+static void build_range_headers(const struct file_sink *s, char *out, size_t out_size) {
+    out[0] = '\0';
+    if (s->offset <= 0) return;
+    int n = snprintf(out, out_size, "Range: bytes=%lld-\r\n", s->offset);
+    if (s->meta.validator[0] && n > 0 && (size_t)n < out_size)
+        snprintf(out + n, out_size - (size_t)n, "If-Range: %s\r\n", s->meta.validator);
+}
+
+// Decide from the final response head whether to append to or restart the
+// part file. Returns 0 to accept the body, -1 to abort this attempt.
+static int sink_begin(struct file_sink *s, const SimpleHttpResponse *resp) {
+    if (resp->status == 206) {
+        long long total = resp->range_total > 0 ? resp->range_total :
+                          (resp->content_length >= 0 ? s->offset + resp->content_length : 0);
+        bool usable = s->offset > 0 && resp->range_start == s->offset;
+        // Without a validator the size is the only evidence the file is unchanged
+        if (usable && !s->meta.validator[0] && (total <= 0 || total != s->meta.total)) usable = false;
+        if (!usable) {
+            // Forget the resume state so the next attempt starts over
+            s->meta.total = 0;
+            s->meta.validator[0] = '\0';
+            download_part_meta_save(s->meta_path, &s->meta);
+            return -1;
+        }
+        s->total = total;
+    } else if (resp->status >= 200 && resp->status < 300) {
+        // Full body: the resource changed or the server ignores ranges
+        if (s->offset > 0) {
+            fflush(s->f);
+            if (ftruncate(fileno(s->f), 0) != 0 || fseeko(s->f, 0, SEEK_SET) != 0) { s->fatal = true; return -1; }
+            s->offset = 0;
+        }
+        s->total = resp->content_length > 0 ? resp->content_length : 0;
+    } else if (resp->status == 416) {
+        // Our range no longer fits the resource; start over on the next attempt
+        s->meta.total = 0;
+        s->meta.validator[0] = '\0';
+        download_part_meta_save(s->meta_path, &s->meta);
+        return -1;
+    } else {
+        s->fatal = resp->status >= 400 && resp->status < 500 && resp->status != 408 && resp->status != 429;
+        return -1;
+    }
+
+    pick_validator(resp, s->meta.validator, sizeof(s->meta.validator));
+    s->meta.total = s->total;
+    download_part_meta_save(s->meta_path, &s->meta);
+    s->begun = true;
+    s->last_pct = -1;
+    return 0;
+}
+
+static int sink_write(struct file_sink *s, const void *data, size_t len) {
+    if (s->cancel && *s->cancel) return -1;
+    if (fwrite(data, 1, len, s->f) != len) { s->fatal = true; return -1; }
+    s->written += (long long)len;
+    size_t current = (size_t)(s->offset + s->written);
+    if (s->hook && s->hook(s->hook_user, len, current, (size_t)s->total) != 0) { s->fatal = true; return -1; }
+    if (s->cb) s->cb("Downloading", current, (size_t)s->total);
+    int pct = s->total > 0 ? (int)(((long long)current * 100) / s->total) : 0;
+    if (s->label && pct != s->last_pct) { ui_downloads_push_update(s->label, pct); s->last_pct = pct; }
+    return 0;
+}
+
+#ifndef USE_LIBCURL
+// simple_http adapters
+static int file_sink_head(void *user, const SimpleHttpResponse *resp) {
+    return sink_begin((struct file_sink*)user, resp);
+}
+
+static int file_sink_write(void *user, const char *data, size_t len) {
+    return sink_write((struct file_sink*)user, data, len);
+}
+#endif
 
-    // If libcurl is enabled, use it to stream directly to file (handles HTTPS too)
 #ifdef USE_LIBCURL
-    CURL *curl = curl_easy_init();
-    if (!curl) return -1;
+// Collects the final response's status and validators; curl reports the
+// headers of every redirect hop, so a new status line starts over.
+struct curl_attempt { struct file_sink *sink; SimpleHttpResponse resp; };
+
+static size_t curl_header_cb(char *buffer, size_t size, size_t nitems, void *userdata) {
+    struct curl_attempt *a = (struct curl_attempt*)userdata;
+    size_t len = size * nitems;
+    char line[512];
+    size_t n = len < sizeof(line) - 1 ? len : sizeof(line) - 1;
+    memcpy(line, buffer, n); line[n] = '\0';
+    line[strcspn(line, "\r\n")] = '\0';
+    if (strncmp(line, "HTTP/", 5) == 0) {
+        memset(&a->resp, 0, sizeof(a->resp));
+        a->resp.content_length = -1; a->resp.range_start = -1; a->resp.range_total = -1;
+        sscanf(line, "HTTP/%*s %d", &a->resp.status);
+        return len;
+    }
+    char *value = strchr(line, ':');
+    if (!value) return len;
+    *value++ = '\0';
+    while (*value == ' ' || *value == '\t') value++;
+    if (strcasecmp(line, "Content-Length") == 0) a->resp.content_length = atoll(value);
+    else if (strcasecmp(line, "Content-Encoding") == 0) a->resp.decoded = http_coding_parse(value) != HTTP_CODING_IDENTITY;
+    else if (strcasecmp(line, "ETag") == 0) snprintf(a->resp.etag, sizeof(a->resp.etag), "%s", value);
+    else if (strcasecmp(line, "Last-Modified") == 0) snprintf(a->resp.last_modified, sizeof(a->resp.last_modified), "%s", value);
+    else if (strcasecmp(line, "Content-Range") == 0) {
+        long long start = -1, end = -1;
+        if (sscanf(value, "bytes %lld-%lld", &start, &end) == 2) a->resp.range_start = start;
+        const char *slash = strchr(value, '/');
+        if (slash && slash[1] != '*') a->resp.range_total = atoll(slash + 1);
+    }
+    return len;
+}
 
-    FILE *f = fopen(out_path, "wb");
-    if (!f) { curl_easy_cleanup(curl); return -1; }
+static size_t curl_write_to_sink_cb(void *ptr, size_t size, size_t nmemb, void *userdata) {
+    struct curl_attempt *a = (struct curl_attempt*)userdata;
+    size_t realsize = size * nmemb;
+    // curl inflates encoded bodies, so Content-Length is not the size written
+    if (a->resp.decoded) a->resp.content_length = -1;
+    if (!a->sink->begun && sink_begin(a->sink, &a->resp) != 0) return 0; // returning 0 aborts curl transfer
+    return sink_write(a->sink, ptr, realsize) == 0 ? realsize : 0;
+}
 
-    struct curl_progress_data prog; memset(&prog, 0, sizeof(prog)); prog.cb = progress_cb; prog.f = f;
-    // Use the common fname derived above
-    snprintf(prog.label, sizeof(prog.label), "%s", fname ? fname : "download");
-    // Add initial UI entry
-    ui_downloads_push_update(fname, 0);
+static int download_attempt_curl(const char *url, struct file_sink *s) {
+    CURL *curl = curl_easy_init();
+    if (!curl) return -1;
+    struct curl_attempt a; memset(&a, 0, sizeof(a)); a.sink = s;
+    struct curl_slist *headers = NULL;
+    char range[512];
+    build_range_headers(s, range, sizeof(range));
+    // curl builds Range itself; only If-Range goes through the header list
+    char *if_range = strstr(range, "If-Range:");
+    if (if_range) { if_range[strcspn(if_range, "\r\n")] = '\0'; headers = curl_slist_append(headers, if_range); }
 
     curl_easy_setopt(curl, CURLOPT_URL, url);
     curl_easy_setopt(curl, CURLOPT_USERAGENT, "DBFM/1.0");
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, (curl_off_t)s->offset);
+    // Ranges must refer to the identity encoding
+    if (s->offset == 0) curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    if (headers) curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curl_header_cb);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &a);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_to_sink_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &a);
 
-    // set write callback to stream to file
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_to_file_cb);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, f);
+    CURLcode res = curl_easy_perform(curl);
+    curl_easy_cleanup(curl);
+    curl_slist_free_all(headers);
+    // curl refuses a 200 answer to a ranged request; restart from zero next time
+    if (res == CURLE_RANGE_ERROR) {
+        s->meta.total = 0;
+        s->meta.validator[0] = '\0';
+        download_part_meta_save(s->meta_path, &s->meta);
+    }
+    // An empty body never reaches the write callback
+    if (a.resp.decoded) a.resp.content_length = -1;
+    if (res == CURLE_OK && !s->begun && sink_begin(s, &a.resp) != 0) return -1;
+    return res == CURLE_OK ? 0 : -1;
+}
+#endif
 
-#if LIBCURL_VERSION_NUM >= 0x072000
-    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &prog);
-    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, curl_progress_func);
+static int download_attempt(const char *url, struct file_sink *s) {
+#ifdef USE_LIBCURL
+    // libcurl handles both http:// and https://
+    return download_attempt_curl(url, s);
 #else
-    curl_easy_setopt(curl, CURLOPT_PROGRESSDATA, &prog);
-    curl_easy_setopt(curl, CURLOPT_PROGRESSFUNCTION, curl_progress_func_old);
+    // https:// runs over pooled mbedTLS connections when built in
+    bool https = strncmp(url, "https://", 8) == 0 && tls_available();
+    if (strncmp(url, "http://", 7) != 0 && !https) { s->fatal = true; return -1; } // HTTPS not supported
+    char range[512]; build_range_headers(s, range, sizeof(range));
+    return simple_http_get_stream_ex(url, range, file_sink_head, file_sink_write, s);
 #endif
+}
 
-    // Reset cancel flag
-    downloader_cancel_flag = 0;
-
-    CURLcode res = curl_easy_perform(curl);
-    curl_easy_cleanup(curl);
-    fclose(f);
-
-    // Ensure UI reflects completion/failure
-    if (prog.label && prog.label[0]) {
-        if (res == CURLE_OK) ui_downloads_remove(prog.label);
-        else ui_downloads_remove(prog.label);
-    }
+// Close the part file after an attempt and decide whether it succeeded
+static int attempt_finish(struct file_sink *s, int rc) {
+    if (fclose(s->f) != 0) { rc = -1; s->fatal = true; }
+    s->f = NULL;
+    // A body cut short by a dropped connection is not a success
+    if (rc == 0 && s->total > 0 && s->offset + s->written != s->total) rc = -1;
+    return rc == 0 && s->begun ? 0 : -1;
+}
 
-    if (res != CURLE_OK) {
-        // remove partial file
-        unlink(out_path);
-        ui_clear_task();
-        return -1;
-    }
-    ui_clear_task();
+// Move a completed part file into place and drop its resume state
+static int part_commit(const char *part_path, const char *meta_path, const char *out_path) {
+    // FAT does not replace on rename
+    remove(out_path);
+    if (rename(part_path, out_path) != 0) return -1;
+    remove(meta_path);
     return 0;
-#elif defined(USE_MBEDTLS)
-    // mbedTLS-backed HTTPS path (when USE_MBEDTLS is enabled)
-    if (strncmp(url, "https://", 8) == 0) {
-        const char *p = url + 8;
-        const char *path = strchr(p, '/');
-        char host[256] = {0};
-        if (!path) { strncpy(host, p, sizeof(host)-1); path = "/"; }
-        else { size_t hlen = (size_t)(path - p); if (hlen >= sizeof(host)) hlen = sizeof(host)-1; memcpy(host, p, hlen); host[hlen] = '\0'; }
-        const char *port = "443";
-
-    FILE *f = fopen(out_path, "wb"); if (!f) return -1;
-    ui_downloads_push_update(fname, 0);
+}
 
-        int rc = -1;
-        mbedtls_net_context server_fd; mbedtls_ssl_context ssl; mbedtls_ssl_config conf;
-        mbedtls_entropy_context entropy; mbedtls_ctr_drbg_context ctr_drbg; mbedtls_x509_crt cacert;
-        const char *pers = "dbfm_tls";
+struct DownloadFileSink {
+    struct file_sink s;
+    char out_path[PATH_MAX];
+    char part_path[PATH_MAX];
+    char meta_path[PATH_MAX];
+    char range[512];
+};
+
+DownloadFileSink *download_sink_open(const char *url, const char *out_path,
+                                     download_transfer_hook hook, void *hook_user) {
+    if (!url || !out_path) return NULL;
+    DownloadFileSink *d = calloc(1, sizeof(*d));
+    if (!d) return NULL;
+    snprintf(d->out_path, sizeof(d->out_path), "%s", out_path);
+    if (snprintf(d->part_path, sizeof(d->part_path), "%s.part", out_path) >= (int)sizeof(d->part_path) ||
+        snprintf(d->meta_path, sizeof(d->meta_path), "%s.part.meta", out_path) >= (int)sizeof(d->meta_path)) {
+        free(d);
+        return NULL;
+    }
+    const char *slash_name = strrchr(d->out_path, '/');
+    d->s.label = slash_name ? slash_name + 1 : d->out_path;
+    d->s.meta_path = d->meta_path;
+    d->s.hook = hook;
+    d->s.hook_user = hook_user;
+    if (part_open(url, d->part_path, &d->s) < 0) { free(d); return NULL; }
+    build_range_headers(&d->s, d->range, sizeof(d->range));
+    return d;
+}
 
-        mbedtls_net_init(&server_fd);
-        mbedtls_ssl_init(&ssl);
-        mbedtls_ssl_config_init(&conf);
-        mbedtls_ctr_drbg_init(&ctr_drbg);
-        mbedtls_entropy_init(&entropy);
-        mbedtls_x509_crt_init(&cacert);
+const char *download_sink_range_headers(const DownloadFileSink *s) {
+    return s ? s->range : "";
+}
 
-        if ((rc = mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy,
-                        (const unsigned char*)pers, strlen(pers))) != 0) goto mbed_cleanup;
+int download_sink_head(void *user, const SimpleHttpResponse *resp) {
+    return sink_begin(&((DownloadFileSink*)user)->s, resp);
+}
 
-        if ((rc = mbedtls_net_connect(&server_fd, host, port, MBEDTLS_NET_PROTO_TCP)) != 0) goto mbed_cleanup;
+int download_sink_body(void *user, const char *data, size_t len) {
+    return sink_write(&((DownloadFileSink*)user)->s, data, len);
+}
 
-        if ((rc = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT)) != 0) goto mbed_cleanup;
-        mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_NONE); // don't verify by default on Switch
-        mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &ctr_drbg);
+int download_sink_close(DownloadFileSink *d, int transfer_rc, bool *retry) {
+    if (retry) *retry = false;
+    if (!d) return -1;
+    int rc = attempt_finish(&d->s, transfer_rc);
+    if (rc == 0) {
+        rc = part_commit(d->part_path, d->meta_path, d->out_path);
+    } else if (retry) {
+        *retry = !d->s.fatal;
+    }
+    free(d);
+    return rc;
+}
 
-        if ((rc = mbedtls_ssl_setup(&ssl, &conf)) != 0) goto mbed_cleanup;
-        mbedtls_ssl_set_hostname(&ssl, host);
-        mbedtls_ssl_set_bio(&ssl, &server_fd, mbedtls_net_send, mbedtls_net_recv, NULL);
+// Stream the given URL to a file on disk and call progress_cb. Interrupted
+// transfers are retried and resumed from the .part file, also across calls.
+// Returns 0 on success.
+int download_url_to_file(const char *url, const char *out_path, download_progress_cb progress_cb) {
+    if (!url || !out_path) return -1;
 
-        while ((rc = mbedtls_ssl_handshake(&ssl)) != 0) {
-            if (rc != MBEDTLS_ERR_SSL_WANT_READ && rc != MBEDTLS_ERR_SSL_WANT_WRITE) goto mbed_cleanup;
-        }
+    // Derive short filename label for UI use
+    const char *slash_name = strrchr(out_path, '/');
+    const char *fname = slash_name ? slash_name + 1 : out_path;
 
-        char req[1024]; snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\nUser-Agent: DBFM/1.0\r\n\r\n", path, host);
-        size_t to_send = strlen(req); size_t sent = 0;
-        while (sent < to_send) {
-            int n = mbedtls_ssl_write(&ssl, (const unsigned char*)req + sent, to_send - sent);
-            if (n <= 0) { rc = n; goto mbed_cleanup; }
-            sent += (size_t)n;
-        }
+    char part_path[PATH_MAX], meta_path[PATH_MAX];
+    if (snprintf(part_path, sizeof(part_path), "%s.part", out_path) >= (int)sizeof(part_path)) return -1;
+    if (snprintf(meta_path, sizeof(meta_path), "%s.part.meta", out_path) >= (int)sizeof(meta_path)) return -1;
 
-        unsigned char buf[8192]; unsigned char header_buf[16384]; size_t header_len = 0; int header_done = 0; size_t total_written = 0;
-        while (1) {
-            if (downloader_cancel_flag) { rc = -1; break; }
-            int r = mbedtls_ssl_read(&ssl, buf, sizeof(buf));
-            if (r == MBEDTLS_ERR_SSL_WANT_READ || r == MBEDTLS_ERR_SSL_WANT_WRITE) continue;
-            if (r <= 0) break;
-            size_t got = (size_t)r;
-            if (!header_done) {
-                if (header_len + got > sizeof(header_buf)) { rc = -1; break; }
-                memcpy(header_buf + header_len, buf, got); header_len += got;
-                for (size_t i = 0; i + 3 < header_len; ++i) {
-                    if (header_buf[i]=='\r' && header_buf[i+1]=='\n' && header_buf[i+2]=='\r' && header_buf[i+3]=='\n') {
-                        size_t body_off = i + 4; size_t body_len = header_len - body_off;
-                        if (body_len) { fwrite(header_buf + body_off, 1, body_len, f); total_written += body_len; }
-                        header_done = 1; header_len = 0; break;
-                    }
-                }
-                continue;
-            } else {
-                fwrite(buf, 1, got, f); total_written += got;
-            }
-            if (progress_cb) progress_cb("Downloading", total_written, 0);
-            // update UI with unknown total (0)
-            if (progress_cb && fname) {
-                // percent unknown => report 0.. we still push an entry
-                ui_downloads_push_update(fname, 0);
-            }
-        }
+    downloader_cancel_reset();
+    volatile bool *cancel = downloader_thread_cancel();
+    ui_downloads_push_update(fname, 0);
 
-    if (!downloader_cancel_flag) rc = 0;
-
-    mbed_cleanup:
-        mbedtls_ssl_close_notify(&ssl);
-        mbedtls_net_free(&server_fd);
-        mbedtls_x509_crt_free(&cacert);
-        mbedtls_ssl_free(&ssl);
-        mbedtls_ssl_config_free(&conf);
-        mbedtls_ctr_drbg_free(&ctr_drbg);
-        mbedtls_entropy_free(&entropy);
-        fclose(f);
-        if (rc != 0) { unlink(out_path); ui_downloads_remove(fname); ui_clear_task(); return -1; }
-        ui_downloads_remove(fname); ui_clear_task();
-        return 0;
-    }
-    // fall through to HTTP socket path below if not https://
-#else
-    // No libcurl: support plain http:// streaming directly via sockets
-    if (strncmp(url, "http://", 7) != 0) return -1; // HTTPS not supported
-
-    // Simple parse: extract host, optional port, and path
-    const char *p = url + 7; // skip http://
-    const char *slash = strchr(p, '/');
-    size_t host_len = slash ? (size_t)(slash - p) : strlen(p);
-    char host[256] = {0};
-    char portstr[8] = "80";
-    const char *portptr = memchr(p, ':', host_len);
-    if (portptr) {
-        size_t hlen = (size_t)(portptr - p);
-        if (hlen >= sizeof(host)) hlen = sizeof(host)-1;
-        memcpy(host, p, hlen); host[hlen] = '\0';
-        size_t plen = host_len - hlen - 1;
-        if (plen >= sizeof(portstr)) plen = sizeof(portstr)-1;
-        memcpy(portstr, portptr+1, plen); portstr[plen] = '\0';
-    } else {
-        if (host_len >= sizeof(host)) host_len = sizeof(host)-1;
-        memcpy(host, p, host_len); host[host_len] = '\0';
+    int rc = -1;
+    unsigned int delay_ms = DOWNLOAD_RETRY_DELAY_MS;
+    for (int attempt = 0; attempt < DOWNLOAD_MAX_ATTEMPTS && !*cancel; attempt++) {
+        struct file_sink s; memset(&s, 0, sizeof(s));
+        s.meta_path = meta_path; s.cb = progress_cb; s.label = fname;
+        s.hook = s_thread_hook; s.hook_user = s_thread_hook_user;
+        s.cancel = cancel;
+        if (part_open(url, part_path, &s) < 0) break;
+        if (progress_cb) progress_cb(s.offset > 0 ? "Resuming" : "Downloading", (size_t)s.offset, (size_t)s.meta.total);
+
+        rc = attempt_finish(&s, download_attempt(url, &s));
+        if (rc == 0 || s.fatal) break;
+        usleep(delay_ms * 1000);
+        delay_ms *= 2;
     }
-    const char *path = slash ? slash : "/";
-
-    struct addrinfo hints, *res = NULL;
-    memset(&hints, 0, sizeof(hints)); hints.ai_socktype = SOCK_STREAM;
-    if (getaddrinfo(host, portstr, &hints, &res) != 0) return -1;
-
-    int sock = -1; struct addrinfo *rp;
-    for (rp = res; rp; rp = rp->ai_next) {
-        sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-        if (sock < 0) continue;
-        if (connect(sock, rp->ai_addr, rp->ai_addrlen) == 0) break;
-        close(sock); sock = -1;
-    }
-    freeaddrinfo(res);
-    if (sock < 0) return -1;
-
-    char req[1024]; snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\nUser-Agent: DBFM/1.0\r\n\r\n", path, host);
-    if (send(sock, req, strlen(req), 0) < 0) { close(sock); return -1; }
-
-    FILE *f = fopen(out_path, "wb"); if (!f) { close(sock); return -1; }
-    ui_downloads_push_update(fname, 0);
 
-    // Use common fname derived at function top
-    (void)0;
-
-    // Read headers first
-    char header_buf[16384]; size_t header_len = 0; int header_done = 0;
-    while (!header_done) {
-        ssize_t r = recv(sock, header_buf + header_len, sizeof(header_buf) - header_len, 0);
-        if (r <= 0) { fclose(f); close(sock); return -1; }
-        header_len += (size_t)r;
-        // look for \r\n\r\n
-        for (size_t i = 0; i + 3 < header_len; ++i) {
-            if (header_buf[i] == '\r' && header_buf[i+1] == '\n' && header_buf[i+2] == '\r' && header_buf[i+3] == '\n') {
-                // write any initial body data after header
-                size_t hdr_end = i + 4;
-                size_t body_bytes = header_len - hdr_end;
-                if (body_bytes) fwrite(header_buf + hdr_end, 1, body_bytes, f);
-                // parse headers for content-length and chunked
-                int is_chunked = 0; size_t content_length = 0;
-                header_buf[header_len] = '\0';
-                char *hpos = header_buf;
-                while (hpos < header_buf + hdr_end) {
-                    char *line = hpos;
-                    char *line_end = strstr(line, "\r\n"); if (!line_end) break;
-                    *line_end = '\0';
-                    if (strncasecmp(line, "Content-Length:", 15) == 0) content_length = (size_t)atoll(line + 15);
-                    if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line+18, "chunked")) is_chunked = 1;
-                    hpos = line_end + 2;
-                }
-                // If chunked, decode on the fly
-                    if (is_chunked) {
-                    // We already wrote any partial chunk body bytes; now iterate reading chunks
-                    char chunkline[64]; size_t partial_bytes = body_bytes; // may be portion of chunk
-                    // Use a simple stateful reader: put back any unread body bytes to buffer processing
-                    // For simplicity, assume header_end aligns to chunk boundary rarely; we will handle by feeding remaining bytes into decoding loop
-                    // Build a small buffer for chunk processing
-                    size_t bufcap = 8192; char *buf = malloc(bufcap); size_t buflen = 0;
-                    if (body_bytes) { buflen = body_bytes; if (buflen > bufcap) buflen = bufcap; memcpy(buf, header_buf + hdr_end, buflen); }
-                    int done = 0;
-                    while (!done) {
-                        // ensure we have a line for chunk size
-                        char *lnpos = memchr(buf, '\n', buflen);
-                        while (!lnpos) {
-                            // read more data
-                            if (bufcap - buflen < 4096) { bufcap *= 2; char *nb = realloc(buf, bufcap); if (!nb) { free(buf); fclose(f); close(sock); return -1; } buf = nb; }
-                            ssize_t r = recv(sock, buf + buflen, bufcap - buflen, 0);
-                            if (r <= 0) { free(buf); fclose(f); close(sock); return -1; }
-                            buflen += (size_t)r;
-                            lnpos = memchr(buf, '\n', buflen);
-                        }
-                        // read chunk size line
-                        size_t linelen = (size_t)(lnpos - buf) + 1; // include newline
-                        char numbuf[32]; size_t copylen = linelen < sizeof(numbuf)-1 ? linelen : sizeof(numbuf)-1;
-                        memcpy(numbuf, buf, copylen); numbuf[copylen] = '\0';
-                        unsigned int chunk_size = 0; sscanf(numbuf, "%x", &chunk_size);
-                        // remove size line from buffer
-                        size_t remaining = buflen - linelen;
-                        memmove(buf, buf + linelen, remaining); buflen = remaining;
-                        if (chunk_size == 0) { done = 1; break; }
-                        // ensure we have chunk_size + 2 (CRLF)
-                        while (buflen < chunk_size + 2) {
-                            if (bufcap - buflen < 4096) { bufcap *= 2; char *nb = realloc(buf, bufcap); if (!nb) { free(buf); fclose(f); close(sock); return -1; } buf = nb; }
-                            ssize_t r = recv(sock, buf + buflen, bufcap - buflen, 0);
-                            if (r <= 0) { free(buf); fclose(f); close(sock); return -1; }
-                            buflen += (size_t)r;
-                        }
-                        // write chunk_size bytes
-                        fwrite(buf, 1, chunk_size, f);
-                        // drop chunk and trailing CRLF
-                        remaining = buflen - (chunk_size + 2);
-                        memmove(buf, buf + chunk_size + 2, remaining); buflen = remaining;
-                        if (progress_cb) progress_cb("Downloading", 0, 0);
-                        if (fname) ui_downloads_push_update(fname, 0);
-                    }
-                    free(buf);
-                    fclose(f); close(sock);
-                    return 0;
-                } else {
-                    // Not chunked: continue streaming remaining content-length or until close
-                    size_t written = body_bytes;
-                    if (progress_cb) progress_cb("Downloading", written, content_length);
-                    char tmp[4096]; ssize_t r;
-                        while ((r = recv(sock, tmp, sizeof(tmp), 0)) > 0) {
-                        fwrite(tmp, 1, (size_t)r, f);
-                        written += (size_t)r;
-                        if (progress_cb) progress_cb("Downloading", written, content_length);
-                        if (content_length > 0 && fname) {
-                            int pct = (int)((written * 100) / content_length);
-                            ui_downloads_push_update(fname, pct);
-                        } else if (fname) {
-                            ui_downloads_push_update(fname, 0);
-                        }
-                    }
-                    fclose(f); close(sock);
-                    ui_downloads_remove(fname); ui_clear_task();
-                    return 0;
-                }
-            }
-        }
+    if (rc == 0) {
+        rc = part_commit(part_path, meta_path, out_path);
+    } else if (*cancel) {
+        remove(part_path);
+        remove(meta_path);
     }
-#endif
-    return -1;
+    ui_downloads_remove(fname);
+    ui_clear_task();
+    return rc;
 }
 
 // downloader_cancel_current implemented above (sets a cancel flag)
@@ -3,6 +3,8 @@
 #define DOWNLOADER_H
 
 #include <stddef.h>
+#include <stdbool.h>
+#include "simple_http.h"
 
 // Progress callback used by streaming download functions.
 // status: a short status string (e.g., "Downloading..."), current/total are bytes (total may be 0 if unknown).
@@ -16,7 +18,73 @@ int download_url_to_memory(const char *url, char **out_buf, size_t *out_len);
 // Returns 0 on success, non-zero on error.
 int download_url_to_file(const char *url, const char *out_path, download_progress_cb progress_cb);
 
-// Convenience: a cancel function (optional) - currently a no-op placeholder.
+// Cancellation. A thread can give the downloads it runs their own flag
+// (the download manager passes each job's); downloads on any other thread
+// share one flag, set by downloader_cancel_current() and cleared when such a
+// download starts.
 void downloader_cancel_current(void);
+// Whether the calling thread's download has been cancelled
+bool downloader_cancel_requested(void);
+// Clears the shared flag; a thread's own flag is left to its owner
+void downloader_cancel_reset(void);
+// Pass NULL to go back to the shared flag
+void downloader_set_thread_cancel(volatile bool *flag);
+// The flag the calling thread's downloads poll, for handing to helper threads
+volatile bool *downloader_thread_cancel(void);
+
+// Per-thread transfer hook, called on the downloading thread after each chunk
+// reaches the file with the chunk size and the running/total byte counts.
+// It may sleep (bandwidth shaping); a non-zero return aborts the download
+// without retrying. Pass NULL to clear.
+typedef int (*download_transfer_hook)(void *user, size_t chunk, size_t current, size_t total);
+void downloader_set_thread_hook(download_transfer_hook hook, void *user);
+// The calling thread's hook, for downloads that hand chunks to other threads
+void downloader_get_thread_hook(download_transfer_hook *hook, void **user);
+
+// One attempt of download_url_to_file()'s resumable file sink, for transports
+// that drive the HTTP exchange themselves (net_loop.c). Open it, send the
+// request with download_sink_range_headers(), feed the response through the
+// head/body callbacks and close it with the transfer result.
+typedef struct DownloadFileSink DownloadFileSink;
+
+// Opens "<out_path>.part" at its resume offset. 'hook' (may be NULL) is
+// called after every chunk like the thread hook, on the calling thread.
+DownloadFileSink *download_sink_open(const char *url, const char *out_path,
+                                     download_transfer_hook hook, void *hook_user);
+// Range/If-Range lines for the request ("" when starting from zero)
+const char *download_sink_range_headers(const DownloadFileSink *s);
+// simple_http_head_cb / simple_http_body_cb, user is the DownloadFileSink
+int download_sink_head(void *user, const SimpleHttpResponse *resp);
+int download_sink_body(void *user, const char *data, size_t len);
+// Finish the attempt and free the sink. Returns 0 once the file is complete
+// and renamed to out_path, otherwise -1 with *retry telling whether another
+// attempt can make progress.
+int download_sink_close(DownloadFileSink *s, int transfer_rc, bool *retry);
+
+// Resume state of "<out_path>.part", kept in "<out_path>.part.meta". A
+// sparse part file was preallocated by the segmented downloader and only its
+// first 'valid' bytes are known to hold data.
+typedef struct {
+    char url[1024];
+    char validator[256];    // strong ETag, else Last-Modified
+    long long total;        // full resource size, 0 if unknown
+    bool sparse;
+    long long valid;
+} DownloadPartMeta;
+
+// Returns 0 if the meta file was read
+int download_part_meta_load(const char *meta_path, DownloadPartMeta *meta);
+void download_part_meta_save(const char *meta_path, const DownloadPartMeta *meta);
+
+// Fetch a large http:// file over 'segments' parallel ranged connections,
+// writing each range at its offset in a preallocated "<out_path>.part".
+// Idle connections steal the tail of the largest remaining range. The
+// calling thread's transfer hook sees every chunk the workers write. A part
+// file left by an earlier attempt is resumed if the server's validator still
+// matches; after a failure the part is cut back to its contiguous head, so
+// either downloader can resume it. Falls back to download_url_to_file() for
+// https without mbedTLS, servers without range support and files too small
+// to benefit. Returns 0 on success, -1 on failure.
+int download_url_to_file_segmented(const char *url, const char *out_path, int segments, download_progress_cb progress_cb);
 
 #endif // DOWNLOADER_H
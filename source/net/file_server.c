@@ -0,0 +1,732 @@
+// file_server.c - HTTP file server for pulling dumps and backups to a PC
+// Notes:
+// - Request parsing and small responses (headers, errors, listings) run on
+//   the network thread; file bodies are read by FILE_SERVER_READERS threads
+//   so a slow SD read never stalls other connections.
+// - Horizon's socket layer has no sendfile(); the closest equivalent is
+//   reading straight into an aligned buffer and queueing that buffer on the
+//   socket with net_loop_send_buffer(), which writes it without a copy.
+// - Lock order is s_lock, then the network loop's own lock; the loop never
+//   holds its lock while calling back here.
+
+#include "file_server.h"
+#include "net_loop.h"
+#include "link_lz4.h"
+#include "../logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <limits.h>
+#include <malloc.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+typedef struct FsClient {
+    u32 conn;
+    bool closed;                // connection gone, free once buffers are back
+    bool closing;               // last response queued, ignore further requests
+    bool keep_alive;            // of the request being answered
+    char req[FILE_SERVER_REQ_MAX];
+    size_t req_len;
+
+    // File body being produced
+    int fd;                     // >= 0 while a body is in progress
+    u64 pos, end;               // next offset to read, end of the range
+    bool lz4;                   // body goes out as chunked link_lz4 frames
+    bool reading;               // a reader thread is filling a buffer
+    bool queued;                // on the ready list
+    u8 *bufs[FILE_SERVER_BUFS];
+    bool busy[FILE_SERVER_BUFS]; // queued on the socket
+
+    struct FsClient *next_ready;
+    struct FsClient *next;
+} FsClient;
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_cond = PTHREAD_COND_INITIALIZER;
+static bool s_running = false;
+static bool s_stop = false;
+static u32 s_listener = 0;
+static char s_root[PATH_MAX];
+static char s_auth[160];        // expected Authorization value, "" for none
+static FsClient *s_clients = NULL;
+static int s_client_count = 0;
+static FsClient *s_ready_head = NULL, *s_ready_tail = NULL;
+static pthread_t s_readers[FILE_SERVER_READERS];
+
+// An LZ4 chunk is "xxxxxx\r\n" (fixed-width hex size), a frame, "\r\n"
+#define CHUNK_HEAD          8
+#define CHUNK_BUF_SIZE      (CHUNK_HEAD + LINK_LZ4_FRAME_BOUND(FILE_SERVER_CHUNK) + 2)
+#define LENGTH_CHUNKED      ((u64)-1)
+static int s_reader_count = 0;
+
+// ---------------------------------------------------------------------------
+// Helpers
+// ---------------------------------------------------------------------------
+
+static void base64_encode(const char *in, size_t len, char *out, size_t out_size) {
+    static const char tbl[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t o = 0;
+    for (size_t i = 0; i < len && o + 5 < out_size; i += 3) {
+        u32 v = (u32)(u8)in[i] << 16;
+        if (i + 1 < len) v |= (u32)(u8)in[i + 1] << 8;
+        if (i + 2 < len) v |= (u8)in[i + 2];
+        out[o++] = tbl[(v >> 18) & 63];
+        out[o++] = tbl[(v >> 12) & 63];
+        out[o++] = i + 1 < len ? tbl[(v >> 6) & 63] : '=';
+        out[o++] = i + 2 < len ? tbl[v & 63] : '=';
+    }
+    out[o] = '\0';
+}
+
+static int hex_value(char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+// Decode a request target's path (query dropped). Rejects "..", NUL bytes
+// and anything not starting with '/'.
+static int decode_path(const char *target, char *out, size_t out_size) {
+    if (target[0] != '/') return -1;
+    size_t o = 0;
+    for (const char *p = target; *p && *p != '?' && *p != '#'; p++) {
+        char ch = *p;
+        if (ch == '%') {
+            int hi = hex_value(p[1]), lo = hi >= 0 ? hex_value(p[2]) : -1;
+            if (lo < 0) return -1;
+            ch = (char)(hi * 16 + lo);
+            if (ch == '\0') return -1;
+            p += 2;
+        }
+        if (o + 1 >= out_size) return -1;
+        out[o++] = ch;
+    }
+    out[o] = '\0';
+    for (const char *seg = out; seg; seg = strchr(seg + 1, '/')) {
+        const char *s = seg + 1;
+        if (s[0] == '.' && s[1] == '.' && (s[2] == '/' || s[2] == '\0')) return -1;
+    }
+    return 0;
+}
+
+// Growable text buffer for directory listings
+typedef struct {
+    char *data;
+    size_t len, cap;
+} TextBuf;
+
+static int tb_append(TextBuf *tb, const char *s, size_t n) {
+    if (tb->len + n + 1 > tb->cap) {
+        size_t cap = tb->cap ? tb->cap : 4096;
+        while (cap < tb->len + n + 1) cap *= 2;
+        char *nb = realloc(tb->data, cap);
+        if (!nb) return -1;
+        tb->data = nb;
+        tb->cap = cap;
+    }
+    memcpy(tb->data + tb->len, s, n);
+    tb->len += n;
+    tb->data[tb->len] = '\0';
+    return 0;
+}
+
+static int tb_puts(TextBuf *tb, const char *s) {
+    return tb_append(tb, s, strlen(s));
+}
+
+static int tb_html(TextBuf *tb, const char *s) {
+    int rc = 0;
+    for (; *s && rc == 0; s++) {
+        switch (*s) {
+        case '&': rc = tb_puts(tb, "&amp;"); break;
+        case '<': rc = tb_puts(tb, "&lt;"); break;
+        case '>': rc = tb_puts(tb, "&gt;"); break;
+        case '"': rc = tb_puts(tb, "&quot;"); break;
+        default: rc = tb_append(tb, s, 1); break;
+        }
+    }
+    return rc;
+}
+
+static int tb_url(TextBuf *tb, const char *s) {
+    int rc = 0;
+    for (; *s && rc == 0; s++) {
+        unsigned char ch = (unsigned char)*s;
+        if ((ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') ||
+            strchr("-._~/", ch)) {
+            rc = tb_append(tb, s, 1);
+        } else {
+            char esc[4];
+            snprintf(esc, sizeof(esc), "%%%02X", ch);
+            rc = tb_append(tb, esc, 3);
+        }
+    }
+    return rc;
+}
+
+static void free_release(void *user, const void *data) {
+    (void)user;
+    free((void*)data);
+}
+
+// ---------------------------------------------------------------------------
+// Responses. Callers hold s_lock.
+// ---------------------------------------------------------------------------
+
+static void send_head(FsClient *cl, int status, const char *reason, const char *type,
+                      u64 length, const char *extra) {
+    char head[PATH_MAX + 512], length_line[48];
+    if (length == LENGTH_CHUNKED) snprintf(length_line, sizeof(length_line), "Transfer-Encoding: chunked");
+    else snprintf(length_line, sizeof(length_line), "Content-Length: %llu", (unsigned long long)length);
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.1 %d %s\r\n"
+                     "Server: dbfm\r\n"
+                     "Content-Type: %s\r\n"
+                     "%s\r\n"
+                     "Connection: %s\r\n"
+                     "%s\r\n",
+                     status, reason, type, length_line, cl->keep_alive ? "keep-alive" : "close", extra ? extra : "");
+    if (n < 0 || (size_t)n >= sizeof(head) || net_loop_send(cl->conn, head, (size_t)n) != 0) {
+        cl->keep_alive = false;
+        net_loop_cancel(cl->conn);
+    }
+}
+
+static void send_error(FsClient *cl, int status, const char *reason, const char *extra, bool head_only) {
+    char body[128];
+    int n = snprintf(body, sizeof(body), "%d %s\n", status, reason);
+    send_head(cl, status, reason, "text/plain", (u64)n, extra);
+    if (!head_only) net_loop_send(cl->conn, body, (size_t)n);
+}
+
+typedef struct {
+    char *name;
+    bool dir;
+    u64 size;
+} ListEntry;
+
+static int entry_cmp(const void *a, const void *b) {
+    const ListEntry *x = (const ListEntry*)a, *y = (const ListEntry*)b;
+    if (x->dir != y->dir) return x->dir ? -1 : 1;
+    return strcasecmp(x->name, y->name);
+}
+
+static void send_listing(FsClient *cl, const char *fs_path, const char *url_path, bool head_only) {
+    DIR *dir = opendir(fs_path);
+    if (!dir) { send_error(cl, 403, "Forbidden", NULL, head_only); return; }
+
+    ListEntry *entries = NULL;
+    size_t count = 0, cap = 0;
+    struct dirent *ent;
+    char path[PATH_MAX];
+    while ((ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+        if (count == cap) {
+            size_t ncap = cap ? cap * 2 : 64;
+            ListEntry *ne = realloc(entries, ncap * sizeof(*ne));
+            if (!ne) break;
+            entries = ne;
+            cap = ncap;
+        }
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", fs_path, ent->d_name);
+        if (stat(path, &st) != 0) continue;
+        if (!(entries[count].name = strdup(ent->d_name))) break;
+        entries[count].dir = S_ISDIR(st.st_mode);
+        entries[count].size = (u64)st.st_size;
+        count++;
+    }
+    closedir(dir);
+    qsort(entries, count, sizeof(*entries), entry_cmp);
+
+    TextBuf tb = {0};
+    int rc = tb_puts(&tb, "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>Index of ");
+    rc |= tb_html(&tb, url_path);
+    rc |= tb_puts(&tb, "</title></head><body><h1>Index of ");
+    rc |= tb_html(&tb, url_path);
+    rc |= tb_puts(&tb, "</h1><pre>\n");
+    if (strcmp(url_path, "/") != 0) rc |= tb_puts(&tb, "<a href=\"../\">../</a>\n");
+    for (size_t i = 0; i < count && rc == 0; i++) {
+        rc |= tb_puts(&tb, "<a href=\"");
+        rc |= tb_url(&tb, entries[i].name);
+        rc |= tb_puts(&tb, entries[i].dir ? "/\">" : "\">");
+        rc |= tb_html(&tb, entries[i].name);
+        if (entries[i].dir) {
+            rc |= tb_puts(&tb, "/</a>\n");
+        } else {
+            char size[32];
+            snprintf(size, sizeof(size), "</a>  %llu\n", (unsigned long long)entries[i].size);
+            rc |= tb_puts(&tb, size);
+        }
+    }
+    rc |= tb_puts(&tb, "</pre></body></html>\n");
+    for (size_t i = 0; i < count; i++) free(entries[i].name);
+    free(entries);
+
+    if (rc != 0) {
+        free(tb.data);
+        send_error(cl, 500, "Internal Server Error", NULL, head_only);
+        return;
+    }
+    send_head(cl, 200, "OK", "text/html; charset=utf-8", tb.len, NULL);
+    if (head_only || net_loop_send_buffer(cl->conn, tb.data, tb.len, free_release, NULL) != 0) free(tb.data);
+}
+
+// Parse a Range header value against 'size'. Returns 1 and the inclusive
+// range, 0 to serve the whole file (absent, malformed or multi-range), or
+// -1 if unsatisfiable.
+static int parse_range(const char *value, u64 size, u64 *first, u64 *last) {
+    if (!value || strncasecmp(value, "bytes=", 6) != 0) return 0;
+    const char *spec = value + 6;
+    if (strchr(spec, ',')) return 0;
+    char *end;
+    if (*spec == '-') {
+        unsigned long long n = strtoull(spec + 1, &end, 10);
+        if (end == spec + 1) return 0;
+        if (n == 0 || size == 0) return -1;
+        *first = n >= size ? 0 : size - n;
+        *last = size - 1;
+        return 1;
+    }
+    unsigned long long a = strtoull(spec, &end, 10);
+    if (end == spec || *end != '-') return 0;
+    const char *b_str = end + 1;
+    unsigned long long b = size ? size - 1 : 0;
+    if (*b_str) {
+        b = strtoull(b_str, &end, 10);
+        if (end == b_str || b < a) return 0;
+        if (b >= size) b = size - 1;
+    }
+    if (a >= size) return -1;
+    *first = a;
+    *last = b;
+    return 1;
+}
+
+static void enqueue(FsClient *cl);
+
+static void send_file(FsClient *cl, const char *fs_path, u64 size, const char *range, bool lz4, bool head_only) {
+    int fd = open(fs_path, O_RDONLY);
+    if (fd < 0) { send_error(cl, 403, "Forbidden", NULL, head_only); return; }
+
+    u64 first = 0, last = size ? size - 1 : 0;
+    int r = parse_range(range, size, &first, &last);
+    char extra[160];
+    if (r < 0) {
+        close(fd);
+        snprintf(extra, sizeof(extra), "Content-Range: bytes */%llu\r\n", (unsigned long long)size);
+        send_error(cl, 416, "Range Not Satisfiable", extra, head_only);
+        return;
+    }
+    u64 length = size ? last - first + 1 : 0;
+    if (r > 0) {
+        snprintf(extra, sizeof(extra), "Accept-Ranges: bytes\r\nContent-Range: bytes %llu-%llu/%llu\r\n",
+                 (unsigned long long)first, (unsigned long long)last, (unsigned long long)size);
+        send_head(cl, 206, "Partial Content", "application/octet-stream", length, extra);
+    } else {
+        lz4 = lz4 && length > 0;
+        send_head(cl, 200, "OK", "application/octet-stream", lz4 ? LENGTH_CHUNKED : length,
+                  lz4 ? "Accept-Ranges: bytes\r\nContent-Encoding: " LINK_LZ4_HTTP_CODING "\r\nVary: Accept-Encoding\r\n"
+                      : "Accept-Ranges: bytes\r\n");
+    }
+    if (head_only || length == 0) { close(fd); return; }
+
+    cl->fd = fd;
+    cl->lz4 = r == 0 && lz4;
+    cl->pos = first;
+    cl->end = first + length;
+    enqueue(cl);
+}
+
+// Copy header 'name' out of a request head, "" if absent
+static void header_value(const char *head, const char *name, char *out, size_t out_size) {
+    size_t nlen = strlen(name);
+    out[0] = '\0';
+    for (const char *line = strstr(head, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, name, nlen) == 0 && line[nlen] == ':') {
+            const char *v = line + nlen + 1;
+            while (*v == ' ' || *v == '\t') v++;
+            size_t len = strcspn(v, "\r\n");
+            while (len > 0 && (v[len - 1] == ' ' || v[len - 1] == '\t')) len--;
+            if (len >= out_size) len = out_size - 1;
+            memcpy(out, v, len);
+            out[len] = '\0';
+            return;
+        }
+    }
+}
+
+// Whether an Accept-Encoding value lists 'token' with a non-zero q
+static bool accepts_coding(const char *value, const char *token) {
+    size_t tl = strlen(token);
+    for (const char *p = value; *p; ) {
+        p += strspn(p, " \t,");
+        size_t len = strcspn(p, " \t;,");
+        if (len == tl && strncasecmp(p, token, tl) == 0) {
+            const char *params = p + len;
+            const char *end = params + strcspn(params, ",");
+            const char *q = strstr(params, "q=");
+            return !(q && q < end && strtod(q + 2, NULL) <= 0.0);
+        }
+        p += len;
+        p += strcspn(p, ",");
+    }
+    return false;
+}
+
+// Answer one complete request head
+static void handle_request(FsClient *cl, char *head) {
+    char method[8], target[2048], version[16];
+    if (sscanf(head, "%7s %2047s %15s", method, target, version) != 3 || strncmp(version, "HTTP/1.", 7) != 0) {
+        cl->keep_alive = false;
+        send_error(cl, 400, "Bad Request", NULL, false);
+        return;
+    }
+    char value[256];
+    header_value(head, "Connection", value, sizeof(value));
+    if (strcmp(version, "HTTP/1.0") == 0) cl->keep_alive = strcasecmp(value, "keep-alive") == 0;
+    else cl->keep_alive = strcasecmp(value, "close") != 0;
+
+    bool head_only = strcmp(method, "HEAD") == 0;
+    if (!head_only && strcmp(method, "GET") != 0) {
+        send_error(cl, 405, "Method Not Allowed", "Allow: GET, HEAD\r\n", false);
+        return;
+    }
+    if (s_auth[0]) {
+        header_value(head, "Authorization", value, sizeof(value));
+        if (strcmp(value, s_auth) != 0) {
+            send_error(cl, 401, "Unauthorized", "WWW-Authenticate: Basic realm=\"dbfm\"\r\n", head_only);
+            return;
+        }
+    }
+
+    char url_path[PATH_MAX], fs_path[PATH_MAX];
+    if (decode_path(target, url_path, sizeof(url_path)) != 0) {
+        send_error(cl, 400, "Bad Request", NULL, head_only);
+        return;
+    }
+    if ((size_t)snprintf(fs_path, sizeof(fs_path), "%s%s", s_root, url_path) >= sizeof(fs_path)) {
+        send_error(cl, 414, "URI Too Long", NULL, head_only);
+        return;
+    }
+    size_t fl = strlen(fs_path);
+    while (fl > 1 && fs_path[fl - 1] == '/' && fs_path[fl - 2] != ':') fs_path[--fl] = '\0';
+
+    struct stat st;
+    if (stat(fs_path, &st) != 0) {
+        send_error(cl, 404, "Not Found", NULL, head_only);
+        return;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        size_t ul = strlen(url_path);
+        if (url_path[ul - 1] != '/') {
+            // Relative links in the listing need the trailing slash
+            char extra[PATH_MAX + 32];
+            size_t tl = strcspn(target, "?#");
+            snprintf(extra, sizeof(extra), "Location: %.*s/\r\n", (int)tl, target);
+            send_error(cl, 301, "Moved Permanently", extra, head_only);
+            return;
+        }
+        send_listing(cl, fs_path, url_path, head_only);
+        return;
+    }
+    // LZ4 frames need chunked encoding (HTTP/1.1) and a whole-file body
+    char coding[256];
+    header_value(head, "Accept-Encoding", coding, sizeof(coding));
+    bool lz4 = link_lz4_available() && strcmp(version, "HTTP/1.0") != 0 && accepts_coding(coding, LINK_LZ4_HTTP_CODING);
+    header_value(head, "Range", value, sizeof(value));
+    send_file(cl, fs_path, (u64)st.st_size, value[0] ? value : NULL, lz4, head_only);
+}
+
+// Answer buffered requests until a file body is in progress. Caller holds s_lock.
+static void process_requests(FsClient *cl) {
+    while (!cl->closed && !cl->closing && cl->fd < 0) {
+        char *end = NULL;
+        for (size_t i = 3; i < cl->req_len; i++) {
+            if (memcmp(cl->req + i - 3, "\r\n\r\n", 4) == 0) { end = cl->req + i + 1; break; }
+        }
+        if (!end) {
+            if (cl->req_len >= sizeof(cl->req) - 1) {
+                cl->keep_alive = false;
+                send_error(cl, 431, "Request Header Fields Too Large", NULL, false);
+                cl->closing = true;
+                net_loop_close(cl->conn);
+            }
+            return;
+        }
+        char saved = *end;
+        *end = '\0';
+        handle_request(cl, cl->req);
+        *end = saved;
+        size_t used = (size_t)(end - cl->req);
+        memmove(cl->req, end, cl->req_len - used);
+        cl->req_len -= used;
+        if (!cl->keep_alive) {
+            cl->closing = true;
+            // With a body in progress the reader closes once it is queued
+            if (cl->fd < 0) net_loop_close(cl->conn);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Body production
+// ---------------------------------------------------------------------------
+
+// Free a client whose connection is gone once nothing references it.
+// Caller holds s_lock.
+static void client_release(FsClient *cl) {
+    if (!cl->closed || cl->reading || cl->queued) return;
+    for (int i = 0; i < FILE_SERVER_BUFS; i++) if (cl->busy[i]) return;
+    for (FsClient **pp = &s_clients; *pp; pp = &(*pp)->next) {
+        if (*pp == cl) { *pp = cl->next; break; }
+    }
+    s_client_count--;
+    if (cl->fd >= 0) close(cl->fd);
+    for (int i = 0; i < FILE_SERVER_BUFS; i++) free(cl->bufs[i]);
+    free(cl);
+}
+
+static int free_slot(const FsClient *cl) {
+    for (int i = 0; i < FILE_SERVER_BUFS; i++) if (!cl->busy[i]) return i;
+    return -1;
+}
+
+// Put a client on the ready list if it can use a reader. Caller holds s_lock.
+static void enqueue(FsClient *cl) {
+    if (cl->queued || cl->reading || cl->closed || cl->fd < 0 || free_slot(cl) < 0 || s_stop) return;
+    cl->queued = true;
+    cl->next_ready = NULL;
+    if (s_ready_tail) s_ready_tail->next_ready = cl;
+    else s_ready_head = cl;
+    s_ready_tail = cl;
+    pthread_cond_signal(&s_cond);
+}
+
+static void body_end(FsClient *cl) {
+    if (cl->fd >= 0) close(cl->fd);
+    cl->fd = -1;
+}
+
+// A chunk has been written to the socket (or the connection dropped it)
+static void buffer_released(void *user, const void *data) {
+    FsClient *cl = (FsClient*)user;
+    pthread_mutex_lock(&s_lock);
+    for (int i = 0; i < FILE_SERVER_BUFS; i++) {
+        if (cl->bufs[i] == data) cl->busy[i] = false;
+    }
+    if (cl->closed) client_release(cl);
+    else enqueue(cl);
+    pthread_mutex_unlock(&s_lock);
+}
+
+static ssize_t read_at(int fd, u64 offset, u8 *buf, size_t len) {
+    if (lseek(fd, (off_t)offset, SEEK_SET) < 0) return -1;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, buf + done, len - done);
+        if (n < 0) return -1;
+        if (n == 0) break;
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+static void *reader_thread(void *arg) {
+    (void)arg;
+    u8 *raw = NULL;             // read buffer for LZ4 bodies, allocated on first use
+    pthread_mutex_lock(&s_lock);
+    for (;;) {
+        while (!s_stop && !s_ready_head) pthread_cond_wait(&s_cond, &s_lock);
+        if (s_stop) break;
+        FsClient *cl = s_ready_head;
+        s_ready_head = cl->next_ready;
+        if (!s_ready_head) s_ready_tail = NULL;
+        cl->queued = false;
+
+        int slot = free_slot(cl);
+        if (cl->closed || cl->fd < 0 || slot < 0) { client_release(cl); continue; }
+        if (!cl->bufs[slot] && !(cl->bufs[slot] = (u8*)memalign(0x1000, CHUNK_BUF_SIZE))) {
+            log_event(LOG_ERROR, "file_server: out of memory");
+            body_end(cl);
+            net_loop_cancel(cl->conn);
+            continue;
+        }
+        // Reads stay aligned to the chunk size; only the first of an
+        // unaligned range is shorter
+        u64 off = cl->pos;
+        u64 want = FILE_SERVER_CHUNK - off % FILE_SERVER_CHUNK;
+        if (want > cl->end - off) want = cl->end - off;
+        int fd = cl->fd;
+        u8 *buf = cl->bufs[slot];
+        bool lz4 = cl->lz4;
+        cl->reading = true;
+        pthread_mutex_unlock(&s_lock);
+
+        ssize_t n = -1;
+        size_t out_len = 0;
+        if (!lz4) {
+            n = read_at(fd, off, buf, (size_t)want);
+            out_len = n > 0 ? (size_t)n : 0;
+        } else if (raw || (raw = (u8*)memalign(0x1000, FILE_SERVER_CHUNK))) {
+            // Read into the thread's scratch, frame into the client's buffer
+            n = read_at(fd, off, raw, (size_t)want);
+            if (n > 0) {
+                size_t frame = link_lz4_encode(raw, (size_t)n, buf + CHUNK_HEAD);
+                char size_line[CHUNK_HEAD + 1];
+                snprintf(size_line, sizeof(size_line), "%06zx\r\n", frame);
+                memcpy(buf, size_line, CHUNK_HEAD);
+                memcpy(buf + CHUNK_HEAD + frame, "\r\n", 2);
+                out_len = CHUNK_HEAD + frame + 2;
+            }
+        }
+
+        pthread_mutex_lock(&s_lock);
+        cl->reading = false;
+        if (cl->closed) { client_release(cl); continue; }
+        cl->busy[slot] = true;
+        if (n <= 0 || net_loop_send_buffer(cl->conn, buf, out_len, buffer_released, cl) != 0) {
+            // The length is already promised; all that is left is to drop the connection
+            cl->busy[slot] = false;
+            if (n <= 0) log_event(LOG_ERROR, "file_server: read failed at offset %llu", (unsigned long long)off);
+            body_end(cl);
+            net_loop_cancel(cl->conn);
+            continue;
+        }
+        cl->pos += (u64)n;
+        if (cl->pos < cl->end) { enqueue(cl); continue; }
+        if (lz4) net_loop_send(cl->conn, "0\r\n\r\n", 5);
+        body_end(cl);
+        if (cl->closing) net_loop_close(cl->conn);
+        else process_requests(cl);
+    }
+    pthread_mutex_unlock(&s_lock);
+    free(raw);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Connection callbacks (network thread)
+// ---------------------------------------------------------------------------
+
+static int on_data(void *user, u32 conn, const char *data, size_t len) {
+    (void)conn;
+    FsClient *cl = (FsClient*)user;
+    pthread_mutex_lock(&s_lock);
+    size_t room = sizeof(cl->req) - 1 - cl->req_len;
+    if (len > room) len = room;
+    memcpy(cl->req + cl->req_len, data, len);
+    cl->req_len += len;
+    process_requests(cl);
+    pthread_mutex_unlock(&s_lock);
+    return 0;
+}
+
+static void on_close(void *user, u32 conn) {
+    (void)conn;
+    FsClient *cl = (FsClient*)user;
+    pthread_mutex_lock(&s_lock);
+    cl->closed = true;
+    client_release(cl);
+    pthread_mutex_unlock(&s_lock);
+}
+
+static int on_accept(void *user, u32 conn, NetStreamHandlers *handlers, void **conn_user) {
+    (void)user;
+    pthread_mutex_lock(&s_lock);
+    FsClient *cl = NULL;
+    if (!s_stop && s_client_count < FILE_SERVER_MAX_CLIENTS) cl = calloc(1, sizeof(*cl));
+    if (cl) {
+        cl->conn = conn;
+        cl->fd = -1;
+        cl->next = s_clients;
+        s_clients = cl;
+        s_client_count++;
+    }
+    pthread_mutex_unlock(&s_lock);
+    if (!cl) return -1;
+    handlers->on_data = on_data;
+    handlers->on_drain = NULL;
+    handlers->on_close = on_close;
+    *conn_user = cl;
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// API
+// ---------------------------------------------------------------------------
+
+int file_server_start(u16 port, bool allow_remote, const char *root,
+                      const char *username, const char *password) {
+    if (!root || !root[0]) return -1;
+    pthread_mutex_lock(&s_lock);
+    if (s_running) { pthread_mutex_unlock(&s_lock); return 0; }
+    // "sdmc:/" and "sdmc:/dumps/" become "sdmc:" and "sdmc:/dumps"; request
+    // paths supply the leading slash
+    snprintf(s_root, sizeof(s_root), "%s", root);
+    size_t rl = strlen(s_root);
+    while (rl > 0 && s_root[rl - 1] == '/') s_root[--rl] = '\0';
+    s_auth[0] = '\0';
+    if (username && username[0]) {
+        char cred[128];
+        int n = snprintf(cred, sizeof(cred), "%s:%s", username, password ? password : "");
+        strcpy(s_auth, "Basic ");
+        base64_encode(cred, (size_t)n < sizeof(cred) ? (size_t)n : sizeof(cred) - 1,
+                      s_auth + 6, sizeof(s_auth) - 6);
+    }
+    s_stop = false;
+    pthread_mutex_unlock(&s_lock);
+
+    if (net_loop_start() != 0) return -1;
+    s_reader_count = 0;
+    for (int i = 0; i < FILE_SERVER_READERS; i++) {
+        if (pthread_create(&s_readers[i], NULL, reader_thread, NULL) != 0) break;
+        s_reader_count++;
+    }
+    if (s_reader_count == 0) return -1;
+    s_listener = net_loop_listen(port, allow_remote, on_accept, NULL);
+    if (!s_listener) {
+        log_event(LOG_ERROR, "file_server: cannot listen on port %u", port);
+        file_server_stop();
+        return -1;
+    }
+    s_running = true;
+    log_event(LOG_INFO, "file_server: serving %s on port %u", root, port);
+    return 0;
+}
+
+void file_server_stop(void) {
+    pthread_mutex_lock(&s_lock);
+    s_stop = true;
+    if (s_listener) net_loop_cancel(s_listener);
+    s_listener = 0;
+    for (FsClient *cl = s_clients; cl; cl = cl->next) net_loop_cancel(cl->conn);
+    pthread_cond_broadcast(&s_cond);
+    pthread_mutex_unlock(&s_lock);
+
+    for (int i = 0; i < s_reader_count; i++) pthread_join(s_readers[i], NULL);
+    s_reader_count = 0;
+
+    // Clients left on the ready list are freed as their connections close
+    pthread_mutex_lock(&s_lock);
+    while (s_ready_head) {
+        FsClient *cl = s_ready_head;
+        s_ready_head = cl->next_ready;
+        cl->queued = false;
+        client_release(cl);
+    }
+    s_ready_tail = NULL;
+    s_running = false;
+    pthread_mutex_unlock(&s_lock);
+}
+
+bool file_server_running(void) {
+    return s_running;
+}
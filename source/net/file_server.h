@@ -0,0 +1,37 @@
+// file_server.h - HTTP file server for pulling dumps and backups to a PC
+#ifndef FILE_SERVER_H
+#define FILE_SERVER_H
+
+#include <switch.h>
+#include <stdbool.h>
+
+// Serves a directory tree over HTTP/1.1 on the shared network thread
+// (net_loop.c): GET and HEAD, single-range Range requests (206/416),
+// keep-alive, optional Basic auth and HTML directory listings.
+//
+// File bodies never pass through the network thread's copy buffers. A small
+// pool of reader threads fills per-client aligned buffers with large reads
+// and hands them to the socket as they are; each client owns at most
+// FILE_SERVER_BUFS of them, so one reader is always a buffer ahead of the
+// link without memory growing with the file or the number of clients.
+//
+// An HTTP/1.1 GET without a Range whose Accept-Encoding lists
+// "x-lz4-frames" gets the file as link_lz4 frames (one per chunk) with
+// Content-Encoding: x-lz4-frames and chunked transfer encoding. Chunks that
+// do not compress go out stored, so game data costs no extra CPU.
+
+#define FILE_SERVER_MAX_CLIENTS   16
+#define FILE_SERVER_READERS       2
+#define FILE_SERVER_CHUNK         (512 * 1024)   // read size, reads stay aligned to it
+#define FILE_SERVER_BUFS          2              // in-flight chunks per client
+#define FILE_SERVER_REQ_MAX       (8 * 1024)     // request head limit
+
+// Start serving 'root' (e.g. "sdmc:/") on 'port'. Starts the network thread
+// if needed. username may be NULL or empty for no authentication.
+int file_server_start(u16 port, bool allow_remote, const char *root,
+                      const char *username, const char *password);
+// Close the listener and every client connection
+void file_server_stop(void);
+bool file_server_running(void);
+
+#endif // FILE_SERVER_H
@@ -0,0 +1,322 @@
+/* http_cache.c - conditional-GET cache for repository indexes and assets.
+ *
+ * Bodies live on the SD card next to a small text meta file. Stale entries
+ * are revalidated with the stored ETag/Last-Modified; a 304 only refreshes
+ * the expiry. When the network is down a stale copy is still returned so the
+ * store can be browsed offline.
+ */
+
+#include "http_cache.h"
+#include "simple_http.h"
+#include "downloader.h"
+#include "tls_conn.h"
+#include "../logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef USE_LIBCURL
+#include <curl/curl.h>
+#endif
+
+typedef struct {
+    char url[1024];
+    char etag[128];
+    char last_modified[64];
+    long long expires;        // unix time after which the entry must be revalidated
+    long long size;           // body size, to detect a body/meta mismatch
+} CacheMeta;
+
+// Result of one conditional request
+typedef struct {
+    SimpleHttpResponse resp;
+    char *buf;
+    size_t len, cap;
+} CacheFetch;
+
+static uint64_t url_hash(const char *url) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (const unsigned char *p = (const unsigned char*)url; *p; p++) {
+        h ^= *p;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+static void entry_paths(const char *url, const char *cache_dir, char *body, char *meta, size_t size) {
+    unsigned long long h = (unsigned long long)url_hash(url);
+    snprintf(body, size, "%s/%016llx.body", cache_dir, h);
+    snprintf(meta, size, "%s/%016llx.meta", cache_dir, h);
+}
+
+static int meta_load(const char *path, const char *url, CacheMeta *m) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    memset(m, 0, sizeof(*m));
+    char line[1200];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *value = strchr(line, ' ');
+        if (!value) continue;
+        *value++ = '\0';
+        if (strcmp(line, "url") == 0) snprintf(m->url, sizeof(m->url), "%s", value);
+        else if (strcmp(line, "etag") == 0) snprintf(m->etag, sizeof(m->etag), "%s", value);
+        else if (strcmp(line, "last_modified") == 0) snprintf(m->last_modified, sizeof(m->last_modified), "%s", value);
+        else if (strcmp(line, "expires") == 0) m->expires = atoll(value);
+        else if (strcmp(line, "size") == 0) m->size = atoll(value);
+    }
+    fclose(f);
+    // Two URLs can share a hash; the stored URL settles it
+    return strcmp(m->url, url) == 0 ? 0 : -1;
+}
+
+// Write to a temp file and move it into place. FAT does not replace on
+// rename, so the old file is removed first.
+static int write_file_atomic(const char *path, const void *data, size_t len) {
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return -1;
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return -1;
+    bool ok = fwrite(data, 1, len, f) == len;
+    if (fclose(f) != 0) ok = false;
+    if (!ok) { remove(tmp); return -1; }
+    remove(path);
+    return rename(tmp, path) == 0 ? 0 : -1;
+}
+
+static int meta_save(const char *path, const CacheMeta *m) {
+    char text[1400];
+    int n = snprintf(text, sizeof(text), "url %s\netag %s\nlast_modified %s\nexpires %lld\nsize %lld\n",
+                     m->url, m->etag, m->last_modified, m->expires, m->size);
+    if (n < 0 || (size_t)n >= sizeof(text)) return -1;
+    return write_file_atomic(path, text, (size_t)n);
+}
+
+static int body_load(const char *path, long long expected, char **out_buf, size_t *out_len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0 || (long long)st.st_size != expected) { fclose(f); return -1; }
+    char *buf = malloc((size_t)st.st_size + 1);
+    if (!buf) { fclose(f); return -1; }
+    if (fread(buf, 1, (size_t)st.st_size, f) != (size_t)st.st_size) { free(buf); fclose(f); return -1; }
+    fclose(f);
+    buf[st.st_size] = '\0';
+    *out_buf = buf;
+    *out_len = (size_t)st.st_size;
+    return 0;
+}
+
+static void mkdir_all(const char *dir) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s", dir);
+    // Start after the device prefix ("sdmc:/") when there is one
+    char *p = strchr(tmp, ':');
+    p = p ? p + 2 : tmp + 1;
+    for (; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        mkdir(tmp, 0777);
+        *p = '/';
+    }
+    mkdir(tmp, 0777);
+}
+
+// ---------------------------------------------------------------------------
+// Conditional request
+// ---------------------------------------------------------------------------
+
+static int fetch_append(CacheFetch *c, const char *data, size_t len) {
+    if (c->len + len + 1 > c->cap) {
+        size_t nc = c->cap ? c->cap : 16384;
+        while (c->len + len + 1 > nc) nc *= 2;
+        char *nb = realloc(c->buf, nc);
+        if (!nb) return -1;
+        c->buf = nb; c->cap = nc;
+    }
+    memcpy(c->buf + c->len, data, len);
+    c->len += len;
+    return 0;
+}
+
+#ifdef USE_LIBCURL
+static size_t fetch_curl_header_cb(char *buffer, size_t size, size_t nitems, void *userdata) {
+    CacheFetch *c = (CacheFetch*)userdata;
+    size_t len = size * nitems;
+    char line[512];
+    size_t n = len < sizeof(line) - 1 ? len : sizeof(line) - 1;
+    memcpy(line, buffer, n); line[n] = '\0';
+    line[strcspn(line, "\r\n")] = '\0';
+    if (strncmp(line, "HTTP/", 5) == 0) {
+        // every redirect hop starts a new head
+        memset(&c->resp, 0, sizeof(c->resp));
+        sscanf(line, "HTTP/%*s %d", &c->resp.status);
+        return len;
+    }
+    char *value = strchr(line, ':');
+    if (!value) return len;
+    *value++ = '\0';
+    while (*value == ' ' || *value == '\t') value++;
+    if (strcasecmp(line, "ETag") == 0) snprintf(c->resp.etag, sizeof(c->resp.etag), "%s", value);
+    else if (strcasecmp(line, "Last-Modified") == 0) snprintf(c->resp.last_modified, sizeof(c->resp.last_modified), "%s", value);
+    return len;
+}
+
+static size_t fetch_curl_write_cb(void *ptr, size_t size, size_t nmemb, void *userdata) {
+    size_t realsize = size * nmemb;
+    return fetch_append((CacheFetch*)userdata, ptr, realsize) == 0 ? realsize : 0;
+}
+#else
+static int fetch_head_cb(void *user, const SimpleHttpResponse *resp) {
+    ((CacheFetch*)user)->resp = *resp;
+    return 0;
+}
+
+static int fetch_body_cb(void *user, const char *data, size_t len) {
+    return fetch_append((CacheFetch*)user, data, len);
+}
+#endif
+
+// GET url with the validators from m (if any). Returns 0 when a response
+// arrived, whatever its status.
+static int fetch_conditional(const char *url, const CacheMeta *m, CacheFetch *c) {
+    char etag_hdr[160] = "", lm_hdr[96] = "";
+    if (m && m->etag[0]) snprintf(etag_hdr, sizeof(etag_hdr), "If-None-Match: %s", m->etag);
+    if (m && m->last_modified[0]) snprintf(lm_hdr, sizeof(lm_hdr), "If-Modified-Since: %s", m->last_modified);
+#ifdef USE_LIBCURL
+    CURL *curl = curl_easy_init();
+    if (!curl) return -1;
+    struct curl_slist *headers = NULL;
+    if (etag_hdr[0]) headers = curl_slist_append(headers, etag_hdr);
+    if (lm_hdr[0]) headers = curl_slist_append(headers, lm_hdr);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "DBFM/1.0");
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, ""); // any encoding libcurl can decode
+    if (headers) curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, fetch_curl_header_cb);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, c);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, fetch_curl_write_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, c);
+    CURLcode res = curl_easy_perform(curl);
+    curl_easy_cleanup(curl);
+    curl_slist_free_all(headers);
+    return res == CURLE_OK ? 0 : -1;
+#else
+    if (strncmp(url, "http://", 7) != 0 && !tls_available()) return -1; // HTTPS needs libcurl or mbedTLS
+    char extra[300];
+    snprintf(extra, sizeof(extra), "%s%s%s%s", etag_hdr, etag_hdr[0] ? "\r\n" : "", lm_hdr, lm_hdr[0] ? "\r\n" : "");
+    return simple_http_get_stream_ex(url, extra, fetch_head_cb, fetch_body_cb, c);
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Public API
+// ---------------------------------------------------------------------------
+
+int http_cache_get(const char *url, const char *cache_dir, unsigned int max_age_s,
+                   char **out_buf, size_t *out_len, HttpCacheOutcome *out_outcome) {
+    if (!url || !out_buf || !out_len) return -1;
+    if (out_outcome) *out_outcome = HTTP_CACHE_MISS;
+    bool cacheable = cache_dir && cache_dir[0] &&
+                     (strncmp(url, "http://", 7) == 0 || strncmp(url, "https://", 8) == 0);
+    if (!cacheable) {
+        // Local paths and romfs: are already on the console
+        return download_url_to_memory(url, out_buf, out_len);
+    }
+
+    char body_path[PATH_MAX], meta_path[PATH_MAX];
+    entry_paths(url, cache_dir, body_path, meta_path, sizeof(body_path));
+
+    CacheMeta meta;
+    char *cached = NULL; size_t cached_len = 0;
+    bool have = meta_load(meta_path, url, &meta) == 0 && body_load(body_path, meta.size, &cached, &cached_len) == 0;
+    long long now = (long long)time(NULL);
+
+    if (have && now < meta.expires) {
+        *out_buf = cached; *out_len = cached_len;
+        if (out_outcome) *out_outcome = HTTP_CACHE_FRESH;
+        return 0;
+    }
+
+    CacheFetch c; memset(&c, 0, sizeof(c));
+    int rc = fetch_conditional(url, have ? &meta : NULL, &c);
+
+    if (rc == 0 && c.resp.status == 304 && have) {
+        meta.expires = now + max_age_s;
+        // A 304 may carry updated validators
+        if (c.resp.etag[0]) snprintf(meta.etag, sizeof(meta.etag), "%s", c.resp.etag);
+        if (c.resp.last_modified[0]) snprintf(meta.last_modified, sizeof(meta.last_modified), "%s", c.resp.last_modified);
+        meta_save(meta_path, &meta);
+        free(c.buf);
+        *out_buf = cached; *out_len = cached_len;
+        if (out_outcome) *out_outcome = HTTP_CACHE_REVALIDATED;
+        return 0;
+    }
+
+    if (rc == 0 && c.resp.status == 200) {
+        free(cached);
+        if (!c.buf && fetch_append(&c, "", 0) != 0) return -1;
+        c.buf[c.len] = '\0';
+
+        mkdir_all(cache_dir);
+        memset(&meta, 0, sizeof(meta));
+        snprintf(meta.url, sizeof(meta.url), "%s", url);
+        snprintf(meta.etag, sizeof(meta.etag), "%s", c.resp.etag);
+        snprintf(meta.last_modified, sizeof(meta.last_modified), "%s", c.resp.last_modified);
+        meta.expires = now + max_age_s;
+        meta.size = (long long)c.len;
+        // Body first: a meta file never describes a body that is not there
+        if (write_file_atomic(body_path, c.buf, c.len) != 0 || meta_save(meta_path, &meta) != 0) {
+            log_event(LOG_WARN, "http_cache: could not store %s", url);
+            remove(meta_path);
+        }
+        *out_buf = c.buf; *out_len = c.len;
+        return 0;
+    }
+
+    free(c.buf);
+    if (have) {
+        log_event(LOG_WARN, "http_cache: %s unavailable (status %d), using cached copy", url, c.resp.status);
+        *out_buf = cached; *out_len = cached_len;
+        if (out_outcome) *out_outcome = HTTP_CACHE_STALE;
+        return 0;
+    }
+    return -1;
+}
+
+int http_cache_invalidate(const char *url, const char *cache_dir) {
+    if (!url || !cache_dir) return -1;
+    char body_path[PATH_MAX], meta_path[PATH_MAX];
+    entry_paths(url, cache_dir, body_path, meta_path, sizeof(body_path));
+    int rc = remove(meta_path);
+    remove(body_path);
+    return rc == 0 ? 0 : -1;
+}
+
+int http_cache_clear(const char *cache_dir) {
+    if (!cache_dir) return 0;
+    DIR *d = opendir(cache_dir);
+    if (!d) return 0;
+    int removed = 0;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        size_t n = strlen(ent->d_name);
+        bool ours = (n > 5 && strcmp(ent->d_name + n - 5, ".body") == 0) ||
+                    (n > 5 && strcmp(ent->d_name + n - 5, ".meta") == 0) ||
+                    (n > 4 && strcmp(ent->d_name + n - 4, ".tmp") == 0);
+        if (!ours) continue;
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, ent->d_name);
+        if (remove(path) == 0) removed++;
+    }
+    closedir(d);
+    return removed;
+}
@@ -0,0 +1,37 @@
+// http_cache.h - on-SD cache for small HTTP resources (repo indexes, icons)
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Each URL is stored as two files in the cache directory, named after a
+// 64-bit FNV-1a hash of the URL:
+//   <hash>.body   the response body
+//   <hash>.meta   url, ETag, Last-Modified, expiry time and body size
+// A fresh entry is served without touching the network. A stale one is
+// revalidated with If-None-Match / If-Modified-Since, so an unchanged
+// resource costs a 304 and no body transfer.
+
+// Result of http_cache_get(), for logging and UI status
+typedef enum {
+    HTTP_CACHE_MISS = 0,      // fetched in full from the server
+    HTTP_CACHE_FRESH,         // served from disk, no request made
+    HTTP_CACHE_REVALIDATED,   // server answered 304 Not Modified
+    HTTP_CACHE_STALE,         // server unreachable, stale copy served
+} HttpCacheOutcome;
+
+// Fetch url into a NUL-terminated buffer (caller frees *out_buf), going
+// through the cache in cache_dir. Entries younger than max_age_s seconds are
+// used as-is; 0 always revalidates. Non-http(s) URLs bypass the cache.
+// out_outcome may be NULL. Returns 0 on success, -1 on failure.
+int http_cache_get(const char *url, const char *cache_dir, unsigned int max_age_s,
+                   char **out_buf, size_t *out_len, HttpCacheOutcome *out_outcome);
+
+// Drop the cached copy of one URL. Returns 0 if it was removed.
+int http_cache_invalidate(const char *url, const char *cache_dir);
+
+// Remove every cache entry in cache_dir. Returns the number of files removed.
+int http_cache_clear(const char *cache_dir);
+
+#endif // HTTP_CACHE_H
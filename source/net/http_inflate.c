@@ -0,0 +1,161 @@
+// http_inflate.c - streaming gzip/deflate decoding of HTTP bodies
+// Notes:
+// - "deflate" is meant to be zlib-wrapped (RFC 9110) but some servers send a
+//   raw deflate stream; the first two bytes decide which one it is.
+// - A gzip body may hold several members back to back; each is inflated in
+//   turn.
+
+#include "http_inflate.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+HttpCoding http_coding_parse(const char *value) {
+    if (!value) return HTTP_CODING_IDENTITY;
+    while (*value == ' ' || *value == '\t') value++;
+    size_t len = strcspn(value, " \t,;");
+    if (len == 0 || (len == 8 && strncasecmp(value, "identity", 8) == 0)) return HTTP_CODING_IDENTITY;
+    if ((len == 4 && strncasecmp(value, "gzip", 4) == 0) || (len == 6 && strncasecmp(value, "x-gzip", 6) == 0))
+        return HTTP_CODING_GZIP;
+    if (len == 7 && strncasecmp(value, "deflate", 7) == 0) return HTTP_CODING_DEFLATE;
+    return HTTP_CODING_UNSUPPORTED;
+}
+
+#ifdef USE_ZLIB
+
+struct HttpInflate {
+    z_stream zs;
+    HttpCoding coding;
+    bool started;               // inflateInit2 done
+    bool ended;                 // saw Z_STREAM_END of the last member
+    bool fed;                   // any compressed bytes arrived
+    unsigned char head[2];      // deflate: bytes held back until the wrapper is known
+    size_t head_len;
+    simple_http_body_cb sink;
+    void *user;
+    unsigned char out[HTTP_INFLATE_OUT_SIZE];
+};
+
+const char *http_accept_encoding(void) {
+    return "Accept-Encoding: gzip, deflate\r\n";
+}
+
+HttpInflate *http_inflate_create(HttpCoding coding, simple_http_body_cb sink, void *user) {
+    if (coding != HTTP_CODING_GZIP && coding != HTTP_CODING_DEFLATE) return NULL;
+    HttpInflate *z = calloc(1, sizeof(*z));
+    if (!z) return NULL;
+    z->coding = coding;
+    z->sink = sink;
+    z->user = user;
+    if (coding == HTTP_CODING_GZIP) {
+        if (inflateInit2(&z->zs, 15 + 16) != Z_OK) { free(z); return NULL; }
+        z->started = true;
+    }
+    return z;
+}
+
+// After a gzip member ended: restart if 'first' begins another one
+static int next_member(HttpInflate *z, unsigned char first) {
+    if (z->coding != HTTP_CODING_GZIP || first != 0x1f) return 0;
+    if (inflateReset(&z->zs) != Z_OK) return -1;
+    z->ended = false;
+    return 0;
+}
+
+// Run the decoder over 'len' input bytes, handing every filled output buffer
+// to the sink
+static int inflate_run(HttpInflate *z, const unsigned char *data, size_t len) {
+    z->zs.next_in = (Bytef*)data;
+    z->zs.avail_in = (uInt)len;
+    while (z->zs.avail_in > 0 && !z->ended) {
+        z->zs.next_out = z->out;
+        z->zs.avail_out = sizeof(z->out);
+        int zr = inflate(&z->zs, Z_NO_FLUSH);
+        if (zr != Z_OK && zr != Z_STREAM_END && zr != Z_BUF_ERROR) return -1;
+        size_t produced = sizeof(z->out) - z->zs.avail_out;
+        if (produced && z->sink && z->sink(z->user, (const char*)z->out, produced) != 0) return -1;
+        if (zr == Z_STREAM_END) {
+            z->ended = true;
+            // Another gzip member may follow; other trailing bytes are ignored
+            if (z->zs.avail_in > 0 && next_member(z, z->zs.next_in[0]) != 0) return -1;
+        } else if (zr == Z_BUF_ERROR && produced == 0) {
+            break; // needs more input
+        }
+    }
+    // Output still buffered inside zlib when the input ran out
+    while (!z->ended) {
+        z->zs.next_out = z->out;
+        z->zs.avail_out = sizeof(z->out);
+        int zr = inflate(&z->zs, Z_NO_FLUSH);
+        if (zr != Z_OK && zr != Z_STREAM_END && zr != Z_BUF_ERROR) return -1;
+        size_t produced = sizeof(z->out) - z->zs.avail_out;
+        if (produced && z->sink && z->sink(z->user, (const char*)z->out, produced) != 0) return -1;
+        if (zr == Z_STREAM_END) z->ended = true;
+        if (produced < sizeof(z->out)) break;
+    }
+    return 0;
+}
+
+int http_inflate_body_cb(void *user, const char *data, size_t len) {
+    HttpInflate *z = (HttpInflate*)user;
+    const unsigned char *p = (const unsigned char*)data;
+    if (len > 0) z->fed = true;
+    if (!z->started) {
+        // Hold back bytes until the two-byte zlib header can be checked
+        while (z->head_len < 2 && len > 0) { z->head[z->head_len++] = *p++; len--; }
+        if (z->head_len < 2) return 0;
+        bool zlib_wrapped = (z->head[0] & 0x0f) == 8 && ((z->head[0] << 8) | z->head[1]) % 31 == 0;
+        if (inflateInit2(&z->zs, zlib_wrapped ? 15 : -15) != Z_OK) return -1;
+        z->started = true;
+        if (inflate_run(z, z->head, z->head_len) != 0) return -1;
+    }
+    if (len == 0) return 0;
+    if (z->ended && next_member(z, p[0]) != 0) return -1;
+    if (z->ended) return 0;
+    return inflate_run(z, p, len);
+}
+
+int http_inflate_finish(HttpInflate *z) {
+    if (!z) return -1;
+    // An empty body is a valid (empty) response
+    if (!z->fed) return 0;
+    return z->ended ? 0 : -1;
+}
+
+void http_inflate_destroy(HttpInflate *z) {
+    if (!z) return;
+    if (z->started) inflateEnd(&z->zs);
+    free(z);
+}
+
+#else // !USE_ZLIB
+
+struct HttpInflate { int unused; };
+
+const char *http_accept_encoding(void) {
+    return "";
+}
+
+HttpInflate *http_inflate_create(HttpCoding coding, simple_http_body_cb sink, void *user) {
+    (void)coding; (void)sink; (void)user;
+    return NULL;
+}
+
+int http_inflate_body_cb(void *user, const char *data, size_t len) {
+    (void)user; (void)data; (void)len;
+    return -1;
+}
+
+int http_inflate_finish(HttpInflate *z) {
+    (void)z;
+    return -1;
+}
+
+void http_inflate_destroy(HttpInflate *z) {
+    (void)z;
+}
+
+#endif // USE_ZLIB
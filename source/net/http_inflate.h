@@ -0,0 +1,47 @@
+// http_inflate.h - streaming gzip/deflate decoding of HTTP bodies
+#ifndef HTTP_INFLATE_H
+#define HTTP_INFLATE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "simple_http.h"
+
+// Compressed bodies are inflated piece by piece as they arrive: input is fed
+// in whatever chunks the socket delivers and output goes to the next sink in
+// HTTP_INFLATE_OUT_SIZE pieces, so memory stays at the 32 KiB deflate window
+// plus one output buffer regardless of the body size.
+//
+// Built without USE_ZLIB, nothing is advertised and http_inflate_create()
+// always fails.
+
+#define HTTP_INFLATE_OUT_SIZE (32 * 1024)
+
+typedef enum {
+    HTTP_CODING_IDENTITY = 0,
+    HTTP_CODING_GZIP,
+    HTTP_CODING_DEFLATE,
+    HTTP_CODING_UNSUPPORTED,    // anything else (br, compress, ...)
+} HttpCoding;
+
+// Map a Content-Encoding header value to a coding
+HttpCoding http_coding_parse(const char *value);
+
+// Request line advertising the codings we can decode ("" without zlib)
+const char *http_accept_encoding(void);
+
+typedef struct HttpInflate HttpInflate;
+
+// Decoder for 'coding' that passes inflated data on to sink(user, ...).
+// Returns NULL for identity/unsupported codings or when out of memory.
+HttpInflate *http_inflate_create(HttpCoding coding, simple_http_body_cb sink, void *user);
+
+// simple_http_body_cb-compatible: feed compressed bytes (user is the
+// HttpInflate). Returns non-zero on corrupt data or when the sink aborts.
+int http_inflate_body_cb(void *user, const char *data, size_t len);
+
+// Check the compressed stream ended cleanly. Returns 0 if it did.
+int http_inflate_finish(HttpInflate *z);
+
+void http_inflate_destroy(HttpInflate *z);
+
+#endif // HTTP_INFLATE_H
@@ -0,0 +1,100 @@
+// link_lz4.c - block LZ4 framing shared by the USB and network transfer paths
+// Notes:
+// - The sample test costs three 4 KiB compressions per block, about 1% of
+//   compressing a 1 MiB block, and skips the full pass on data that will
+//   not shrink anyway.
+// - The full pass compresses into a buffer one byte smaller than the block,
+//   so LZ4 itself gives up as soon as the output would not be a saving.
+
+#include "link_lz4.h"
+#include <string.h>
+
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+
+#define SAMPLE_SIZE     4096
+#define SAMPLE_COUNT    3
+#define SAMPLE_MIN      (SAMPLE_SIZE * SAMPLE_COUNT * 4)    // below this, just try the block
+#define SAMPLE_KEEP_PCT 97                                  // compress if samples shrink below this
+
+static void put_le32(u8 *p, u32 v) {
+    p[0] = (u8)v; p[1] = (u8)(v >> 8); p[2] = (u8)(v >> 16); p[3] = (u8)(v >> 24);
+}
+
+static u32 get_le32(const u8 *p) {
+    return (u32)p[0] | (u32)p[1] << 8 | (u32)p[2] << 16 | (u32)p[3] << 24;
+}
+
+static size_t store_raw(const void *raw, size_t len, u8 *out) {
+    put_le32(out, (u32)len);
+    put_le32(out + 4, (u32)len | LINK_LZ4_STORED);
+    memcpy(out + LINK_LZ4_HEADER, raw, len);
+    return LINK_LZ4_HEADER + len;
+}
+
+#ifdef USE_LZ4
+
+bool link_lz4_available(void) {
+    return true;
+}
+
+// Test-compress slices from the start, middle and end of the block
+static bool worth_compressing(const u8 *raw, size_t len) {
+    if (len < SAMPLE_MIN) return true;
+    char sample[LZ4_COMPRESSBOUND(SAMPLE_SIZE)];
+    size_t in = 0, out = 0;
+    for (int i = 0; i < SAMPLE_COUNT; i++) {
+        size_t at = (len - SAMPLE_SIZE) / (SAMPLE_COUNT - 1) * (size_t)i;
+        int n = LZ4_compress_default((const char*)raw + at, sample, SAMPLE_SIZE, (int)sizeof(sample));
+        in += SAMPLE_SIZE;
+        out += n > 0 ? (size_t)n : SAMPLE_SIZE;
+    }
+    return out * 100 < in * SAMPLE_KEEP_PCT;
+}
+
+size_t link_lz4_encode(const void *raw, size_t len, void *out) {
+    u8 *o = (u8*)out;
+    if (len == 0 || len > LINK_LZ4_MAX_BLOCK || !worth_compressing((const u8*)raw, len)) {
+        return store_raw(raw, len, o);
+    }
+    int n = LZ4_compress_default((const char*)raw, (char*)o + LINK_LZ4_HEADER, (int)len, (int)len - 1);
+    if (n <= 0) return store_raw(raw, len, o);
+    put_le32(o, (u32)len);
+    put_le32(o + 4, (u32)n);
+    return LINK_LZ4_HEADER + (size_t)n;
+}
+
+#else // !USE_LZ4
+
+bool link_lz4_available(void) {
+    return false;
+}
+
+size_t link_lz4_encode(const void *raw, size_t len, void *out) {
+    return store_raw(raw, len, (u8*)out);
+}
+
+#endif // USE_LZ4
+
+ssize_t link_lz4_decode(const void *frame, size_t avail, void *out, size_t cap, size_t *frame_len) {
+    const u8 *f = (const u8*)frame;
+    if (avail < LINK_LZ4_HEADER) return -1;
+    u32 raw_len = get_le32(f);
+    u32 word = get_le32(f + 4);
+    u32 stored = word & ~LINK_LZ4_STORED;
+    if (raw_len > cap || raw_len > LINK_LZ4_MAX_BLOCK || stored > avail - LINK_LZ4_HEADER) return -1;
+    *frame_len = LINK_LZ4_HEADER + stored;
+
+    if (word & LINK_LZ4_STORED) {
+        if (stored != raw_len) return -1;
+        memcpy(out, f + LINK_LZ4_HEADER, raw_len);
+        return (ssize_t)raw_len;
+    }
+#ifdef USE_LZ4
+    int n = LZ4_decompress_safe((const char*)f + LINK_LZ4_HEADER, (char*)out, (int)stored, (int)raw_len);
+    return n == (int)raw_len ? (ssize_t)raw_len : -1;
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,45 @@
+// link_lz4.h - block LZ4 framing shared by the USB and network transfer paths
+#ifndef LINK_LZ4_H
+#define LINK_LZ4_H
+
+#include <switch.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// A payload is cut into blocks and each block becomes one frame:
+//
+//   u32 LE  raw length
+//   u32 LE  stored length | LINK_LZ4_STORED if the bytes are not compressed
+//   ...     stored bytes (an LZ4 block, or the raw bytes)
+//
+// Before compressing, a few slices of the block are test-compressed; if
+// they do not shrink (encrypted NCAs, already compressed archives) the
+// block is stored raw without spending CPU on the rest. A block that does
+// not get smaller is stored raw as well, so a frame is never more than
+// LINK_LZ4_HEADER bytes larger than its block.
+//
+// Built without USE_LZ4, link_lz4_available() is false: encoding always
+// stores raw, and compressed frames cannot be decoded. Peers only use
+// frames after both sides have said they can.
+
+#define LINK_LZ4_HEADER         8
+#define LINK_LZ4_STORED         0x80000000u
+#define LINK_LZ4_MAX_BLOCK      (4 * 1024 * 1024)
+#define LINK_LZ4_HTTP_CODING    "x-lz4-frames"   // Content-Encoding token
+
+bool link_lz4_available(void);
+
+// Largest frame a block of n raw bytes can produce
+#define LINK_LZ4_FRAME_BOUND(n) ((n) + LINK_LZ4_HEADER)
+
+// Encode one block (at most LINK_LZ4_MAX_BLOCK bytes) into 'out', which
+// must hold LINK_LZ4_FRAME_BOUND(len) bytes. Returns the frame size.
+size_t link_lz4_encode(const void *raw, size_t len, void *out);
+
+// Decode the frame at the start of 'frame' ('avail' bytes) into 'out'.
+// Returns the raw length and sets *frame_len to the bytes consumed, or
+// returns -1 if the frame is truncated, corrupt or larger than 'cap'.
+ssize_t link_lz4_decode(const void *frame, size_t avail, void *out, size_t cap, size_t *frame_len);
+
+#endif // LINK_LZ4_H
@@ -0,0 +1,1275 @@
+// net_loop.c - single-threaded poll() loop for concurrent network transfers
+// Notes:
+// - Connections live in s_conns, which only the network thread walks and
+//   frees. Other threads hand new connections over through s_pending and
+//   flag cancels/closes; both, and the stream send buffers, are guarded by
+//   s_lock. The network thread never holds s_lock while running callbacks.
+// - A UDP socket connected to itself wakes poll() when work is queued from
+//   another thread. If it cannot be created the loop falls back to polling
+//   every NET_LOOP_POLL_MS.
+// - Each HTTP transfer is a state machine advanced by whatever bytes the
+//   socket has: status line -> headers -> body (Content-Length, chunked or
+//   until close), with gzip/deflate decoded by http_inflate.c. Requests use
+//   Connection: close; there is no keep-alive pool here.
+// - Redirect targets and retries after a failed connect are resolved on a
+//   helper thread (through simple_http's DNS cache), so a slow lookup never
+//   holds up poll(). The answer comes back through s_resolve_done.
+// - Download bodies are written to the SD card by a writer thread, so a slow
+//   card never holds up poll() either. Each download may have up to
+//   NET_LOOP_WRITE_AHEAD bytes queued; past that its socket is not read until
+//   the writer catches up. The writer also closes the part file at the end of
+//   an attempt and reports back through s_write_done; until then the
+//   connection waits in NC_HTTP_FLUSHING. Opening the part file and handling
+//   the response head stay on the network thread (once per attempt).
+
+#include "net_loop.h"
+#include "downloader.h"
+#include "http_inflate.h"
+#include "../logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define NET_LOOP_IDLE_MS          1000    // longest poll() when the wake socket works
+#define NET_LOOP_POLL_MS          50      // poll interval without a wake socket
+#define NET_LOOP_MAX_REDIRECTS    4
+#define NET_LOOP_MAX_ATTEMPTS     5
+#define NET_LOOP_RETRY_DELAY_NS   (1000ull * 1000 * 1000)   // doubled after every failed attempt
+#define NET_LOOP_STALL_NS         (30ull * 1000 * 1000 * 1000) // no progress for this long fails a transfer
+#define NET_LOOP_WRITE_AHEAD      (1024 * 1024)  // per download: bytes queued for the writer before reads pause
+
+typedef enum {
+    NC_LISTEN,
+    NC_STREAM,
+    NC_HTTP_FLUSHING,       // download attempt over, the writer is closing the part file
+    NC_HTTP_WAIT,           // retry backoff until wake_ns
+    NC_HTTP_RESOLVING,      // lookup queued on the resolver thread
+    NC_HTTP_CONNECTING,
+    NC_HTTP_SENDING,
+    NC_HTTP_STATUS,
+    NC_HTTP_HEADERS,
+    NC_HTTP_BODY,           // Content-Length body, or until close when remaining < 0
+    NC_HTTP_CHUNK_SIZE,
+    NC_HTTP_CHUNK_DATA,
+    NC_HTTP_CHUNK_END,
+    NC_HTTP_TRAILER,
+} NetConnState;
+
+// Caller-owned buffer queued with net_loop_send_buffer(), or a private copy
+// (release == NULL) made when net_loop_send() has to queue behind one
+typedef struct NetSeg {
+    const char *data;
+    size_t len, pos;
+    net_release_cb release;
+    void *release_user;
+    struct NetSeg *next;
+} NetSeg;
+
+typedef struct NetConn {
+    u32 id;
+    int fd;
+    NetConnState state;
+    volatile bool cancel;       // set by net_loop_cancel(), from any thread
+    volatile bool closing;      // stream: close once the send buffer is empty
+    bool dead;                  // finished; freed at the top of the next iteration
+    bool eof;                   // HTTP: peer closed, parse what is buffered
+    u64 wake_ns;                // WAIT: start time; reading states: reads paused until then
+    u64 active_ns;              // last time the connection made progress
+
+    char rbuf[NET_LOOP_RBUF_SIZE];
+    size_t rpos, rlen;
+    char *obuf;                 // request or stream output (stream: under s_lock)
+    size_t opos, olen, ocap;
+    NetSeg *segs, *segs_tail;   // stream output queued after obuf (under s_lock)
+    size_t seg_bytes;           // unsent bytes in segs
+    size_t seg_copied;          // of which private copies
+
+    // HTTP client
+    char *url;
+    char *extra_headers;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    int family;
+    bool resolved;              // addr is valid for url
+    int redirects;
+    SimpleHttpResponse resp;
+    HttpCoding coding;
+    char *location;
+    long long remaining;
+    HttpInflate *inflater;
+    NetHttpHandlers h;
+
+    // File download layered on the HTTP client
+    bool download;
+    char *out_path;
+    DownloadFileSink *sink;
+    struct NetWrite *close_job; // allocated with the sink, so ending an attempt cannot fail
+    net_rate_hook rate_hook;
+    void *rate_user;
+    int attempts;
+    u64 retry_delay_ns;
+    size_t write_pending;       // queued for the writer, not yet on disk (under s_lock)
+    u64 write_wake_ns;          // pause asked for by the rate hook on the writer (under s_lock)
+    bool write_failed;          // the writer could not store a chunk (under s_lock)
+    bool write_full;            // write_pending reached NET_LOOP_WRITE_AHEAD: reads paused
+
+    // Server side
+    net_accept_cb on_accept;
+    void *accept_user;
+    NetStreamHandlers sh;
+    void *stream_user;
+
+    struct NetConn *next;
+} NetConn;
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static NetConn *s_conns = NULL;         // owned by the network thread
+static NetConn *s_pending = NULL;       // handed over under s_lock
+static u32 s_next_id = 1;
+static int s_count = 0;                 // connections adopted or pending
+static bool s_running = false;
+static volatile bool s_stop = false;
+static pthread_t s_thread;
+static int s_wake_fd = -1;
+
+// Lookup handed to the resolver thread. Keyed by connection id: the
+// connection may be cancelled and freed before the answer arrives.
+typedef struct NetResolve {
+    u32 conn;
+    char *url;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    int family;
+    int rc;
+    struct NetResolve *next;
+} NetResolve;
+
+static pthread_cond_t s_resolve_cond = PTHREAD_COND_INITIALIZER;
+static NetResolve *s_resolve_queue = NULL;  // waiting for the resolver (under s_lock)
+static NetResolve *s_resolve_done = NULL;   // answered, for the network thread (under s_lock)
+static pthread_t s_resolver;
+
+// Work for the writer thread: body bytes of a download, or the end of an
+// attempt. The connection is not freed before its close has been answered,
+// so jobs can point at it.
+typedef struct NetWrite {
+    NetConn *conn;
+    DownloadFileSink *sink;
+    bool close;
+    int rc;                     // close: the attempt's result, then the sink's
+    bool retry;                 // close: set by download_sink_close()
+    size_t len;
+    struct NetWrite *next;
+    char data[];
+} NetWrite;
+
+static pthread_cond_t s_write_cond = PTHREAD_COND_INITIALIZER;
+static NetWrite *s_write_queue = NULL;      // in order, for the writer (under s_lock)
+static NetWrite *s_write_tail = NULL;
+static NetWrite *s_write_done = NULL;       // closes answered, for the network thread (under s_lock)
+static bool s_write_stop = false;           // writer exits once the queue is empty
+static pthread_t s_writer;
+
+static u64 now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void wake_loop(void) {
+    if (s_wake_fd >= 0) {
+        char b = 0;
+        send(s_wake_fd, &b, 1, 0);
+    }
+}
+
+static int wake_open(void) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(sa);
+    if (bind(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0 ||
+        getsockname(fd, (struct sockaddr*)&sa, &len) != 0 ||
+        connect(fd, (struct sockaddr*)&sa, len) != 0 || set_nonblocking(fd) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Hand a new connection to the network thread
+static u32 conn_submit(NetConn *c) {
+    pthread_mutex_lock(&s_lock);
+    if (!s_running || s_count >= NET_LOOP_MAX_CONNS) { pthread_mutex_unlock(&s_lock); return 0; }
+    s_count++;
+    c->id = s_next_id++;
+    if (s_next_id == 0) s_next_id = 1;
+    u32 id = c->id;
+    c->next = s_pending;
+    s_pending = c;
+    pthread_mutex_unlock(&s_lock);
+    wake_loop();
+    return id;
+}
+
+static void seg_release(NetSeg *g) {
+    if (g->release) g->release(g->release_user, g->data);
+    else free((void*)g->data);
+    free(g);
+}
+
+// Never called with s_lock held: release callbacks may call back into the API
+static void conn_free(NetConn *c) {
+    while (c->segs) { NetSeg *g = c->segs; c->segs = g->next; seg_release(g); }
+    if (c->fd >= 0) close(c->fd);
+    http_inflate_destroy(c->inflater);
+    free(c->obuf);
+    free(c->url);
+    free(c->extra_headers);
+    free(c->location);
+    free(c->out_path);
+    free(c->close_job);
+    free(c);
+}
+
+// Append to a connection's send buffer. Caller holds s_lock.
+static int obuf_append(NetConn *c, const void *data, size_t len) {
+    if (c->opos > 0 && c->opos == c->olen) c->opos = c->olen = 0;
+    if (c->olen - c->opos + c->seg_copied + len > NET_LOOP_MAX_OUTBUF && c->state == NC_STREAM) return -1;
+    if (c->segs) {
+        // Keep the order: queue a copy behind the caller-owned buffers
+        NetSeg *g = calloc(1, sizeof(*g));
+        char *copy = g ? malloc(len ? len : 1) : NULL;
+        if (!copy) { free(g); return -1; }
+        memcpy(copy, data, len);
+        g->data = copy;
+        g->len = len;
+        c->segs_tail->next = g;
+        c->segs_tail = g;
+        c->seg_bytes += len;
+        c->seg_copied += len;
+        return 0;
+    }
+    if (c->olen + len > c->ocap) {
+        // Reclaim the already-sent prefix before growing
+        if (c->opos > 0) {
+            memmove(c->obuf, c->obuf + c->opos, c->olen - c->opos);
+            c->olen -= c->opos;
+            c->opos = 0;
+        }
+        if (c->olen + len > c->ocap) {
+            size_t cap = c->ocap ? c->ocap : 4096;
+            while (cap < c->olen + len) cap *= 2;
+            char *nb = realloc(c->obuf, cap);
+            if (!nb) return -1;
+            c->obuf = nb;
+            c->ocap = cap;
+        }
+    }
+    memcpy(c->obuf + c->olen, data, len);
+    c->olen += len;
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// HTTP client state machine
+// ---------------------------------------------------------------------------
+
+static void http_finish(NetConn *c, int rc);
+
+// Blocking lookup; never called on the network thread
+static int url_resolve(const char *url, struct sockaddr_storage *addr, socklen_t *addrlen, int *family) {
+    char *host = NULL, *port = NULL, *path = NULL;
+    if (simple_http_parse_url(url, &host, &port, &path) != 0) return -1;
+    int rc = simple_http_resolve(host, port, addr, addrlen, family);
+    free(host); free(port); free(path);
+    return rc;
+}
+
+static int http_resolve(NetConn *c) {
+    int rc = url_resolve(c->url, &c->addr, &c->addrlen, &c->family);
+    c->resolved = rc == 0;
+    return rc;
+}
+
+// Queue a lookup of c->url on the resolver thread; the network thread calls
+// http_connect() again once it is answered
+static int resolve_start(NetConn *c) {
+    NetResolve *r = calloc(1, sizeof(*r));
+    if (!r || !(r->url = strdup(c->url))) { free(r); return -1; }
+    r->conn = c->id;
+    c->state = NC_HTTP_RESOLVING;
+    pthread_mutex_lock(&s_lock);
+    r->next = s_resolve_queue;
+    s_resolve_queue = r;
+    pthread_cond_signal(&s_resolve_cond);
+    pthread_mutex_unlock(&s_lock);
+    return 0;
+}
+
+static void *net_resolver_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&s_lock);
+    while (!s_stop) {
+        NetResolve *r = s_resolve_queue;
+        if (!r) { pthread_cond_wait(&s_resolve_cond, &s_lock); continue; }
+        s_resolve_queue = r->next;
+        pthread_mutex_unlock(&s_lock);
+        r->rc = url_resolve(r->url, &r->addr, &r->addrlen, &r->family);
+        pthread_mutex_lock(&s_lock);
+        r->next = s_resolve_done;
+        s_resolve_done = r;
+        wake_loop();
+    }
+    pthread_mutex_unlock(&s_lock);
+    return NULL;
+}
+
+static void resolve_free_list(NetResolve *r) {
+    while (r) { NetResolve *next = r->next; free(r->url); free(r); r = next; }
+}
+
+// Open the socket and queue the request, or first hand an unresolved host
+// to the resolver. Returns -1 if the attempt failed before reaching the
+// network.
+static int http_connect(NetConn *c) {
+    if (!c->resolved) return resolve_start(c);
+    char *host = NULL, *port = NULL, *path = NULL;
+    if (simple_http_parse_url(c->url, &host, &port, &path) != 0) return -1;
+
+    const char *extra = c->extra_headers ? c->extra_headers : "";
+    if (c->download && c->sink) extra = download_sink_range_headers(c->sink);
+    // A compressed 206 would be a range of the compressed bytes
+    const char *accept = strstr(extra, "Range:") ? "" : http_accept_encoding();
+    bool default_port = strcmp(port, "80") == 0;
+    char req[4096];
+    int n = snprintf(req, sizeof(req),
+             "GET %s HTTP/1.1\r\nHost: %s%s%s\r\nConnection: close\r\nUser-Agent: DBFM/1.0\r\n%s%s\r\n",
+             path, host, default_port ? "" : ":", default_port ? "" : port, accept, extra);
+    free(host); free(port); free(path);
+    if (n < 0 || (size_t)n >= sizeof(req)) return -1;
+
+    c->opos = c->olen = 0;
+    c->rpos = c->rlen = 0;
+    if (obuf_append(c, req, (size_t)n) != 0) return -1;
+
+    c->fd = socket(c->family, SOCK_STREAM, 0);
+    if (c->fd < 0) return -1;
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (set_nonblocking(c->fd) != 0) return -1;
+    if (connect(c->fd, (struct sockaddr*)&c->addr, c->addrlen) == 0) c->state = NC_HTTP_SENDING;
+    else if (errno == EINPROGRESS) c->state = NC_HTTP_CONNECTING;
+    else { c->resolved = false; return -1; }  // the host may have moved
+    c->active_ns = now_ns();
+    return 0;
+}
+
+// Reset per-response state before (re)sending a request
+static void http_reset(NetConn *c) {
+    if (c->fd >= 0) { close(c->fd); c->fd = -1; }
+    http_inflate_destroy(c->inflater);
+    c->inflater = NULL;
+    free(c->location);
+    c->location = NULL;
+    memset(&c->resp, 0, sizeof(c->resp));
+    c->coding = HTTP_CODING_IDENTITY;
+    c->remaining = 0;
+    c->wake_ns = 0;
+    c->eof = false;
+}
+
+// Consume one CRLF-terminated line from the receive buffer. Returns NULL if
+// no complete line is buffered yet; *overflow is set if none can ever fit.
+static char *take_line(NetConn *c, bool *overflow) {
+    char *start = c->rbuf + c->rpos;
+    char *nl = memchr(start, '\n', c->rlen - c->rpos);
+    if (!nl) {
+        *overflow = c->rpos == 0 && c->rlen == sizeof(c->rbuf);
+        return NULL;
+    }
+    *nl = '\0';
+    if (nl > start && nl[-1] == '\r') nl[-1] = '\0';
+    c->rpos = (size_t)(nl - c->rbuf) + 1;
+    return start;
+}
+
+static void parse_header(NetConn *c, char *line) {
+    char *value = strchr(line, ':');
+    if (!value) return;
+    *value++ = '\0';
+    while (*value == ' ' || *value == '\t') value++;
+    SimpleHttpResponse *r = &c->resp;
+    if (strcasecmp(line, "Content-Length") == 0) r->content_length = atoll(value);
+    else if (strcasecmp(line, "Transfer-Encoding") == 0 && strstr(value, "chunked")) r->chunked = true;
+    else if (strcasecmp(line, "Content-Encoding") == 0) c->coding = http_coding_parse(value);
+    else if (strcasecmp(line, "Location") == 0) { free(c->location); c->location = strdup(value); }
+    else if (strcasecmp(line, "ETag") == 0) snprintf(r->etag, sizeof(r->etag), "%s", value);
+    else if (strcasecmp(line, "Last-Modified") == 0) snprintf(r->last_modified, sizeof(r->last_modified), "%s", value);
+    else if (strcasecmp(line, "Content-Range") == 0) {
+        long long start = -1, end = -1;
+        if (sscanf(value, "bytes %lld-%lld", &start, &end) == 2) r->range_start = start;
+        const char *slash = strchr(value, '/');
+        if (slash && slash[1] != '*') r->range_total = atoll(slash + 1);
+    }
+}
+
+static bool status_has_body(int status) {
+    return !(status == 204 || status == 304 || (status >= 100 && status < 200));
+}
+
+static bool is_redirect(int status) {
+    return status == 301 || status == 302 || status == 303 || status == 307 || status == 308;
+}
+
+static void write_queue(NetWrite *w) {
+    w->next = NULL;
+    if (s_write_tail) s_write_tail->next = w;
+    else s_write_queue = w;
+    s_write_tail = w;
+    pthread_cond_signal(&s_write_cond);
+}
+
+// Body bytes of a download: hand a copy to the writer thread. Once the
+// writer is NET_LOOP_WRITE_AHEAD bytes behind, reads pause (write_full).
+static int download_queue_body(void *user, const char *data, size_t len) {
+    NetConn *c = (NetConn*)user;
+    if (len == 0) return 0;
+    NetWrite *w = malloc(sizeof(*w) + len);
+    if (!w) return -1;
+    memset(w, 0, sizeof(*w));
+    w->conn = c;
+    w->sink = c->sink;
+    w->len = len;
+    memcpy(w->data, data, len);
+    pthread_mutex_lock(&s_lock);
+    bool failed = c->write_failed;
+    if (!failed) {
+        c->write_pending += len;
+        c->write_full = c->write_pending >= NET_LOOP_WRITE_AHEAD;
+        write_queue(w);
+    }
+    pthread_mutex_unlock(&s_lock);
+    if (failed) { free(w); return -1; }
+    return 0;
+}
+
+// Follow a redirect on the same connection slot. Returns 0 if the new
+// request is under way.
+static int http_follow(NetConn *c) {
+    char *next = simple_http_resolve_location(c->url, c->location);
+    if (!next || strncmp(next, "http://", 7) != 0) { free(next); return -1; }
+    free(c->url);
+    c->url = next;
+    c->resolved = false;
+    c->redirects++;
+    http_reset(c);
+    return http_connect(c);
+}
+
+// Response head complete. Returns 0 to read the body, 1 when there is no
+// body, 2 when a redirect is under way, -1 on failure.
+static int http_head_done(NetConn *c) {
+    // Framing uses the wire length, not the decoded one
+    long long wire = c->resp.content_length;
+    if (is_redirect(c->resp.status) && c->location) {
+        if (c->redirects >= NET_LOOP_MAX_REDIRECTS) return -1;
+        return http_follow(c) == 0 ? 2 : -1;
+    }
+    simple_http_body_cb body = c->download ? download_queue_body : c->h.on_body;
+    void *user = c->download ? (void*)c : c->h.user;
+    if (c->coding != HTTP_CODING_IDENTITY && status_has_body(c->resp.status)) {
+        c->inflater = http_inflate_create(c->coding, body, user);
+        if (c->inflater) {
+            c->resp.decoded = true;
+            c->resp.content_length = -1;
+        }
+    }
+    if (c->download ? download_sink_head(c->sink, &c->resp) != 0 :
+        c->h.on_head && c->h.on_head(c->h.user, &c->resp) != 0) return -1;
+
+    if (!status_has_body(c->resp.status)) return 1;
+    if (c->resp.chunked) { c->state = NC_HTTP_CHUNK_SIZE; return 0; }
+    if (wire == 0) return 1;
+    c->remaining = wire;
+    c->state = NC_HTTP_BODY;
+    return 0;
+}
+
+// Deliver body bytes to the sink (through the decoder if any)
+static int http_deliver(NetConn *c, const char *data, size_t len) {
+    if (len == 0) return 0;
+    if (c->inflater) return http_inflate_body_cb(c->inflater, data, len);
+    if (c->download) return download_queue_body(c, data, len);
+    return c->h.on_body ? c->h.on_body(c->h.user, data, len) : 0;
+}
+
+// Reads paused by the rate hook, or until the writer catches up
+static bool throttled(const NetConn *c) {
+    return c->write_full || (c->wake_ns && now_ns() < c->wake_ns);
+}
+
+// Run the parser over everything buffered. Returns 0 to keep going, 1 when
+// the response is complete, -1 on failure.
+static int http_process(NetConn *c) {
+    for (;;) {
+        if (throttled(c)) return 0;
+        bool overflow = false;
+        char *line;
+        switch (c->state) {
+        case NC_HTTP_STATUS:
+            if (!(line = take_line(c, &overflow))) return overflow ? -1 : 0;
+            memset(&c->resp, 0, sizeof(c->resp));
+            c->resp.content_length = -1;
+            c->resp.range_start = -1;
+            c->resp.range_total = -1;
+            if (sscanf(line, "HTTP/1.%*d %d", &c->resp.status) != 1) return -1;
+            c->state = NC_HTTP_HEADERS;
+            break;
+        case NC_HTTP_HEADERS: {
+            if (!(line = take_line(c, &overflow))) return overflow ? -1 : 0;
+            if (line[0]) { parse_header(c, line); break; }
+            // Interim 1xx responses are followed by the real one
+            if (c->resp.status < 200) { c->state = NC_HTTP_STATUS; break; }
+            int r = http_head_done(c);
+            if (r < 0) return -1;
+            if (r == 1) return 1;
+            if (r == 2) return 0;       // redirected: a new request is in flight
+            break;
+        }
+        case NC_HTTP_BODY: {
+            size_t avail = c->rlen - c->rpos;
+            if (avail == 0) return 0;
+            size_t n = avail;
+            if (c->remaining >= 0 && (long long)n > c->remaining) n = (size_t)c->remaining;
+            if (http_deliver(c, c->rbuf + c->rpos, n) != 0) return -1;
+            c->rpos += n;
+            if (c->remaining >= 0) {
+                c->remaining -= (long long)n;
+                if (c->remaining == 0) return 1;
+            }
+            break;
+        }
+        case NC_HTTP_CHUNK_SIZE:
+            if (!(line = take_line(c, &overflow))) return overflow ? -1 : 0;
+            c->remaining = (long long)strtoull(line, NULL, 16);
+            c->state = c->remaining == 0 ? NC_HTTP_TRAILER : NC_HTTP_CHUNK_DATA;
+            break;
+        case NC_HTTP_CHUNK_DATA: {
+            size_t avail = c->rlen - c->rpos;
+            if (avail == 0) return 0;
+            size_t n = (long long)avail > c->remaining ? (size_t)c->remaining : avail;
+            if (http_deliver(c, c->rbuf + c->rpos, n) != 0) return -1;
+            c->rpos += n;
+            c->remaining -= (long long)n;
+            if (c->remaining == 0) c->state = NC_HTTP_CHUNK_END;
+            break;
+        }
+        case NC_HTTP_CHUNK_END:
+            if (!(line = take_line(c, &overflow))) return overflow ? -1 : 0;
+            c->state = NC_HTTP_CHUNK_SIZE;
+            break;
+        case NC_HTTP_TRAILER:
+            if (!(line = take_line(c, &overflow))) return overflow ? -1 : 0;
+            if (!line[0]) return 1;
+            break;
+        default:
+            return 0;
+        }
+    }
+}
+
+// Parse what is buffered; after the peer closed, decide between a complete
+// unframed body and a truncated response
+static int http_advance(NetConn *c) {
+    int r = http_process(c);
+    if (r != 0 || !c->eof || throttled(c)) return r;
+    return c->state == NC_HTTP_BODY && c->remaining < 0 && c->rpos == c->rlen ? 1 : -1;
+}
+
+// Read what the socket has and advance the parser. Returns 0 to keep going,
+// 1 when done, -1 on failure.
+static int http_readable(NetConn *c) {
+    if (c->rpos > 0) {
+        memmove(c->rbuf, c->rbuf + c->rpos, c->rlen - c->rpos);
+        c->rlen -= c->rpos;
+        c->rpos = 0;
+    }
+    if (c->rlen < sizeof(c->rbuf)) {
+        ssize_t r = recv(c->fd, c->rbuf + c->rlen, sizeof(c->rbuf) - c->rlen, 0);
+        if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+        if (r == 0) c->eof = true;
+        if (r > 0) {
+            c->rlen += (size_t)r;
+            c->active_ns = now_ns();
+        }
+    }
+    return http_advance(c);
+}
+
+static int download_hook(void *user, size_t chunk, size_t current, size_t total) {
+    NetConn *c = (NetConn*)user;
+    if (c->cancel) return -1;
+    if (!c->rate_hook) return 0;
+    s64 r = c->rate_hook(c->rate_user, chunk, current, total);
+    if (r < 0) return -1;
+    if (r > 0) {
+        // Runs on the writer thread; the network thread applies the pause
+        pthread_mutex_lock(&s_lock);
+        c->write_wake_ns = now_ns() + (u64)r;
+        pthread_mutex_unlock(&s_lock);
+        wake_loop();
+    }
+    return 0;
+}
+
+static void *net_writer_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&s_lock);
+    for (;;) {
+        NetWrite *w = s_write_queue;
+        if (!w) {
+            if (s_write_stop) break;
+            pthread_cond_wait(&s_write_cond, &s_lock);
+            continue;
+        }
+        s_write_queue = w->next;
+        if (!s_write_queue) s_write_tail = NULL;
+        NetConn *c = w->conn;
+        bool failed = c->write_failed;
+        pthread_mutex_unlock(&s_lock);
+
+        // Once a chunk is lost the rest of the attempt is dropped
+        int rc = 0;
+        if (w->close) w->rc = download_sink_close(w->sink, failed ? -1 : w->rc, &w->retry);
+        else if (!failed) rc = download_sink_body(w->sink, w->data, w->len);
+
+        pthread_mutex_lock(&s_lock);
+        bool wake = true;
+        if (w->close) {
+            w->next = s_write_done;
+            s_write_done = w;
+        } else {
+            // Wake the network thread only when reads were paused on us
+            wake = c->write_pending >= NET_LOOP_WRITE_AHEAD;
+            c->write_pending -= w->len;
+            if (rc != 0) c->write_failed = true;
+            wake = wake && (c->write_pending < NET_LOOP_WRITE_AHEAD || c->write_failed);
+            free(w);
+        }
+        if (wake) wake_loop();
+    }
+    pthread_mutex_unlock(&s_lock);
+    return NULL;
+}
+
+// Begin (or retry) an attempt of a file download
+static int download_begin(NetConn *c) {
+    if (!c->close_job && !(c->close_job = malloc(sizeof(*c->close_job)))) return -1;
+    c->sink = download_sink_open(c->url, c->out_path, download_hook, c);
+    if (!c->sink) return -1;
+    pthread_mutex_lock(&s_lock);
+    c->write_failed = false;
+    c->write_full = false;
+    pthread_mutex_unlock(&s_lock);
+    return 0;
+}
+
+// The current attempt ended with rc: queue the close of the part file behind
+// the attempt's last bytes. download_closed() picks up from the answer.
+static void download_end(NetConn *c, int rc) {
+    if (rc == 0 && c->inflater) rc = http_inflate_finish(c->inflater);
+    NetWrite *w = c->close_job;
+    c->close_job = NULL;
+    memset(w, 0, sizeof(*w));
+    w->conn = c;
+    w->sink = c->sink;
+    w->close = true;
+    w->rc = rc;
+    c->sink = NULL;
+    c->state = NC_HTTP_FLUSHING;
+    pthread_mutex_lock(&s_lock);
+    write_queue(w);
+    pthread_mutex_unlock(&s_lock);
+}
+
+// The writer closed the attempt's part file with rc. Either retry after a
+// delay or report the outcome; returns true when the connection can be freed.
+static bool download_closed(NetConn *c, int rc, bool retry) {
+    if (rc != 0 && retry && !c->cancel && !s_stop && ++c->attempts < NET_LOOP_MAX_ATTEMPTS &&
+        download_begin(c) == 0) {
+        http_reset(c);
+        c->state = NC_HTTP_WAIT;
+        c->wake_ns = now_ns() + c->retry_delay_ns;
+        c->retry_delay_ns *= 2;
+        c->redirects = 0;
+        log_event(LOG_WARN, "net_loop: retrying %s (attempt %d)", c->url, c->attempts + 1);
+        return false;
+    }
+    if (c->h.on_done) c->h.on_done(c->h.user, rc == 0 ? 0 : -1);
+    return true;
+}
+
+// Transfer over: report it and drop the connection unless a retry was set up
+static void http_finish(NetConn *c, int rc) {
+    if (c->fd >= 0) { close(c->fd); c->fd = -1; }
+    if (c->cancel) rc = -1;
+    bool done;
+    if (c->download) {
+        download_end(c, rc);
+        done = false;
+    } else {
+        if (rc == 0 && c->inflater) rc = http_inflate_finish(c->inflater);
+        if (c->h.on_done) c->h.on_done(c->h.user, rc);
+        done = true;
+    }
+    if (done) c->dead = true;
+}
+
+// ---------------------------------------------------------------------------
+// Server side
+// ---------------------------------------------------------------------------
+
+static void stream_close(NetConn *c) {
+    if (c->fd >= 0) { close(c->fd); c->fd = -1; }
+    if (c->sh.on_close) c->sh.on_close(c->stream_user, c->id);
+    c->sh.on_close = NULL;
+    c->dead = true;
+}
+
+static void listener_accept(NetConn *l) {
+    for (;;) {
+        int fd = accept(l->fd, NULL, NULL);
+        if (fd < 0) return;
+        NetConn *c = calloc(1, sizeof(*c));
+        if (!c || set_nonblocking(fd) != 0) { free(c); close(fd); continue; }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        c->fd = fd;
+        c->state = NC_STREAM;
+        pthread_mutex_lock(&s_lock);
+        bool full = s_count >= NET_LOOP_MAX_CONNS;
+        if (!full) s_count++;
+        c->id = s_next_id++;
+        if (s_next_id == 0) s_next_id = 1;
+        pthread_mutex_unlock(&s_lock);
+        if (full || !l->on_accept || l->on_accept(l->accept_user, c->id, &c->sh, &c->stream_user) != 0) {
+            if (!full) {
+                pthread_mutex_lock(&s_lock);
+                s_count--;
+                pthread_mutex_unlock(&s_lock);
+            }
+            conn_free(c);
+            continue;
+        }
+        // Published under the lock so net_loop_send() can find it
+        pthread_mutex_lock(&s_lock);
+        c->next = s_conns;
+        s_conns = c;
+        pthread_mutex_unlock(&s_lock);
+    }
+}
+
+static void stream_readable(NetConn *c) {
+    ssize_t r = recv(c->fd, c->rbuf, sizeof(c->rbuf), 0);
+    if (r < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) stream_close(c);
+        return;
+    }
+    if (r == 0) { stream_close(c); return; }
+    if (c->sh.on_data && c->sh.on_data(c->stream_user, c->id, c->rbuf, (size_t)r) != 0) stream_close(c);
+}
+
+static bool has_output(const NetConn *c) {
+    return c->opos < c->olen || c->segs != NULL;
+}
+
+// Write queued output. Returns 1 when everything queued has been written, 0
+// while data is still queued, -1 on a socket error.
+static int conn_flush(NetConn *c) {
+    NetSeg *sent = NULL;
+    pthread_mutex_lock(&s_lock);
+    int rc = 0;
+    while (c->opos < c->olen) {
+        ssize_t n = send(c->fd, c->obuf + c->opos, c->olen - c->opos, 0);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) rc = -1;
+            break;
+        }
+        c->opos += (size_t)n;
+        if (c->opos == c->olen) { c->opos = c->olen = 0; if (!c->segs) rc = 1; }
+    }
+    // Caller-owned buffers go to the socket as they are, without a copy
+    while (rc == 0 && c->opos == c->olen && c->segs) {
+        NetSeg *g = c->segs;
+        if (g->pos < g->len) {
+            ssize_t n = send(c->fd, g->data + g->pos, g->len - g->pos, 0);
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) rc = -1;
+                break;
+            }
+            g->pos += (size_t)n;
+            c->seg_bytes -= (size_t)n;
+            if (!g->release) c->seg_copied -= (size_t)n;
+        }
+        if (g->pos < g->len) continue;
+        c->segs = g->next;
+        if (!c->segs) { c->segs_tail = NULL; rc = 1; }
+        g->next = sent;
+        sent = g;
+    }
+    pthread_mutex_unlock(&s_lock);
+    while (sent) { NetSeg *g = sent; sent = g->next; seg_release(g); }
+    return rc;
+}
+
+// ---------------------------------------------------------------------------
+// Loop
+// ---------------------------------------------------------------------------
+
+static bool http_reading(const NetConn *c) {
+    return c->state >= NC_HTTP_STATUS && c->state <= NC_HTTP_TRAILER;
+}
+
+static void *net_loop_thread(void *arg) {
+    (void)arg;
+    struct pollfd fds[NET_LOOP_MAX_CONNS + 1];
+    NetConn *owners[NET_LOOP_MAX_CONNS + 1];
+
+    while (!s_stop) {
+        // Adopt queued connections, reap finished ones
+        pthread_mutex_lock(&s_lock);
+        while (s_pending) {
+            NetConn *c = s_pending;
+            s_pending = c->next;
+            c->next = s_conns;
+            s_conns = c;
+        }
+        NetConn *reap = NULL;
+        for (NetConn **pp = &s_conns; *pp; ) {
+            NetConn *c = *pp;
+            if (c->dead) { *pp = c->next; c->next = reap; reap = c; s_count--; }
+            else pp = &c->next;
+        }
+        NetResolve *answers = s_resolve_done;
+        s_resolve_done = NULL;
+        NetWrite *closed = s_write_done;
+        s_write_done = NULL;
+        // Pauses asked for on the writer thread, and how far behind it is
+        for (NetConn *c = s_conns; c; c = c->next) {
+            if (!c->download) continue;
+            if (http_reading(c) && c->write_wake_ns > c->wake_ns) c->wake_ns = c->write_wake_ns;
+            c->write_wake_ns = 0;
+            bool full = c->write_pending >= NET_LOOP_WRITE_AHEAD && !c->write_failed;
+            if (c->write_full && !full) c->active_ns = now_ns();
+            c->write_full = full;
+        }
+        pthread_mutex_unlock(&s_lock);
+        while (reap) { NetConn *c = reap; reap = c->next; conn_free(c); }
+
+        while (closed) {
+            NetWrite *w = closed;
+            closed = w->next;
+            if (download_closed(w->conn, w->rc, w->retry)) w->conn->dead = true;
+            free(w);
+        }
+
+        // Lookups for connections that were cancelled meanwhile are dropped
+        for (NetResolve *r = answers; r; r = r->next) {
+            NetConn *c = s_conns;
+            while (c && c->id != r->conn) c = c->next;
+            if (!c || c->dead || c->state != NC_HTTP_RESOLVING) continue;
+            if (r->rc == 0) {
+                memcpy(&c->addr, &r->addr, r->addrlen);
+                c->addrlen = r->addrlen;
+                c->family = r->family;
+                c->resolved = true;
+            }
+            if (r->rc != 0 || http_connect(c) != 0) http_finish(c, -1);
+        }
+        resolve_free_list(answers);
+
+        u64 now = now_ns();
+        int timeout_ms = s_wake_fd >= 0 ? NET_LOOP_IDLE_MS : NET_LOOP_POLL_MS;
+        nfds_t nfds = 0;
+        if (s_wake_fd >= 0) {
+            fds[nfds].fd = s_wake_fd; fds[nfds].events = POLLIN; fds[nfds].revents = 0;
+            owners[nfds++] = NULL;
+        }
+
+        for (NetConn *c = s_conns; c; c = c->next) {
+            if (c->dead || c->state == NC_HTTP_FLUSHING) continue;
+            // Cancels and closes requested from other threads
+            if (c->cancel) {
+                if (c->state == NC_STREAM) stream_close(c);
+                else if (c->state == NC_LISTEN) { close(c->fd); c->fd = -1; c->dead = true; }
+                else http_finish(c, -1);
+                continue;
+            }
+            if (c->state == NC_STREAM && c->closing && !has_output(c)) { stream_close(c); continue; }
+
+            if (c->state == NC_HTTP_WAIT) {
+                if (now >= c->wake_ns) {
+                    if (http_connect(c) != 0) http_finish(c, -1);
+                } else {
+                    u64 ms = (c->wake_ns - now) / 1000000 + 1;
+                    if (ms < (u64)timeout_ms) timeout_ms = (int)ms;
+                    continue;
+                }
+            }
+            if (c->state >= NC_HTTP_CONNECTING && !throttled(c) && now > c->active_ns + NET_LOOP_STALL_NS) {
+                log_event(LOG_WARN, "net_loop: %s stalled", c->url);
+                http_finish(c, -1);
+                continue;
+            }
+            // Peer closed: finish parsing what is buffered, no more polling
+            if (c->eof && http_reading(c)) {
+                if (throttled(c)) {
+                    u64 ms = c->wake_ns > now ? (c->wake_ns - now) / 1000000 + 1 : (u64)timeout_ms;
+                    if (ms < (u64)timeout_ms) timeout_ms = (int)ms;
+                    continue;
+                }
+                int r = http_advance(c);
+                if (r != 0) http_finish(c, r > 0 ? 0 : -1);
+                else timeout_ms = 0;
+                continue;
+            }
+            if (c->fd < 0 || nfds >= NET_LOOP_MAX_CONNS + 1) continue;
+
+            short events = 0;
+            switch (c->state) {
+            case NC_LISTEN: events = POLLIN; break;
+            case NC_STREAM:
+                events = c->closing ? 0 : POLLIN;
+                if (has_output(c)) events |= POLLOUT;
+                break;
+            case NC_HTTP_CONNECTING:
+            case NC_HTTP_SENDING: events = POLLOUT; break;
+            default:
+                if (http_reading(c)) {
+                    if (throttled(c)) {
+                        // Leave the data in the socket until the pause is over
+                        u64 ms = c->wake_ns > now ? (c->wake_ns - now) / 1000000 + 1 : (u64)timeout_ms;
+                        if (ms < (u64)timeout_ms) timeout_ms = (int)ms;
+                    } else {
+                        if (c->wake_ns) { c->wake_ns = 0; c->active_ns = now; }
+                        // Bytes already buffered are parsed without waiting for more
+                        if (c->rpos < c->rlen) timeout_ms = 0;
+                        events = POLLIN;
+                    }
+                }
+                break;
+            }
+            if (!events) continue;
+            fds[nfds].fd = c->fd; fds[nfds].events = events; fds[nfds].revents = 0;
+            owners[nfds++] = c;
+        }
+
+        int ready = poll(fds, nfds, timeout_ms);
+        if (ready < 0 && errno != EINTR) usleep(10000);
+
+        for (nfds_t i = 0; i < nfds; i++) {
+            NetConn *c = owners[i];
+            short re = fds[i].revents;
+            if (!c) {
+                char drain[64];
+                while (recv(s_wake_fd, drain, sizeof(drain), 0) > 0) {}
+                continue;
+            }
+            if (c->dead || c->cancel) continue;
+            switch (c->state) {
+            case NC_LISTEN:
+                if (re & POLLIN) listener_accept(c);
+                break;
+            case NC_STREAM:
+                if (re & (POLLERR | POLLNVAL)) { stream_close(c); break; }
+                if (re & POLLOUT) {
+                    int fr = conn_flush(c);
+                    if (fr < 0) { stream_close(c); break; }
+                    if (fr > 0 && c->sh.on_drain && !c->closing) c->sh.on_drain(c->stream_user, c->id);
+                }
+                if (re & (POLLIN | POLLHUP)) stream_readable(c);
+                break;
+            case NC_HTTP_CONNECTING: {
+                if (!(re & (POLLOUT | POLLERR | POLLHUP))) break;
+                int err = 0;
+                socklen_t len = sizeof(err);
+                if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+                    c->resolved = false;
+                    http_finish(c, -1);
+                    break;
+                }
+                c->state = NC_HTTP_SENDING;
+            }
+            // fall through
+            case NC_HTTP_SENDING:
+                if (!(re & (POLLOUT | POLLERR | POLLHUP))) break;
+                if (conn_flush(c) < 0) { http_finish(c, -1); break; }
+                if (c->opos == c->olen) { c->state = NC_HTTP_STATUS; c->active_ns = now_ns(); }
+                break;
+            default:
+                if (http_reading(c)) {
+                    int r = (re & (POLLIN | POLLHUP | POLLERR)) ? http_readable(c) :
+                            (c->rpos < c->rlen ? http_advance(c) : 0);
+                    if (r != 0) http_finish(c, r > 0 ? 0 : -1);
+                }
+                break;
+            }
+        }
+    }
+
+    // Shutting down: fail transfers, close everything
+    pthread_mutex_lock(&s_lock);
+    while (s_pending) {
+        NetConn *c = s_pending;
+        s_pending = c->next;
+        c->next = s_conns;
+        s_conns = c;
+    }
+    NetConn *all = s_conns;
+    s_conns = NULL;
+    s_count = 0;
+    pthread_mutex_unlock(&s_lock);
+    for (NetConn *c = all; c; c = c->next) {
+        if (c->dead) continue;
+        if (c->state == NC_STREAM) stream_close(c);
+        else if (c->state >= NC_HTTP_WAIT) http_finish(c, -1);
+    }
+    // Let the writer store what is queued and close the part files
+    pthread_mutex_lock(&s_lock);
+    s_write_stop = true;
+    pthread_cond_broadcast(&s_write_cond);
+    pthread_mutex_unlock(&s_lock);
+    pthread_join(s_writer, NULL);
+    NetWrite *closed = s_write_done;
+    s_write_done = NULL;
+    while (closed) {
+        NetWrite *w = closed;
+        closed = w->next;
+        download_closed(w->conn, w->rc, w->retry);
+        free(w);
+    }
+    while (all) {
+        NetConn *c = all;
+        all = c->next;
+        conn_free(c);
+    }
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// API
+// ---------------------------------------------------------------------------
+
+int net_loop_start(void) {
+    pthread_mutex_lock(&s_lock);
+    if (s_running) { pthread_mutex_unlock(&s_lock); return 0; }
+    s_stop = false;
+    s_wake_fd = wake_open();
+    if (s_wake_fd < 0) log_event(LOG_WARN, "net_loop: no wake socket, polling every %d ms", NET_LOOP_POLL_MS);
+    if (pthread_create(&s_resolver, NULL, net_resolver_thread, NULL) != 0) {
+        if (s_wake_fd >= 0) close(s_wake_fd);
+        s_wake_fd = -1;
+        pthread_mutex_unlock(&s_lock);
+        return -1;
+    }
+    s_write_stop = false;
+    bool writer = pthread_create(&s_writer, NULL, net_writer_thread, NULL) == 0;
+    if (!writer || pthread_create(&s_thread, NULL, net_loop_thread, NULL) != 0) {
+        s_stop = true;
+        s_write_stop = true;
+        pthread_cond_broadcast(&s_resolve_cond);
+        pthread_cond_broadcast(&s_write_cond);
+        pthread_mutex_unlock(&s_lock);
+        pthread_join(s_resolver, NULL);
+        if (writer) pthread_join(s_writer, NULL);
+        pthread_mutex_lock(&s_lock);
+        if (s_wake_fd >= 0) close(s_wake_fd);
+        s_wake_fd = -1;
+        pthread_mutex_unlock(&s_lock);
+        return -1;
+    }
+    s_running = true;
+    pthread_mutex_unlock(&s_lock);
+    return 0;
+}
+
+void net_loop_stop(void) {
+    pthread_mutex_lock(&s_lock);
+    if (!s_running) { pthread_mutex_unlock(&s_lock); return; }
+    s_running = false;
+    s_stop = true;
+    pthread_cond_broadcast(&s_resolve_cond);
+    pthread_mutex_unlock(&s_lock);
+    wake_loop();
+    // The network thread stops the writer once the part files are closed
+    pthread_join(s_thread, NULL);
+    // A lookup in progress finishes first
+    pthread_join(s_resolver, NULL);
+    pthread_mutex_lock(&s_lock);
+    resolve_free_list(s_resolve_queue);
+    resolve_free_list(s_resolve_done);
+    s_resolve_queue = s_resolve_done = NULL;
+    pthread_mutex_unlock(&s_lock);
+    if (s_wake_fd >= 0) close(s_wake_fd);
+    s_wake_fd = -1;
+}
+
+bool net_loop_running(void) {
+    return s_running;
+}
+
+static NetConn *http_conn_new(const char *url) {
+    if (!url || strncmp(url, "http://", 7) != 0) return NULL;
+    NetConn *c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->fd = -1;
+    c->state = NC_HTTP_WAIT;
+    c->url = strdup(url);
+    c->retry_delay_ns = NET_LOOP_RETRY_DELAY_NS;
+    // Resolve here so the network thread does not block on DNS
+    if (!c->url || http_resolve(c) != 0) { conn_free(c); return NULL; }
+    return c;
+}
+
+u32 net_loop_http_get(const char *url, const char *extra_headers, const NetHttpHandlers *handlers) {
+    NetConn *c = http_conn_new(url);
+    if (!c) return 0;
+    if (handlers) c->h = *handlers;
+    if (extra_headers && !(c->extra_headers = strdup(extra_headers))) { conn_free(c); return 0; }
+    u32 id = conn_submit(c);
+    if (!id) conn_free(c);
+    return id;
+}
+
+u32 net_loop_download(const char *url, const char *out_path, net_rate_hook hook,
+                      net_done_cb on_done, void *user) {
+    if (!out_path) return 0;
+    NetConn *c = http_conn_new(url);
+    if (!c) return 0;
+    c->download = true;
+    c->rate_hook = hook;
+    c->rate_user = user;
+    c->h.on_done = on_done;
+    c->h.user = user;
+    if (!(c->out_path = strdup(out_path)) || download_begin(c) != 0) { conn_free(c); return 0; }
+    u32 id = conn_submit(c);
+    if (!id) {
+        bool retry;
+        download_sink_close(c->sink, -1, &retry);
+        conn_free(c);
+    }
+    return id;
+}
+
+// Caller holds s_lock
+static NetConn *conn_find(u32 id) {
+    for (NetConn *c = s_conns; c; c = c->next) if (c->id == id) return c;
+    for (NetConn *c = s_pending; c; c = c->next) if (c->id == id) return c;
+    return NULL;
+}
+
+int net_loop_cancel(u32 id) {
+    pthread_mutex_lock(&s_lock);
+    NetConn *c = conn_find(id);
+    if (c) c->cancel = true;
+    pthread_mutex_unlock(&s_lock);
+    if (c) wake_loop();
+    return c ? 0 : -1;
+}
+
+u32 net_loop_listen(u16 port, bool allow_remote, net_accept_cb on_accept, void *user) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return 0;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(allow_remote ? INADDR_ANY : INADDR_LOOPBACK);
+    sa.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0 || listen(fd, 16) != 0 || set_nonblocking(fd) != 0) {
+        close(fd);
+        return 0;
+    }
+    NetConn *c = calloc(1, sizeof(*c));
+    if (!c) { close(fd); return 0; }
+    c->fd = fd;
+    c->state = NC_LISTEN;
+    c->on_accept = on_accept;
+    c->accept_user = user;
+    u32 id = conn_submit(c);
+    if (!id) conn_free(c);
+    return id;
+}
+
+int net_loop_send(u32 conn, const void *data, size_t len) {
+    pthread_mutex_lock(&s_lock);
+    NetConn *c = conn_find(conn);
+    int rc = -1;
+    if (c && c->state == NC_STREAM && !c->dead && !c->cancel && !c->closing) rc = obuf_append(c, data, len);
+    pthread_mutex_unlock(&s_lock);
+    if (rc == 0) wake_loop();
+    return rc;
+}
+
+int net_loop_send_buffer(u32 conn, const void *data, size_t len, net_release_cb release, void *user) {
+    if (!release) return -1;
+    NetSeg *g = calloc(1, sizeof(*g));
+    if (!g) return -1;
+    g->data = (const char*)data;
+    g->len = len;
+    g->release = release;
+    g->release_user = user;
+    pthread_mutex_lock(&s_lock);
+    NetConn *c = conn_find(conn);
+    int rc = -1;
+    if (c && c->state == NC_STREAM && !c->dead && !c->cancel && !c->closing) {
+        if (c->segs_tail) c->segs_tail->next = g;
+        else c->segs = g;
+        c->segs_tail = g;
+        c->seg_bytes += len;
+        rc = 0;
+    }
+    pthread_mutex_unlock(&s_lock);
+    if (rc == 0) wake_loop();
+    else free(g);
+    return rc;
+}
+
+size_t net_loop_pending(u32 conn) {
+    pthread_mutex_lock(&s_lock);
+    NetConn *c = conn_find(conn);
+    size_t n = c && c->state == NC_STREAM ? c->olen - c->opos + c->seg_bytes : 0;
+    pthread_mutex_unlock(&s_lock);
+    return n;
+}
+
+int net_loop_close(u32 conn) {
+    pthread_mutex_lock(&s_lock);
+    NetConn *c = conn_find(conn);
+    if (c && c->state == NC_STREAM) c->closing = true;
+    pthread_mutex_unlock(&s_lock);
+    if (c) wake_loop();
+    return c ? 0 : -1;
+}
@@ -0,0 +1,97 @@
+// net_loop.h - single-threaded poll() loop for concurrent network transfers
+#ifndef NET_LOOP_H
+#define NET_LOOP_H
+
+#include <switch.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "simple_http.h"
+
+// One network thread multiplexes every connection registered here over
+// non-blocking sockets: HTTP GETs (header parsing, chunked framing and
+// gzip/deflate decoding run as per-connection state machines), resumable
+// file downloads, and listening sockets with their accepted stream
+// connections. Dozens of transfers therefore cost one thread, not one each.
+//
+// All callbacks run on the network thread and must not block; they may call
+// back into this API. The one exception is net_rate_hook (see there).
+
+#define NET_LOOP_MAX_CONNS    64
+#define NET_LOOP_RBUF_SIZE    (32 * 1024)    // per connection; also bounds a response header
+#define NET_LOOP_MAX_OUTBUF   (256 * 1024)   // send backlog a stream connection may queue
+
+// Start/stop the network thread. Stopping fails every pending transfer and
+// closes every connection. Both are safe to call more than once.
+int net_loop_start(void);
+void net_loop_stop(void);
+bool net_loop_running(void);
+
+// Called once when a transfer ends: rc is 0 on success, -1 on failure or cancel
+typedef void (*net_done_cb)(void *user, int rc);
+
+// Called after each body chunk of a download is written, with the running
+// byte counts. Runs on the download writer thread, not the network thread,
+// so it must be thread-safe. Return 0 to continue, a positive number of
+// nanoseconds to stop reading for that long (bandwidth shaping), or a
+// negative value to abort.
+typedef s64 (*net_rate_hook)(void *user, size_t chunk, size_t current, size_t total);
+
+typedef struct {
+    simple_http_head_cb on_head;    // final (post-redirect) response head, may be NULL
+    simple_http_body_cb on_body;    // decoded body data, may be NULL
+    net_done_cb on_done;            // may be NULL
+    void *user;
+} NetHttpHandlers;
+
+// Queue an http:// GET. extra_headers are complete "Name: value\r\n" lines
+// or NULL. The host is resolved on the calling thread. Returns the transfer
+// id, 0 on failure (no callback is made then).
+u32 net_loop_http_get(const char *url, const char *extra_headers, const NetHttpHandlers *handlers);
+
+// Queue an http:// download to out_path through download_url_to_file()'s
+// "<out_path>.part" resume scheme, retried with backoff on network errors.
+// hook may be NULL. Returns the transfer id, 0 on failure.
+u32 net_loop_download(const char *url, const char *out_path, net_rate_hook hook,
+                      net_done_cb on_done, void *user);
+
+// Abort a transfer (its done callback reports -1) or close a connection or
+// listener. Returns 0 if the id was found.
+int net_loop_cancel(u32 id);
+
+// Server side. on_data returns non-zero to close the connection; on_drain
+// (optional) runs whenever everything queued with net_loop_send() has been
+// written, so producers can send the next piece; on_close runs once.
+typedef struct {
+    int (*on_data)(void *user, u32 conn, const char *data, size_t len);
+    void (*on_drain)(void *user, u32 conn);
+    void (*on_close)(void *user, u32 conn);
+} NetStreamHandlers;
+
+// Decide on a new connection: fill *handlers and *conn_user and return 0 to
+// accept it, non-zero to close it.
+typedef int (*net_accept_cb)(void *user, u32 conn, NetStreamHandlers *handlers, void **conn_user);
+
+// Listen on 'port', on every interface or only on loopback. Returns the
+// listener id, 0 on failure.
+u32 net_loop_listen(u16 port, bool allow_remote, net_accept_cb on_accept, void *user);
+
+// Queue bytes on a stream connection. Returns 0, or -1 if the connection is
+// gone or the copied backlog would exceed NET_LOOP_MAX_OUTBUF.
+int net_loop_send(u32 conn, const void *data, size_t len);
+
+// Hands a buffer back to its owner once the network thread is done with it
+typedef void (*net_release_cb)(void *user, const void *data);
+
+// Queue a caller-owned buffer; it is written straight from 'data' without a
+// copy and does not count against NET_LOOP_MAX_OUTBUF, so the producer
+// bounds its own backlog. On success release(user, data) runs exactly once
+// on the network thread, after the last byte is sent or when the connection
+// goes away. Returns -1 (buffer not taken, no callback) if the connection is
+// gone.
+int net_loop_send_buffer(u32 conn, const void *data, size_t len, net_release_cb release, void *user);
+// Bytes queued on a stream connection and not yet written (0 if gone)
+size_t net_loop_pending(u32 conn);
+// Close a stream connection once its queued output has been written
+int net_loop_close(u32 conn);
+
+#endif // NET_LOOP_H
@@ -0,0 +1,377 @@
+/* segmented_download.c - parallel ranged downloads for large files.
+ *
+ * A single TCP stream on the Switch's Wi-Fi stack rarely reaches the link's
+ * capacity. This splits the file into byte ranges that are fetched over
+ * several keep-alive connections at once, each writing at its own offset of
+ * a preallocated "<out_path>.part". When a worker finishes its range it
+ * steals the upper half of the largest remaining range, so one slow
+ * connection cannot hold up the end of the download.
+ *
+ * The part file shares its resume state with download_url_to_file(): while
+ * the workers run, "<out_path>.part.meta" marks the part as sparse with the
+ * head this run started from. When a run fails the part is cut back to the
+ * bytes that are contiguous from the start, so the next attempt by either
+ * downloader fetches only what is missing.
+ *
+ * Only plain http:// is segmented (it goes through simple_http). Anything
+ * else, servers without range support and small files use the single-stream
+ * download_url_to_file().
+ */
+
+#include "downloader.h"
+#include "simple_http.h"
+#include "tls_conn.h"
+#include "../ui/ui_data.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define SEG_MAX_WORKERS     8
+#define SEG_MIN_FILE_SIZE   (8ll * 1024 * 1024)  // below this one stream is fine
+#define SEG_MIN_STEAL       (1ll * 1024 * 1024)  // don't split ranges smaller than this
+#define SEG_WRITE_BUF       (256 * 1024)         // per-worker write coalescing
+#define SEG_MAX_RETRIES     5
+
+struct SegDownload;
+
+typedef struct {
+    struct SegDownload *dl;
+    pthread_t thread;
+    long long pos;          // next byte this worker accepts (guarded by dl->lock)
+    long long end;          // exclusive; shrinks when another worker steals the tail
+    long long flushed;      // first byte of [.., end) not on disk yet (guarded by dl->lock)
+    long long req_start;    // first byte of the in-flight request
+    bool stopped;           // request cut short on purpose after a steal
+    char *buf;              // coalesced bytes waiting to be written at buf_pos
+    size_t buf_len;
+    long long buf_pos;
+} SegWorker;
+
+typedef struct SegDownload {
+    const char *url;
+    FILE *f;
+    pthread_mutex_t lock;   // guards worker ranges, the file position and counters
+    long long total;
+    long long done;         // bytes on disk
+    char validator[256];
+    bool failed;
+    bool stale;             // the resource changed; the part is useless
+    bool aborted;           // the caller's transfer hook asked to stop
+    int live;               // workers still running
+    download_transfer_hook hook;
+    void *hook_user;
+    volatile bool *cancel;  // the calling thread's flag
+    int count;
+    SegWorker workers[SEG_MAX_WORKERS];
+} SegDownload;
+
+// ---------------------------------------------------------------------------
+// Probe: one-byte ranged request to learn the size, validator and whether the
+// server honours ranges at all.
+// ---------------------------------------------------------------------------
+
+struct seg_probe { bool ranged; long long total; char validator[256]; };
+
+static int seg_probe_head(void *user, const SimpleHttpResponse *resp) {
+    struct seg_probe *p = (struct seg_probe*)user;
+    if (resp->status == 206 && resp->range_start == 0 && resp->range_total > 0) {
+        p->ranged = true;
+        p->total = resp->range_total;
+        if (resp->etag[0] && strncmp(resp->etag, "W/", 2) != 0) snprintf(p->validator, sizeof(p->validator), "%s", resp->etag);
+        else snprintf(p->validator, sizeof(p->validator), "%s", resp->last_modified);
+        return 0;
+    }
+    // Anything else would stream the whole file just to be fetched again
+    return -1;
+}
+
+// ---------------------------------------------------------------------------
+// Workers
+// ---------------------------------------------------------------------------
+
+static int seg_flush(SegWorker *w) {
+    if (w->buf_len == 0) return 0;
+    SegDownload *dl = w->dl;
+    pthread_mutex_lock(&dl->lock);
+    int rc = 0;
+    if (fseeko(dl->f, (off_t)w->buf_pos, SEEK_SET) != 0 || fwrite(w->buf, 1, w->buf_len, dl->f) != w->buf_len) rc = -1;
+    else {
+        dl->done += (long long)w->buf_len;
+        if (w->flushed == w->buf_pos) w->flushed += (long long)w->buf_len;
+    }
+    if (rc != 0) dl->failed = true; // SD write errors are not worth retrying
+    long long done = dl->done;
+    pthread_mutex_unlock(&dl->lock);
+    size_t chunk = w->buf_len;
+    w->buf_pos += (long long)w->buf_len;
+    w->buf_len = 0;
+
+    // The hook may sleep to shape bandwidth, so it runs without the lock
+    if (rc == 0 && dl->hook && dl->hook(dl->hook_user, chunk, (size_t)done, (size_t)dl->total) != 0) {
+        pthread_mutex_lock(&dl->lock);
+        dl->failed = true;
+        dl->aborted = true;
+        pthread_mutex_unlock(&dl->lock);
+        rc = -1;
+    }
+    return rc;
+}
+
+static int seg_head(void *user, const SimpleHttpResponse *resp) {
+    SegWorker *w = (SegWorker*)user;
+    // A 200 here means the If-Range validator no longer matches
+    if (resp->status != 206 || resp->range_start != w->req_start) {
+        pthread_mutex_lock(&w->dl->lock);
+        if (resp->status == 200) w->dl->failed = w->dl->stale = true;
+        pthread_mutex_unlock(&w->dl->lock);
+        return -1;
+    }
+    return 0;
+}
+
+static int seg_body(void *user, const char *data, size_t len) {
+    SegWorker *w = (SegWorker*)user;
+    SegDownload *dl = w->dl;
+    if (*dl->cancel) return -1;
+
+    // The tail of our range may have been stolen since the request was sent
+    pthread_mutex_lock(&dl->lock);
+    long long room = w->end - w->pos;
+    bool clipped = (long long)len > room;
+    size_t take = clipped ? (size_t)(room > 0 ? room : 0) : len;
+    w->pos += (long long)take;
+    bool failed = dl->failed;
+    pthread_mutex_unlock(&dl->lock);
+    if (failed) return -1;
+
+    while (take > 0) {
+        size_t n = SEG_WRITE_BUF - w->buf_len;
+        if (n > take) n = take;
+        memcpy(w->buf + w->buf_len, data, n);
+        w->buf_len += n; data += n; take -= n;
+        if (w->buf_len == SEG_WRITE_BUF && seg_flush(w) != 0) return -1;
+    }
+    if (clipped) {
+        w->stopped = true;
+        return -1;
+    }
+    return 0;
+}
+
+// Give idle worker w the upper half of the largest remaining range.
+// Caller holds dl->lock.
+static bool seg_steal(SegDownload *dl, SegWorker *w) {
+    SegWorker *victim = NULL;
+    long long best = 0;
+    for (int i = 0; i < dl->count; i++) {
+        SegWorker *v = &dl->workers[i];
+        long long remaining = v->end - v->pos;
+        if (v != w && remaining > best) { best = remaining; victim = v; }
+    }
+    if (!victim || best < 2 * SEG_MIN_STEAL) return false;
+    long long mid = victim->pos + best / 2;
+    w->pos = w->flushed = mid;
+    w->end = victim->end;
+    victim->end = mid;
+    return true;
+}
+
+static void *seg_worker_main(void *arg) {
+    SegWorker *w = (SegWorker*)arg;
+    SegDownload *dl = w->dl;
+    int failures = 0;
+    for (;;) {
+        pthread_mutex_lock(&dl->lock);
+        bool stop = dl->failed || *dl->cancel || (w->pos >= w->end && !seg_steal(dl, w));
+        long long from = w->pos, to = w->end - 1;
+        if (!stop) w->flushed = from;
+        pthread_mutex_unlock(&dl->lock);
+        if (stop) break;
+
+        char headers[512];
+        snprintf(headers, sizeof(headers), "Range: bytes=%lld-%lld\r\n%s%s%s", from, to,
+                 dl->validator[0] ? "If-Range: " : "", dl->validator, dl->validator[0] ? "\r\n" : "");
+        w->req_start = from;
+        w->buf_pos = from;
+        w->buf_len = 0;
+        w->stopped = false;
+        int rc = simple_http_get_stream_ex(dl->url, headers, seg_head, seg_body, w);
+        if (seg_flush(w) != 0) break;
+
+        // Bytes accepted but never written must be fetched again
+        pthread_mutex_lock(&dl->lock);
+        if (w->buf_pos < w->pos) w->pos = w->buf_pos;
+        pthread_mutex_unlock(&dl->lock);
+
+        if (rc != 0 && !w->stopped) {
+            if (++failures > SEG_MAX_RETRIES) {
+                pthread_mutex_lock(&dl->lock);
+                dl->failed = true;
+                pthread_mutex_unlock(&dl->lock);
+                break;
+            }
+            usleep(250 * 1000 * failures);
+        }
+    }
+    pthread_mutex_lock(&dl->lock);
+    dl->live--;
+    pthread_mutex_unlock(&dl->lock);
+    return NULL;
+}
+
+// Bytes known to be on disk from the start of the file: everything below
+// the lowest range a worker still has to finish. Caller holds dl->lock or
+// has joined the workers.
+static long long seg_contiguous(const SegDownload *dl) {
+    long long head = dl->total;
+    for (int i = 0; i < dl->count; i++) {
+        const SegWorker *w = &dl->workers[i];
+        if (w->flushed < w->end && w->flushed < head) head = w->flushed;
+    }
+    return head;
+}
+
+// How much of an existing part file this run can keep: its head, if it was
+// written for the same URL and the same version of the resource
+static long long seg_resume_offset(const char *url, const char *part_path, const DownloadPartMeta *meta,
+                                   const struct seg_probe *probe) {
+    struct stat st;
+    if (!probe->validator[0] || strcmp(meta->url, url) != 0 || strcmp(meta->validator, probe->validator) != 0 ||
+        meta->total != probe->total || stat(part_path, &st) != 0) {
+        return 0;
+    }
+    long long head = (long long)st.st_size;
+    if (meta->sparse && head > meta->valid) head = meta->valid;
+    return head < probe->total ? head : 0;
+}
+
+int download_url_to_file_segmented(const char *url, const char *out_path, int segments, download_progress_cb progress_cb) {
+    if (!url || !out_path) return -1;
+    if (segments > SEG_MAX_WORKERS) segments = SEG_MAX_WORKERS;
+    bool https = strncmp(url, "https://", 8) == 0 && tls_available();
+    if (segments < 2 || (strncmp(url, "http://", 7) != 0 && !https)) return download_url_to_file(url, out_path, progress_cb);
+
+    struct seg_probe probe; memset(&probe, 0, sizeof(probe));
+    if (simple_http_get_stream_ex(url, "Range: bytes=0-0\r\n", seg_probe_head, NULL, &probe) != 0 ||
+        !probe.ranged || probe.total < SEG_MIN_FILE_SIZE) {
+        return download_url_to_file(url, out_path, progress_cb);
+    }
+
+    char part_path[PATH_MAX], meta_path[PATH_MAX];
+    if (snprintf(part_path, sizeof(part_path), "%s.part", out_path) >= (int)sizeof(part_path) ||
+        snprintf(meta_path, sizeof(meta_path), "%s.part.meta", out_path) >= (int)sizeof(meta_path)) {
+        return -1;
+    }
+    DownloadPartMeta meta;
+    if (download_part_meta_load(meta_path, &meta) != 0) memset(&meta, 0, sizeof(meta));
+    long long head = seg_resume_offset(url, part_path, &meta, &probe);
+    // Too little left to split; one stream resumes the part as it is
+    if (probe.total - head < SEG_MIN_FILE_SIZE) return download_url_to_file(url, out_path, progress_cb);
+
+    FILE *f = fopen(part_path, head > 0 ? "r+b" : "w+b");
+    if (!f) return -1;
+    // Mark the part sparse before growing it, so a crash mid-run resumes
+    // from this run's head rather than trusting preallocated space
+    snprintf(meta.url, sizeof(meta.url), "%s", url);
+    memcpy(meta.validator, probe.validator, sizeof(meta.validator));
+    meta.total = probe.total;
+    meta.sparse = true;
+    meta.valid = head;
+    download_part_meta_save(meta_path, &meta);
+    // Preallocate so each segment can write at its own offset
+    if (ftruncate(fileno(f), (off_t)probe.total) != 0) { fclose(f); return -1; }
+
+    SegDownload *dl = calloc(1, sizeof(SegDownload));
+    if (!dl) { fclose(f); return -1; }
+    dl->url = url; dl->f = f; dl->total = probe.total; dl->count = segments; dl->done = head;
+    memcpy(dl->validator, probe.validator, sizeof(dl->validator));
+    // The workers report to the caller's hook, which is per-thread
+    downloader_get_thread_hook(&dl->hook, &dl->hook_user);
+    pthread_mutex_init(&dl->lock, NULL);
+
+    downloader_cancel_reset();
+    volatile bool *cancel = downloader_thread_cancel();
+    dl->cancel = cancel;
+    const char *slash_name = strrchr(out_path, '/');
+    const char *fname = slash_name ? slash_name + 1 : out_path;
+    ui_downloads_push_update(fname, (int)((head * 100) / probe.total));
+
+    // Split what is missing. A range whose worker cannot start goes to the
+    // last worker that did, or to the next one if none has yet.
+    SegWorker *last = NULL;
+    long long seg_size = (probe.total - head) / segments;
+    long long next = head;
+    for (int i = 0; i < segments; i++) {
+        SegWorker *w = &dl->workers[i];
+        w->dl = dl;
+        long long end = (i == segments - 1) ? probe.total : head + (long long)(i + 1) * seg_size;
+        pthread_mutex_lock(&dl->lock);
+        w->pos = w->flushed = next;
+        w->end = end;
+        dl->live++;
+        pthread_mutex_unlock(&dl->lock);
+        w->buf = malloc(SEG_WRITE_BUF);
+        if (w->buf && pthread_create(&w->thread, NULL, seg_worker_main, w) == 0) {
+            last = w;
+            next = end;
+            continue;
+        }
+        free(w->buf); w->buf = NULL;
+        pthread_mutex_lock(&dl->lock);
+        dl->live--;
+        w->pos = w->flushed = w->end = 0;
+        if (last) last->end = end;
+        pthread_mutex_unlock(&dl->lock);
+        if (last) next = end;
+    }
+    if (!last) dl->failed = true;
+
+    // Report progress from the calling thread while the workers run
+    for (;;) {
+        pthread_mutex_lock(&dl->lock);
+        long long done = dl->done;
+        bool failed = dl->failed;
+        int live = dl->live;
+        pthread_mutex_unlock(&dl->lock);
+        if (progress_cb) progress_cb("Downloading", (size_t)done, (size_t)dl->total);
+        ui_downloads_push_update(fname, (int)((done * 100) / dl->total));
+        if (done >= dl->total || failed || *cancel || live == 0) break;
+        usleep(100 * 1000);
+    }
+    for (int i = 0; i < segments; i++) {
+        if (dl->workers[i].buf) pthread_join(dl->workers[i].thread, NULL);
+        free(dl->workers[i].buf);
+    }
+
+    int rc = (dl->done == dl->total && !dl->failed) ? 0 : -1;
+    bool aborted = dl->aborted, stale = dl->stale;
+    long long good = seg_contiguous(dl);
+    // Keep the contiguous head for the next attempt; the rest is refetched
+    if (rc != 0 && !stale && (fflush(f) != 0 || ftruncate(fileno(f), (off_t)good) != 0)) stale = true;
+    if (fclose(f) != 0) rc = -1;
+    pthread_mutex_destroy(&dl->lock);
+    free(dl);
+
+    ui_downloads_remove(fname);
+    ui_clear_task();
+    if (rc != 0) {
+        if (stale || *cancel) {
+            remove(part_path);
+            remove(meta_path);
+        } else {
+            meta.sparse = false;
+            download_part_meta_save(meta_path, &meta);
+        }
+        // The server may have refused parallel ranges; one stream still works
+        if (!aborted && !*cancel) return download_url_to_file(url, out_path, progress_cb);
+        return -1;
+    }
+    remove(meta_path);
+    remove(out_path); // FAT does not replace on rename
+    return rename(part_path, out_path) == 0 ? 0 : -1;
+}
@@ -1,25 +1,94 @@
-// simple_http.c - minimal HTTP GET implementation using BSD sockets
+// simple_http.c - minimal HTTP/1.1 GET implementation using BSD sockets
 // Notes:
-// - Supports only plain HTTP (no TLS). HTTPS will return error unless
-//   libcurl or mbedTLS support is enabled elsewhere.
-// - This is intentionally small and defensive; it reads until the server
-//   closes the connection and returns the body (strips headers).
+// - https:// goes through tls_conn.c when built with USE_MBEDTLS and fails
+//   otherwise. TLS connections are pooled like plain ones, so a host's
+//   handshake is paid once per idle period rather than once per request.
+// - Connections are kept alive and parked in a small shared pool (at most
+//   HTTP_POOL_PER_HOST to one host), and resolved addresses are cached, so
+//   fetching a repository index plus its icons pays for one TCP handshake instead of one per file or redirect.
+//   The pool and cache are shared between threads under s_lock.
+// - Bodies are framed by Content-Length or chunked encoding; only responses
+//   with neither are read until the server closes the connection.
+// - Body data is handed to a callback straight out of the socket receive
+//   buffer; simple_http_get() is just a memory sink on top of that.
+// - gzip/deflate responses are inflated between the socket and the callback
+//   (http_inflate.c). Ranged requests ask for the identity encoding so byte
+//   offsets keep referring to the resource itself.
 
 #include "simple_http.h"
+#include "http_inflate.h"
+#include "tls_conn.h"
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
+#include <time.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 
-// Helper: parse URL of form http://host[:port]/path
-static int parse_http_url(const char *url, char **out_host, char **out_port, char **out_path) {
+#define HTTP_POOL_SIZE       8      // idle keep-alive connections kept around
+#define HTTP_POOL_PER_HOST   4      // of which at most this many to one host
+#define HTTP_POOL_IDLE_SECS  30     // drop idle connections older than this
+#define HTTP_DNS_CACHE_SIZE  8
+#define HTTP_DNS_TTL_SECS    300
+#define HTTP_MAX_REDIRECTS   4
+#define HTTP_RECV_TIMEOUT    30     // seconds without data before giving up
+#define HTTP_RBUF_SIZE       (64 * 1024) // also bounds the response header size
+#define HTTP_LINE_MAX        (16 * 1024) // longest header line (signed CDN redirects run long)
+
+typedef struct {
+    int sock;
+    TlsConn *tls;               // NULL for plain http
+    char host[256];
+    char port[8];
+    time_t last_used;
+    bool reused;                // served at least one earlier request
+    char rbuf[HTTP_RBUF_SIZE];  // bytes received but not yet consumed
+    size_t rpos, rlen;
+} HttpConn;
+
+typedef struct {
+    int status;
+    long long content_length;   // -1 when not sent
+    bool chunked;
+    bool keep_alive;
+    char *location;             // redirect target (heap), NULL if none
+    char etag[128];
+    char last_modified[64];
+    long long range_start;
+    long long range_total;
+    HttpCoding coding;          // Content-Encoding
+} HttpResponseHead;
+
+typedef struct {
+    bool valid;
+    char host[256];
+    char port[8];
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    int family, socktype, protocol;
+    time_t expires;
+} HttpDnsEntry;
+
+static HttpConn *s_pool[HTTP_POOL_SIZE];
+static HttpDnsEntry s_dns_cache[HTTP_DNS_CACHE_SIZE];
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Split http(s)://host[:port]/path; https only when TLS is built in
+static int parse_url_scheme(const char *url, char **out_host, char **out_port, char **out_path, bool *out_tls) {
     if (!url) return -1;
     const char *p = url;
+    *out_tls = false;
     if (strncmp(p, "http://", 7) == 0) p += 7;
-    else return -1; // only http supported
+    else if (strncmp(p, "https://", 8) == 0 && tls_available()) { p += 8; *out_tls = true; }
+    else return -1;
 
     const char *host_start = p;
     const char *path_start = strchr(p, '/');
@@ -32,173 +101,566 @@ static int parse_http_url(const char *url, char **out_host, char **out_port, cha
         *out_port = strndup(colon + 1, host_end - colon - 1);
     } else {
         *out_host = strndup(host_start, host_end - host_start);
-        *out_port = strdup("80");
+        *out_port = strdup(*out_tls ? "443" : "80");
     }
     if (path_start) *out_path = strdup(path_start);
     else *out_path = strdup("/");
     return 0;
 }
 
-int simple_http_get(const char *url, char **out_buf, size_t *out_len) {
-    if (!url || !out_buf || !out_len) return -1;
+// Helper: parse URL of form http://host[:port]/path
+int simple_http_parse_url(const char *url, char **out_host, char **out_port, char **out_path) {
+    bool tls;
+    if (!url || strncmp(url, "http://", 7) != 0) return -1; // only plain http here
+    return parse_url_scheme(url, out_host, out_port, out_path, &tls);
+}
 
-    // Follow up to 4 redirects
-    char *current_url = strdup(url);
-    int redirects = 0;
-    int final_rc = -1;
-    while (redirects < 4) {
-        char *host = NULL, *port = NULL, *path = NULL;
-        if (parse_http_url(current_url, &host, &port, &path) != 0) { free(current_url); return -1; }
-
-        struct addrinfo hints, *res = NULL;
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_UNSPEC;
-        hints.ai_socktype = SOCK_STREAM;
-
-        int rc = getaddrinfo(host, port, &hints, &res);
-        if (rc != 0) {
-            free(host); free(port); free(path); free(current_url);
-            return -1;
-        }
-
-        int sock = -1;
-        struct addrinfo *rp;
-        for (rp = res; rp != NULL; rp = rp->ai_next) {
-            sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-            if (sock == -1) continue;
-            if (connect(sock, rp->ai_addr, rp->ai_addrlen) == 0) break;
-            close(sock); sock = -1;
-        }
-        freeaddrinfo(res);
-        if (sock == -1) { free(host); free(port); free(path); free(current_url); return -1; }
-
-        // Build request
-        char req[1024];
-        snprintf(req, sizeof(req), "GET %s HTTP/1.0\r\nHost: %s\r\nConnection: close\r\nUser-Agent: DBFM/1.0\r\n\r\n", path, host);
-
-        ssize_t sent = send(sock, req, strlen(req), 0);
-        if (sent < 0) { close(sock); free(host); free(port); free(path); free(current_url); return -1; }
-
-        // Read response into growing buffer
-        size_t cap = 8192;
-        char *buf = malloc(cap);
-        if (!buf) { close(sock); free(host); free(port); free(path); free(current_url); return -1; }
-        size_t len = 0;
-        for (;;) {
-            if (len + 4096 > cap) {
-                size_t nc = cap * 2;
-                char *nb = realloc(buf, nc);
-                if (!nb) { free(buf); close(sock); free(host); free(port); free(path); free(current_url); return -1; }
-                buf = nb; cap = nc;
-            }
-            ssize_t r = recv(sock, buf + len, cap - len, 0);
-            if (r < 0) { free(buf); close(sock); free(host); free(port); free(path); free(current_url); return -1; }
-            if (r == 0) break; // closed
-            len += (size_t)r;
-        }
-        close(sock);
-
-        // Find header/body split: \r\n\r\n
-        const char *body = NULL; size_t body_len = 0; size_t header_len = 0;
-        for (size_t i = 0; i + 3 < len; ++i) {
-            if (buf[i] == '\r' && buf[i+1] == '\n' && buf[i+2] == '\r' && buf[i+3] == '\n') {
-                body = buf + i + 4;
-                header_len = i + 4;
-                body_len = len - header_len;
-                break;
-            }
+// Resolve a relative Location header against the URL that produced it.
+char *simple_http_resolve_location(const char *base_url, const char *location) {
+    if (strncmp(location, "http://", 7) == 0 || strncmp(location, "https://", 8) == 0) return strdup(location);
+    const char *host_start = strstr(base_url, "://");
+    host_start = host_start ? host_start + 3 : base_url;
+    const char *path_start = strchr(host_start, '/');
+    size_t origin_len = path_start ? (size_t)(path_start - base_url) : strlen(base_url);
+    size_t n = origin_len + strlen(location) + 2;
+    char *out = malloc(n);
+    if (!out) return NULL;
+    if (location[0] == '/') {
+        snprintf(out, n, "%.*s%s", (int)origin_len, base_url, location);
+    } else {
+        // relative to the directory of the current path
+        const char *last_slash = path_start ? strrchr(path_start, '/') : NULL;
+        size_t dir_len = last_slash ? (size_t)(last_slash - base_url) + 1 : origin_len;
+        n = dir_len + strlen(location) + 2;
+        char *grown = realloc(out, n);
+        if (!grown) { free(out); return NULL; }
+        out = grown;
+        snprintf(out, n, "%.*s%s%s", (int)dir_len, base_url, last_slash ? "" : "/", location);
+    }
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// DNS cache
+// ---------------------------------------------------------------------------
+
+// Caller holds s_lock
+static HttpDnsEntry *dns_lookup(const char *host, const char *port) {
+    time_t now = time(NULL);
+    for (int i = 0; i < HTTP_DNS_CACHE_SIZE; i++) {
+        HttpDnsEntry *e = &s_dns_cache[i];
+        if (!e->valid) continue;
+        if (e->expires <= now) { e->valid = false; continue; }
+        if (strcmp(e->host, host) == 0 && strcmp(e->port, port) == 0) return e;
+    }
+    return NULL;
+}
+
+static void dns_invalidate(const char *host, const char *port) {
+    pthread_mutex_lock(&s_lock);
+    for (int i = 0; i < HTTP_DNS_CACHE_SIZE; i++) {
+        HttpDnsEntry *e = &s_dns_cache[i];
+        if (e->valid && strcmp(e->host, host) == 0 && strcmp(e->port, port) == 0) e->valid = false;
+    }
+    pthread_mutex_unlock(&s_lock);
+}
+
+static void dns_store(const char *host, const char *port, const struct addrinfo *ai) {
+    if (ai->ai_addrlen > sizeof(struct sockaddr_storage)) return;
+    pthread_mutex_lock(&s_lock);
+    // Reuse a free or expired slot, otherwise evict the entry closest to expiry
+    HttpDnsEntry *slot = &s_dns_cache[0];
+    for (int i = 0; i < HTTP_DNS_CACHE_SIZE; i++) {
+        HttpDnsEntry *e = &s_dns_cache[i];
+        if (!e->valid) { slot = e; break; }
+        if (e->expires < slot->expires) slot = e;
+    }
+    memset(slot, 0, sizeof(*slot));
+    snprintf(slot->host, sizeof(slot->host), "%s", host);
+    snprintf(slot->port, sizeof(slot->port), "%s", port);
+    memcpy(&slot->addr, ai->ai_addr, ai->ai_addrlen);
+    slot->addrlen = ai->ai_addrlen;
+    slot->family = ai->ai_family;
+    slot->socktype = ai->ai_socktype;
+    slot->protocol = ai->ai_protocol;
+    slot->expires = time(NULL) + HTTP_DNS_TTL_SECS;
+    slot->valid = true;
+    pthread_mutex_unlock(&s_lock);
+}
+
+// ---------------------------------------------------------------------------
+// Connections
+// ---------------------------------------------------------------------------
+
+static void socket_tune(int sock) {
+    struct timeval tv = { HTTP_RECV_TIMEOUT, 0 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+static int connect_cached(const char *host, const char *port) {
+    HttpDnsEntry cached;
+    pthread_mutex_lock(&s_lock);
+    HttpDnsEntry *e = dns_lookup(host, port);
+    if (e) cached = *e;
+    pthread_mutex_unlock(&s_lock);
+    if (e) {
+        int sock = socket(cached.family, cached.socktype, cached.protocol);
+        if (sock >= 0) {
+            if (connect(sock, (struct sockaddr*)&cached.addr, cached.addrlen) == 0) return sock;
+            close(sock);
         }
-        if (!body) {
-            // no header separation; return whole buffer
-            *out_buf = buf; *out_len = len;
-            free(host); free(port); free(path); free(current_url);
+        // The host may have moved; fall back to a fresh lookup
+        dns_invalidate(host, port);
+    }
+
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0) return -1;
+
+    int sock = -1;
+    for (struct addrinfo *rp = res; rp != NULL; rp = rp->ai_next) {
+        sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (sock == -1) continue;
+        if (connect(sock, rp->ai_addr, rp->ai_addrlen) == 0) {
+            dns_store(host, port, rp);
+            break;
+        }
+        close(sock); sock = -1;
+    }
+    freeaddrinfo(res);
+    return sock;
+}
+
+int simple_http_resolve(const char *host, const char *port, struct sockaddr_storage *out_addr,
+                        socklen_t *out_len, int *out_family) {
+    pthread_mutex_lock(&s_lock);
+    HttpDnsEntry *e = dns_lookup(host, port);
+    if (e) {
+        memcpy(out_addr, &e->addr, e->addrlen);
+        *out_len = e->addrlen;
+        *out_family = e->family;
+    }
+    pthread_mutex_unlock(&s_lock);
+    if (e) return 0;
+
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0 || !res) return -1;
+    memcpy(out_addr, res->ai_addr, res->ai_addrlen);
+    *out_len = res->ai_addrlen;
+    *out_family = res->ai_family;
+    dns_store(host, port, res);
+    freeaddrinfo(res);
+    return 0;
+}
+
+static void conn_close(HttpConn *c) {
+    if (!c) return;
+    tls_conn_close(c->tls);
+    if (c->sock >= 0) close(c->sock);
+    free(c);
+}
+
+// Take an idle pooled connection to host:port, or open a new one.
+static HttpConn *conn_acquire(const char *host, const char *port, bool tls) {
+    time_t now = time(NULL);
+    pthread_mutex_lock(&s_lock);
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        HttpConn *c = s_pool[i];
+        if (!c) continue;
+        if (now - c->last_used > HTTP_POOL_IDLE_SECS) {
+            conn_close(c); s_pool[i] = NULL;
+            continue;
+        }
+        if (strcmp(c->host, host) == 0 && strcmp(c->port, port) == 0 && (c->tls != NULL) == tls) {
+            s_pool[i] = NULL;
+            pthread_mutex_unlock(&s_lock);
+            c->reused = true;
+            return c;
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+
+    int sock = connect_cached(host, port);
+    if (sock < 0) return NULL;
+    HttpConn *c = calloc(1, sizeof(HttpConn));
+    if (!c) { close(sock); return NULL; }
+    socket_tune(sock);
+    c->sock = sock;
+    if (tls && !(c->tls = tls_conn_open(sock, host, port))) {
+        conn_close(c);
+        return NULL;
+    }
+    snprintf(c->host, sizeof(c->host), "%s", host);
+    snprintf(c->port, sizeof(c->port), "%s", port);
+    return c;
+}
+
+// Park a connection for reuse. A host that already has its share parked
+// gives up its least recently used one; otherwise a free slot is taken, or
+// the least recently used connection overall is evicted.
+static void conn_release(HttpConn *c) {
+    if (!c) return;
+    c->last_used = time(NULL);
+    c->rpos = c->rlen = 0;
+    pthread_mutex_lock(&s_lock);
+    int slot = -1, free_slot = -1, oldest = 0, same_host = 0;
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        HttpConn *p = s_pool[i];
+        if (!p) {
+            if (free_slot < 0) free_slot = i;
+            continue;
+        }
+        if (s_pool[oldest] == NULL || p->last_used < s_pool[oldest]->last_used) oldest = i;
+        if (strcmp(p->host, c->host) == 0 && strcmp(p->port, c->port) == 0) {
+            if (slot < 0 || p->last_used < s_pool[slot]->last_used) slot = i;
+            same_host++;
+        }
+    }
+    if (same_host < HTTP_POOL_PER_HOST) slot = free_slot >= 0 ? free_slot : oldest;
+    HttpConn *evicted = s_pool[slot];
+    s_pool[slot] = c;
+    pthread_mutex_unlock(&s_lock);
+    conn_close(evicted);
+}
+
+void simple_http_close_idle(void) {
+    pthread_mutex_lock(&s_lock);
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        if (s_pool[i]) { conn_close(s_pool[i]); s_pool[i] = NULL; }
+    }
+    pthread_mutex_unlock(&s_lock);
+}
+
+// Receive more bytes into the connection buffer. Returns bytes read, 0 on
+// orderly close, -1 on error.
+static ssize_t conn_fill(HttpConn *c) {
+    if (c->rpos > 0) {
+        memmove(c->rbuf, c->rbuf + c->rpos, c->rlen - c->rpos);
+        c->rlen -= c->rpos; c->rpos = 0;
+    }
+    if (c->rlen >= sizeof(c->rbuf)) return -1;
+    ssize_t r;
+    if (c->tls) r = tls_conn_recv(c->tls, c->rbuf + c->rlen, sizeof(c->rbuf) - c->rlen);
+    else do { r = recv(c->sock, c->rbuf + c->rlen, sizeof(c->rbuf) - c->rlen, 0); } while (r < 0 && errno == EINTR);
+    if (r > 0) c->rlen += (size_t)r;
+    return r;
+}
+
+// Read one CRLF-terminated line (without the terminator) into out. A line
+// that does not fit fails rather than being cut short.
+static int conn_read_line(HttpConn *c, char *out, size_t out_size) {
+    for (;;) {
+        char *start = c->rbuf + c->rpos;
+        char *nl = memchr(start, '\n', c->rlen - c->rpos);
+        if (nl) {
+            size_t len = (size_t)(nl - start);
+            if (len > 0 && start[len - 1] == '\r') len--;
+            if (len >= out_size) return -1;
+            memcpy(out, start, len); out[len] = '\0';
+            c->rpos += (size_t)(nl - start) + 1;
             return 0;
         }
+        if (conn_fill(c) <= 0) return -1;
+    }
+}
+
+static int send_all(HttpConn *c, const char *data, size_t len) {
+    if (c->tls) return tls_conn_send_all(c->tls, data, len);
+    while (len > 0) {
+        ssize_t n = send(c->sock, data, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n; len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int read_response_head(HttpConn *c, HttpResponseHead *head) {
+    memset(head, 0, sizeof(*head));
+    head->content_length = -1;
+    head->range_start = -1;
+    head->range_total = -1;
+    char *line = malloc(HTTP_LINE_MAX);
+    if (!line) return -1;
+
+    // Skip interim 1xx responses (e.g. 100 Continue)
+    int rc = 0;
+    do {
+        int minor = 0;
+        if (conn_read_line(c, line, HTTP_LINE_MAX) != 0 ||
+            sscanf(line, "HTTP/1.%d %d", &minor, &head->status) != 2) {
+            rc = -1;
+            break;
+        }
+        head->keep_alive = minor >= 1;
+        if (head->status >= 200) break;
+        while ((rc = conn_read_line(c, line, HTTP_LINE_MAX)) == 0 && line[0]) {}
+    } while (rc == 0);
 
-        // Parse status code from first line
-        int status = 0;
-        char status_line[128] = {0};
-        size_t i = 0;
-        while (i < header_len && i < sizeof(status_line)-1 && buf[i] != '\r') { status_line[i] = buf[i]; i++; }
-        status = 0; sscanf(status_line, "HTTP/%*s %d", &status);
-
-        // Parse headers for Transfer-Encoding and Location
-        int is_chunked = 0;
-        char *location = NULL;
-        const char *hpos = buf;
-        while (hpos < buf + header_len) {
-            const char *line_end = strstr(hpos, "\r\n");
-            if (!line_end) break;
-            size_t llen = line_end - hpos;
-            if (llen == 0) break; // end headers
-            if (strncasecmp(hpos, "Transfer-Encoding:", 18) == 0) {
-                if (strncasecmp(hpos+18, " chunked", 8) == 0) is_chunked = 1;
-                else if (strstr(hpos+18, "chunked")) is_chunked = 1;
+    while (rc == 0) {
+        if (conn_read_line(c, line, HTTP_LINE_MAX) != 0) {
+            rc = -1;
+            break;
+        }
+        if (line[0] == '\0') break; // end headers
+        char *value = strchr(line, ':');
+        if (!value) continue;
+        *value++ = '\0';
+        while (*value == ' ' || *value == '\t') value++;
+        if (strcasecmp(line, "Content-Length") == 0) {
+            head->content_length = atoll(value);
+        } else if (strcasecmp(line, "Transfer-Encoding") == 0) {
+            if (strstr(value, "chunked")) head->chunked = true;
+        } else if (strcasecmp(line, "Content-Encoding") == 0) {
+            head->coding = http_coding_parse(value);
+        } else if (strcasecmp(line, "Connection") == 0) {
+            if (strcasecmp(value, "close") == 0) head->keep_alive = false;
+            else if (strcasecmp(value, "keep-alive") == 0) head->keep_alive = true;
+        } else if (strcasecmp(line, "Location") == 0) {
+            free(head->location);
+            head->location = strdup(value);
+        } else if (strcasecmp(line, "ETag") == 0) {
+            snprintf(head->etag, sizeof(head->etag), "%s", value);
+        } else if (strcasecmp(line, "Last-Modified") == 0) {
+            snprintf(head->last_modified, sizeof(head->last_modified), "%s", value);
+        } else if (strcasecmp(line, "Content-Range") == 0) {
+            // "bytes <start>-<end>/<total|*>"
+            long long start = -1, end = -1;
+            if (sscanf(value, "bytes %lld-%lld", &start, &end) == 2) head->range_start = start;
+            const char *slash = strchr(value, '/');
+            if (slash && slash[1] != '*') head->range_total = atoll(slash + 1);
+        }
+    }
+    free(line);
+    if (rc != 0) {
+        free(head->location);
+        head->location = NULL;
+    }
+    return rc;
+}
+
+// Deliver up to 'remaining' body bytes (or everything until close when
+// remaining < 0) from the connection to the sink.
+static int read_body_bytes(HttpConn *c, long long remaining, simple_http_body_cb sink, void *user) {
+    for (;;) {
+        size_t avail = c->rlen - c->rpos;
+        if (avail > 0) {
+            size_t n = avail;
+            if (remaining >= 0 && (long long)n > remaining) n = (size_t)remaining;
+            if (n > 0 && sink && sink(user, c->rbuf + c->rpos, n) != 0) return -1;
+            c->rpos += n;
+            if (remaining >= 0) remaining -= (long long)n;
+        }
+        if (remaining == 0) return 0;
+        c->rpos = c->rlen = 0; // everything buffered was consumed
+        ssize_t r = conn_fill(c);
+        if (r == 0) return remaining < 0 ? 0 : -1; // close ends an unframed body
+        if (r < 0) return -1;
+    }
+}
+
+static int read_chunked_body(HttpConn *c, simple_http_body_cb sink, void *user) {
+    char line[1024];
+    for (;;) {
+        if (conn_read_line(c, line, sizeof(line)) != 0) return -1;
+        unsigned long long chunk_size = strtoull(line, NULL, 16);
+        if (chunk_size == 0) break;
+        if (read_body_bytes(c, (long long)chunk_size, sink, user) != 0) return -1;
+        if (conn_read_line(c, line, sizeof(line)) != 0) return -1; // CRLF after data
+    }
+    // Trailer headers end with an empty line
+    do {
+        if (conn_read_line(c, line, sizeof(line)) != 0) return -1;
+    } while (line[0]);
+    return 0;
+}
+
+static bool status_has_body(int status) {
+    return !(status == 204 || status == 304 || (status >= 100 && status < 200));
+}
+
+static bool is_redirect(int status) {
+    return status == 301 || status == 302 || status == 303 || status == 307 || status == 308;
+}
+
+// True if the CRLF-separated header lines contain 'name'
+static bool has_header(const char *headers, const char *name) {
+    size_t len = strlen(name);
+    for (const char *line = headers; line && *line; ) {
+        if (strncasecmp(line, name, len) == 0 && line[len] == ':') return true;
+        line = strchr(line, '\n');
+        if (line) line++;
+    }
+    return false;
+}
+
+// Send one GET on a connection and read its response head. A pooled
+// connection the server already closed is retried once on a fresh socket.
+static HttpConn *http_send_request(const char *host, const char *port, const char *path, bool tls,
+                                   const char *extra_headers, HttpResponseHead *head) {
+    char req[4096];
+    bool default_port = strcmp(port, tls ? "443" : "80") == 0;
+    // A compressed 206 would be a range of the compressed bytes
+    const char *accept = has_header(extra_headers, "Range") ? "" : http_accept_encoding();
+    int n = snprintf(req, sizeof(req),
+             "GET %s HTTP/1.1\r\nHost: %s%s%s\r\nConnection: keep-alive\r\nUser-Agent: DBFM/1.0\r\n%s%s\r\n",
+             path, host, default_port ? "" : ":", default_port ? "" : port, accept,
+             extra_headers ? extra_headers : "");
+    if (n < 0 || (size_t)n >= sizeof(req)) return NULL;
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        HttpConn *c = conn_acquire(host, port, tls);
+        if (!c) return NULL;
+        if (send_all(c, req, strlen(req)) == 0 && read_response_head(c, head) == 0) return c;
+        bool was_reused = c->reused;
+        free(head->location); head->location = NULL;
+        conn_close(c);
+        if (!was_reused) return NULL;
+    }
+    return NULL;
+}
+
+// Fetch url, following redirects, and stream the final body into sink.
+static int http_fetch(const char *url, const char *extra_headers,
+                      simple_http_head_cb on_head, simple_http_body_cb sink, void *user) {
+    char *current_url = strdup(url);
+    if (!current_url) return -1;
+
+    for (int redirects = 0; redirects <= HTTP_MAX_REDIRECTS; redirects++) {
+        char *host = NULL, *port = NULL, *path = NULL;
+        bool tls = false;
+        if (parse_url_scheme(current_url, &host, &port, &path, &tls) != 0) { free(current_url); return -1; }
+
+        HttpResponseHead head;
+        HttpConn *c = http_send_request(host, port, path, tls, extra_headers, &head);
+        free(host); free(port); free(path);
+        if (!c) { free(current_url); return -1; }
+
+        bool follow = is_redirect(head.status) && head.location;
+        simple_http_body_cb body_sink = follow ? NULL : sink; // redirect bodies are drained
+        void *body_user = user;
+        HttpInflate *inflater = NULL;
+        if (!follow && status_has_body(head.status) && head.coding != HTTP_CODING_IDENTITY) {
+            // Codings we cannot decode are passed through as before
+            inflater = http_inflate_create(head.coding, sink, user);
+            if (inflater) { body_sink = http_inflate_body_cb; body_user = inflater; }
+        }
+        int rc = 0;
+        if (!follow && on_head) {
+            SimpleHttpResponse resp;
+            memset(&resp, 0, sizeof(resp));
+            resp.status = head.status;
+            resp.content_length = head.content_length;
+            resp.chunked = head.chunked;
+            memcpy(resp.etag, head.etag, sizeof(resp.etag));
+            memcpy(resp.last_modified, head.last_modified, sizeof(resp.last_modified));
+            resp.range_start = head.range_start;
+            resp.range_total = head.range_total;
+            if (inflater) {
+                resp.decoded = true;
+                resp.content_length = -1;
             }
-            if (strncasecmp(hpos, "Location:", 9) == 0) {
-                // store location
-                size_t off = 9; while (off < llen && (hpos[off] == ' ' || hpos[off] == '\t')) off++;
-                location = strndup(hpos + off, llen - off);
+            if (on_head(user, &resp) != 0) {
+                http_inflate_destroy(inflater);
+                conn_close(c);
+                free(head.location); free(current_url);
+                return -1;
             }
-            hpos = line_end + 2;
         }
+        bool framed = true;
+        if (status_has_body(head.status)) {
+            if (head.chunked) rc = read_chunked_body(c, body_sink, body_user);
+            else if (head.content_length >= 0) rc = read_body_bytes(c, head.content_length, body_sink, body_user);
+            else { rc = read_body_bytes(c, -1, body_sink, body_user); framed = false; }
+        }
+        if (inflater) {
+            if (rc == 0) rc = http_inflate_finish(inflater);
+            http_inflate_destroy(inflater);
+        }
+        if (rc == 0 && framed && head.keep_alive) conn_release(c);
+        else conn_close(c);
 
-        // Handle redirects
-        if ((status == 301 || status == 302 || status == 303 || status == 307 || status == 308) && location) {
-            // follow redirect
-            free(buf);
-            free(host); free(port); free(path);
+        if (rc != 0) { free(head.location); free(current_url); return -1; }
+        if (follow) {
+            char *next = simple_http_resolve_location(current_url, head.location);
+            free(head.location);
             free(current_url);
-            current_url = location; // already strdup'd
-            redirects++;
+            if (!next) return -1;
+            current_url = next;
             continue;
         }
+        free(head.location);
+        free(current_url);
+        return 0;
+    }
+    free(current_url);
+    return -1; // too many redirects
+}
 
-        // Handle chunked transfer encoding
-        if (is_chunked) {
-            // decode chunked body
-            size_t out_cap = 1024;
-            char *out = malloc(out_cap);
-            size_t out_len_local = 0;
-            const char *p = body;
-            const char *endp = buf + len;
-            while (p < endp) {
-                // read chunk size line
-                const char *ln = strstr(p, "\r\n");
-                if (!ln) break;
-                char numbuf[32]; size_t nlen = ln - p; if (nlen >= sizeof(numbuf)) nlen = sizeof(numbuf)-1;
-                memcpy(numbuf, p, nlen); numbuf[nlen] = '\0';
-                unsigned int chunk_size = 0; sscanf(numbuf, "%x", &chunk_size);
-                p = ln + 2;
-                if (chunk_size == 0) break;
-                if (out_len_local + chunk_size + 1 > out_cap) {
-                    size_t nc = out_cap;
-                    while (out_len_local + chunk_size + 1 > nc) nc *= 2;
-                    char *nb = realloc(out, nc);
-                    if (!nb) { free(out); free(buf); free(host); free(port); free(path); free(current_url); return -1; }
-                    out = nb; out_cap = nc;
-                }
-                if (p + chunk_size > endp) break;
-                memcpy(out + out_len_local, p, chunk_size);
-                out_len_local += chunk_size;
-                p += chunk_size;
-                // skip CRLF
-                if (p + 2 <= endp && p[0] == '\r' && p[1] == '\n') p += 2;
-            }
-            out[out_len_local] = '\0';
-            *out_buf = out; *out_len = out_len_local;
-            free(buf); free(host); free(port); free(path); free(current_url);
-            final_rc = 0; break;
-        } else {
-            // normal body
-            char *b = malloc(body_len + 1);
-            if (!b) { free(buf); free(host); free(port); free(path); free(current_url); return -1; }
-            memcpy(b, body, body_len);
-            b[body_len] = '\0';
-            *out_buf = b; *out_len = body_len;
-            free(buf); free(host); free(port); free(path); free(current_url);
-            final_rc = 0; break;
-        }
-    }
-    return final_rc;
+// ---------------------------------------------------------------------------
+// Whole-body GET
+// ---------------------------------------------------------------------------
+
+int simple_http_get_stream(const char *url, simple_http_head_cb on_head, simple_http_body_cb on_body, void *user) {
+    return simple_http_get_stream_ex(url, NULL, on_head, on_body, user);
+}
+
+int simple_http_get_stream_ex(const char *url, const char *extra_headers,
+                              simple_http_head_cb on_head, simple_http_body_cb on_body, void *user) {
+    if (!url) return -1;
+    return http_fetch(url, extra_headers, on_head, on_body, user);
+}
+
+typedef struct {
+    char *buf;
+    size_t len, cap;
+} HttpMemSink;
+
+// Size the buffer exactly when the length is known so large bodies do not
+// briefly need twice their size while a doubling realloc copies them.
+static int mem_sink_head(void *user, const SimpleHttpResponse *resp) {
+    HttpMemSink *m = (HttpMemSink*)user;
+    if (resp->content_length > 0 && !resp->chunked) {
+        if ((unsigned long long)resp->content_length >= (unsigned long long)SIZE_MAX) return -1;
+        m->cap = (size_t)resp->content_length + 1;
+        m->buf = malloc(m->cap);
+        if (!m->buf) return -1;
+    }
+    return 0;
+}
+
+static int mem_sink_write(void *user, const char *data, size_t len) {
+    HttpMemSink *m = (HttpMemSink*)user;
+    if (m->len + len + 1 > m->cap) {
+        size_t nc = m->cap ? m->cap : 8192;
+        while (m->len + len + 1 > nc) nc *= 2;
+        char *nb = realloc(m->buf, nc);
+        if (!nb) return -1;
+        m->buf = nb; m->cap = nc;
+    }
+    memcpy(m->buf + m->len, data, len);
+    m->len += len;
+    return 0;
+}
+
+int simple_http_get(const char *url, char **out_buf, size_t *out_len) {
+    if (!url || !out_buf || !out_len) return -1;
+
+    HttpMemSink m = {0};
+    if (http_fetch(url, NULL, mem_sink_head, mem_sink_write, &m) != 0) { free(m.buf); return -1; }
+    if (!m.buf) {
+        m.buf = malloc(1);
+        if (!m.buf) return -1;
+    }
+    m.buf[m.len] = '\0';
+    *out_buf = m.buf;
+    *out_len = m.len;
+    return 0;
 }
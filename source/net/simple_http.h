@@ -1,11 +1,62 @@
-// simple_http.h - minimal HTTP client (GET only, no TLS)
+// simple_http.h - minimal HTTP/1.1 client (GET only, https with USE_MBEDTLS)
 #ifndef SIMPLE_HTTP_H
 #define SIMPLE_HTTP_H
 
 #include <stddef.h>
+#include <stdbool.h>
+#include <sys/socket.h>
 
 // Perform a simple HTTP GET. The caller must free *out_buf when successful.
+// Connections are kept alive and reused for later requests to the same host.
 // Returns 0 on success, -1 on failure.
 int simple_http_get(const char *url, char **out_buf, size_t *out_len);
 
+// Final (post-redirect) response head handed to streaming callers.
+typedef struct {
+    int status;                 // HTTP status code
+    long long content_length;   // body size, -1 when the server did not say
+    bool chunked;               // body uses chunked transfer encoding
+    char etag[128];             // ETag validator, empty if none
+    char last_modified[64];     // Last-Modified validator, empty if none
+    long long range_start;      // first byte of a 206 body (Content-Range), -1 if none
+    long long range_total;      // full resource size from Content-Range, -1 if unknown
+    bool decoded;               // body was gzip/deflate on the wire and is delivered inflated;
+                                // content_length is then -1 (decoded size unknown)
+} SimpleHttpResponse;
+
+// Called once with the final response head before any body bytes.
+// Return non-zero to abort the request.
+typedef int (*simple_http_head_cb)(void *user, const SimpleHttpResponse *resp);
+
+// Called for each piece of body data as it arrives. 'data' points straight
+// into the connection's receive buffer and is only valid during the call.
+// Return non-zero to abort the transfer.
+typedef int (*simple_http_body_cb)(void *user, const char *data, size_t len);
+
+// Streaming GET: headers are parsed incrementally and the body is delivered
+// to on_body without ever being held in memory as a whole, so memory use does
+// not depend on the response size. Either callback may be NULL.
+// Requests without a Range header advertise gzip/deflate, and compressed
+// bodies are inflated on the fly before they reach on_body.
+// Returns 0 on success, -1 on failure or when a callback aborted.
+int simple_http_get_stream(const char *url, simple_http_head_cb on_head, simple_http_body_cb on_body, void *user);
+
+// Same as simple_http_get_stream() but appends extra_headers (zero or more
+// complete "Name: value\r\n" lines, e.g. Range/If-Range) to the request.
+int simple_http_get_stream_ex(const char *url, const char *extra_headers,
+                              simple_http_head_cb on_head, simple_http_body_cb on_body, void *user);
+
+// Close all pooled keep-alive connections (e.g. before network shutdown).
+void simple_http_close_idle(void);
+
+// Helpers shared with the event loop (net_loop.c).
+// Split http://host[:port]/path into heap strings (plain http only).
+// Returns 0 on success.
+int simple_http_parse_url(const char *url, char **out_host, char **out_port, char **out_path);
+// Resolve a Location header against the URL that produced it (heap string).
+char *simple_http_resolve_location(const char *base_url, const char *location);
+// Look host:port up through the shared DNS cache. Returns 0 on success.
+int simple_http_resolve(const char *host, const char *port, struct sockaddr_storage *out_addr,
+                        socklen_t *out_len, int *out_family);
+
 #endif // SIMPLE_HTTP_H
@@ -0,0 +1,270 @@
+// tls_conn.c - TLS client connections over mbedTLS with shared, cached state
+// Notes:
+// - Seeding the DRBG from the entropy pool and parsing a CA bundle are far
+//   more expensive than a request; both happen once, on first use.
+// - mbedTLS is not built with MBEDTLS_THREADING_C here, so the shared DRBG
+//   is wrapped in a lock. The ssl config and CA chain are read-only once set
+//   up and may be shared by concurrent connections.
+// - The BIO callbacks talk to the socket directly so SO_RCVTIMEO timeouts
+//   surface as errors (mbedtls_net_recv() would report them as WANT_READ).
+
+#include "tls_conn.h"
+#include "../logger.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#ifdef USE_MBEDTLS
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/x509_crt.h>
+
+struct TlsConn {
+    int sock;
+    mbedtls_ssl_context ssl;
+};
+
+typedef struct {
+    bool valid;
+    char host[256];
+    char port[8];
+    uint64_t stamp;             // LRU order
+    mbedtls_ssl_session session;
+} TlsSessionEntry;
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;      // setup and session cache
+static pthread_mutex_t s_rng_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool s_ready = false;
+static mbedtls_entropy_context s_entropy;
+static mbedtls_ctr_drbg_context s_drbg;
+static mbedtls_x509_crt s_ca;
+static mbedtls_ssl_config s_conf;
+static TlsSessionEntry s_sessions[TLS_SESSION_CACHE_SIZE];
+static uint64_t s_stamp = 0;
+
+bool tls_available(void) {
+    return true;
+}
+
+static int rng_locked(void *ctx, unsigned char *out, size_t len) {
+    pthread_mutex_lock(&s_rng_lock);
+    int rc = mbedtls_ctr_drbg_random(ctx, out, len);
+    pthread_mutex_unlock(&s_rng_lock);
+    return rc;
+}
+
+static int bio_send(void *ctx, const unsigned char *buf, size_t len) {
+    int sock = *(int*)ctx;
+    ssize_t n;
+    do { n = send(sock, buf, len, 0); } while (n < 0 && errno == EINTR);
+    return n < 0 ? MBEDTLS_ERR_NET_SEND_FAILED : (int)n;
+}
+
+static int bio_recv(void *ctx, unsigned char *buf, size_t len) {
+    int sock = *(int*)ctx;
+    ssize_t n;
+    do { n = recv(sock, buf, len, 0); } while (n < 0 && errno == EINTR);
+    return n < 0 ? MBEDTLS_ERR_NET_RECV_FAILED : (int)n;
+}
+
+static void state_free(void) {
+    for (int i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+        if (s_sessions[i].valid) mbedtls_ssl_session_free(&s_sessions[i].session);
+        s_sessions[i].valid = false;
+    }
+    mbedtls_ssl_config_free(&s_conf);
+    mbedtls_x509_crt_free(&s_ca);
+    mbedtls_ctr_drbg_free(&s_drbg);
+    mbedtls_entropy_free(&s_entropy);
+}
+
+// Caller holds s_lock
+static int state_init(void) {
+    if (s_ready) return 0;
+    mbedtls_entropy_init(&s_entropy);
+    mbedtls_ctr_drbg_init(&s_drbg);
+    mbedtls_x509_crt_init(&s_ca);
+    mbedtls_ssl_config_init(&s_conf);
+
+    const char *pers = "dbfm_tls";
+    if (mbedtls_ctr_drbg_seed(&s_drbg, mbedtls_entropy_func, &s_entropy,
+                              (const unsigned char*)pers, strlen(pers)) != 0 ||
+        mbedtls_ssl_config_defaults(&s_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+        state_free();
+        return -1;
+    }
+    // A non-negative result means at least one certificate parsed
+    bool have_ca = false;
+    static const char *bundles[] = TLS_CA_BUNDLE_PATHS;
+    for (size_t i = 0; i < sizeof(bundles) / sizeof(bundles[0]) && !have_ca; i++) {
+        have_ca = mbedtls_x509_crt_parse_file(&s_ca, bundles[i]) >= 0;
+        if (have_ca) log_event(LOG_INFO, "tls: verifying peers against %s", bundles[i]);
+    }
+    if (have_ca) {
+        mbedtls_ssl_conf_authmode(&s_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+        mbedtls_ssl_conf_ca_chain(&s_conf, &s_ca, NULL);
+    } else {
+        mbedtls_ssl_conf_authmode(&s_conf, MBEDTLS_SSL_VERIFY_NONE); // don't verify by default on Switch
+    }
+    mbedtls_ssl_conf_rng(&s_conf, rng_locked, &s_drbg);
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+    mbedtls_ssl_conf_session_tickets(&s_conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+    s_ready = true;
+    return 0;
+}
+
+// Caller holds s_lock
+static TlsSessionEntry *session_find(const char *host, const char *port) {
+    for (int i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+        TlsSessionEntry *e = &s_sessions[i];
+        if (e->valid && strcmp(e->host, host) == 0 && strcmp(e->port, port) == 0) return e;
+    }
+    return NULL;
+}
+
+// Remember the session just negotiated, replacing the host's previous one
+// or the least recently stored entry
+static void session_store(mbedtls_ssl_context *ssl, const char *host, const char *port) {
+    pthread_mutex_lock(&s_lock);
+    TlsSessionEntry *e = session_find(host, port);
+    if (!e) {
+        e = &s_sessions[0];
+        for (int i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+            if (!s_sessions[i].valid) { e = &s_sessions[i]; break; }
+            if (s_sessions[i].stamp < e->stamp) e = &s_sessions[i];
+        }
+    }
+    if (e->valid) mbedtls_ssl_session_free(&e->session);
+    mbedtls_ssl_session_init(&e->session);
+    e->valid = mbedtls_ssl_get_session(ssl, &e->session) == 0;
+    if (e->valid) {
+        snprintf(e->host, sizeof(e->host), "%s", host);
+        snprintf(e->port, sizeof(e->port), "%s", port);
+        e->stamp = ++s_stamp;
+    } else {
+        mbedtls_ssl_session_free(&e->session);
+    }
+    pthread_mutex_unlock(&s_lock);
+}
+
+static void session_forget(const char *host, const char *port) {
+    pthread_mutex_lock(&s_lock);
+    TlsSessionEntry *e = session_find(host, port);
+    if (e) {
+        mbedtls_ssl_session_free(&e->session);
+        e->valid = false;
+    }
+    pthread_mutex_unlock(&s_lock);
+}
+
+TlsConn *tls_conn_open(int sock, const char *host, const char *port) {
+    pthread_mutex_lock(&s_lock);
+    int rc = state_init();
+    pthread_mutex_unlock(&s_lock);
+    if (rc != 0) return NULL;
+
+    TlsConn *t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    t->sock = sock;
+    mbedtls_ssl_init(&t->ssl);
+    if (mbedtls_ssl_setup(&t->ssl, &s_conf) != 0 || mbedtls_ssl_set_hostname(&t->ssl, host) != 0) {
+        mbedtls_ssl_free(&t->ssl);
+        free(t);
+        return NULL;
+    }
+    mbedtls_ssl_set_bio(&t->ssl, &t->sock, bio_send, bio_recv, NULL);
+
+    // Offer the cached session; the server decides whether to resume it
+    pthread_mutex_lock(&s_lock);
+    TlsSessionEntry *e = session_find(host, port);
+    bool offered = e && mbedtls_ssl_set_session(&t->ssl, &e->session) == 0;
+    pthread_mutex_unlock(&s_lock);
+
+    while ((rc = mbedtls_ssl_handshake(&t->ssl)) != 0) {
+        if (rc != MBEDTLS_ERR_SSL_WANT_READ && rc != MBEDTLS_ERR_SSL_WANT_WRITE) break;
+    }
+    if (rc != 0) {
+        log_event(LOG_WARN, "tls: handshake with %s failed (-0x%04x)", host, (unsigned)-rc);
+        // A stale session must not poison the next attempt
+        if (offered) session_forget(host, port);
+        mbedtls_ssl_free(&t->ssl);
+        free(t);
+        return NULL;
+    }
+    session_store(&t->ssl, host, port);
+    return t;
+}
+
+int tls_conn_send_all(TlsConn *t, const char *data, size_t len) {
+    while (len > 0) {
+        int n = mbedtls_ssl_write(&t->ssl, (const unsigned char*)data, len);
+        if (n == MBEDTLS_ERR_SSL_WANT_READ || n == MBEDTLS_ERR_SSL_WANT_WRITE) continue;
+        if (n <= 0) return -1;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+ssize_t tls_conn_recv(TlsConn *t, char *buf, size_t len) {
+    for (;;) {
+        int n = mbedtls_ssl_read(&t->ssl, (unsigned char*)buf, len);
+        if (n == MBEDTLS_ERR_SSL_WANT_READ || n == MBEDTLS_ERR_SSL_WANT_WRITE) continue;
+        if (n == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY || n == 0) return 0;
+        return n < 0 ? -1 : n;
+    }
+}
+
+void tls_conn_close(TlsConn *t) {
+    if (!t) return;
+    mbedtls_ssl_close_notify(&t->ssl);
+    mbedtls_ssl_free(&t->ssl);
+    free(t);
+}
+
+void tls_cleanup(void) {
+    pthread_mutex_lock(&s_lock);
+    if (s_ready) state_free();
+    s_ready = false;
+    pthread_mutex_unlock(&s_lock);
+}
+
+#else // !USE_MBEDTLS
+
+struct TlsConn { int unused; };
+
+bool tls_available(void) {
+    return false;
+}
+
+TlsConn *tls_conn_open(int sock, const char *host, const char *port) {
+    (void)sock; (void)host; (void)port;
+    return NULL;
+}
+
+int tls_conn_send_all(TlsConn *t, const char *data, size_t len) {
+    (void)t; (void)data; (void)len;
+    return -1;
+}
+
+ssize_t tls_conn_recv(TlsConn *t, char *buf, size_t len) {
+    (void)t; (void)buf; (void)len;
+    return -1;
+}
+
+void tls_conn_close(TlsConn *t) {
+    (void)t;
+}
+
+void tls_cleanup(void) {
+}
+
+#endif // USE_MBEDTLS
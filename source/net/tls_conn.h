@@ -0,0 +1,47 @@
+// tls_conn.h - TLS client connections over mbedTLS with shared, cached state
+#ifndef TLS_CONN_H
+#define TLS_CONN_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Everything that does not depend on the peer is set up once per process
+// and shared by every connection: the seeded CTR-DRBG (behind a lock), the
+// parsed CA chain and the ssl config. The last session negotiated with each
+// host (session ID or ticket) is kept, so reconnecting to a host costs an
+// abbreviated handshake instead of a full RSA/ECDHE exchange.
+//
+// If a CA bundle is found at one of TLS_CA_BUNDLE_PATHS, peers are verified
+// against it; otherwise certificates are not checked, as before.
+//
+// Built without USE_MBEDTLS, tls_available() is false and tls_conn_open()
+// always fails.
+
+#define TLS_SESSION_CACHE_SIZE  8
+#define TLS_CA_BUNDLE_PATHS     { "sdmc:/dbfm/cacert.pem", "romfs:/cacert.pem" }
+
+typedef struct TlsConn TlsConn;
+
+bool tls_available(void);
+
+// Run the client handshake on a connected socket, resuming the cached
+// session for host:port when there is one. Returns NULL on failure; the
+// socket stays open and owned by the caller either way.
+TlsConn *tls_conn_open(int sock, const char *host, const char *port);
+
+// Write all of 'data'. Returns 0, or -1 on error.
+int tls_conn_send_all(TlsConn *t, const char *data, size_t len);
+
+// Read decrypted bytes. Returns the count, 0 when the peer closed, -1 on
+// error or timeout (the socket's SO_RCVTIMEO applies).
+ssize_t tls_conn_recv(TlsConn *t, char *buf, size_t len);
+
+// Send close_notify and free the connection (not the socket)
+void tls_conn_close(TlsConn *t);
+
+// Drop cached sessions and the shared state. Only call once no connection
+// is open (e.g. at exit); the next tls_conn_open() sets everything up again.
+void tls_cleanup(void);
+
+#endif // TLS_CONN_H
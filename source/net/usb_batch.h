@@ -0,0 +1,69 @@
+// usb_batch.h - folder transfers as one manifest plus a framed payload stream
+#ifndef USB_BATCH_H
+#define USB_BATCH_H
+
+#include "usb_transport.h"
+
+// A batch moves a whole directory tree in one session instead of a
+// command/OK/DONE round trip per file:
+//
+//   manifest  text, one entry per line, in transfer order:
+//               "D <path>\n"          directory
+//               "F <size> <path>\n"   file
+//             paths are relative to the batch root, '/'-separated, with no
+//             empty, "." or ".." components
+//   payload   for each file in order: its bytes, then the CRC-32 (IEEE) of
+//             the whole file, little-endian
+//
+// A session can start part-way through, at (index, offset): the payload
+// then begins with byte 'offset' of entry 'index'. The trailing CRC always
+// covers the whole file, so both sides fold the bytes already on disk into
+// it before continuing.
+
+#define USB_BATCH_MAX_ENTRIES   200000
+#define USB_BATCH_MANIFEST_MAX  (32 * 1024 * 1024)
+
+typedef struct {
+    char *path;
+    u64 size;
+    bool dir;
+} UsbBatchEntry;
+
+typedef struct {
+    UsbBatchEntry *entries;
+    u32 count;
+    u32 cap;
+} UsbBatchManifest;
+
+// Walk 'root' (sorted per directory, so a rescan gives the same order).
+// Returns 0, or -1 on error.
+int usb_batch_scan(const char *root, UsbBatchManifest *m);
+void usb_batch_manifest_free(UsbBatchManifest *m);
+
+// Text form. encode returns a malloc'd buffer (not NUL-terminated) or NULL.
+char *usb_batch_manifest_encode(const UsbBatchManifest *m, size_t *len);
+int usb_batch_manifest_decode(const char *text, size_t len, UsbBatchManifest *m);
+
+// Payload bytes from (index, offset) to the end
+u64 usb_batch_payload_size(const UsbBatchManifest *m, u32 index, u64 offset);
+
+// Where an interrupted receive into 'root' should pick up: the first file
+// that is missing or not at full size, at its current length. Files before
+// it are assumed to come from the earlier session.
+void usb_batch_resume_point(const char *root, const UsbBatchManifest *m, u32 *index, u64 *offset);
+
+// Manifest over the link (its length travels in the command exchange).
+// 'flags' are the USB_STREAM_* flags the session negotiated.
+Result usb_batch_send_manifest(const UsbTransport *t, const char *text, size_t len, u32 flags);
+Result usb_batch_recv_manifest(const UsbTransport *t, size_t len, u32 flags, UsbBatchManifest *m);
+
+// Stream the payload from (index, offset). On receive, a file whose CRC
+// does not match is deleted (so a resume fetches it again) and counted in
+// *bad_files; the call still fails with an I/O error in that case.
+Result usb_batch_send(const UsbTransport *t, const char *root, const UsbBatchManifest *m,
+                      u32 index, u64 offset, u32 flags, void (*progress_callback)(size_t current, size_t total));
+Result usb_batch_recv(const UsbTransport *t, const char *root, const UsbBatchManifest *m,
+                      u32 index, u64 offset, u32 flags, u32 *bad_files,
+                      void (*progress_callback)(size_t current, size_t total));
+
+#endif // USB_BATCH_H
@@ -1,4 +1,7 @@
 #include "usb_service.h"
+#include "usb_batch.h"
+#include "link_lz4.h"
+#include "../logger.h"
 #include "verify.h"
 #include "crypto.h"
 #include "fs.h"
@@ -6,11 +9,10 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define USB_BUFFER_SIZE (1 * 1024 * 1024)  // 1MB transfer buffer
 #define USB_VENDOR_ID 0x057E               // Nintendo
 #define USB_PRODUCT_ID 0x3000              // Switch
 #define USB_INTERFACE_CLASS 0xFF           // Vendor-specific
-#define USB_TIMEOUT 1000                   // 1 second timeout
+#define USB_URB_DONE 3                     // usb:ds report status: completed
 
 // Protocol commands
 #define CMD_HELLO "HELLO"
@@ -19,12 +21,77 @@
 #define CMD_SEND "SEND"
 #define CMD_RECV "RECV"
 #define CMD_INST "INST"
+#define CMD_BSND "BSND"
+#define CMD_BRCV "BRCV"
+#define CMD_FROM "FROM"
 
 static AppUsbState s_state = AppUsbState_Disconnected;
 static UsbDsInterface* s_interface = NULL;
 static UsbDsEndpoint* s_endpoint_in = NULL;
 static UsbDsEndpoint* s_endpoint_out = NULL;
 static bool s_initialized = false;
+static u32 s_stream_flags = 0;             // USB_STREAM_* agreed at HELLO
+
+// usb:ds backend for the transport. Send goes out on the IN endpoint,
+// Receive comes in on the OUT endpoint.
+static UsbDsEndpoint* _usb_endpoint(UsbTransferMode mode) {
+    return mode == UsbTransfer_Send ? s_endpoint_in : s_endpoint_out;
+}
+
+static Result _usbds_post(void* ctx, UsbTransferMode mode, void* buf, size_t size, u32* urb_id) {
+    (void)ctx;
+    UsbDsEndpoint* ep = _usb_endpoint(mode);
+    if (!ep) return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+    return usbDsEndpoint_PostBufferAsync(ep, buf, size, urb_id);
+}
+
+// The completion event fires once per finished URB; the report lists the
+// last few URBs, so look ours up there before (re)arming the wait
+static Result _usbds_wait(void* ctx, UsbTransferMode mode, u32 urb_id, u64 timeout_ns, size_t* transferred) {
+    (void)ctx;
+    UsbDsEndpoint* ep = _usb_endpoint(mode);
+    if (!ep) return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+
+    u64 deadline = armTicksToNs(armGetSystemTick()) + timeout_ns;
+    for (;;) {
+        UsbDsReportData report;
+        Result rc = usbDsEndpoint_GetReportData(ep, &report);
+        if (R_FAILED(rc)) return rc;
+        u32 count = report.report_count > 8 ? 8 : report.report_count;
+        for (u32 i = 0; i < count; i++) {
+            if (report.report[i].id != urb_id) continue;
+            if (report.report[i].urb_status == USB_URB_DONE) {
+                *transferred = report.report[i].transferredSize;
+                return 0;
+            }
+            if (report.report[i].urb_status > USB_URB_DONE) {
+                *transferred = 0;
+                return MAKERESULT(Module_Libnx, LibnxError_IoError);
+            }
+        }
+
+        u64 now = armTicksToNs(armGetSystemTick());
+        if (now >= deadline) return MAKERESULT(Module_Libnx, LibnxError_IoError);
+        rc = eventWait(&ep->CompletionEvent, deadline - now);
+        eventClear(&ep->CompletionEvent);
+        if (R_FAILED(rc) && armTicksToNs(armGetSystemTick()) >= deadline) {
+            return MAKERESULT(Module_Libnx, LibnxError_IoError);
+        }
+    }
+}
+
+static void _usbds_cancel(void* ctx, UsbTransferMode mode) {
+    (void)ctx;
+    UsbDsEndpoint* ep = _usb_endpoint(mode);
+    if (ep) usbDsEndpoint_Cancel(ep);
+}
+
+static const UsbTransport s_transport = {
+    .post = _usbds_post,
+    .wait = _usbds_wait,
+    .cancel = _usbds_cancel,
+    .ctx = NULL,
+};
 
 Result usb_init(void) {
     if (s_initialized) return 0;
@@ -148,10 +215,16 @@ Result usb_start_service(void) {
 
     s_state = AppUsbState_Connected;
 
-    // Send hello command to verify connection
+    // Send hello command to verify connection. "HELLO LZ4" offers framed
+    // LZ4 payloads; a host that takes them answers "OK LZ4".
     char response[256];
-    rc = usb_send_command(CMD_HELLO, response, sizeof(response));
-    if (R_SUCCEEDED(rc) && strcmp(response, "OK") == 0) {
+    s_stream_flags = 0;
+    rc = usb_send_command(link_lz4_available() ? CMD_HELLO " LZ4" : CMD_HELLO, response, sizeof(response));
+    if (R_SUCCEEDED(rc) && strncmp(response, "OK", 2) == 0) {
+        if (strcmp(response + 2, " LZ4") == 0 && link_lz4_available()) {
+            s_stream_flags |= USB_STREAM_LZ4;
+            log_event(LOG_INFO, "usb: host accepted LZ4 payload frames");
+        }
         s_state = AppUsbState_Ready;
     }
 
@@ -189,20 +262,18 @@ AppUsbState usb_get_state(void) {
 }
 
 Result usb_send_command(const char* command, char* response, size_t response_size) {
-    if (!command || s_state != AppUsbState_Ready) {
+    // HELLO goes out while still Connected
+    if (!command || (s_state != AppUsbState_Ready && s_state != AppUsbState_Connected)) {
         return MAKERESULT(Module_Libnx, LibnxError_BadInput);
     }
 
-    size_t command_len = strlen(command);
-    u32 transferred = 0;
-    Result rc = usbDsEndpoint_PostBufferAsync(s_endpoint_out, (void*)command, command_len, &transferred);
+    Result rc = usb_transport_write(&s_transport, command, strlen(command), USB_COMMAND_TIMEOUT_NS);
     if (R_FAILED(rc)) return rc;
 
     if (response && response_size > 0) {
-        rc = usbDsEndpoint_PostBufferAsync(s_endpoint_in, response, response_size - 1, &transferred);
-        if (R_SUCCEEDED(rc)) {
-            response[transferred] = '\0';
-        }
+        size_t transferred = 0;
+        rc = usb_transport_read(&s_transport, response, response_size - 1, USB_COMMAND_TIMEOUT_NS, &transferred);
+        response[R_SUCCEEDED(rc) ? transferred : 0] = '\0';
     }
 
     return rc;
@@ -224,7 +295,8 @@ static Result _usb_transfer_file(const char* local_path, const char* remote_path
     Result rc = usb_send_command(command, response, sizeof(response));
     if (R_FAILED(rc)) return rc;
 
-    if (strcmp(response, "OK") != 0) {
+    // RECV answers "OK <size>"
+    if (strncmp(response, "OK", 2) != 0 || (response[2] != '\0' && response[2] != ' ')) {
         return MAKERESULT(Module_Libnx, LibnxError_IoError);
     }
 
@@ -233,55 +305,22 @@ static Result _usb_transfer_file(const char* local_path, const char* remote_path
         return MAKERESULT(Module_Libnx, LibnxError_NotFound);
     }
 
-    u8* buffer = malloc(USB_BUFFER_SIZE);
-    if (!buffer) {
-        fclose(f);
-        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
-    }
-
-    size_t total_size = 0;
+    u64 total_size = 0;
     if (mode == UsbTransfer_Send) {
         fseek(f, 0, SEEK_END);
         total_size = ftell(f);
         fseek(f, 0, SEEK_SET);
-    } else {
-        sscanf(response + 3, "%zu", &total_size);
+    } else if (response[2] == ' ') {
+        sscanf(response + 3, "%llu", (unsigned long long*)&total_size);
     }
 
-    size_t transferred = 0;
-    rc = 0;
-
-    while (transferred < total_size) {
-        size_t chunk_size = total_size - transferred;
-        if (chunk_size > USB_BUFFER_SIZE) chunk_size = USB_BUFFER_SIZE;
-
-        u32 xfer = 0;
-        if (mode == UsbTransfer_Send) {
-            size_t read = fread(buffer, 1, chunk_size, f);
-            if (read != chunk_size) {
-                rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
-                break;
-            }
-            rc = usbDsEndpoint_PostBufferAsync(s_endpoint_out, buffer, chunk_size, &xfer);
-        } else {
-            rc = usbDsEndpoint_PostBufferAsync(s_endpoint_in, buffer, chunk_size, &xfer);
-            if (R_SUCCEEDED(rc)) {
-                if (fwrite(buffer, 1, xfer, f) != xfer) {
-                    rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
-                    break;
-                }
-            }
-        }
-
-        if (R_FAILED(rc)) break;
-
-        transferred += xfer;
-        if (progress_callback) {
-            progress_callback(transferred, total_size);
-        }
+    // Disk I/O for one block overlaps the bus time of the others
+    if (mode == UsbTransfer_Send) {
+        rc = usb_stream_send(&s_transport, f, total_size, USB_RING_SLOTS, s_stream_flags, progress_callback);
+    } else {
+        rc = usb_stream_recv(&s_transport, f, total_size, USB_RING_SLOTS, s_stream_flags, progress_callback);
     }
 
-    free(buffer);
     fclose(f);
 
     if (R_SUCCEEDED(rc)) {
@@ -301,6 +340,110 @@ Result usb_receive_file(const char* remote_path, const char* local_path,
     return _usb_transfer_file(local_path, remote_path, UsbTransfer_Receive, progress_callback);
 }
 
+// BSND <remote> <manifest bytes> -> OK; manifest; <- OK [<index> <offset>];
+// payload from there; DONE -> OK
+Result usb_send_folder(const char* local_dir, const char* remote_dir,
+                      void (*progress_callback)(size_t current, size_t total)) {
+    if (!local_dir || !remote_dir || s_state != AppUsbState_Ready) {
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    }
+
+    UsbBatchManifest manifest;
+    if (usb_batch_scan(local_dir, &manifest) != 0) {
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+    }
+    size_t manifest_len = 0;
+    char* text = usb_batch_manifest_encode(&manifest, &manifest_len);
+    if (!text) {
+        usb_batch_manifest_free(&manifest);
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    }
+
+    char command[1024];
+    char response[256];
+    snprintf(command, sizeof(command), "%s %s %zu", CMD_BSND, remote_dir, manifest_len);
+    Result rc = usb_send_command(command, response, sizeof(response));
+    if (R_SUCCEEDED(rc) && strcmp(response, "OK") != 0) rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+    if (R_SUCCEEDED(rc)) rc = usb_batch_send_manifest(&s_transport, text, manifest_len, s_stream_flags);
+    free(text);
+
+    // The host answers with where its copy stops (nothing = from the start)
+    unsigned long index = 0;
+    unsigned long long offset = 0;
+    if (R_SUCCEEDED(rc)) {
+        size_t got = 0;
+        rc = usb_transport_read(&s_transport, response, sizeof(response) - 1, USB_COMMAND_TIMEOUT_NS, &got);
+        if (R_SUCCEEDED(rc)) {
+            response[got] = '\0';
+            if (strncmp(response, "OK", 2) != 0) rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+            else if (response[2] == ' ') sscanf(response + 3, "%lu %llu", &index, &offset);
+        }
+    }
+    if (R_SUCCEEDED(rc)) {
+        if (index > 0 || offset > 0) {
+            log_event(LOG_INFO, "usb: folder send resumes at entry %lu offset %llu", index, offset);
+        }
+        rc = usb_batch_send(&s_transport, local_dir, &manifest, (u32)index, offset, s_stream_flags,
+                            progress_callback);
+    }
+    usb_batch_manifest_free(&manifest);
+
+    if (R_SUCCEEDED(rc)) {
+        rc = usb_send_command("DONE", response, sizeof(response));
+        if (R_SUCCEEDED(rc) && strcmp(response, "OK") != 0) rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+    }
+    return rc;
+}
+
+// BRCV <remote> -> OK <manifest bytes>; manifest; FROM <index> <offset> -> OK;
+// payload from there; DONE -> OK
+Result usb_receive_folder(const char* remote_dir, const char* local_dir, bool resume,
+                         void (*progress_callback)(size_t current, size_t total)) {
+    if (!local_dir || !remote_dir || s_state != AppUsbState_Ready) {
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    }
+
+    char command[1024];
+    char response[256];
+    snprintf(command, sizeof(command), "%s %s", CMD_BRCV, remote_dir);
+    Result rc = usb_send_command(command, response, sizeof(response));
+    if (R_FAILED(rc)) return rc;
+
+    unsigned long long manifest_len = 0;
+    if (strncmp(response, "OK ", 3) != 0 || sscanf(response + 3, "%llu", &manifest_len) != 1) {
+        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+    }
+
+    UsbBatchManifest manifest;
+    rc = usb_batch_recv_manifest(&s_transport, (size_t)manifest_len, s_stream_flags, &manifest);
+    if (R_FAILED(rc)) return rc;
+
+    u32 index = 0;
+    u64 offset = 0;
+    if (resume) {
+        usb_batch_resume_point(local_dir, &manifest, &index, &offset);
+        if (index > 0 || offset > 0) {
+            log_event(LOG_INFO, "usb: folder receive resumes at entry %u offset %llu", index, (unsigned long long)offset);
+        }
+    }
+    snprintf(command, sizeof(command), "%s %u %llu", CMD_FROM, index, (unsigned long long)offset);
+    rc = usb_send_command(command, response, sizeof(response));
+    if (R_SUCCEEDED(rc) && strcmp(response, "OK") != 0) rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+
+    if (R_SUCCEEDED(rc)) {
+        u32 bad = 0;
+        rc = usb_batch_recv(&s_transport, local_dir, &manifest, index, offset, s_stream_flags, &bad,
+                            progress_callback);
+        if (bad > 0) log_event(LOG_ERROR, "usb: %u file(s) failed their CRC check", bad);
+    }
+    usb_batch_manifest_free(&manifest);
+
+    if (R_SUCCEEDED(rc)) {
+        rc = usb_send_command("DONE", response, sizeof(response));
+    }
+    return rc;
+}
+
 Result usb_install_title(const char* remote_path,
                         void (*progress_callback)(size_t current, size_t total)) {
     if (!remote_path || s_state != AppUsbState_Ready) {
@@ -318,13 +461,8 @@ Result usb_install_title(const char* remote_path,
         return MAKERESULT(Module_Libnx, LibnxError_IoError);
     }
 
-    size_t total_size = 0;
-    sscanf(response + 3, "%zu", &total_size);
-
-    u8* buffer = malloc(USB_BUFFER_SIZE);
-    if (!buffer) {
-        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
-    }
+    u64 total_size = 0;
+    sscanf(response + 3, "%llu", (unsigned long long*)&total_size);
 
     char temp_path[FS_MAX_PATH];
     snprintf(temp_path, sizeof(temp_path), "sdmc:/temp/install_%lx.nsp",
@@ -332,33 +470,14 @@ Result usb_install_title(const char* remote_path,
 
     FILE* f = fopen(temp_path, "wb");
     if (!f) {
-        free(buffer);
         return MAKERESULT(Module_Libnx, LibnxError_IoError);
     }
 
-    size_t transferred = 0;
-    while (transferred < total_size) {
-        size_t chunk_size = total_size - transferred;
-        if (chunk_size > USB_BUFFER_SIZE) chunk_size = USB_BUFFER_SIZE;
-
-        u32 xfer = 0;
-         rc = usbDsEndpoint_PostBufferAsync(s_endpoint_in, buffer, chunk_size, &xfer);
-        if (R_FAILED(rc)) break;
-
-        if (fwrite(buffer, 1, xfer, f) != xfer) {
-            rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
-            break;
-        }
-
-        transferred += xfer;
-        if (progress_callback) {
-            progress_callback(transferred, total_size);
-        }
+    rc = usb_stream_recv(&s_transport, f, total_size, USB_RING_SLOTS, s_stream_flags, progress_callback);
+    if (fclose(f) != 0 && R_SUCCEEDED(rc)) {
+        rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
     }
 
-    fclose(f);
-    free(buffer);
-
     if (R_SUCCEEDED(rc)) {
         // Verify downloaded NSP
         NspVerifyResult verify_result;
@@ -2,6 +2,7 @@
 #define USB_SERVICE_H
 
 #include <switch.h>
+#include "usb_transport.h"
 
 // Connection states
 typedef enum AppUsbState {
@@ -11,12 +12,6 @@ typedef enum AppUsbState {
     AppUsbState_Error
 } AppUsbState;
 
-// File transfer modes
-typedef enum {
-    UsbTransfer_Send,
-    UsbTransfer_Receive
-} UsbTransferMode;
-
 // USB service initialization
 Result usb_init(void);
 void usb_exit(void);
@@ -32,6 +27,14 @@ Result usb_send_file(const char* local_path, const char* remote_path,
 Result usb_receive_file(const char* remote_path, const char* local_path,
                        void (*progress_callback)(size_t current, size_t total));
 
+// Folder operations: the whole tree goes over in one batch session (see
+// usb_batch.h). With 'resume', a receive continues where an interrupted
+// one into the same folder stopped; a send always lets the host choose.
+Result usb_send_folder(const char* local_dir, const char* remote_dir,
+                      void (*progress_callback)(size_t current, size_t total));
+Result usb_receive_folder(const char* remote_dir, const char* local_dir, bool resume,
+                         void (*progress_callback)(size_t current, size_t total));
+
 // Remote install operations
 Result usb_install_title(const char* remote_path,
                         void (*progress_callback)(size_t current, size_t total));
@@ -0,0 +1,231 @@
+// usb_transport.c - synchronous helpers and the pipelined file stream
+// Notes:
+// - The pipeline is a single thread. URBs are asynchronous, so while the
+//   oldest block is awaited the others keep the link busy; disk reads and
+//   writes for one block overlap the bus time of the rest.
+// - On failure everything still in flight is cancelled and reaped before
+//   the ring is freed, so the USB stack never writes into freed memory.
+
+#include "usb_transport.h"
+#include "link_lz4.h"
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+static size_t align_up(size_t n) {
+    return (n + USB_ALIGN - 1) & ~(size_t)(USB_ALIGN - 1);
+}
+
+Result usb_transport_write(const UsbTransport *t, const void *data, size_t len, u64 timeout_ns) {
+    u8 *bounce = (u8*)memalign(USB_ALIGN, align_up(len ? len : 1));
+    if (!bounce) return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    memcpy(bounce, data, len);
+    u32 urb = 0;
+    size_t xfer = 0;
+    Result rc = t->post(t->ctx, UsbTransfer_Send, bounce, len, &urb);
+    if (R_SUCCEEDED(rc)) {
+        rc = t->wait(t->ctx, UsbTransfer_Send, urb, timeout_ns, &xfer);
+        if (R_FAILED(rc)) {
+            t->cancel(t->ctx, UsbTransfer_Send);
+            t->wait(t->ctx, UsbTransfer_Send, urb, USB_COMMAND_TIMEOUT_NS, &xfer);
+        } else if (xfer != len) {
+            rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+        }
+    }
+    free(bounce);
+    return rc;
+}
+
+Result usb_transport_read(const UsbTransport *t, void *data, size_t len, u64 timeout_ns, size_t *got) {
+    u8 *bounce = (u8*)memalign(USB_ALIGN, align_up(len ? len : 1));
+    if (!bounce) return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    u32 urb = 0;
+    size_t xfer = 0;
+    Result rc = t->post(t->ctx, UsbTransfer_Receive, bounce, len, &urb);
+    if (R_SUCCEEDED(rc)) {
+        rc = t->wait(t->ctx, UsbTransfer_Receive, urb, timeout_ns, &xfer);
+        if (R_FAILED(rc)) {
+            t->cancel(t->ctx, UsbTransfer_Receive);
+            t->wait(t->ctx, UsbTransfer_Receive, urb, USB_COMMAND_TIMEOUT_NS, &xfer);
+        } else {
+            memcpy(data, bounce, xfer);
+            if (got) *got = xfer;
+        }
+    }
+    free(bounce);
+    return rc;
+}
+
+typedef struct {
+    const UsbTransport *t;
+    UsbTransferMode mode;
+    u8 *blocks;
+    u32 slots;
+    u32 head;                           // oldest block in flight
+    u32 inflight;
+    u32 urb[USB_RING_MAX_SLOTS];
+    size_t len[USB_RING_MAX_SLOTS];     // bytes on the wire
+    size_t raw[USB_RING_MAX_SLOTS];     // payload bytes they stand for
+    u8 *stage;                          // USB_STREAM_LZ4: block before encoding / after decoding
+} UsbRing;
+
+static int ring_open(UsbRing *r, const UsbTransport *t, UsbTransferMode mode, u32 slots, u32 flags) {
+    memset(r, 0, sizeof(*r));
+    if (slots == 0) slots = USB_RING_SLOTS;
+    if (slots > USB_RING_MAX_SLOTS) slots = USB_RING_MAX_SLOTS;
+    r->t = t;
+    r->mode = mode;
+    r->slots = slots;
+    r->blocks = (u8*)memalign(USB_ALIGN, (size_t)slots * USB_RING_BLOCK);
+    if (r->blocks && (flags & USB_STREAM_LZ4) && !(r->stage = malloc(USB_LZ4_FRAME_RAW))) {
+        free(r->blocks);
+        r->blocks = NULL;
+    }
+    return r->blocks ? 0 : -1;
+}
+
+static u8 *ring_block(UsbRing *r, u32 slot) {
+    return r->blocks + (size_t)slot * USB_RING_BLOCK;
+}
+
+// Post 'len' bytes of the next free block, carrying 'raw' payload bytes
+static Result ring_post(UsbRing *r, size_t len, size_t raw) {
+    u32 slot = (r->head + r->inflight) % r->slots;
+    Result rc = r->t->post(r->t->ctx, r->mode, ring_block(r, slot), len, &r->urb[slot]);
+    if (R_SUCCEEDED(rc)) {
+        r->len[slot] = len;
+        r->raw[slot] = raw;
+        r->inflight++;
+    }
+    return rc;
+}
+
+// Wait for the oldest block; *slot tells where its data is
+static Result ring_complete(UsbRing *r, u32 *slot, size_t *xfer) {
+    *slot = r->head;
+    Result rc = r->t->wait(r->t->ctx, r->mode, r->urb[r->head], USB_TRANSFER_TIMEOUT_NS, xfer);
+    if (R_SUCCEEDED(rc)) {
+        r->head = (r->head + 1) % r->slots;
+        r->inflight--;
+    }
+    return rc;
+}
+
+// Cancel and reap whatever is still in flight, then free the ring
+static void ring_close(UsbRing *r) {
+    if (r->inflight > 0) {
+        r->t->cancel(r->t->ctx, r->mode);
+        for (; r->inflight > 0; r->inflight--) {
+            size_t xfer;
+            r->t->wait(r->t->ctx, r->mode, r->urb[r->head], USB_COMMAND_TIMEOUT_NS, &xfer);
+            r->head = (r->head + 1) % r->slots;
+        }
+    }
+    free(r->blocks);
+    free(r->stage);
+    r->blocks = NULL;
+    r->stage = NULL;
+}
+
+Result usb_stream_send_from(const UsbTransport *t, UsbStreamSource source, void *user, u64 total, u32 slots,
+                            u32 flags, void (*progress_callback)(size_t current, size_t total)) {
+    UsbRing r;
+    if (ring_open(&r, t, UsbTransfer_Send, slots, flags) != 0) return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    size_t block_raw = r.stage ? USB_LZ4_FRAME_RAW : USB_RING_BLOCK;
+
+    Result rc = 0;
+    u64 queued = 0, done = 0;
+    while (done < total) {
+        // Top the ring up: this read (and encode) overlaps the blocks already on the wire
+        while (r.inflight < r.slots && queued < total) {
+            size_t n = total - queued > block_raw ? block_raw : (size_t)(total - queued);
+            u8 *block = ring_block(&r, (r.head + r.inflight) % r.slots);
+            size_t len = n;
+            if (source(user, r.stage ? r.stage : block, n) != n) { rc = MAKERESULT(Module_Libnx, LibnxError_IoError); break; }
+            if (r.stage) {
+                len = link_lz4_encode(r.stage, n, block);
+                // Never a whole number of packets, so the frame ends its transfer
+                if (len % USB_PACKET_SIZE == 0) block[len++] = 0;
+            }
+            rc = ring_post(&r, len, n);
+            if (R_FAILED(rc)) break;
+            queued += n;
+        }
+        if (R_FAILED(rc)) break;
+
+        u32 slot;
+        size_t xfer = 0;
+        rc = ring_complete(&r, &slot, &xfer);
+        if (R_SUCCEEDED(rc) && xfer != r.len[slot]) rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+        if (R_FAILED(rc)) break;
+        done += r.raw[slot];
+        if (progress_callback) progress_callback((size_t)done, (size_t)total);
+    }
+    ring_close(&r);
+    return rc;
+}
+
+Result usb_stream_recv_to(const UsbTransport *t, UsbStreamSink sink, void *user, u64 total, u32 slots,
+                          u32 flags, void (*progress_callback)(size_t current, size_t total)) {
+    UsbRing r;
+    if (ring_open(&r, t, UsbTransfer_Receive, slots, flags) != 0) return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    size_t block_raw = r.stage ? USB_LZ4_FRAME_RAW : USB_RING_BLOCK;
+
+    Result rc = 0;
+    u64 queued = 0, done = 0;
+    while (done < total) {
+        // Keep receive URBs posted so the host can stream while we write
+        while (r.inflight < r.slots && queued < total) {
+            size_t n = total - queued > block_raw ? block_raw : (size_t)(total - queued);
+            // A frame's size is only known once it arrives
+            rc = ring_post(&r, r.stage ? USB_RING_BLOCK : n, n);
+            if (R_FAILED(rc)) break;
+            queued += n;
+        }
+        if (R_FAILED(rc)) break;
+
+        u32 slot;
+        size_t xfer = 0;
+        rc = ring_complete(&r, &slot, &xfer);
+        if (R_FAILED(rc)) break;
+        if (r.stage) {
+            // One frame per transfer, holding exactly the block we expect
+            size_t frame_len = 0;
+            ssize_t n = link_lz4_decode(ring_block(&r, slot), xfer, r.stage, r.raw[slot], &frame_len);
+            if (n < 0 || (size_t)n != r.raw[slot] || sink(user, r.stage, (size_t)n) != 0) {
+                rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+                break;
+            }
+            done += (size_t)n;
+            if (progress_callback) progress_callback((size_t)done, (size_t)total);
+            continue;
+        }
+        if (xfer == 0 || xfer > r.len[slot] || done + xfer > total) { rc = MAKERESULT(Module_Libnx, LibnxError_IoError); break; }
+        // A short transfer leaves bytes for a later block to pick up
+        queued -= r.len[slot] - xfer;
+        if (sink(user, ring_block(&r, slot), xfer) != 0) { rc = MAKERESULT(Module_Libnx, LibnxError_IoError); break; }
+        done += xfer;
+        if (progress_callback) progress_callback((size_t)done, (size_t)total);
+    }
+    // Blocks posted past a short-transfer tail are never filled
+    ring_close(&r);
+    return rc;
+}
+
+static size_t file_source(void *user, void *buf, size_t len) {
+    return fread(buf, 1, len, (FILE*)user);
+}
+
+static int file_sink(void *user, const void *buf, size_t len) {
+    return fwrite(buf, 1, len, (FILE*)user) == len ? 0 : -1;
+}
+
+Result usb_stream_send(const UsbTransport *t, FILE *f, u64 total, u32 slots, u32 flags,
+                       void (*progress_callback)(size_t current, size_t total)) {
+    return usb_stream_send_from(t, file_source, f, total, slots, flags, progress_callback);
+}
+
+Result usb_stream_recv(const UsbTransport *t, FILE *f, u64 total, u32 slots, u32 flags,
+                       void (*progress_callback)(size_t current, size_t total)) {
+    return usb_stream_recv_to(t, file_sink, f, total, slots, flags, progress_callback);
+}
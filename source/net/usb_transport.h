@@ -0,0 +1,70 @@
+// usb_transport.h - bulk transfer backends and the pipelined file stream
+#ifndef USB_TRANSPORT_H
+#define USB_TRANSPORT_H
+
+#include <switch.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// File transfer modes; also the direction of a bulk transfer
+typedef enum {
+    UsbTransfer_Send,       // device -> host (IN endpoint)
+    UsbTransfer_Receive     // host -> device (OUT endpoint)
+} UsbTransferMode;
+
+// A bulk link. post() queues one transfer and returns at once; several may
+// be in flight per direction and they complete in order. Buffers must be
+// USB_ALIGN-aligned and stay untouched until wait() (or cancel() followed
+// by wait()) has returned for them.
+typedef struct UsbTransport {
+    Result (*post)(void *ctx, UsbTransferMode mode, void *buf, size_t size, u32 *urb_id);
+    Result (*wait)(void *ctx, UsbTransferMode mode, u32 urb_id, u64 timeout_ns, size_t *transferred);
+    void (*cancel)(void *ctx, UsbTransferMode mode);
+    void *ctx;
+} UsbTransport;
+
+#define USB_ALIGN               0x1000
+#define USB_RING_BLOCK          (1 * 1024 * 1024)
+#define USB_RING_SLOTS          4           // default blocks in flight
+#define USB_RING_MAX_SLOTS      8           // the usb:ds report holds 8 URBs
+#define USB_COMMAND_TIMEOUT_NS  (5ull * 1000 * 1000 * 1000)
+#define USB_TRANSFER_TIMEOUT_NS (30ull * 1000 * 1000 * 1000)
+
+// Synchronous helpers for small messages (bounced through an aligned buffer)
+Result usb_transport_write(const UsbTransport *t, const void *data, size_t len, u64 timeout_ns);
+Result usb_transport_read(const UsbTransport *t, void *data, size_t len, u64 timeout_ns, size_t *got);
+
+#define USB_PACKET_SIZE         0x200       // bulk max packet size (high speed)
+
+// Stream flags
+// USB_STREAM_LZ4: every transfer carries one link_lz4 frame (link_lz4.h)
+// holding up to USB_LZ4_FRAME_RAW payload bytes, LZ4-compressed unless the
+// block does not shrink. A frame whose size is a multiple of
+// USB_PACKET_SIZE is followed by one pad byte, so it always ends in a
+// short packet and each frame is exactly one transfer in both directions.
+// Only use it once both ends have agreed to.
+#define USB_STREAM_LZ4          (1u << 0)
+#define USB_LZ4_FRAME_RAW       (USB_RING_BLOCK - USB_ALIGN)
+
+// Move 'total' bytes between f and the link through a ring of 'slots'
+// (0 = USB_RING_SLOTS) aligned blocks: while the link works on up to
+// slots-1 blocks, the calling thread reads the next one from disk (send)
+// or writes the last completed one out (receive). 'total' and progress
+// count payload bytes, whatever the flags do on the wire.
+Result usb_stream_send(const UsbTransport *t, FILE *f, u64 total, u32 slots, u32 flags,
+                       void (*progress_callback)(size_t current, size_t total));
+Result usb_stream_recv(const UsbTransport *t, FILE *f, u64 total, u32 slots, u32 flags,
+                       void (*progress_callback)(size_t current, size_t total));
+
+// Same pipeline over a callback source/sink instead of a FILE. The source
+// fills exactly len bytes and returns len (anything less is an error); the
+// sink takes len bytes and returns 0, or -1 to abort.
+typedef size_t (*UsbStreamSource)(void *user, void *buf, size_t len);
+typedef int (*UsbStreamSink)(void *user, const void *buf, size_t len);
+Result usb_stream_send_from(const UsbTransport *t, UsbStreamSource source, void *user, u64 total, u32 slots,
+                            u32 flags, void (*progress_callback)(size_t current, size_t total));
+Result usb_stream_recv_to(const UsbTransport *t, UsbStreamSink sink, void *user, u64 total, u32 slots,
+                          u32 flags, void (*progress_callback)(size_t current, size_t total));
+
+#endif // USB_TRANSPORT_H
@@ -5,6 +5,10 @@
 #include <sys/stat.h>
 #include "save_manager.h"
 #include "../ui/ui_data.h"
+#include "../security/sha256.h"
+#include "../security/hash_db.h"
+#include "../security/manifest.h"
+#include "../logger.h"
 
 #define SAVE_TRANSFER_BUFFER_SIZE (1024 * 1024)
 
@@ -103,6 +107,11 @@ Result save_backup_title(u64 title_id, const char* backup_path,
         return rc;
     }
     
+    // One manifest for the whole backup, next to its directory so a
+    // restore does not copy it into the save
+    Manifest* manifest = NULL;
+    if (manifest_create(&manifest) != 0) manifest = NULL;
+    
     // Read directory entries
     s64 total_entries = 0;
     FsDirectoryEntry dir_entry;
@@ -137,6 +146,13 @@ Result save_backup_title(u64 title_id, const char* backup_path,
                 continue;
             }
             
+            // Hashed on the way through, so verifying the backup later
+            // does not have to read it back
+            sha256_ctx digest_ctx;
+            sha256_init(&digest_ctx);
+            char manifest_name[PATH_MAX];
+            snprintf(manifest_name, PATH_MAX, "%016lx/%s", title_id, dir_entry.name);
+            bool in_manifest = manifest && manifest_begin_file(manifest, manifest_name) == 0;
             s64 file_size;
             rc = fsFileGetSize(&src_file, &file_size);
             if (R_SUCCEEDED(rc)) {
@@ -153,6 +169,8 @@ Result save_backup_title(u64 title_id, const char* backup_path,
                         rc = -1;
                         break;
                     }
+                    sha256_update(&digest_ctx, transfer_buffer, bytes_read);
+                    if (in_manifest) manifest_update(manifest, transfer_buffer, bytes_read);
                     
                     offset += bytes_read;
                     if (progress_cb) {
@@ -166,14 +184,29 @@ Result save_backup_title(u64 title_id, const char* backup_path,
                 }
             }
             
-            fclose(dst);
+            bool written = fclose(dst) == 0 && R_SUCCEEDED(rc);
             fsFileClose(&src_file);
+            if (written) {
+                u8 digest[32];
+                sha256_final(&digest_ctx, digest);
+                hash_db_put_sha256(dst_path, NULL, digest);
+                if (in_manifest && manifest_end_file(manifest) != 0) in_manifest = false;
+            }
+            if (!written && in_manifest) manifest_drop_file(manifest);
         }
     }
     
     fsDirClose(&dir);
     fsFsClose(&save_fs);
     
+    if (manifest) {
+        char manifest_path[PATH_MAX];
+        snprintf(manifest_path, PATH_MAX, "%s" MANIFEST_EXT, save_path);
+        int mrc = manifest_save(manifest, manifest_path);
+        if (mrc != 0) log_event(LOG_ERROR, "save backup: failed to write manifest %s (%d)", manifest_path, mrc);
+        manifest_free(manifest);
+    }
+    
     if (progress_cb) {
         progress_cb("Backup complete", 1, 1);
     }
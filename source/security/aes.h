@@ -0,0 +1,90 @@
+// aes.h - AES with runtime-selected block functions and CTR/XTS/GCM modes
+#ifndef AES_H
+#define AES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// The block functions are picked once, on first use:
+//   arm      ARMv8 AES and PMULL instructions (every Switch CPU has them)
+//   aesni    x86 AES-NI and PCLMULQDQ, for host builds
+//   ct       portable C, constant time (no lookup tables indexed by secret
+//            data); much slower, only used when neither of the above is there
+// Like the SHA-256 backends, a candidate is only picked after it matches
+// the portable code on a set of known inputs. The hardware backends keep
+// eight blocks in flight so the AES units stay busy.
+//
+// All modes are streaming: data can be fed in pieces of any size.
+
+#define AES_BLOCK_SIZE  16
+#define AES_MAX_ROUNDS  14
+
+typedef struct {
+    uint8_t enc[AES_MAX_ROUNDS + 1][AES_BLOCK_SIZE];
+    uint8_t dec[AES_MAX_ROUNDS + 1][AES_BLOCK_SIZE];   // equivalent inverse cipher
+    int rounds;
+} aes_key;
+
+// key_len is 16, 24 or 32. Returns 0, or -1 for a bad length.
+int aes_set_key(aes_key *k, const void *key, size_t key_len);
+void aes_ecb_encrypt(const aes_key *k, const void *in, void *out, size_t blocks);
+void aes_ecb_decrypt(const aes_key *k, const void *in, void *out, size_t blocks);
+
+// Name of the selected backend ("arm", "aesni" or "ct")
+const char *aes_backend_name(void);
+
+// CTR with a 128-bit big-endian counter; encryption and decryption are the
+// same operation
+typedef struct {
+    aes_key key;
+    uint8_t ctr[AES_BLOCK_SIZE];
+    uint8_t pad[AES_BLOCK_SIZE];    // keystream left over from the last call
+    size_t pad_used;
+} aes_ctr_ctx;
+
+int aes_ctr_init(aes_ctr_ctx *ctx, const void *key, size_t key_len, const uint8_t iv[AES_BLOCK_SIZE]);
+void aes_ctr_crypt(aes_ctr_ctx *ctx, const void *in, void *out, size_t len);
+
+// XTS (IEEE 1619). key holds the data key followed by the tweak key, so
+// key_len is 32 or 64. Each call processes one whole data unit of at least
+// 16 bytes; a length that is not a multiple of 16 uses ciphertext stealing.
+// The tweak is the unit number encoded as the caller's format requires
+// (little-endian for IEEE 1619, big-endian for Nintendo's NCA sectors).
+typedef struct {
+    aes_key data;
+    aes_key tweak;
+} aes_xts_ctx;
+
+int aes_xts_init(aes_xts_ctx *ctx, const void *key, size_t key_len);
+int aes_xts_encrypt(const aes_xts_ctx *ctx, const uint8_t tweak[AES_BLOCK_SIZE],
+                    const void *in, void *out, size_t len);
+int aes_xts_decrypt(const aes_xts_ctx *ctx, const uint8_t tweak[AES_BLOCK_SIZE],
+                    const void *in, void *out, size_t len);
+// The values the blocks of a unit are XORed with on both sides of the block
+// cipher. Many units with the same unit numbers (NCA headers) can then be
+// done as XOR, one aes_ecb_* call over all of them, XOR.
+void aes_xts_tweaks(const aes_xts_ctx *ctx, const uint8_t tweak[AES_BLOCK_SIZE], uint8_t *out, size_t blocks);
+
+// GCM. Feed all AAD before the first encrypt/decrypt call.
+typedef struct {
+    aes_key key;
+    uint64_t h[2];                  // hash key, as two big-endian halves
+    uint64_t x[2];                  // running GHASH
+    uint8_t j0[AES_BLOCK_SIZE];
+    uint8_t ctr[AES_BLOCK_SIZE];
+    uint8_t pad[AES_BLOCK_SIZE];
+    size_t pad_used;
+    uint8_t buf[AES_BLOCK_SIZE];    // partial GHASH input block
+    size_t buf_len;
+    uint64_t aad_len, text_len;
+    bool aad_done;
+} aes_gcm_ctx;
+
+int aes_gcm_init(aes_gcm_ctx *ctx, const void *key, size_t key_len, const void *iv, size_t iv_len);
+void aes_gcm_aad(aes_gcm_ctx *ctx, const void *aad, size_t len);
+void aes_gcm_encrypt(aes_gcm_ctx *ctx, const void *in, void *out, size_t len);
+void aes_gcm_decrypt(aes_gcm_ctx *ctx, const void *in, void *out, size_t len);
+void aes_gcm_tag(aes_gcm_ctx *ctx, uint8_t tag[AES_BLOCK_SIZE]);
+
+#endif // AES_H
@@ -0,0 +1,234 @@
+// checksum.c - fast non-cryptographic checksums (XXH64, CRC-32C)
+
+#include "checksum.h"
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#define CRC32C_HAVE_ARM 1
+#elif defined(__x86_64__)
+#include <immintrin.h>
+#include <cpuid.h>
+#define CRC32C_HAVE_SSE42 1
+#endif
+
+// ---------------------------------------------------------------------------
+// XXH64
+// ---------------------------------------------------------------------------
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static uint64_t read_le64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static uint32_t read_le32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static uint64_t xxh64_merge(uint64_t acc, uint64_t v) {
+    acc ^= xxh64_round(0, v);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+void xxh64_init(xxh64_ctx *ctx, uint64_t seed) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->v[0] = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+    ctx->v[1] = seed + XXH_PRIME64_2;
+    ctx->v[2] = seed;
+    ctx->v[3] = seed - XXH_PRIME64_1;
+}
+
+void xxh64_update(xxh64_ctx *ctx, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t*)data;
+    ctx->total_len += len;
+
+    if (ctx->memsize + len < 32) {
+        memcpy(ctx->mem + ctx->memsize, p, len);
+        ctx->memsize += (uint32_t)len;
+        return;
+    }
+    if (ctx->memsize) {
+        size_t need = 32 - ctx->memsize;
+        memcpy(ctx->mem + ctx->memsize, p, need);
+        for (int i = 0; i < 4; i++) ctx->v[i] = xxh64_round(ctx->v[i], read_le64(ctx->mem + i * 8));
+        p += need; len -= need;
+        ctx->memsize = 0;
+    }
+
+    uint64_t v0 = ctx->v[0], v1 = ctx->v[1], v2 = ctx->v[2], v3 = ctx->v[3];
+    for (; len >= 32; p += 32, len -= 32) {
+        v0 = xxh64_round(v0, read_le64(p));
+        v1 = xxh64_round(v1, read_le64(p + 8));
+        v2 = xxh64_round(v2, read_le64(p + 16));
+        v3 = xxh64_round(v3, read_le64(p + 24));
+    }
+    ctx->v[0] = v0; ctx->v[1] = v1; ctx->v[2] = v2; ctx->v[3] = v3;
+
+    if (len) {
+        memcpy(ctx->mem, p, len);
+        ctx->memsize = (uint32_t)len;
+    }
+}
+
+uint64_t xxh64_digest(const xxh64_ctx *ctx) {
+    uint64_t h;
+    if (ctx->total_len >= 32) {
+        h = rotl64(ctx->v[0], 1) + rotl64(ctx->v[1], 7) + rotl64(ctx->v[2], 12) + rotl64(ctx->v[3], 18);
+        for (int i = 0; i < 4; i++) h = xxh64_merge(h, ctx->v[i]);
+    } else {
+        h = ctx->v[2] + XXH_PRIME64_5;   // v[2] is still the seed
+    }
+    h += ctx->total_len;
+
+    const uint8_t *p = ctx->mem;
+    size_t len = ctx->memsize;
+    for (; len >= 8; p += 8, len -= 8) {
+        h ^= xxh64_round(0, read_le64(p));
+        h = rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (len >= 4) {
+        h ^= (uint64_t)read_le32(p) * XXH_PRIME64_1;
+        h = rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4; len -= 4;
+    }
+    for (; len; p++, len--) {
+        h ^= (*p) * XXH_PRIME64_5;
+        h = rotl64(h, 11) * XXH_PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// ---------------------------------------------------------------------------
+// CRC-32C
+// ---------------------------------------------------------------------------
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const uint8_t *p, size_t len);
+
+// Slicing-by-8 tables for the reflected Castagnoli polynomial
+static uint32_t s_crc_table[8][256];
+
+static void crc32c_make_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+        s_crc_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            uint32_t c = s_crc_table[t - 1][i];
+            s_crc_table[t][i] = (c >> 8) ^ s_crc_table[0][c & 0xFF];
+        }
+    }
+}
+
+static uint32_t crc32c_table(uint32_t crc, const uint8_t *p, size_t len) {
+    for (; len >= 8; p += 8, len -= 8) {
+        uint32_t lo = read_le32(p) ^ crc, hi = read_le32(p + 4);
+        crc = s_crc_table[7][lo & 0xFF] ^ s_crc_table[6][(lo >> 8) & 0xFF] ^
+              s_crc_table[5][(lo >> 16) & 0xFF] ^ s_crc_table[4][lo >> 24] ^
+              s_crc_table[3][hi & 0xFF] ^ s_crc_table[2][(hi >> 8) & 0xFF] ^
+              s_crc_table[1][(hi >> 16) & 0xFF] ^ s_crc_table[0][hi >> 24];
+    }
+    for (; len; p++, len--) crc = (crc >> 8) ^ s_crc_table[0][(crc ^ *p) & 0xFF];
+    return crc;
+}
+
+#ifdef CRC32C_HAVE_ARM
+static bool cpu_has_arm_crc(void) {
+#if defined(__SWITCH__)
+    return true;
+#elif defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    return false;
+#endif
+}
+
+__attribute__((target("+crc")))
+static uint32_t crc32c_arm(uint32_t crc, const uint8_t *p, size_t len) {
+    for (; len >= 8; p += 8, len -= 8) crc = __crc32cd(crc, read_le64(p));
+    for (; len; p++, len--) crc = __crc32cb(crc, *p);
+    return crc;
+}
+#endif
+
+#ifdef CRC32C_HAVE_SSE42
+static bool cpu_has_sse42(void) {
+    unsigned int a, b, c, d;
+    return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_2);
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t len) {
+    uint64_t c = crc;
+    for (; len >= 8; p += 8, len -= 8) c = _mm_crc32_u64(c, read_le64(p));
+    crc = (uint32_t)c;
+    for (; len; p++, len--) crc = _mm_crc32_u8(crc, *p);
+    return crc;
+}
+#endif
+
+static pthread_once_t s_crc_once = PTHREAD_ONCE_INIT;
+static crc32c_fn s_crc = crc32c_table;
+
+static void crc32c_select(void) {
+    crc32c_make_table();
+    crc32c_fn hw = NULL;
+#if defined(CRC32C_HAVE_ARM)
+    if (cpu_has_arm_crc()) hw = crc32c_arm;
+#elif defined(CRC32C_HAVE_SSE42)
+    if (cpu_has_sse42()) hw = crc32c_sse42;
+#endif
+    if (!hw) return;
+
+    // "123456789" is the standard check value; the odd lengths cover the
+    // byte-at-a-time tails
+    static const uint8_t check[] = "123456789abcdefghijklmnopqrstuvwxyz";
+    if (crc32c_table(0xFFFFFFFFu, check, 9) != ~0xE3069283u) return;
+    for (size_t len = 0; len < sizeof(check); len++) {
+        if (hw(0xFFFFFFFFu, check, len) != crc32c_table(0xFFFFFFFFu, check, len)) return;
+    }
+    s_crc = hw;
+}
+
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&s_crc_once, crc32c_select);
+    return ~s_crc(~crc, (const uint8_t*)data, len);
+}
@@ -0,0 +1,31 @@
+// checksum.h - fast non-cryptographic checksums (XXH64, CRC-32C)
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Both are for catching corruption, not tampering: use SHA-256 where the
+// data may come from someone else.
+//
+// XXH64 is the reference xxHash64 (same output as XXH64() in libxxhash),
+// several times faster than SHA-256 in plain C. CRC-32C (Castagnoli) uses
+// the ARMv8 CRC32 or SSE4.2 instructions when the CPU has them, picked on
+// first use and checked against the table version like the SHA-256
+// backends.
+
+typedef struct {
+    uint64_t total_len;
+    uint64_t v[4];
+    uint8_t mem[32];
+    uint32_t memsize;
+} xxh64_ctx;
+
+void xxh64_init(xxh64_ctx *ctx, uint64_t seed);
+void xxh64_update(xxh64_ctx *ctx, const void *data, size_t len);
+uint64_t xxh64_digest(const xxh64_ctx *ctx);
+
+// Running CRC: start from 0, feed each chunk's result back in
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len);
+
+#endif // CHECKSUM_H
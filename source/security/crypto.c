@@ -3,149 +3,115 @@
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "sha256.h"
+#include "aes.h"
+#include "../../include/libnx_errors.h"
 
-// Minimal SHA256 implementation (public-domain style) - small footprint
-// For brevity and safety, use a simple implementation adapted from public domain sources.
-
+// HMAC-SHA256 with the key folded in once: the compression states after
+// the ipad and opad blocks. Every MAC under the same key starts from them,
+// so the key blocks are never hashed again.
 typedef struct {
-    uint32_t state[8];
-    uint64_t bitcount;
-    unsigned char buffer[64];
-} sha256_ctx;
-
-static const uint32_t K[64] = {
-    0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
-    0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
-    0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
-    0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
-    0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
-    0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
-    0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
-    0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
-};
-
-static uint32_t ROR(uint32_t x, int r) { return (x >> r) | (x << (32 - r)); }
-
-static void sha256_transform(sha256_ctx *ctx, const unsigned char data[64]) {
-    uint32_t W[64];
-    for (int i = 0; i < 16; ++i) {
-        W[i] = (data[i*4] << 24) | (data[i*4+1] << 16) | (data[i*4+2] << 8) | (data[i*4+3]);
-    }
-    for (int i = 16; i < 64; ++i) {
-        uint32_t s0 = ROR(W[i-15], 7) ^ ROR(W[i-15], 18) ^ (W[i-15] >> 3);
-        uint32_t s1 = ROR(W[i-2], 17) ^ ROR(W[i-2], 19) ^ (W[i-2] >> 10);
-        W[i] = W[i-16] + s0 + W[i-7] + s1;
-    }
-    uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
-    uint32_t e = ctx->state[4], f = ctx->state[5], g = ctx->state[6], h = ctx->state[7];
-    for (int i = 0; i < 64; ++i) {
-        uint32_t S1 = ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25);
-        uint32_t ch = (e & f) ^ ((~e) & g);
-        uint32_t temp1 = h + S1 + ch + K[i] + W[i];
-        uint32_t S0 = ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22);
-        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
-        uint32_t temp2 = S0 + maj;
-        h = g; g = f; f = e; e = d + temp1; d = c; c = b; b = a; a = temp1 + temp2;
-    }
-    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
-    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
-}
-
-static void sha256_init(sha256_ctx *ctx) {
-    ctx->state[0] = 0x6a09e667; ctx->state[1] = 0xbb67ae85; ctx->state[2] = 0x3c6ef372; ctx->state[3] = 0xa54ff53a;
-    ctx->state[4] = 0x510e527f; ctx->state[5] = 0x9b05688c; ctx->state[6] = 0x1f83d9ab; ctx->state[7] = 0x5be0cd19;
-    ctx->bitcount = 0;
-}
-
-static void sha256_update(sha256_ctx *ctx, const unsigned char *data, size_t len) {
-    size_t fill = ctx->bitcount / 8 % 64;
-    ctx->bitcount += (uint64_t)len * 8;
-    if (fill) {
-        size_t need = 64 - fill;
-        if (len >= need) {
-            memcpy(ctx->buffer + fill, data, need);
-            sha256_transform(ctx, ctx->buffer);
-            data += need; len -= need; fill = 0;
-        } else {
-            memcpy(ctx->buffer + fill, data, len);
-            return;
-        }
+    uint32_t inner[8];
+    uint32_t outer[8];
+} HmacSha256Key;
+
+static void hmac_sha256_key(HmacSha256Key *hk, const unsigned char *key, size_t keylen) {
+    unsigned char pad[SHA256_BLOCK_SIZE]; unsigned char tk[32];
+    if (keylen > SHA256_BLOCK_SIZE) {
+        crypto_sha256(key, keylen, tk); key = tk; keylen = 32;
     }
-    while (len >= 64) {
-        sha256_transform(ctx, data);
-        data += 64; len -= 64;
-    }
-    if (len) memcpy(ctx->buffer, data, len);
-}
-
-static void sha256_final(sha256_ctx *ctx, unsigned char digest[32]) {
-    unsigned int fill = ctx->bitcount / 8 % 64;
-    ctx->buffer[fill++] = 0x80;
-    if (fill > 56) {
-        while (fill < 64) ctx->buffer[fill++] = 0x00;
-        sha256_transform(ctx, ctx->buffer);
-        fill = 0;
-    }
-    while (fill < 56) ctx->buffer[fill++] = 0x00;
-    uint64_t bits = ctx->bitcount;
-    ctx->buffer[56] = (unsigned char)(bits >> 56);
-    ctx->buffer[57] = (unsigned char)(bits >> 48);
-    ctx->buffer[58] = (unsigned char)(bits >> 40);
-    ctx->buffer[59] = (unsigned char)(bits >> 32);
-    ctx->buffer[60] = (unsigned char)(bits >> 24);
-    ctx->buffer[61] = (unsigned char)(bits >> 16);
-    ctx->buffer[62] = (unsigned char)(bits >> 8);
-    ctx->buffer[63] = (unsigned char)(bits);
-    sha256_transform(ctx, ctx->buffer);
-    for (int i = 0; i < 8; ++i) {
-        digest[i*4] = (unsigned char)(ctx->state[i] >> 24);
-        digest[i*4+1] = (unsigned char)(ctx->state[i] >> 16);
-        digest[i*4+2] = (unsigned char)(ctx->state[i] >> 8);
-        digest[i*4+3] = (unsigned char)(ctx->state[i]);
-    }
-}
-
-// HMAC-SHA256
-static void hmac_sha256(const unsigned char *key, size_t keylen, const unsigned char *data, size_t datalen, unsigned char out[32]) {
-    unsigned char k_ipad[64]; unsigned char k_opad[64]; unsigned char tk[32];
-    if (keylen > 64) {
-        sha256_ctx tctx; sha256_init(&tctx); sha256_update(&tctx, key, keylen); sha256_final(&tctx, tk); key = tk; keylen = 32;
-    }
-    memset(k_ipad, 0x36, 64); memset(k_opad, 0x5c, 64);
-    for (size_t i = 0; i < keylen; ++i) { k_ipad[i] ^= key[i]; k_opad[i] ^= key[i]; }
-    sha256_ctx ctx; sha256_init(&ctx); sha256_update(&ctx, k_ipad, 64); sha256_update(&ctx, data, datalen);
-    unsigned char inner[32]; sha256_final(&ctx, inner);
-    sha256_init(&ctx); sha256_update(&ctx, k_opad, 64); sha256_update(&ctx, inner, 32); sha256_final(&ctx, out);
+    sha256_ctx ctx;
+    memset(pad, 0x36, sizeof(pad));
+    for (size_t i = 0; i < keylen; ++i) pad[i] ^= key[i];
+    sha256_init(&ctx); sha256_blocks(ctx.state, pad, 1);
+    memcpy(hk->inner, ctx.state, sizeof(hk->inner));
+    memset(pad, 0x5c, sizeof(pad));
+    for (size_t i = 0; i < keylen; ++i) pad[i] ^= key[i];
+    sha256_init(&ctx); sha256_blocks(ctx.state, pad, 1);
+    memcpy(hk->outer, ctx.state, sizeof(hk->outer));
+    memset(pad, 0, sizeof(pad)); memset(tk, 0, sizeof(tk));
+}
+
+// Inner hash context positioned right after the key block
+static void hmac_sha256_start(const HmacSha256Key *hk, sha256_ctx *ctx) {
+    memcpy(ctx->state, hk->inner, sizeof(ctx->state));
+    ctx->bitcount = SHA256_BLOCK_SIZE * 8;
+}
+
+static void hmac_sha256_end(const HmacSha256Key *hk, sha256_ctx *ctx, unsigned char out[32]) {
+    unsigned char inner[32];
+    sha256_final(ctx, inner);
+    memcpy(ctx->state, hk->outer, sizeof(ctx->state));
+    ctx->bitcount = SHA256_BLOCK_SIZE * 8;
+    sha256_update(ctx, inner, sizeof(inner));
+    sha256_final(ctx, out);
+}
+
+static void put_be32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24); p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);  p[3] = (unsigned char)v;
+}
+
+// Padded single block for a 32-byte message after a key block: the
+// message goes in bytes 0-31, the bit length (64 + 32) * 8 at the end
+static void hmac_sha256_digest_block(unsigned char block[SHA256_BLOCK_SIZE]) {
+    memset(block, 0, SHA256_BLOCK_SIZE);
+    block[32] = 0x80;
+    block[62] = (unsigned char)((SHA256_BLOCK_SIZE + 32) * 8 >> 8);
+    block[63] = (unsigned char)((SHA256_BLOCK_SIZE + 32) * 8);
 }
 
 int pbkdf2_hmac_sha256(const char *password, const unsigned char *salt, size_t salt_len, int iterations, unsigned char *out, size_t out_len) {
     if (!password || !salt || !out) return -1;
-    size_t plen = strlen(password);
-    unsigned char U[32]; unsigned char T[32];
+    HmacSha256Key hk;
+    hmac_sha256_key(&hk, (const unsigned char*)password, strlen(password));
+
+    // U(n+1) = HMAC(P, U(n)) is two compressions on prebuilt blocks: the
+    // inner one over U(n), the outer one over its result
+    unsigned char ublock[SHA256_BLOCK_SIZE]; unsigned char iblock[SHA256_BLOCK_SIZE];
+    hmac_sha256_digest_block(ublock);
+    hmac_sha256_digest_block(iblock);
+
+    unsigned char T[32];
     int blocks = (out_len + 31) / 32;
     for (int block = 1; block <= blocks; ++block) {
         // F(P, S, c, i) = U1 ^ U2 ^ ... ^ Uc
         // U1 = PRF(P, S || INT(i))
-        unsigned char int_block[4]; int_block[0] = (block >> 24) & 0xff; int_block[1] = (block >> 16) & 0xff; int_block[2] = (block >> 8) & 0xff; int_block[3] = block & 0xff;
-        unsigned char *salt_block = malloc(salt_len + 4);
-        memcpy(salt_block, salt, salt_len); memcpy(salt_block + salt_len, int_block, 4);
-        hmac_sha256((const unsigned char*)password, plen, salt_block, salt_len + 4, U);
-        memcpy(T, U, 32);
+        unsigned char int_block[4]; put_be32(int_block, (uint32_t)block);
+        sha256_ctx ctx;
+        hmac_sha256_start(&hk, &ctx);
+        sha256_update(&ctx, salt, salt_len);
+        sha256_update(&ctx, int_block, 4);
+        hmac_sha256_end(&hk, &ctx, ublock);
+        memcpy(T, ublock, 32);
         for (int i = 1; i < iterations; ++i) {
-            hmac_sha256((const unsigned char*)password, plen, U, 32, U);
-            for (int j = 0; j < 32; ++j) T[j] ^= U[j];
+            uint32_t st[8];
+            memcpy(st, hk.inner, sizeof(st));
+            sha256_blocks(st, ublock, 1);
+            for (int j = 0; j < 8; ++j) put_be32(iblock + j * 4, st[j]);
+            memcpy(st, hk.outer, sizeof(st));
+            sha256_blocks(st, iblock, 1);
+            for (int j = 0; j < 8; ++j) put_be32(ublock + j * 4, st[j]);
+            for (int j = 0; j < 32; ++j) T[j] ^= ublock[j];
         }
         size_t offset = (block - 1) * 32;
         size_t to_copy = (out_len - offset) < 32 ? (out_len - offset) : 32;
         memcpy(out + offset, T, to_copy);
-        free(salt_block);
     }
+    memset(&hk, 0, sizeof(hk)); memset(T, 0, sizeof(T));
+    memset(ublock, 0, sizeof(ublock)); memset(iblock, 0, sizeof(iblock));
     return 0;
 }
 
 // Simple init/exit stubs for the crypto subsystem used by other modules.
 Result crypto_init(void) {
-    // Nothing to initialize in this compatibility shim.
+    // Pick (and self-check) the SHA-256 backend now rather than on the
+    // first hash
+    sha256_backend_name();
+    aes_backend_name();
     return 0;
 }
 
@@ -157,15 +123,191 @@ void crypto_exit(void) {
 void crypto_sha256(const void *data, size_t len, unsigned char out[32]) {
     sha256_ctx ctx;
     sha256_init(&ctx);
-    sha256_update(&ctx, (const unsigned char*)data, len);
+    sha256_update(&ctx, data, len);
     sha256_final(&ctx, out);
 }
 
-// Simple random generator using libc rand() seeded with time — not cryptographically strong but acceptable for local salt.
-// For stronger randomness on Switch, later replace with secure RNG if available.
+// Incremental hashing
+
+#define HASH_STATE_MAGIC    "CHS1"
+#define HASH_STATE_HEAD     16      // magic, algo, 3 reserved, length
+
+static void put_le32(unsigned char *p, u32 v) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (i * 8));
+}
+
+static void put_le64(unsigned char *p, u64 v) {
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (i * 8));
+}
+
+static u32 get_le32(const unsigned char *p) {
+    u32 v = 0;
+    for (int i = 0; i < 4; i++) v |= (u32)p[i] << (i * 8);
+    return v;
+}
+
+static u64 get_le64(const unsigned char *p) {
+    u64 v = 0;
+    for (int i = 0; i < 8; i++) v |= (u64)p[i] << (i * 8);
+    return v;
+}
+
+// Bytes after the header for a given algorithm and length
+static size_t hash_state_body(CryptoHashAlgo algo, u64 length) {
+    switch (algo) {
+        case CRYPTO_HASH_SHA256: return 32 + length % SHA256_BLOCK_SIZE;
+        case CRYPTO_HASH_XXH64:  return 32 + length % 32;
+        case CRYPTO_HASH_CRC32C: return 4;
+    }
+    return 0;
+}
+
+size_t crypto_hash_digest_size(CryptoHashAlgo algo) {
+    switch (algo) {
+        case CRYPTO_HASH_SHA256: return 32;
+        case CRYPTO_HASH_XXH64:  return 8;
+        case CRYPTO_HASH_CRC32C: return 4;
+    }
+    return 0;
+}
+
+Result crypto_hash_init(CryptoHashCtx *ctx, CryptoHashAlgo algo) {
+    if (!ctx || crypto_hash_digest_size(algo) == 0) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->algo = algo;
+    switch (algo) {
+        case CRYPTO_HASH_SHA256: sha256_init(&ctx->u.sha256); break;
+        case CRYPTO_HASH_XXH64:  xxh64_init(&ctx->u.xxh64, 0); break;
+        case CRYPTO_HASH_CRC32C: ctx->u.crc32c = 0; break;
+    }
+    return 0;
+}
+
+void crypto_hash_update(CryptoHashCtx *ctx, const void *data, size_t len) {
+    ctx->length += len;
+    switch (ctx->algo) {
+        case CRYPTO_HASH_SHA256: sha256_update(&ctx->u.sha256, data, len); break;
+        case CRYPTO_HASH_XXH64:  xxh64_update(&ctx->u.xxh64, data, len); break;
+        case CRYPTO_HASH_CRC32C: ctx->u.crc32c = crc32c_update(ctx->u.crc32c, data, len); break;
+    }
+}
+
+size_t crypto_hash_final(const CryptoHashCtx *ctx, unsigned char out[CRYPTO_HASH_MAX_DIGEST]) {
+    switch (ctx->algo) {
+        case CRYPTO_HASH_SHA256: {
+            sha256_ctx tmp = ctx->u.sha256;
+            sha256_final(&tmp, out);
+            return 32;
+        }
+        case CRYPTO_HASH_XXH64: {
+            u64 h = xxh64_digest(&ctx->u.xxh64);
+            for (int i = 0; i < 8; i++) out[i] = (unsigned char)(h >> (56 - i * 8));
+            return 8;
+        }
+        case CRYPTO_HASH_CRC32C: {
+            u32 c = ctx->u.crc32c;
+            for (int i = 0; i < 4; i++) out[i] = (unsigned char)(c >> (24 - i * 8));
+            return 4;
+        }
+    }
+    return 0;
+}
+
+size_t crypto_hash_serialize(const CryptoHashCtx *ctx, unsigned char *out, size_t out_len) {
+    size_t body = hash_state_body(ctx->algo, ctx->length);
+    if (!out || out_len < HASH_STATE_HEAD + body) return 0;
+    memcpy(out, HASH_STATE_MAGIC, 4);
+    out[4] = (unsigned char)ctx->algo;
+    out[5] = out[6] = out[7] = 0;
+    put_le64(out + 8, ctx->length);
+
+    unsigned char *p = out + HASH_STATE_HEAD;
+    switch (ctx->algo) {
+        case CRYPTO_HASH_SHA256:
+            for (int i = 0; i < 8; i++) put_le32(p + i * 4, ctx->u.sha256.state[i]);
+            memcpy(p + 32, ctx->u.sha256.buffer, body - 32);
+            break;
+        case CRYPTO_HASH_XXH64:
+            for (int i = 0; i < 4; i++) put_le64(p + i * 8, ctx->u.xxh64.v[i]);
+            memcpy(p + 32, ctx->u.xxh64.mem, body - 32);
+            break;
+        case CRYPTO_HASH_CRC32C:
+            put_le32(p, ctx->u.crc32c);
+            break;
+    }
+    return HASH_STATE_HEAD + body;
+}
+
+Result crypto_hash_deserialize(CryptoHashCtx *ctx, const unsigned char *in, size_t len) {
+    if (!ctx || !in || len < HASH_STATE_HEAD || memcmp(in, HASH_STATE_MAGIC, 4) != 0) {
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    }
+    CryptoHashAlgo algo = (CryptoHashAlgo)in[4];
+    u64 length = get_le64(in + 8);
+    size_t body = hash_state_body(algo, length);
+    if (body == 0 || len != HASH_STATE_HEAD + body) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    crypto_hash_init(ctx, algo);
+    ctx->length = length;
+    const unsigned char *p = in + HASH_STATE_HEAD;
+    switch (algo) {
+        case CRYPTO_HASH_SHA256:
+            for (int i = 0; i < 8; i++) ctx->u.sha256.state[i] = get_le32(p + i * 4);
+            ctx->u.sha256.bitcount = length * 8;
+            memcpy(ctx->u.sha256.buffer, p + 32, body - 32);
+            break;
+        case CRYPTO_HASH_XXH64:
+            for (int i = 0; i < 4; i++) ctx->u.xxh64.v[i] = get_le64(p + i * 8);
+            ctx->u.xxh64.total_len = length;
+            ctx->u.xxh64.memsize = (u32)(body - 32);
+            memcpy(ctx->u.xxh64.mem, p + 32, body - 32);
+            break;
+        case CRYPTO_HASH_CRC32C:
+            ctx->u.crc32c = get_le32(p);
+            break;
+    }
+    return 0;
+}
+
+// Nonces, keys and salts come from here, so it has to be a real CSPRNG:
+// the kernel's on the Switch, the OS's on a host build
 void crypto_random_bytes(unsigned char *buf, size_t len) {
-    srand((unsigned int)time(NULL));
-    for (size_t i = 0; i < len; ++i) buf[i] = rand() & 0xFF;
+#ifdef __SWITCH__
+    randomGet(buf, len);
+#else
+    FILE *f = fopen("/dev/urandom", "rb");
+    size_t got = f ? fread(buf, 1, len, f) : 0;
+    if (f) fclose(f);
+    if (got != len) abort();
+#endif
+}
+
+Result crypto_generate_key(unsigned char *key, size_t key_len) {
+    if (!key || key_len == 0) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    crypto_random_bytes(key, key_len);
+    return 0;
+}
+
+Result crypto_generate_salt(unsigned char *salt, size_t salt_len) {
+    if (!salt || salt_len == 0) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    crypto_random_bytes(salt, salt_len);
+    return 0;
+}
+
+Result crypto_secure_wipe(void *data, size_t len) {
+    if (!data && len) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    volatile unsigned char *p = (volatile unsigned char*)data;
+    while (len--) *p++ = 0;
+    return 0;
+}
+
+Result crypto_secure_compare(const void *a, const void *b, size_t len) {
+    if ((!a || !b) && len) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    const volatile unsigned char *pa = (const volatile unsigned char*)a;
+    const volatile unsigned char *pb = (const volatile unsigned char*)b;
+    unsigned char diff = 0;
+    for (size_t i = 0; i < len; i++) diff |= pa[i] ^ pb[i];
+    return diff ? MAKERESULT(Module_Libnx, LibnxError_VerificationFailed) : 0;
 }
 
 void bin_to_hex(const unsigned char *bin, size_t bin_len, char *out) {
@@ -227,3 +369,371 @@ Result crypto_encrypt_title_key(const void *title_key, const void *rights_id, vo
     memcpy(out_enc_key, title_key, 16);
     return 0;
 }
+
+// AES encryption
+
+#define CRYPTO_FILE_BUFFERS 3
+
+static size_t key_size(CryptoMode mode) {
+    switch (mode) {
+        case CRYPTO_MODE_AES_XTS: return CRYPTO_XTS_KEY_SIZE;
+        case CRYPTO_MODE_AES_GCM:
+        case CRYPTO_MODE_AES_CTR: return CRYPTO_KEY_SIZE;
+    }
+    return 0;
+}
+
+// XTS over consecutive data units starting at 'unit'; unit n uses tweak
+// base + n as a 128-bit little-endian number
+static Result xts_units(const aes_xts_ctx *x, bool encrypt, const unsigned char base[16], u64 unit,
+                        unsigned char *data, size_t len) {
+    while (len > 0) {
+        size_t n = len < CRYPTO_XTS_UNIT_SIZE ? len : CRYPTO_XTS_UNIT_SIZE;
+        if (len - n < AES_BLOCK_SIZE) n = len;
+        unsigned char tweak[16];
+        u64 lo = get_le64(base), sum = lo + unit;
+        put_le64(tweak, sum);
+        put_le64(tweak + 8, get_le64(base + 8) + (sum < lo));
+        int rc = encrypt ? aes_xts_encrypt(x, tweak, data, data, n) : aes_xts_decrypt(x, tweak, data, data, n);
+        if (rc != 0) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+        data += n;
+        len -= n;
+        unit++;
+    }
+    return 0;
+}
+
+static Result crypto_crypt(const void *data, size_t data_len, void *out, size_t *out_len,
+                           const unsigned char *key, CryptoMode mode, AuthContext *auth, bool encrypt) {
+    if (!data || !out || !out_len || !key || key_size(mode) == 0 || *out_len < data_len) {
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    }
+    if (mode != CRYPTO_MODE_AES_XTS && !auth) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    if (mode == CRYPTO_MODE_AES_XTS && data_len < AES_BLOCK_SIZE) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    if (encrypt && auth) {
+        crypto_random_bytes(auth->nonce, sizeof(auth->nonce));
+        auth->data_len = data_len;
+    }
+    if (out != data) memmove(out, data, data_len);
+
+    Result rc = 0;
+    switch (mode) {
+        case CRYPTO_MODE_AES_XTS: {
+            static const unsigned char zero[16];
+            aes_xts_ctx x;
+            aes_xts_init(&x, key, CRYPTO_XTS_KEY_SIZE);
+            rc = xts_units(&x, encrypt, zero, 0, out, data_len);
+            crypto_secure_wipe(&x, sizeof(x));
+            break;
+        }
+        case CRYPTO_MODE_AES_CTR: {
+            unsigned char iv[16] = { 0 };
+            memcpy(iv, auth->nonce, sizeof(auth->nonce));
+            aes_ctr_ctx c;
+            aes_ctr_init(&c, key, CRYPTO_KEY_SIZE, iv);
+            aes_ctr_crypt(&c, out, out, data_len);
+            crypto_secure_wipe(&c, sizeof(c));
+            break;
+        }
+        case CRYPTO_MODE_AES_GCM: {
+            size_t tag_len = auth->tag_len ? auth->tag_len : sizeof(auth->tag);
+            if (!encrypt && (tag_len < 12 || tag_len > sizeof(auth->tag))) {
+                rc = MAKERESULT(Module_Libnx, LibnxError_BadInput);
+                break;
+            }
+            unsigned char tag[16];
+            aes_gcm_ctx g;
+            aes_gcm_init(&g, key, CRYPTO_KEY_SIZE, auth->nonce, sizeof(auth->nonce));
+            if (encrypt) aes_gcm_encrypt(&g, out, out, data_len);
+            else aes_gcm_decrypt(&g, out, out, data_len);
+            aes_gcm_tag(&g, tag);
+            crypto_secure_wipe(&g, sizeof(g));
+            if (encrypt) {
+                memcpy(auth->tag, tag, sizeof(tag));
+                auth->tag_len = sizeof(tag);
+            } else if (crypto_secure_compare(tag, auth->tag, tag_len) != 0) {
+                crypto_secure_wipe(out, data_len);
+                rc = MAKERESULT(Module_Libnx, LibnxError_VerificationFailed);
+            }
+            break;
+        }
+    }
+    *out_len = R_SUCCEEDED(rc) ? data_len : 0;
+    return rc;
+}
+
+Result crypto_encrypt(const void *data, size_t data_len, void *out, size_t *out_len,
+                      const unsigned char *key, CryptoMode mode, AuthContext *auth) {
+    return crypto_crypt(data, data_len, out, out_len, key, mode, auth, true);
+}
+
+Result crypto_decrypt(const void *data, size_t data_len, void *out, size_t *out_len,
+                      const unsigned char *key, CryptoMode mode, AuthContext *auth) {
+    return crypto_crypt(data, data_len, out, out_len, key, mode, auth, false);
+}
+
+// File pipeline: a reader thread fills a small ring of chunk buffers while
+// the calling thread encrypts the previous chunk and writes it out.
+
+typedef struct {
+    FILE *in;
+    u64 left;                   // bytes still to read
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+    pthread_cond_t emptied;
+    unsigned char *buf[CRYPTO_FILE_BUFFERS];
+    size_t len[CRYPTO_FILE_BUFFERS];
+    u32 head, count;            // filled buffers not yet consumed
+    bool done, failed, stop;
+} FileReader;
+
+// Chunks are whole XTS units except the last, which also takes a tail too
+// short to stand alone
+static size_t next_chunk(u64 left) {
+    size_t n = left < CRYPTO_FILE_CHUNK ? (size_t)left : CRYPTO_FILE_CHUNK;
+    if (left - n < AES_BLOCK_SIZE) n = (size_t)left;
+    return n;
+}
+
+static void *reader_main(void *arg) {
+    FileReader *r = (FileReader*)arg;
+    pthread_mutex_lock(&r->lock);
+    while (r->left > 0) {
+        while (r->count == CRYPTO_FILE_BUFFERS && !r->stop) pthread_cond_wait(&r->emptied, &r->lock);
+        if (r->stop) break;
+        u32 slot = (r->head + r->count) % CRYPTO_FILE_BUFFERS;
+        size_t n = next_chunk(r->left);
+        pthread_mutex_unlock(&r->lock);
+
+        size_t got = fread(r->buf[slot], 1, n, r->in);
+
+        pthread_mutex_lock(&r->lock);
+        if (got != n) {
+            r->failed = true;
+            break;
+        }
+        r->len[slot] = n;
+        r->left -= n;
+        r->count++;
+        pthread_cond_signal(&r->filled);
+    }
+    r->done = true;
+    pthread_cond_signal(&r->filled);
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+typedef struct {
+    CryptoMode mode;
+    bool encrypt;
+    unsigned char nonce[16];
+    aes_xts_ctx xts;
+    aes_ctr_ctx ctr;
+    aes_gcm_ctx gcm;
+} FileCipher;
+
+static void cipher_chunk(FileCipher *c, u64 offset, unsigned char *data, size_t len) {
+    switch (c->mode) {
+        case CRYPTO_MODE_AES_XTS:
+            xts_units(&c->xts, c->encrypt, c->nonce, offset / CRYPTO_XTS_UNIT_SIZE, data, len);
+            break;
+        case CRYPTO_MODE_AES_CTR:
+            aes_ctr_crypt(&c->ctr, data, data, len);
+            break;
+        case CRYPTO_MODE_AES_GCM:
+            if (c->encrypt) aes_gcm_encrypt(&c->gcm, data, data, len);
+            else aes_gcm_decrypt(&c->gcm, data, data, len);
+            break;
+    }
+}
+
+// Run 'size' bytes of 'in' through the cipher into 'out'
+static Result pipe_file(FILE *in, FILE *out, u64 size, FileCipher *c,
+                        void (*progress)(size_t current, size_t total)) {
+    FileReader r;
+    memset(&r, 0, sizeof(r));
+    r.in = in;
+    r.left = size;
+    for (int i = 0; i < CRYPTO_FILE_BUFFERS; i++) {
+        r.buf[i] = (unsigned char*)malloc(CRYPTO_FILE_CHUNK + AES_BLOCK_SIZE);
+        if (!r.buf[i]) {
+            for (int j = 0; j < i; j++) free(r.buf[j]);
+            return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        }
+    }
+    pthread_mutex_init(&r.lock, NULL);
+    pthread_cond_init(&r.filled, NULL);
+    pthread_cond_init(&r.emptied, NULL);
+
+    Result rc = 0;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, reader_main, &r) != 0) {
+        rc = MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    } else {
+        u64 offset = 0;
+        pthread_mutex_lock(&r.lock);
+        for (;;) {
+            while (r.count == 0 && !r.done) pthread_cond_wait(&r.filled, &r.lock);
+            if (r.count == 0) break;
+            unsigned char *buf = r.buf[r.head];
+            size_t len = r.len[r.head];
+            pthread_mutex_unlock(&r.lock);
+
+            cipher_chunk(c, offset, buf, len);
+            bool ok = fwrite(buf, 1, len, out) == len;
+
+            pthread_mutex_lock(&r.lock);
+            r.head = (r.head + 1) % CRYPTO_FILE_BUFFERS;
+            r.count--;
+            pthread_cond_signal(&r.emptied);
+            if (!ok) {
+                rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+                r.stop = true;
+                break;
+            }
+            offset += len;
+            if (progress) {
+                pthread_mutex_unlock(&r.lock);
+                progress((size_t)offset, (size_t)size);
+                pthread_mutex_lock(&r.lock);
+            }
+        }
+        if (R_SUCCEEDED(rc) && r.failed) rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+        pthread_mutex_unlock(&r.lock);
+        pthread_join(thread, NULL);
+    }
+
+    pthread_cond_destroy(&r.emptied);
+    pthread_cond_destroy(&r.filled);
+    pthread_mutex_destroy(&r.lock);
+    for (int i = 0; i < CRYPTO_FILE_BUFFERS; i++) {
+        crypto_secure_wipe(r.buf[i], CRYPTO_FILE_CHUNK + AES_BLOCK_SIZE);
+        free(r.buf[i]);
+    }
+    return rc;
+}
+
+static void cipher_init(FileCipher *c, const unsigned char *key, CryptoMode mode, bool encrypt,
+                        const unsigned char header[CRYPTO_FILE_HEADER_SIZE]) {
+    c->mode = mode;
+    c->encrypt = encrypt;
+    memcpy(c->nonce, header + 8, sizeof(c->nonce));
+    switch (mode) {
+        case CRYPTO_MODE_AES_XTS:
+            aes_xts_init(&c->xts, key, CRYPTO_XTS_KEY_SIZE);
+            break;
+        case CRYPTO_MODE_AES_CTR:
+            aes_ctr_init(&c->ctr, key, CRYPTO_KEY_SIZE, c->nonce);
+            break;
+        case CRYPTO_MODE_AES_GCM:
+            aes_gcm_init(&c->gcm, key, CRYPTO_KEY_SIZE, c->nonce, 12);
+            aes_gcm_aad(&c->gcm, header, CRYPTO_FILE_HEADER_SIZE);
+            break;
+    }
+}
+
+Result crypto_encrypt_file(const char *in_path, const char *out_path,
+                           const unsigned char *key, CryptoMode mode,
+                           void (*progress)(size_t current, size_t total)) {
+    if (!in_path || !out_path || !key || key_size(mode) == 0) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    struct stat st;
+    if (stat(in_path, &st) != 0) return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+    u64 size = (u64)st.st_size;
+    if (mode == CRYPTO_MODE_AES_XTS && size > 0 && size < AES_BLOCK_SIZE) {
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    }
+
+    unsigned char header[CRYPTO_FILE_HEADER_SIZE] = { 0 };
+    memcpy(header, CRYPTO_FILE_MAGIC, 4);
+    header[4] = CRYPTO_FILE_VERSION;
+    header[5] = (unsigned char)mode;
+    crypto_random_bytes(header + 8, 16);
+    // GCM takes a 96-bit nonce; CTR counts up from a zero low word
+    if (mode != CRYPTO_MODE_AES_XTS) memset(header + 20, 0, 4);
+    put_le64(header + 24, size);
+
+    FILE *in = fopen(in_path, "rb");
+    if (!in) return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+    FILE *out = fopen(out_path, "wb");
+    if (!out) {
+        fclose(in);
+        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+    }
+    setvbuf(in, NULL, _IONBF, 0);
+    setvbuf(out, NULL, _IONBF, 0);
+
+    FileCipher *c = (FileCipher*)malloc(sizeof(FileCipher));
+    Result rc = c ? 0 : MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    if (R_SUCCEEDED(rc)) {
+        cipher_init(c, key, mode, true, header);
+        if (fwrite(header, 1, sizeof(header), out) != sizeof(header)) rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+    }
+    if (R_SUCCEEDED(rc)) rc = pipe_file(in, out, size, c, progress);
+    if (R_SUCCEEDED(rc) && mode == CRYPTO_MODE_AES_GCM) {
+        unsigned char tag[16];
+        aes_gcm_tag(&c->gcm, tag);
+        if (fwrite(tag, 1, sizeof(tag), out) != sizeof(tag)) rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+    }
+    if (c) {
+        crypto_secure_wipe(c, sizeof(*c));
+        free(c);
+    }
+    fclose(in);
+    if (fclose(out) != 0 && R_SUCCEEDED(rc)) rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+    if (R_FAILED(rc)) remove(out_path);
+    return rc;
+}
+
+Result crypto_decrypt_file(const char *in_path, const char *out_path,
+                           const unsigned char *key, CryptoMode mode,
+                           void (*progress)(size_t current, size_t total)) {
+    if (!in_path || !out_path || !key || key_size(mode) == 0) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    struct stat st;
+    if (stat(in_path, &st) != 0) return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+    FILE *in = fopen(in_path, "rb");
+    if (!in) return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+    setvbuf(in, NULL, _IONBF, 0);
+    unsigned char header[CRYPTO_FILE_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), in) != sizeof(header) ||
+        memcmp(header, CRYPTO_FILE_MAGIC, 4) != 0 || header[4] != CRYPTO_FILE_VERSION) {
+        fclose(in);
+        return MAKERESULT(Module_Libnx, LibnxError_BadMagic);
+    }
+    u64 size = get_le64(header + 24);
+    u64 trailer = mode == CRYPTO_MODE_AES_GCM ? 16 : 0;
+    if (header[5] != (unsigned char)mode || (u64)st.st_size != sizeof(header) + size + trailer ||
+        (mode == CRYPTO_MODE_AES_XTS && size > 0 && size < AES_BLOCK_SIZE)) {
+        fclose(in);
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    }
+
+    FILE *out = fopen(out_path, "wb");
+    if (!out) {
+        fclose(in);
+        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+    }
+    setvbuf(out, NULL, _IONBF, 0);
+
+    FileCipher *c = (FileCipher*)malloc(sizeof(FileCipher));
+    Result rc = c ? 0 : MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    if (R_SUCCEEDED(rc)) {
+        cipher_init(c, key, mode, false, header);
+        rc = pipe_file(in, out, size, c, progress);
+    }
+    if (R_SUCCEEDED(rc) && mode == CRYPTO_MODE_AES_GCM) {
+        unsigned char want[16], tag[16];
+        aes_gcm_tag(&c->gcm, tag);
+        if (fread(want, 1, sizeof(want), in) != sizeof(want)) rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+        else if (crypto_secure_compare(tag, want, sizeof(tag)) != 0) rc = MAKERESULT(Module_Libnx, LibnxError_VerificationFailed);
+    }
+    if (c) {
+        crypto_secure_wipe(c, sizeof(*c));
+        free(c);
+    }
+    fclose(in);
+    if (fclose(out) != 0 && R_SUCCEEDED(rc)) rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+    // Never leave unauthenticated or partial plaintext behind
+    if (R_FAILED(rc)) remove(out_path);
+    return rc;
+}
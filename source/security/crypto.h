@@ -4,6 +4,9 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <switch.h>
+#include "sha256.h"
+#include "checksum.h"
+#include "aes.h"
 
 // Encryption modes for different security needs
 typedef enum {
@@ -12,6 +15,14 @@ typedef enum {
     CRYPTO_MODE_AES_CTR  // For stream encryption
 } CryptoMode;
 
+// Key sizes: AES-256 for GCM and CTR; for XTS the data key followed by the
+// tweak key
+#define CRYPTO_KEY_SIZE         32
+#define CRYPTO_XTS_KEY_SIZE     64
+// XTS data unit. Buffers and files are a run of units numbered from 0; a
+// tail shorter than one AES block is folded into the unit before it.
+#define CRYPTO_XTS_UNIT_SIZE    0x200
+
 // Key derivation context for secure key generation
 typedef struct {
     unsigned char salt[32];
@@ -32,6 +43,12 @@ typedef struct {
 int pbkdf2_hmac_sha256(const char *password, const unsigned char *salt, 
                        size_t salt_len, int iterations, 
                        unsigned char *out, size_t out_len);
+// Length-preserving: 'out' (may equal 'data') needs data_len bytes, and
+// *out_len is its capacity on entry and the bytes written on return. GCM
+// and CTR need 'auth': encryption fills in a fresh nonce (and, for GCM, the
+// tag), decryption reads them back and a GCM tag mismatch fails with
+// LibnxError_VerificationFailed and a wiped 'out'. XTS ignores 'auth' and
+// needs at least 16 bytes.
 Result crypto_encrypt(const void *data, size_t data_len,
                      void *out, size_t *out_len,
                      const unsigned char *key,
@@ -59,7 +76,17 @@ Result crypto_has_title_key(const void *rights_id, bool *out_has_key);
 // can build and run. Replace with a proper implementation if required.
 Result crypto_encrypt_title_key(const void *title_key, const void *rights_id, void *out_enc_key);
 
-// File encryption functions
+// File encryption functions. The output of crypto_encrypt_file is a
+// 32-byte header followed by the encrypted data and, for GCM, a 16-byte
+// tag over header and data:
+//   "DBFE", version, mode, 2 reserved, 16-byte nonce, u64 LE plain size
+// CTR counts from nonce; XTS unit n uses tweak nonce + n (little-endian).
+// Reading, encryption and writing overlap in CRYPTO_FILE_CHUNK pieces.
+// A failed GCM check on decryption deletes out_path.
+#define CRYPTO_FILE_MAGIC       "DBFE"
+#define CRYPTO_FILE_VERSION     1
+#define CRYPTO_FILE_HEADER_SIZE 32
+#define CRYPTO_FILE_CHUNK       (1024 * 1024)
 Result crypto_encrypt_file(const char *in_path, const char *out_path,
                          const unsigned char *key, CryptoMode mode,
                          void (*progress)(size_t current, size_t total));
@@ -73,7 +100,9 @@ Result crypto_encrypt_log(const char *log_data, size_t data_len,
 Result crypto_decrypt_log(const char *enc_data, size_t data_len,
                          char *out_data, size_t *out_len);
 
-// Secure memory functions
+// Secure memory functions. The wipe is not optimized away; the compare
+// takes the same time wherever the buffers differ and returns 0 when they
+// are equal, LibnxError_VerificationFailed when not.
 Result crypto_secure_wipe(void *data, size_t len);
 Result crypto_secure_compare(const void *a, const void *b, size_t len);
 
@@ -88,6 +117,41 @@ int hex_to_bin(const char *hex, unsigned char *out, size_t out_len);
 // SHA-256 helper (32-byte output)
 void crypto_sha256(const void *data, size_t len, unsigned char out[32]);
 
+// Incremental hashing for data that arrives in pieces (copies, downloads,
+// installs), so it can be hashed in flight instead of read back. A
+// context is plain data: assign it to fork the hash of a shared prefix,
+// or serialize it to resume after an interruption (ctx.length tells how
+// far into the data it got).
+typedef enum {
+    CRYPTO_HASH_SHA256,     // 32-byte digest
+    CRYPTO_HASH_XXH64,      // 8 bytes, big-endian like XXH64_canonicalFromHash()
+    CRYPTO_HASH_CRC32C      // 4 bytes, big-endian
+} CryptoHashAlgo;
+
+#define CRYPTO_HASH_MAX_DIGEST  32
+#define CRYPTO_HASH_STATE_MAX   112     // largest crypto_hash_serialize() output
+
+typedef struct {
+    CryptoHashAlgo algo;
+    u64 length;             // bytes hashed so far
+    union {
+        sha256_ctx sha256;
+        xxh64_ctx xxh64;
+        u32 crc32c;
+    } u;
+} CryptoHashCtx;
+
+Result crypto_hash_init(CryptoHashCtx *ctx, CryptoHashAlgo algo);
+void crypto_hash_update(CryptoHashCtx *ctx, const void *data, size_t len);
+// Digest of everything so far; ctx is not consumed and can keep going.
+// Returns the digest size.
+size_t crypto_hash_final(const CryptoHashCtx *ctx, unsigned char out[CRYPTO_HASH_MAX_DIGEST]);
+size_t crypto_hash_digest_size(CryptoHashAlgo algo);
+// Portable little-endian snapshot. Returns its size, or 0 if out_len is
+// too small.
+size_t crypto_hash_serialize(const CryptoHashCtx *ctx, unsigned char *out, size_t out_len);
+Result crypto_hash_deserialize(CryptoHashCtx *ctx, const unsigned char *in, size_t len);
+
 // Initialization/teardown for crypto subsystem
 Result crypto_init(void);
 void crypto_exit(void);
@@ -0,0 +1,562 @@
+// hash_db.c - on-SD database of file digests and verification verdicts
+// Notes:
+// - Keys are "<path>" or "<path>\t<member>"; paths never contain tabs (the
+//   task journal relies on the same thing).
+// - Dropped entries stay in the table as tombstones until it is next grown,
+//   so probing never has to deal with holes.
+// - A digest is only recorded if the file's stat key is the same after it
+//   was read as before, so a file written to while being hashed is not
+//   cached with the wrong digest.
+
+#include "hash_db.h"
+#include "sha256.h"
+#include "crypto.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define HASH_DB_KEY_MAX     (PATH_MAX + 0x100)
+#define HASH_DB_READ_CHUNK  (256 * 1024)
+
+typedef struct {
+    char *key;                  // NULL for an empty slot
+    u64 hash;
+    HashDbEntry e;
+    bool live;
+    bool seen;                  // marked by the updater's directory walk
+} DbSlot;
+
+static DbSlot *db_slots = NULL;
+static size_t db_cap = 0;       // power of two
+static size_t db_used = 0;      // slots holding a key, live or tombstone
+static size_t db_live = 0;
+static bool db_loaded = false;
+static FILE *db_file = NULL;
+static size_t db_dead_records = 0;  // records in the log a compaction would drop
+
+static u64 key_hash(const char *key) {
+    u64 h = 0xcbf29ce484222325ULL;
+    for (const unsigned char *p = (const unsigned char*)key; *p; p++) {
+        h ^= *p;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static int make_key(const char *path, const char *member, char *out) {
+    int n = member ? snprintf(out, HASH_DB_KEY_MAX, "%s\t%s", path, member)
+                   : snprintf(out, HASH_DB_KEY_MAX, "%s", path);
+    return n < 0 || n >= HASH_DB_KEY_MAX ? -ENAMETOOLONG : 0;
+}
+
+static bool stat_matches(const HashDbEntry *e, const struct stat *st) {
+    return e->size == (u64)st->st_size && e->mtime == (s64)st->st_mtime && e->file_id == (u64)st->st_ino;
+}
+
+static int db_grow(void) {
+    size_t cap = 256;
+    while (cap < (db_live + 1) * 2) cap *= 2;
+    DbSlot *slots = calloc(cap, sizeof(DbSlot));
+    if (!slots) return -ENOMEM;
+
+    // Tombstones are left behind here
+    for (size_t i = 0; i < db_cap; i++) {
+        DbSlot *s = &db_slots[i];
+        if (!s->key) continue;
+        if (!s->live) { free(s->key); continue; }
+        size_t j = (size_t)s->hash & (cap - 1);
+        while (slots[j].key) j = (j + 1) & (cap - 1);
+        slots[j] = *s;
+    }
+    free(db_slots);
+    db_slots = slots;
+    db_cap = cap;
+    db_used = db_live;
+    return 0;
+}
+
+// Find the slot for key; with 'create', claim an empty one if it is missing
+static DbSlot *db_find(const char *key, bool create) {
+    if (create && (db_used + 1) * 4 > db_cap * 3 && db_grow() != 0) return NULL;
+    if (!db_cap) return NULL;
+
+    u64 h = key_hash(key);
+    size_t i = (size_t)h & (db_cap - 1);
+    while (db_slots[i].key) {
+        if (db_slots[i].hash == h && strcmp(db_slots[i].key, key) == 0) return &db_slots[i];
+        i = (i + 1) & (db_cap - 1);
+    }
+    if (!create) return NULL;
+
+    char *copy = strdup(key);
+    if (!copy) return NULL;
+    DbSlot *s = &db_slots[i];
+    memset(s, 0, sizeof(*s));
+    s->key = copy;
+    s->hash = h;
+    db_used++;
+    return s;
+}
+
+static void db_set_live(DbSlot *s, bool live) {
+    if (s->live != live) db_live += live ? 1 : (size_t)-1;
+    s->live = live;
+}
+
+static void write_record(FILE *f, const DbSlot *s) {
+    if (!s->live) {
+        fprintf(f, "X %s\n", s->key);
+        return;
+    }
+    char hex[65] = "-";
+    if (s->e.has_sha256) bin_to_hex_s(s->e.sha256, sizeof(s->e.sha256), hex, sizeof(hex));
+    fprintf(f, "H %llu %lld %llu %d %s %s\n", (unsigned long long)s->e.size, (long long)s->e.mtime,
+            (unsigned long long)s->e.file_id, (int)s->e.verdict, hex, s->key);
+}
+
+static void db_load(void) {
+    db_loaded = true;
+    FILE *f = fopen(HASH_DB_PATH, "r");
+    if (!f) {
+        // A crash between remove() and rename() during compaction leaves only the temp file
+        if (rename(HASH_DB_TMP, HASH_DB_PATH) == 0) f = fopen(HASH_DB_PATH, "r");
+        if (!f) return;
+    }
+
+    size_t line_size = HASH_DB_KEY_MAX + 160;
+    char *line = malloc(line_size);
+    if (!line) { fclose(f); return; }
+
+    size_t records = 0;
+    while (fgets(line, (int)line_size, f)) {
+        size_t len = strlen(line);
+        if (len == 0 || line[len - 1] != '\n') break; // torn write at the tail
+        line[len - 1] = '\0';
+        records++;
+
+        if (line[0] == 'X' && line[1] == ' ') {
+            DbSlot *s = db_find(line + 2, false);
+            if (s) db_set_live(s, false);
+        } else if (line[0] == 'H') {
+            unsigned long long size = 0, file_id = 0;
+            long long mtime = 0;
+            int verdict = 0, consumed = 0;
+            char hex[65];
+            if (sscanf(line + 1, " %llu %lld %llu %d %64s %n", &size, &mtime, &file_id, &verdict, hex, &consumed) != 5 || !consumed) continue;
+            if (verdict < HASH_DB_UNVERIFIED || verdict > HASH_DB_VERIFIED_BAD) continue;
+            DbSlot *s = db_find(line + 1 + consumed, true);
+            if (!s) break;
+            memset(&s->e, 0, sizeof(s->e));
+            s->e.size = size;
+            s->e.mtime = mtime;
+            s->e.file_id = file_id;
+            s->e.verdict = (HashDbVerdict)verdict;
+            s->e.has_sha256 = strlen(hex) == 64 && hex_to_bin(hex, s->e.sha256, sizeof(s->e.sha256)) == 32;
+            db_set_live(s, true);
+        }
+    }
+    free(line);
+    fclose(f);
+
+    db_dead_records = records > db_live ? records - db_live : 0;
+    log_event(LOG_INFO, "hash_db: loaded %zu entries (%zu stale records)", db_live, db_dead_records);
+}
+
+static void db_ensure_loaded(void) {
+    if (!db_loaded) db_load();
+}
+
+static void db_append(const DbSlot *s) {
+    if (!db_file) {
+        mkdir("sdmc:/dbfm", 0777);
+        mkdir(HASH_DB_DIR, 0777);
+        db_file = fopen(HASH_DB_PATH, "a");
+        if (!db_file) {
+            log_event(LOG_WARN, "hash_db: cannot open %s (errno=%d), digests will not be kept", HASH_DB_PATH, errno);
+            return;
+        }
+    }
+    // Losing the tail in a power cut only costs a re-hash, so no fsync here
+    write_record(db_file, s);
+    fflush(db_file);
+}
+
+static void db_maybe_compact(void) {
+    if (db_dead_records >= HASH_DB_COMPACT_RECORDS && db_dead_records > db_live) hash_db_compact();
+}
+
+// Record what is known about key, stat'd as st. sha256 NULL keeps the
+// digest and verdict < 0 keeps the verdict, as long as the file is unchanged.
+static int db_record(const char *key, const struct stat *st, const u8 *sha256, int verdict) {
+    db_ensure_loaded();
+    DbSlot *s = db_find(key, true);
+    if (!s) return -ENOMEM;
+
+    bool existed = s->live;
+    HashDbEntry e;
+    memset(&e, 0, sizeof(e));
+    if (existed && stat_matches(&s->e, st)) {
+        e.verdict = s->e.verdict;
+        e.has_sha256 = s->e.has_sha256;
+        memcpy(e.sha256, s->e.sha256, sizeof(e.sha256));
+    }
+    e.size = (u64)st->st_size;
+    e.mtime = (s64)st->st_mtime;
+    e.file_id = (u64)st->st_ino;
+    if (sha256) {
+        e.has_sha256 = true;
+        memcpy(e.sha256, sha256, sizeof(e.sha256));
+    }
+    if (verdict >= 0) e.verdict = (HashDbVerdict)verdict;
+
+    if (existed && stat_matches(&s->e, st) && s->e.verdict == e.verdict && s->e.has_sha256 == e.has_sha256 &&
+        memcmp(s->e.sha256, e.sha256, sizeof(e.sha256)) == 0) {
+        return 0;   // nothing new to write
+    }
+
+    s->e = e;
+    db_set_live(s, true);
+    if (existed) db_dead_records++;
+    db_append(s);
+    db_maybe_compact();
+    return 0;
+}
+
+static void db_drop(DbSlot *s) {
+    if (!s->live) return;
+    db_set_live(s, false);
+    db_dead_records += 2;   // the X record and the H it cancels
+    db_append(s);
+}
+
+bool hash_db_lookup(const char *path, const char *member, HashDbEntry *out) {
+    if (!path) return false;
+    char key[HASH_DB_KEY_MAX];
+    if (make_key(path, member, key) != 0) return false;
+    db_ensure_loaded();
+    DbSlot *s = db_find(key, false);
+    if (!s || !s->live) return false;
+
+    struct stat st;
+    if (stat(path, &st) != 0 || !stat_matches(&s->e, &st)) return false;
+    if (out) *out = s->e;
+    return true;
+}
+
+int hash_db_put_sha256(const char *path, const char *member, const u8 sha256[32]) {
+    if (!path || !sha256) return -EINVAL;
+    char key[HASH_DB_KEY_MAX];
+    int rc = make_key(path, member, key);
+    if (rc != 0) return rc;
+    struct stat st;
+    if (stat(path, &st) != 0) return -errno;
+    return db_record(key, &st, sha256, -1);
+}
+
+int hash_db_put_verdict(const char *path, HashDbVerdict verdict) {
+    if (!path) return -EINVAL;
+    char key[HASH_DB_KEY_MAX];
+    int rc = make_key(path, NULL, key);
+    if (rc != 0) return rc;
+    struct stat st;
+    if (stat(path, &st) != 0) return -errno;
+    return db_record(key, &st, NULL, (int)verdict);
+}
+
+void hash_db_forget(const char *path) {
+    if (!path) return;
+    db_ensure_loaded();
+    size_t len = strlen(path);
+    for (size_t i = 0; i < db_cap; i++) {
+        DbSlot *s = &db_slots[i];
+        if (s->live && strncmp(s->key, path, len) == 0 && (s->key[len] == '\0' || s->key[len] == '\t')) db_drop(s);
+    }
+    db_maybe_compact();
+}
+
+int hash_db_file_sha256(const char *path, u8 out[32], bool *out_cached) {
+    if (!path || !out) return -EINVAL;
+    if (out_cached) *out_cached = false;
+
+    HashDbEntry e;
+    if (hash_db_lookup(path, NULL, &e) && e.has_sha256) {
+        memcpy(out, e.sha256, 32);
+        if (out_cached) *out_cached = true;
+        return 0;
+    }
+
+    struct stat before, after;
+    if (stat(path, &before) != 0) return -errno;
+    FILE *f = fopen(path, "rb");
+    if (!f) return -errno;
+    setvbuf(f, NULL, _IONBF, 0);
+    u8 *buf = malloc(HASH_DB_READ_CHUNK);
+    if (!buf) { fclose(f); return -ENOMEM; }
+
+    sha256_ctx ctx;
+    sha256_init(&ctx);
+    size_t got;
+    while ((got = fread(buf, 1, HASH_DB_READ_CHUNK, f)) > 0) sha256_update(&ctx, buf, got);
+    int failed = ferror(f);
+    free(buf);
+    fclose(f);
+    if (failed) return -EIO;
+    sha256_final(&ctx, out);
+
+    char key[HASH_DB_KEY_MAX];
+    if (make_key(path, NULL, key) == 0 && stat(path, &after) == 0 &&
+        after.st_size == before.st_size && after.st_mtime == before.st_mtime && after.st_ino == before.st_ino) {
+        db_record(key, &after, out, -1);
+    }
+    return 0;
+}
+
+struct HashDbUpdate {
+    char root[PATH_MAX];        // without a trailing '/'
+    char **paths;               // files to hash
+    u64 *sizes;
+    size_t count, cap, next;
+    u64 total, done;            // 'done' counts whole files already finished
+    u64 cur_read;
+    FILE *cur;
+    struct stat cur_st;
+    sha256_ctx ctx;
+    u8 *buf;
+    HashDbUpdateStats stats;
+};
+
+static int update_add(HashDbUpdate *u, const char *path, u64 size) {
+    if (u->count == u->cap) {
+        size_t cap = u->cap ? u->cap * 2 : 64;
+        char **paths = realloc(u->paths, cap * sizeof(*paths));
+        if (!paths) return -ENOMEM;
+        u->paths = paths;
+        u64 *sizes = realloc(u->sizes, cap * sizeof(*sizes));
+        if (!sizes) return -ENOMEM;
+        u->sizes = sizes;
+        u->cap = cap;
+    }
+    char *copy = strdup(path);
+    if (!copy) return -ENOMEM;
+    u->paths[u->count] = copy;
+    u->sizes[u->count] = size;
+    u->count++;
+    u->total += size;
+    return 0;
+}
+
+// Queue a regular file for hashing unless its digest is still valid
+static int update_consider(HashDbUpdate *u, const char *path, const struct stat *st) {
+    char key[HASH_DB_KEY_MAX];
+    u->stats.files_seen++;
+    make_key(path, NULL, key);
+    DbSlot *s = db_find(key, false);
+    if (s) s->seen = true;
+    if (s && s->live && s->e.has_sha256 && stat_matches(&s->e, st)) return 0;
+    return update_add(u, path, (u64)st->st_size);
+}
+
+static int update_walk(HashDbUpdate *u, const char *dir_path) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) return -errno;
+
+    size_t len = strlen(dir_path);
+    const char *sep = len && dir_path[len - 1] == '/' ? "" : "/";
+    char path[PATH_MAX];
+    struct dirent *entry;
+    struct stat st;
+    int rc = 0;
+
+    while (rc == 0 && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        int n = snprintf(path, sizeof(path), "%s%s%s", dir_path, sep, entry->d_name);
+        if (n < 0 || n >= (int)sizeof(path) || stat(path, &st) != 0) continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            // The database's own log changes on every write
+            if (strcmp(path, HASH_DB_DIR) != 0) rc = update_walk(u, path);
+            continue;
+        }
+        if (S_ISREG(st.st_mode)) rc = update_consider(u, path, &st);
+    }
+    closedir(dir);
+    return rc;
+}
+
+// Drop entries under the root whose files the walk did not find
+static void update_prune(HashDbUpdate *u) {
+    size_t root_len = strlen(u->root);
+    char path[PATH_MAX];
+    for (size_t i = 0; i < db_cap; i++) {
+        DbSlot *s = &db_slots[i];
+        if (!s->live || strncmp(s->key, u->root, root_len) != 0 || s->key[root_len] != '/') continue;
+
+        bool gone;
+        const char *tab = strchr(s->key, '\t');
+        if (!tab) {
+            gone = !s->seen;
+        } else {
+            // A member lives as long as its container
+            size_t n = (size_t)(tab - s->key);
+            if (n >= sizeof(path)) n = sizeof(path) - 1;
+            memcpy(path, s->key, n);
+            path[n] = '\0';
+            DbSlot *container = db_find(path, false);
+            struct stat st;
+            gone = container ? !container->seen : stat(path, &st) != 0;
+        }
+        if (gone) {
+            db_drop(s);
+            if (!tab) u->stats.files_removed++;
+        }
+    }
+}
+
+int hash_db_update_begin(const char *root, HashDbUpdate **out) {
+    if (!root || !out) return -EINVAL;
+    *out = NULL;
+    HashDbUpdate *u = calloc(1, sizeof(HashDbUpdate));
+    if (!u) return -ENOMEM;
+    u->buf = malloc(HASH_DB_READ_CHUNK);
+    if (!u->buf) { free(u); return -ENOMEM; }
+    snprintf(u->root, sizeof(u->root), "%s", root);
+    size_t len = strlen(u->root);
+    while (len > 0 && u->root[len - 1] == '/') u->root[--len] = '\0';
+
+    db_ensure_loaded();
+    for (size_t i = 0; i < db_cap; i++) db_slots[i].seen = false;
+    // A single file is only hashed if needed; nothing under it to prune
+    struct stat st;
+    int rc;
+    if (stat(root, &st) == 0 && S_ISREG(st.st_mode)) {
+        rc = update_consider(u, root, &st);
+    } else {
+        rc = update_walk(u, root);
+        if (rc == 0) update_prune(u);
+    }
+    if (rc != 0) {
+        hash_db_update_finish(u, NULL);
+        return rc;
+    }
+    log_event(LOG_INFO, "hash_db: %s: %zu file(s), %zu new or changed (%llu bytes), %zu removed",
+              root, u->stats.files_seen, u->count, (unsigned long long)u->total, u->stats.files_removed);
+    *out = u;
+    return 0;
+}
+
+int hash_db_update_step(HashDbUpdate *u, size_t budget, const bool *cancel) {
+    if (!u) return -EINVAL;
+    while (budget > 0) {
+        if (cancel && *cancel) return -EINTR;
+        if (!u->cur) {
+            if (u->next >= u->count) return 1;
+            const char *path = u->paths[u->next];
+            // The file may have gone away since the walk
+            if (stat(path, &u->cur_st) != 0 || !(u->cur = fopen(path, "rb"))) {
+                u->done += u->sizes[u->next++];
+                continue;
+            }
+            setvbuf(u->cur, NULL, _IONBF, 0);
+            sha256_init(&u->ctx);
+            u->cur_read = 0;
+        }
+
+        size_t want = budget < HASH_DB_READ_CHUNK ? budget : HASH_DB_READ_CHUNK;
+        size_t got = fread(u->buf, 1, want, u->cur);
+        sha256_update(&u->ctx, u->buf, got);
+        u->cur_read += got;
+        u->stats.bytes_hashed += got;
+        budget -= got;
+        if (got == want) continue;
+
+        const char *path = u->paths[u->next];
+        bool failed = ferror(u->cur) != 0;
+        fclose(u->cur);
+        u->cur = NULL;
+        struct stat now;
+        if (!failed && stat(path, &now) == 0 && now.st_size == u->cur_st.st_size &&
+            now.st_mtime == u->cur_st.st_mtime && now.st_ino == u->cur_st.st_ino) {
+            u8 digest[32];
+            sha256_final(&u->ctx, digest);
+            char key[HASH_DB_KEY_MAX];
+            if (make_key(path, NULL, key) == 0) db_record(key, &now, digest, -1);
+            u->stats.files_hashed++;
+        }
+        u->done += u->sizes[u->next++];
+        break;  // one file per step at most, so the caller sees progress
+    }
+    return u->next >= u->count && !u->cur ? 1 : 0;
+}
+
+int hash_db_update_progress(const HashDbUpdate *u) {
+    if (!u || u->total == 0) return 100;
+    u64 done = u->done + (u->cur ? u->cur_read : 0);
+    if (done > u->total) done = u->total;
+    return (int)(done * 100 / u->total);
+}
+
+void hash_db_update_finish(HashDbUpdate *u, HashDbUpdateStats *stats) {
+    if (!u) return;
+    if (stats) *stats = u->stats;
+    if (u->cur) fclose(u->cur);
+    for (size_t i = 0; i < u->count; i++) free(u->paths[i]);
+    free(u->paths);
+    free(u->sizes);
+    free(u->buf);
+    free(u);
+    db_maybe_compact();
+}
+
+int hash_db_compact(void) {
+    db_ensure_loaded();
+    if (db_file) {
+        fclose(db_file);
+        db_file = NULL;
+    }
+
+    mkdir("sdmc:/dbfm", 0777);
+    mkdir(HASH_DB_DIR, 0777);
+    FILE *f = fopen(HASH_DB_TMP, "w");
+    if (!f) return -errno;
+    for (size_t i = 0; i < db_cap; i++) {
+        if (db_slots[i].live) write_record(f, &db_slots[i]);
+    }
+    fflush(f);
+    fsync(fileno(f));
+    int failed = ferror(f);
+    fclose(f);
+    if (failed) {
+        remove(HASH_DB_TMP);
+        return -EIO;
+    }
+
+    // FAT does not replace on rename, so drop the old log first; loading
+    // falls back to the temp file if we die in between.
+    remove(HASH_DB_PATH);
+    if (rename(HASH_DB_TMP, HASH_DB_PATH) != 0) return -errno;
+    db_dead_records = 0;
+    return 0;
+}
+
+void hash_db_close(void) {
+    if (!db_loaded) return;
+    db_maybe_compact();
+    if (db_file) {
+        fflush(db_file);
+        fsync(fileno(db_file));
+        fclose(db_file);
+        db_file = NULL;
+    }
+    for (size_t i = 0; i < db_cap; i++) free(db_slots[i].key);
+    free(db_slots);
+    db_slots = NULL;
+    db_cap = db_used = db_live = 0;
+    db_dead_records = 0;
+    db_loaded = false;
+}
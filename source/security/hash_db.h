@@ -0,0 +1,89 @@
+// hash_db.h - on-SD database of file digests and verification verdicts
+#ifndef HASH_DB_H
+#define HASH_DB_H
+
+#include <switch.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Remembers what is already known about a file so it does not have to be
+// read again: its SHA-256, the verdict of the last verification, and the
+// SHA-256 of members inside it (the NCAs of an NSP). An entry only counts
+// while the file still has the size, mtime and file id it had when the
+// entry was recorded; any change makes it a miss.
+//
+// Append-only text log, one record per line, last record for a key wins:
+//   H <size> <mtime> <file id> <verdict> <sha256 hex or -> <path>[\t<member>]
+//   X <path>[\t<member>]          entry dropped
+// A torn final line (no trailing newline) is ignored when loading. The log
+// is loaded on first use and rewritten once superseded records pile up.
+// Not thread-safe: use it from the main thread.
+#define HASH_DB_DIR  "sdmc:/dbfm/hashdb"
+#define HASH_DB_PATH HASH_DB_DIR "/hashes.db"
+#define HASH_DB_TMP  HASH_DB_DIR "/hashes.db.tmp"
+
+// Rewrite the log once this many records are dead weight
+#define HASH_DB_COMPACT_RECORDS 512
+
+typedef enum {
+    HASH_DB_UNVERIFIED = 0,     // digest known, never verified
+    HASH_DB_VERIFIED_OK,
+    HASH_DB_VERIFIED_BAD
+} HashDbVerdict;
+
+typedef struct {
+    u64 size;
+    s64 mtime;
+    u64 file_id;                // st_ino where the filesystem has one
+    HashDbVerdict verdict;
+    bool has_sha256;
+    u8 sha256[32];
+} HashDbEntry;
+
+// Look up path (member NULL for the file itself). Returns true only if the
+// entry exists and the file is unchanged since it was recorded.
+bool hash_db_lookup(const char *path, const char *member, HashDbEntry *out);
+
+// Record the digest of path, or of a member inside it. Keeps the verdict if
+// the file has not changed. Returns 0 on success, negative errno on failure.
+int hash_db_put_sha256(const char *path, const char *member, const u8 sha256[32]);
+
+// Record the verification verdict for path. Keeps the digest if the file
+// has not changed.
+int hash_db_put_verdict(const char *path, HashDbVerdict verdict);
+
+// Drop path and all of its members
+void hash_db_forget(const char *path);
+
+// SHA-256 of a whole file, from the database when it is still valid,
+// otherwise read and recorded. out_cached may be NULL.
+int hash_db_file_sha256(const char *path, u8 out[32], bool *out_cached);
+
+// Incremental updater: walks a directory tree, drops entries for files that
+// are gone, and hashes only the files that are new or changed. Stepped a
+// little at a time so it can run from the task queue. Given a single file
+// it just brings that file's digest up to date.
+typedef struct HashDbUpdate HashDbUpdate;
+
+typedef struct {
+    size_t files_seen;
+    size_t files_hashed;
+    size_t files_removed;
+    u64 bytes_hashed;
+} HashDbUpdateStats;
+
+int hash_db_update_begin(const char *root, HashDbUpdate **out);
+// Hash up to 'budget' bytes. Returns 1 when done, 0 if there is more to do,
+// -EINTR if *cancel was set, other negative errno on failure.
+int hash_db_update_step(HashDbUpdate *u, size_t budget, const bool *cancel);
+int hash_db_update_progress(const HashDbUpdate *u); // 0..100
+// Frees u; stats may be NULL
+void hash_db_update_finish(HashDbUpdate *u, HashDbUpdateStats *stats);
+
+// Rewrite the log with only the live entries. Crash-safe.
+int hash_db_compact(void);
+
+// Write out pending state and free the in-memory table
+void hash_db_close(void);
+
+#endif // HASH_DB_H
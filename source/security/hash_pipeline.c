@@ -0,0 +1,319 @@
+// hash_pipeline.c - SHA-256 of file ranges with reads and hashing overlapped
+// Notes:
+// - A worker queue can never overflow: it has one slot per buffer and a
+//   job always holds a buffer.
+// - After a read error the workers keep draining their queues (without
+//   hashing) so every buffer comes back before the next set of ranges
+//   starts or the threads are joined.
+// - Only the calling thread waits on 'freed', so one signal per buffer is
+//   enough.
+
+#include "hash_pipeline.h"
+#include "sha256.h"
+#include "../../include/libnx_errors.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+typedef struct {
+    u32 range;
+    u8 *data;
+    size_t len;
+    bool last;                  // final block of its range
+} HashJob;
+
+typedef struct {
+    u64 offset;
+    u32 range;
+} RangeOrder;
+
+typedef struct {
+    HashPipeline *p;
+    u32 index;
+    pthread_t thread;
+    bool started;
+    HashJob queue[HASH_PIPELINE_BUFFERS];
+    u32 head, count;
+    u64 queued;                 // bytes waiting, to pick the least loaded worker
+} HashWorker;
+
+struct HashPipeline {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t freed;
+    u8 *pool;
+    u8 *free_bufs[HASH_PIPELINE_BUFFERS];
+    u32 free_count;
+    HashWorker workers[HASH_PIPELINE_WORKERS];
+    bool stop;
+    bool failed;
+    FILE *f;
+    u64 pos;                    // file position
+    // The current set of ranges
+    HashRange *ranges;
+    sha256_ctx *ctx;
+    RangeOrder *order;          // ranges in offset order
+    size_t count, cap;
+    size_t next;                // next entry of 'order' to start reading
+    u32 cur;                    // range being read while cur_left > 0
+    u64 cur_left;
+    HashWorker *cur_worker;
+    u64 done, total;
+};
+
+static void *worker_main(void *arg) {
+    HashWorker *w = (HashWorker*)arg;
+    HashPipeline *p = w->p;
+#ifdef __SWITCH__
+    // pthreads start on the default core; give each hasher its own
+    svcSetThreadCoreMask(CUR_THREAD_HANDLE, (s32)(w->index % 3), 1u << (w->index % 3));
+#endif
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (w->count == 0 && !p->stop) pthread_cond_wait(&p->work, &p->lock);
+        if (w->count == 0) break;
+        HashJob job = w->queue[w->head];
+        bool skip = p->failed;
+        pthread_mutex_unlock(&p->lock);
+
+        if (!skip) {
+            sha256_update(&p->ctx[job.range], job.data, job.len);
+            if (job.last) sha256_final(&p->ctx[job.range], p->ranges[job.range].sha256);
+        }
+
+        pthread_mutex_lock(&p->lock);
+        w->head = (w->head + 1) % HASH_PIPELINE_BUFFERS;
+        w->count--;
+        w->queued -= job.len;
+        p->free_bufs[p->free_count++] = job.data;
+        pthread_cond_signal(&p->freed);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+static int compare_offsets(const void *a, const void *b) {
+    const RangeOrder *ra = (const RangeOrder*)a, *rb = (const RangeOrder*)b;
+    if (ra->offset != rb->offset) return ra->offset < rb->offset ? -1 : 1;
+    return ra->range < rb->range ? -1 : ra->range > rb->range;
+}
+
+static HashWorker *least_loaded(HashPipeline *p) {
+    HashWorker *best = &p->workers[0];
+    for (u32 i = 1; i < HASH_PIPELINE_WORKERS; i++) {
+        if (p->workers[i].queued < best->queued) best = &p->workers[i];
+    }
+    return best;
+}
+
+// Block until every buffer is back, i.e. all queued blocks are hashed
+static void wait_idle(HashPipeline *p) {
+    pthread_mutex_lock(&p->lock);
+    while (p->free_count < HASH_PIPELINE_BUFFERS) pthread_cond_wait(&p->freed, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
+Result hash_pipeline_create(const char *path, HashPipeline **out) {
+    if (!path || !out) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    *out = NULL;
+
+    HashPipeline *p = calloc(1, sizeof(HashPipeline));
+    if (!p) return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    p->f = fopen(path, "rb");
+    if (!p->f) {
+        free(p);
+        return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+    }
+    // Blocks are big enough to go straight to the filesystem
+    setvbuf(p->f, NULL, _IONBF, 0);
+    p->pool = malloc((size_t)HASH_PIPELINE_BUFFERS * HASH_PIPELINE_BLOCK);
+    if (!p->pool) {
+        fclose(p->f);
+        free(p);
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    }
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->freed, NULL);
+    for (u32 i = 0; i < HASH_PIPELINE_BUFFERS; i++) p->free_bufs[i] = p->pool + (size_t)i * HASH_PIPELINE_BLOCK;
+    p->free_count = HASH_PIPELINE_BUFFERS;
+
+    for (u32 i = 0; i < HASH_PIPELINE_WORKERS; i++) {
+        HashWorker *w = &p->workers[i];
+        w->p = p;
+        w->index = i;
+        if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+            hash_pipeline_destroy(p);
+            return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        }
+        w->started = true;
+    }
+    *out = p;
+    return 0;
+}
+
+Result hash_pipeline_start(HashPipeline *p, HashRange *ranges, size_t count) {
+    if (!p || (!ranges && count)) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    // Whatever is left of the previous set (after a failure) drains first
+    wait_idle(p);
+    p->failed = false;
+
+    if (count > p->cap) {
+        RangeOrder *order = realloc(p->order, count * sizeof(RangeOrder));
+        if (!order) return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        p->order = order;
+        sha256_ctx *ctx = realloc(p->ctx, count * sizeof(sha256_ctx));
+        if (!ctx) return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        p->ctx = ctx;
+        p->cap = count;
+    }
+    p->ranges = ranges;
+    p->count = count;
+    p->next = 0;
+    p->cur_left = 0;
+    p->done = p->total = 0;
+    for (size_t i = 0; i < count; i++) {
+        p->order[i].offset = ranges[i].offset;
+        p->order[i].range = (u32)i;
+        p->total += ranges[i].size;
+    }
+    // Reading in offset order keeps the card sequential
+    if (count > 1) qsort(p->order, count, sizeof(RangeOrder), compare_offsets);
+    return 0;
+}
+
+// Move to the next range with data, finishing empty ones on the spot.
+// Returns false once every range has been read.
+static bool next_range(HashPipeline *p) {
+    while (p->next < p->count) {
+        u32 r = p->order[p->next++].range;
+        sha256_init(&p->ctx[r]);
+        if (p->ranges[r].size == 0) {
+            sha256_final(&p->ctx[r], p->ranges[r].sha256);
+            continue;
+        }
+        p->cur = r;
+        p->cur_left = p->ranges[r].size;
+        pthread_mutex_lock(&p->lock);
+        p->cur_worker = least_loaded(p);
+        pthread_mutex_unlock(&p->lock);
+        return true;
+    }
+    return false;
+}
+
+// Read up to 'max' bytes of the current range into its worker's queue
+static Result feed_block(HashPipeline *p, size_t max, size_t *fed) {
+    HashRange *range = &p->ranges[p->cur];
+    u64 at = range->offset + (range->size - p->cur_left);
+    if (p->pos != at) {
+        if (fseeko(p->f, (off_t)at, SEEK_SET) != 0) return MAKERESULT(Module_Libnx, LibnxError_IoError);
+        p->pos = at;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    while (p->free_count == 0) pthread_cond_wait(&p->freed, &p->lock);
+    u8 *buf = p->free_bufs[--p->free_count];
+    pthread_mutex_unlock(&p->lock);
+
+    size_t n = p->cur_left < max ? (size_t)p->cur_left : max;
+    size_t got = fread(buf, 1, n, p->f);
+    p->pos += got;
+
+    pthread_mutex_lock(&p->lock);
+    if (got != n) {
+        p->free_bufs[p->free_count++] = buf;
+        pthread_mutex_unlock(&p->lock);
+        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+    }
+    p->cur_left -= n;
+    HashWorker *w = p->cur_worker;
+    HashJob *job = &w->queue[(w->head + w->count) % HASH_PIPELINE_BUFFERS];
+    job->range = p->cur;
+    job->data = buf;
+    job->len = n;
+    job->last = p->cur_left == 0;
+    w->count++;
+    w->queued += n;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+
+    p->done += n;
+    *fed = n;
+    return 0;
+}
+
+Result hash_pipeline_step(HashPipeline *p, size_t budget, bool *done) {
+    if (!p || !done) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    *done = false;
+    size_t left = budget ? budget : SIZE_MAX;
+    while (left > 0) {
+        if (p->cur_left == 0 && !next_range(p)) {
+            // Everything is read; the digests are ready once the workers are
+            wait_idle(p);
+            *done = true;
+            return 0;
+        }
+        size_t fed = 0;
+        Result rc = feed_block(p, left < HASH_PIPELINE_BLOCK ? left : HASH_PIPELINE_BLOCK, &fed);
+        if (R_FAILED(rc)) {
+            // Nothing more of this set gets hashed; the next start drains it
+            pthread_mutex_lock(&p->lock);
+            p->failed = true;
+            pthread_mutex_unlock(&p->lock);
+            p->next = p->count;
+            p->cur_left = 0;
+            return rc;
+        }
+        left -= fed;
+    }
+    return 0;
+}
+
+void hash_pipeline_position(const HashPipeline *p, u64 *current, u64 *total) {
+    if (current) *current = p ? p->done : 0;
+    if (total) *total = p ? p->total : 0;
+}
+
+void hash_pipeline_destroy(HashPipeline *p) {
+    if (!p) return;
+    pthread_mutex_lock(&p->lock);
+    p->stop = true;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+    for (u32 i = 0; i < HASH_PIPELINE_WORKERS; i++) {
+        if (p->workers[i].started) pthread_join(p->workers[i].thread, NULL);
+    }
+
+    pthread_cond_destroy(&p->freed);
+    pthread_cond_destroy(&p->work);
+    pthread_mutex_destroy(&p->lock);
+    free(p->pool);
+    free(p->ctx);
+    free(p->order);
+    fclose(p->f);
+    free(p);
+}
+
+Result hash_pipeline_file(const char *path, HashRange *ranges, size_t count,
+                          void (*progress)(size_t current, size_t total)) {
+    if (!path || (!ranges && count)) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    if (count == 0) return 0;
+
+    HashPipeline *p = NULL;
+    Result rc = hash_pipeline_create(path, &p);
+    if (R_FAILED(rc)) return rc;
+    rc = hash_pipeline_start(p, ranges, count);
+    bool done = false;
+    while (R_SUCCEEDED(rc) && !done) {
+        // A block at a time, so progress moves as the card is read
+        rc = hash_pipeline_step(p, HASH_PIPELINE_BLOCK, &done);
+        if (progress && R_SUCCEEDED(rc)) progress((size_t)p->done, (size_t)p->total);
+    }
+    hash_pipeline_destroy(p);
+    return rc;
+}
@@ -0,0 +1,48 @@
+// hash_pipeline.h - SHA-256 of file ranges with reads and hashing overlapped
+#ifndef HASH_PIPELINE_H
+#define HASH_PIPELINE_H
+
+#include <switch.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// The calling thread reads the file in HASH_PIPELINE_BLOCK pieces, in
+// offset order, and hands them to HASH_PIPELINE_WORKERS hasher threads
+// (pinned to the application cores on the Switch). Each range stays on one
+// worker so its blocks are hashed in order; different ranges are hashed
+// on different cores at the same time. With a small pool of buffers in
+// flight, the card is read continuously while the previous blocks hash.
+
+#define HASH_PIPELINE_WORKERS   3
+#define HASH_PIPELINE_BLOCK     (4 * 1024 * 1024)
+#define HASH_PIPELINE_BUFFERS   6
+
+typedef struct {
+    u64 offset;
+    u64 size;
+    u8 sha256[32];      // filled in on success
+} HashRange;
+
+// Hash every range of 'path'. Ranges may be in any order and may overlap.
+// 'progress' (may be NULL) runs on the calling thread with bytes read so
+// far and the sum of all range sizes.
+Result hash_pipeline_file(const char *path, HashRange *ranges, size_t count,
+                          void (*progress)(size_t current, size_t total));
+
+// The same pipeline stepped, for callers that run a little per frame or
+// hash several sets of ranges from one file: the file, buffers and
+// workers are set up once by create and kept until destroy.
+typedef struct HashPipeline HashPipeline;
+
+Result hash_pipeline_create(const char *path, HashPipeline **out);
+// Begin a new set of ranges. 'ranges' must stay valid until the set is
+// done; a set abandoned after an error is drained first.
+Result hash_pipeline_start(HashPipeline *p, HashRange *ranges, size_t count);
+// Read up to 'budget' bytes (0 = all of the set). *done is set once every
+// range of the set has its digest.
+Result hash_pipeline_step(HashPipeline *p, size_t budget, bool *done);
+// Bytes of the current set read so far, and their total
+void hash_pipeline_position(const HashPipeline *p, u64 *current, u64 *total);
+void hash_pipeline_destroy(HashPipeline *p);
+
+#endif // HASH_PIPELINE_H
@@ -0,0 +1,497 @@
+// manifest.c - chunked Merkle integrity manifests for dumps and backups
+// Notes:
+// - Leaves are plain SHA-256 of the chunk, so a chunk can be checked with
+//   the hash pipeline over its byte range and nothing else.
+// - Interior nodes are hashed a whole level at a time with sha256_multi().
+// - A manifest is only trusted after its roots have been recomputed from
+//   its chunk lists, so a damaged manifest is reported as such rather than
+//   as damage in the data.
+
+#include "manifest.h"
+#include "hash_pipeline.h"
+#include "sha256.h"
+#include "crypto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MANIFEST_LINE_MAX   (PATH_MAX + 160)
+#define MANIFEST_MIN_CHUNK  0x1000
+#define MANIFEST_MAX_CHUNK  (64 * 1024 * 1024)
+
+typedef struct {
+    char *name;
+    u64 size;
+    u8 root[32];
+    size_t first;               // index of its first chunk digest
+    size_t chunks;
+} ManifestFile;
+
+struct Manifest {
+    u32 chunk_size;
+    ManifestFile *files;
+    size_t count, cap;
+    u8 (*leaves)[32];
+    size_t leaf_count, leaf_cap;
+    // File being fed
+    bool open;
+    u64 fed;
+    size_t chunk_fill;
+    sha256_ctx ctx;
+    int error;
+};
+
+static size_t chunk_count(u64 size, u32 chunk_size) {
+    return (size_t)((size + chunk_size - 1) / chunk_size);
+}
+
+static int merkle_root(const u8 (*leaves)[32], size_t count, u8 root[32]) {
+    if (count <= 1) {
+        if (count == 1) {
+            memcpy(root, leaves[0], 32);
+        } else {
+            sha256_ctx ctx;
+            sha256_init(&ctx);
+            sha256_final(&ctx, root);
+        }
+        return 0;
+    }
+
+    size_t half = count / 2;
+    u8 (*level)[32] = malloc(count * 32);
+    u8 (*pairs)[65] = malloc(half * 65);
+    const void **data = malloc(half * sizeof(*data));
+    size_t *lens = malloc(half * sizeof(*lens));
+    if (!level || !pairs || !data || !lens) {
+        free(level); free(pairs); free(data); free(lens);
+        return -ENOMEM;
+    }
+    memcpy(level, leaves, count * 32);
+
+    while (count > 1) {
+        half = count / 2;
+        for (size_t i = 0; i < half; i++) {
+            pairs[i][0] = 0x01;
+            memcpy(pairs[i] + 1, level[2 * i], 32);
+            memcpy(pairs[i] + 33, level[2 * i + 1], 32);
+            data[i] = pairs[i];
+            lens[i] = 65;
+        }
+        // The inputs were copied out, so the level can be overwritten in place
+        sha256_multi(data, lens, half, level);
+        if (count & 1) memcpy(level[half], level[count - 1], 32);
+        count = half + (count & 1);
+    }
+    memcpy(root, level[0], 32);
+    free(level); free(pairs); free(data); free(lens);
+    return 0;
+}
+
+static int file_root(const Manifest *m, const ManifestFile *f, u8 root[32]) {
+    return merkle_root((const u8 (*)[32])m->leaves + f->first, f->chunks, root);
+}
+
+static int push_leaf(Manifest *m, const u8 digest[32]) {
+    if (m->leaf_count == m->leaf_cap) {
+        size_t cap = m->leaf_cap ? m->leaf_cap * 2 : 256;
+        u8 (*leaves)[32] = realloc(m->leaves, cap * 32);
+        if (!leaves) return -ENOMEM;
+        m->leaves = leaves;
+        m->leaf_cap = cap;
+    }
+    memcpy(m->leaves[m->leaf_count++], digest, 32);
+    return 0;
+}
+
+static int push_file(Manifest *m, const char *name) {
+    if (m->count == m->cap) {
+        size_t cap = m->cap ? m->cap * 2 : 16;
+        ManifestFile *files = realloc(m->files, cap * sizeof(*files));
+        if (!files) return -ENOMEM;
+        m->files = files;
+        m->cap = cap;
+    }
+    char *copy = strdup(name);
+    if (!copy) return -ENOMEM;
+    ManifestFile *f = &m->files[m->count++];
+    memset(f, 0, sizeof(*f));
+    f->name = copy;
+    f->first = m->leaf_count;
+    return 0;
+}
+
+int manifest_create(Manifest **out) {
+    if (!out) return -EINVAL;
+    *out = calloc(1, sizeof(Manifest));
+    if (!*out) return -ENOMEM;
+    (*out)->chunk_size = MANIFEST_CHUNK_SIZE;
+    return 0;
+}
+
+void manifest_free(Manifest *m) {
+    if (!m) return;
+    for (size_t i = 0; i < m->count; i++) free(m->files[i].name);
+    free(m->files);
+    free(m->leaves);
+    free(m);
+}
+
+int manifest_begin_file(Manifest *m, const char *name) {
+    if (!m || !name || !name[0] || strchr(name, '\n') || m->open) return -EINVAL;
+    int rc = push_file(m, name);
+    if (rc != 0) return rc;
+    m->open = true;
+    m->fed = 0;
+    m->chunk_fill = 0;
+    m->error = 0;
+    sha256_init(&m->ctx);
+    return 0;
+}
+
+void manifest_update(Manifest *m, const void *data, size_t len) {
+    if (!m || !m->open || m->error) return;
+    const u8 *p = (const u8*)data;
+    while (len > 0) {
+        size_t n = m->chunk_size - m->chunk_fill;
+        if (n > len) n = len;
+        sha256_update(&m->ctx, p, n);
+        m->chunk_fill += n;
+        m->fed += n;
+        p += n;
+        len -= n;
+        if (m->chunk_fill == m->chunk_size) {
+            u8 digest[32];
+            sha256_final(&m->ctx, digest);
+            sha256_init(&m->ctx);
+            m->chunk_fill = 0;
+            m->error = push_leaf(m, digest);
+            if (m->error) return;
+        }
+    }
+}
+
+int manifest_end_file(Manifest *m) {
+    if (!m || !m->open) return -EINVAL;
+    if (m->chunk_fill > 0 && !m->error) {
+        u8 digest[32];
+        sha256_final(&m->ctx, digest);
+        m->error = push_leaf(m, digest);
+    }
+    ManifestFile *f = &m->files[m->count - 1];
+    f->size = m->fed;
+    f->chunks = m->leaf_count - f->first;
+    int rc = m->error ? m->error : file_root(m, f, f->root);
+    if (rc != 0) {
+        manifest_drop_file(m);
+        return rc;
+    }
+    m->open = false;
+    return 0;
+}
+
+void manifest_drop_file(Manifest *m) {
+    if (!m || m->count == 0) return;
+    ManifestFile *f = &m->files[--m->count];
+    m->leaf_count = f->first;
+    free(f->name);
+    m->open = false;
+}
+
+int manifest_rehash(Manifest *m, const char *path, u64 offset, u64 len) {
+    if (!m || !path || m->open || m->count == 0) return -EINVAL;
+    ManifestFile *f = &m->files[m->count - 1];
+    if (offset > f->size || len > f->size - offset) return -EINVAL;
+    if (len == 0) return 0;
+
+    FILE *in = fopen(path, "rb");
+    if (!in) return -errno;
+    u8 *buf = malloc(m->chunk_size);
+    int rc = buf ? 0 : -ENOMEM;
+    size_t last = (size_t)((offset + len - 1) / m->chunk_size);
+    for (size_t c = (size_t)(offset / m->chunk_size); rc == 0 && c <= last; c++) {
+        u64 start = (u64)c * m->chunk_size;
+        size_t n = f->size - start < m->chunk_size ? (size_t)(f->size - start) : m->chunk_size;
+        if (fseeko(in, (off_t)start, SEEK_SET) != 0 || fread(buf, 1, n, in) != n) {
+            rc = -EIO;
+            break;
+        }
+        sha256_ctx ctx;
+        sha256_init(&ctx);
+        sha256_update(&ctx, buf, n);
+        sha256_final(&ctx, m->leaves[f->first + c]);
+    }
+    free(buf);
+    fclose(in);
+    return rc == 0 ? file_root(m, f, f->root) : rc;
+}
+
+int manifest_save(const Manifest *m, const char *path) {
+    if (!m || !path || m->open) return -EINVAL;
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return -ENAMETOOLONG;
+
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -errno;
+    char hex[65];
+    fprintf(f, "M %d %u\n", MANIFEST_VERSION, (unsigned)m->chunk_size);
+    for (size_t i = 0; i < m->count; i++) {
+        const ManifestFile *file = &m->files[i];
+        bin_to_hex_s(file->root, 32, hex, sizeof(hex));
+        fprintf(f, "F %llu %s %s\n", (unsigned long long)file->size, hex, file->name);
+        for (size_t c = 0; c < file->chunks; c++) {
+            bin_to_hex_s(m->leaves[file->first + c], 32, hex, sizeof(hex));
+            fprintf(f, "%s\n", hex);
+        }
+    }
+    fflush(f);
+    fsync(fileno(f));
+    int failed = ferror(f);
+    fclose(f);
+    if (failed) {
+        remove(tmp);
+        return -EIO;
+    }
+
+    // FAT does not replace on rename
+    remove(path);
+    if (rename(tmp, path) != 0) return -errno;
+    return 0;
+}
+
+// 1 for a line (newline stripped), 0 at the end of the file, -EBADMSG for
+// a torn or overlong line
+static int read_line(FILE *f, char *line) {
+    if (!fgets(line, MANIFEST_LINE_MAX, f)) return ferror(f) ? -EIO : 0;
+    size_t len = strlen(line);
+    if (len == 0 || line[len - 1] != '\n') return -EBADMSG;
+    line[len - 1] = '\0';
+    return 1;
+}
+
+static int manifest_load(const char *path, Manifest **out) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -errno;
+    char *line = malloc(MANIFEST_LINE_MAX);
+    Manifest *m = NULL;
+    int rc = line ? manifest_create(&m) : -ENOMEM;
+
+    int version = 0;
+    unsigned chunk = 0;
+    if (rc == 0 && (read_line(f, line) != 1 || sscanf(line, "M %d %u", &version, &chunk) != 2 ||
+                    version != MANIFEST_VERSION || chunk < MANIFEST_MIN_CHUNK || chunk > MANIFEST_MAX_CHUNK)) {
+        rc = -EBADMSG;
+    }
+    if (rc == 0) m->chunk_size = chunk;
+
+    while (rc == 0 && (rc = read_line(f, line)) == 1) {
+        unsigned long long size = 0;
+        char hex[65];
+        int consumed = 0;
+        rc = 0;
+        if (sscanf(line, "F %llu %64s %n", &size, hex, &consumed) != 2 || !consumed ||
+            !line[consumed] || strlen(hex) != 64) {
+            rc = -EBADMSG;
+            break;
+        }
+        rc = push_file(m, line + consumed);
+        if (rc != 0) break;
+        ManifestFile *file = &m->files[m->count - 1];
+        file->size = size;
+        file->chunks = chunk_count(size, m->chunk_size);
+        u8 digest[32];
+        for (size_t c = 0; rc == 0 && c < file->chunks; c++) {
+            if (read_line(f, line) != 1 || strlen(line) != 64 || hex_to_bin(line, digest, 32) != 32) rc = -EBADMSG;
+            else rc = push_leaf(m, digest);
+        }
+        u8 root[32];
+        if (rc == 0) rc = file_root(m, file, root);
+        if (rc == 0 && (hex_to_bin(hex, file->root, 32) != 32 || memcmp(root, file->root, 32) != 0)) rc = -EBADMSG;
+    }
+
+    free(line);
+    fclose(f);
+    if (rc != 0) {
+        manifest_free(m);
+        return rc;
+    }
+    *out = m;
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Verification
+// ---------------------------------------------------------------------------
+
+struct ManifestVerify {
+    Manifest *m;
+    char dir[PATH_MAX];         // manifest's directory, with the trailing '/'
+    char path[PATH_MAX];        // current file
+    size_t file;
+    size_t chunk;               // next chunk of the current file
+    bool opened;                // current file has been stat'ed
+    u64 actual_size;
+    u64 total, done;
+    u64 position;
+    ManifestDamage *damage;
+    size_t damage_count, damage_cap;
+    HashRange ranges[MANIFEST_VERIFY_BATCH];
+    HashPipeline *pipeline;     // current file's, kept across batches
+};
+
+static int add_damage(ManifestVerify *v, const char *name, u64 offset, u64 size) {
+    if (size == 0) return 0;
+    if (v->damage_count > 0) {
+        ManifestDamage *last = &v->damage[v->damage_count - 1];
+        if (last->name == name && last->offset + last->size == offset) {
+            last->size += size;
+            return 0;
+        }
+    }
+    if (v->damage_count == v->damage_cap) {
+        size_t cap = v->damage_cap ? v->damage_cap * 2 : 16;
+        ManifestDamage *damage = realloc(v->damage, cap * sizeof(*damage));
+        if (!damage) return -ENOMEM;
+        v->damage = damage;
+        v->damage_cap = cap;
+    }
+    v->damage[v->damage_count++] = (ManifestDamage){name, offset, size};
+    return 0;
+}
+
+int manifest_verify_begin(const char *manifest_path, u64 resume, ManifestVerify **out) {
+    if (!manifest_path || !out) return -EINVAL;
+    *out = NULL;
+    ManifestVerify *v = calloc(1, sizeof(ManifestVerify));
+    if (!v) return -ENOMEM;
+
+    const char *slash = strrchr(manifest_path, '/');
+    size_t dir_len = slash ? (size_t)(slash - manifest_path) + 1 : 0;
+    if (dir_len >= sizeof(v->dir)) {
+        free(v);
+        return -ENAMETOOLONG;
+    }
+    memcpy(v->dir, manifest_path, dir_len);
+    v->dir[dir_len] = '\0';
+
+    int rc = manifest_load(manifest_path, &v->m);
+    if (rc != 0) {
+        free(v);
+        return rc;
+    }
+    for (size_t i = 0; i < v->m->count; i++) v->total += v->m->files[i].size;
+
+    // Whole files first, then whole chunks of the file the last run was in
+    while (v->file < v->m->count && resume > v->m->files[v->file].size) {
+        resume -= v->m->files[v->file].size;
+        v->done += v->m->files[v->file].size;
+        v->file++;
+    }
+    if (v->file < v->m->count) {
+        v->chunk = (size_t)(resume / v->m->chunk_size);
+        if (v->chunk > v->m->files[v->file].chunks) v->chunk = v->m->files[v->file].chunks;
+        v->done += (u64)v->chunk * v->m->chunk_size;
+    }
+    v->position = v->done;
+    *out = v;
+    return 0;
+}
+
+// Open the current file; a missing one is damaged from start to end
+static int verify_open(ManifestVerify *v, const ManifestFile *f) {
+    if (snprintf(v->path, sizeof(v->path), "%s%s", v->dir, f->name) >= (int)sizeof(v->path)) return -ENAMETOOLONG;
+    struct stat st;
+    if (stat(v->path, &st) != 0) {
+        if (errno != ENOENT) return -errno;
+        v->actual_size = 0;
+    } else {
+        v->actual_size = (u64)st.st_size;
+    }
+    v->opened = true;
+    return 0;
+}
+
+int manifest_verify_step(ManifestVerify *v, const bool *cancel) {
+    if (!v) return -EINVAL;
+    Manifest *m = v->m;
+    while (v->file < m->count) {
+        if (cancel && *cancel) return -EINTR;
+        const ManifestFile *f = &m->files[v->file];
+        int rc = v->opened ? 0 : verify_open(v, f);
+        if (rc != 0) return rc;
+
+        if (v->chunk == f->chunks) {
+            // Bytes past the recorded end are damage too
+            if (v->actual_size > f->size) rc = add_damage(v, f->name, f->size, v->actual_size - f->size);
+            if (rc != 0) return rc;
+            hash_pipeline_destroy(v->pipeline);
+            v->pipeline = NULL;
+            v->file++;
+            v->chunk = 0;
+            v->opened = false;
+            continue;
+        }
+
+        // Chunks the file is too short to hold are damaged without reading
+        size_t end = v->chunk + MANIFEST_VERIFY_BATCH < f->chunks ? v->chunk + MANIFEST_VERIFY_BATCH : f->chunks;
+        size_t n = 0;
+        for (size_t c = v->chunk; c < end; c++) {
+            u64 offset = (u64)c * m->chunk_size;
+            u64 size = f->size - offset < m->chunk_size ? f->size - offset : m->chunk_size;
+            if (offset + size > v->actual_size) break;
+            v->ranges[n].offset = offset;
+            v->ranges[n].size = size;
+            n++;
+        }
+        if (n > 0) {
+            bool hashed = false;
+            Result hr = v->pipeline ? 0 : hash_pipeline_create(v->path, &v->pipeline);
+            if (R_SUCCEEDED(hr)) hr = hash_pipeline_start(v->pipeline, v->ranges, n);
+            if (R_SUCCEEDED(hr)) hr = hash_pipeline_step(v->pipeline, 0, &hashed);
+            if (R_FAILED(hr)) return -EIO;
+        }
+
+        u64 checked = 0;
+        for (size_t i = 0; i < end - v->chunk && rc == 0; i++) {
+            size_t c = v->chunk + i;
+            u64 offset = (u64)c * m->chunk_size;
+            u64 size = f->size - offset < m->chunk_size ? f->size - offset : m->chunk_size;
+            if (i >= n || memcmp(v->ranges[i].sha256, m->leaves[f->first + c], 32) != 0) {
+                rc = add_damage(v, f->name, offset, size);
+            }
+            checked += size;
+        }
+        if (rc != 0) return rc;
+        v->chunk = end;
+        v->done += checked;
+        if (v->damage_count == 0) v->position = v->done;
+        return 0;
+    }
+    return 1;
+}
+
+int manifest_verify_progress(const ManifestVerify *v) {
+    if (!v) return 0;
+    if (v->total == 0) return v->file == v->m->count ? 100 : 0;
+    return (int)(v->done * 100 / v->total);
+}
+
+u64 manifest_verify_position(const ManifestVerify *v) {
+    return v ? v->position : 0;
+}
+
+const ManifestDamage *manifest_verify_damage(const ManifestVerify *v, size_t *count) {
+    if (count) *count = v ? v->damage_count : 0;
+    return v ? v->damage : NULL;
+}
+
+void manifest_verify_finish(ManifestVerify *v) {
+    if (!v) return;
+    hash_pipeline_destroy(v->pipeline);
+    manifest_free(v->m);
+    free(v->damage);
+    free(v);
+}
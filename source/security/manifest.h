@@ -0,0 +1,76 @@
+// manifest.h - chunked Merkle integrity manifests for dumps and backups
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <switch.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// A manifest lists one or more files with the SHA-256 of every fixed-size
+// chunk and a Merkle root over those chunk digests. The dump and backup
+// code builds it while the data goes past, so there is nothing to read
+// back afterwards. Checking a copy hashes its chunks on several cores, and
+// a mismatch names the exact byte ranges that need to be copied again
+// instead of the whole file.
+//
+// Text file, one record per line:
+//   M <version> <chunk size>
+//   F <size> <root hex> <name>      followed by one line per chunk:
+//   <chunk sha256 hex>
+// Names are relative to the directory holding the manifest. A node of the
+// tree is SHA-256(0x01 || left || right); an odd node at the end of a level
+// moves up unchanged, and a file with no chunks has the root SHA-256("").
+#define MANIFEST_VERSION    1
+#define MANIFEST_CHUNK_SIZE (1024 * 1024)
+#define MANIFEST_EXT        ".manifest"
+
+// Chunks hashed per manifest_verify_step()
+#define MANIFEST_VERIFY_BATCH 32
+
+typedef struct Manifest Manifest;
+
+int manifest_create(Manifest **out);
+void manifest_free(Manifest *m);
+
+// Add a file: begin, feed its bytes in order, then end (or drop it if the
+// copy failed). Errors from update are remembered and returned by end.
+// All return 0 on success, negative errno on failure.
+int manifest_begin_file(Manifest *m, const char *name);
+void manifest_update(Manifest *m, const void *data, size_t len);
+int manifest_end_file(Manifest *m);
+void manifest_drop_file(Manifest *m);
+
+// Re-read the chunks of the last ended file that overlap [offset,
+// offset + len) from 'path', for writers that patch a header in place
+// after streaming the rest.
+int manifest_rehash(Manifest *m, const char *path, u64 offset, u64 len);
+
+// Write the manifest; crash-safe like the hash database
+int manifest_save(const Manifest *m, const char *path);
+
+// Stepped verification of every file a manifest lists
+typedef struct ManifestVerify ManifestVerify;
+
+typedef struct {
+    const char *name;           // file as named in the manifest
+    u64 offset;
+    u64 size;
+} ManifestDamage;
+
+// Skip the first 'resume' bytes (counted over all files in manifest order),
+// as reported by manifest_verify_position() in an earlier run. Returns
+// -EBADMSG if the manifest is malformed or its roots do not match its
+// chunk lists.
+int manifest_verify_begin(const char *manifest_path, u64 resume, ManifestVerify **out);
+// Check up to MANIFEST_VERIFY_BATCH chunks. Returns 1 when done, 0 if there
+// is more to do, -EINTR if *cancel was set, other negative errno on failure.
+int manifest_verify_step(ManifestVerify *v, const bool *cancel);
+int manifest_verify_progress(const ManifestVerify *v); // 0..100
+// Bytes known good so far. Stops moving once damage has been found, so a
+// run resumed from it reports that damage again.
+u64 manifest_verify_position(const ManifestVerify *v);
+// Damaged ranges found so far, adjacent chunks merged. Valid until finish.
+const ManifestDamage *manifest_verify_damage(const ManifestVerify *v, size_t *count);
+void manifest_verify_finish(ManifestVerify *v);
+
+#endif // MANIFEST_H
@@ -0,0 +1,34 @@
+// nca_header.h - batch decryption of NCA headers
+#ifndef NCA_HEADER_H
+#define NCA_HEADER_H
+
+#include <switch.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// An NCA starts with a 0xC00-byte header, AES-128-XTS encrypted with the
+// console-wide header key in 0x200-byte sectors whose tweak is the sector
+// number (big-endian). Every header uses the same sector numbers, so the
+// tweaks are worked out once when the key is set and a batch of headers is
+// decrypted with a single pass of the block cipher over all of them.
+#define NCA_HEADER_SIZE     0xC00
+#define NCA_SECTOR_SIZE     0x200
+#define NCA_HEADER_KEY_SIZE 0x20
+
+// Keys file looked at by verify_init(): key dumpers write it here, one
+// "name = hex" per line; only header_key is used
+#define NCA_KEYS_PATH       "sdmc:/switch/prod.keys"
+
+// LibnxError_NotFound if the file or the header_key line is missing
+Result nca_header_load_keys(const char *path);
+void nca_header_set_key(const u8 key[NCA_HEADER_KEY_SIZE]);
+bool nca_header_has_key(void);
+
+// Decrypt 'count' headers stored back to back, in place. Headers that are
+// already plain (some tools extract them that way) are left as they are.
+// rcs (may be NULL) gets one result per header: LibnxError_BadMagic if it
+// is not an NCA2/NCA3 header once decrypted, LibnxError_InvalidKey if it is
+// encrypted and no key is loaded. Returns the first failure.
+Result nca_header_decrypt(u8 *headers, size_t count, Result *rcs);
+
+#endif // NCA_HEADER_H
@@ -12,6 +12,12 @@
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define SECURE_LOG_FILE "sdmc:/switch/dbfm/secure.log"
 #define SECURE_WIPE_PASSES 3
@@ -193,56 +199,301 @@ Result secure_remove_file(const char* path) {
     return 0;
 }
 
-Result secure_wipe_file(const char* path) {
-    if (!s_initialized || !path) {
-        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
-    }
+// Random pass source: a thread keeps the other buffer filled with AES-CTR
+// keystream under a throwaway key while the current one is written
+typedef struct {
+    aes_ctr_ctx ctr;
+    u8* buf[2];
+    bool ready[2];
+    int fill;                   // buffer the generator fills next
+    int take;                   // buffer the writer takes next
+    bool started, stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} WipeRandom;
+
+static void* wipe_random_main(void* arg) {
+    WipeRandom* r = (WipeRandom*)arg;
+    pthread_mutex_lock(&r->lock);
+    for (;;) {
+        while (r->ready[r->fill] && !r->stop) pthread_cond_wait(&r->cond, &r->lock);
+        if (r->stop) break;
+        int i = r->fill;
+        pthread_mutex_unlock(&r->lock);
+
+        memset(r->buf[i], 0, SECURE_WIPE_BUFFER);
+        aes_ctr_crypt(&r->ctr, r->buf[i], r->buf[i], SECURE_WIPE_BUFFER);
+
+        pthread_mutex_lock(&r->lock);
+        r->ready[i] = true;
+        r->fill ^= 1;
+        pthread_cond_broadcast(&r->cond);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
 
-    FILE* f = fopen(path, "r+b");
-    if (!f) return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+static int wipe_random_start(WipeRandom* r) {
+    u8 key[CRYPTO_KEY_SIZE], iv[AES_BLOCK_SIZE];
+    crypto_random_bytes(key, sizeof(key));
+    crypto_random_bytes(iv, sizeof(iv));
+    aes_ctr_init(&r->ctr, key, sizeof(key), iv);
+    crypto_secure_wipe(key, sizeof(key));
+
+    for (int i = 0; i < 2; i++) {
+        r->buf[i] = aligned_alloc(0x1000, SECURE_WIPE_BUFFER);
+        if (!r->buf[i]) return -ENOMEM;
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    if (pthread_create(&r->thread, NULL, wipe_random_main, r) != 0) {
+        pthread_cond_destroy(&r->cond);
+        pthread_mutex_destroy(&r->lock);
+        return -ENOMEM;
+    }
+    r->started = true;
+    return 0;
+}
 
-    fseek(f, 0, SEEK_END);
-    size_t size = ftell(f);
-    fseek(f, 0, SEEK_SET);
+static const u8* wipe_random_take(WipeRandom* r) {
+    pthread_mutex_lock(&r->lock);
+    while (!r->ready[r->take]) pthread_cond_wait(&r->cond, &r->lock);
+    pthread_mutex_unlock(&r->lock);
+    return r->buf[r->take];
+}
 
-    u8* buffer = secure_alloc(0x4000); // 16KB buffer
-    if (!buffer) {
-        fclose(f);
-        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+// The buffer from the last take has been written; let it be refilled
+static void wipe_random_release(WipeRandom* r) {
+    pthread_mutex_lock(&r->lock);
+    r->ready[r->take] = false;
+    r->take ^= 1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
+
+static void wipe_random_stop(WipeRandom* r) {
+    if (r->started) {
+        pthread_mutex_lock(&r->lock);
+        r->stop = true;
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+        pthread_join(r->thread, NULL);
+        pthread_cond_destroy(&r->cond);
+        pthread_mutex_destroy(&r->lock);
+    }
+    crypto_secure_wipe(&r->ctr, sizeof(r->ctr));
+    free(r->buf[0]);
+    free(r->buf[1]);
+    memset(r, 0, sizeof(*r));
+}
+
+struct SecureWipe {
+    bool remove_after;
+    char** paths;               // files, in walk order
+    u64* sizes;
+    size_t count, cap, next;
+    char** dirs;                // directories, parents before children
+    size_t dir_count, dir_cap;
+    u64 total, done;            // bytes over all passes
+    FILE* cur;
+    int pass;
+    u64 pos;
+    u8* pattern;
+    int pattern_byte;           // what 'pattern' is filled with, -1 for nothing yet
+    WipeRandom random;
+};
+
+static int wipe_push(char*** list, size_t* count, size_t* cap, const char* path) {
+    if (*count == *cap) {
+        size_t n = *cap ? *cap * 2 : 64;
+        char** grown = realloc(*list, n * sizeof(*grown));
+        if (!grown) return -ENOMEM;
+        *list = grown;
+        *cap = n;
+    }
+    char* copy = strdup(path);
+    if (!copy) return -ENOMEM;
+    (*list)[(*count)++] = copy;
+    return 0;
+}
+
+static int wipe_add_file(SecureWipe* w, const char* path, u64 size) {
+    size_t cap = w->cap;
+    int rc = wipe_push(&w->paths, &w->count, &w->cap, path);
+    if (rc != 0) return rc;
+    if (w->cap != cap) {
+        u64* sizes = realloc(w->sizes, w->cap * sizeof(*sizes));
+        if (!sizes) {
+            free(w->paths[--w->count]);
+            return -ENOMEM;
+        }
+        w->sizes = sizes;
     }
+    w->sizes[w->count - 1] = size;
+    w->total += size * SECURE_WIPE_PASSES;
+    return 0;
+}
 
-    Result rc = 0;
-    for (int pass = 0; pass < SECURE_WIPE_PASSES; pass++) {
-        u8 pattern = (pass == 0) ? 0x00 : (pass == 1) ? 0xFF : 0x00;
-        
-        if (pass == 2) {
-            // Random pass
-            for (size_t i = 0; i < 0x4000; i++) {
-                buffer[i] = (u8)rand();
-            }
-        } else {
-            memset(buffer, pattern, 0x4000);
+static int wipe_walk(SecureWipe* w, const char* dir_path) {
+    int rc = wipe_push(&w->dirs, &w->dir_count, &w->dir_cap, dir_path);
+    if (rc != 0) return rc;
+    DIR* dir = opendir(dir_path);
+    if (!dir) return -errno;
+
+    size_t len = strlen(dir_path);
+    const char* sep = len && dir_path[len - 1] == '/' ? "" : "/";
+    char path[PATH_MAX];
+    struct dirent* entry;
+    struct stat st;
+    while (rc == 0 && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        int n = snprintf(path, sizeof(path), "%s%s%s", dir_path, sep, entry->d_name);
+        if (n < 0 || n >= (int)sizeof(path)) {
+            rc = -ENAMETOOLONG;
+        } else if (stat(path, &st) != 0) {
+            rc = -errno;
+        } else if (S_ISDIR(st.st_mode)) {
+            rc = wipe_walk(w, path);
+        } else if (S_ISREG(st.st_mode)) {
+            rc = wipe_add_file(w, path, (u64)st.st_size);
         }
+    }
+    closedir(dir);
+    return rc;
+}
+
+int secure_wipe_begin(const char* path, bool remove_after, SecureWipe** out) {
+    if (!path || !out) return -EINVAL;
+    *out = NULL;
+    struct stat st;
+    if (stat(path, &st) != 0) return -errno;
+
+    SecureWipe* w = calloc(1, sizeof(SecureWipe));
+    if (!w) return -ENOMEM;
+    w->remove_after = remove_after;
+    w->pattern_byte = -1;
+    w->pattern = aligned_alloc(0x1000, SECURE_WIPE_BUFFER);
+    int rc = w->pattern ? 0 : -ENOMEM;
+    if (rc == 0) {
+        if (S_ISDIR(st.st_mode)) rc = wipe_walk(w, path);
+        else if (S_ISREG(st.st_mode)) rc = wipe_add_file(w, path, (u64)st.st_size);
+        else rc = -EINVAL;
+    }
+    if (rc != 0) {
+        secure_wipe_finish(w);
+        return rc;
+    }
+    *out = w;
+    return 0;
+}
 
-        size_t remaining = size;
-        fseek(f, 0, SEEK_SET);
+// Buffer for the current pass: a constant pattern, or fresh random data
+static const u8* wipe_buffer(SecureWipe* w) {
+    if (w->pass == SECURE_WIPE_PASSES - 1) return wipe_random_take(&w->random);
+    int byte = w->pass == 0 ? 0x00 : 0xFF;
+    if (w->pattern_byte != byte) {
+        memset(w->pattern, byte, SECURE_WIPE_BUFFER);
+        w->pattern_byte = byte;
+    }
+    return w->pattern;
+}
 
-        while (remaining > 0) {
-            size_t to_write = (remaining > 0x4000) ? 0x4000 : remaining;
-            if (fwrite(buffer, 1, to_write, f) != to_write) {
-                rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
-                break;
+int secure_wipe_step(SecureWipe* w, size_t budget, const bool* cancel) {
+    if (!w) return -EINVAL;
+    for (;;) {
+        if (cancel && *cancel) return -EINTR;
+        if (!w->cur) {
+            if (w->next == w->count) break;
+            w->cur = fopen(w->paths[w->next], "r+b");
+            if (!w->cur) return -errno;
+            setvbuf(w->cur, NULL, _IONBF, 0);
+            w->pass = 0;
+            w->pos = 0;
+        }
+
+        u64 size = w->sizes[w->next];
+        if (w->pos == size) {
+            // Pass done: make sure it reached the card before the next one.
+            // The stream is unbuffered, so only fsync() does anything here.
+            if (fsync(fileno(w->cur)) != 0) return -EIO;
+            if (++w->pass < SECURE_WIPE_PASSES) {
+                w->pos = 0;
+                if (fseeko(w->cur, 0, SEEK_SET) != 0) return -EIO;
+                continue;
             }
-            remaining -= to_write;
+            bool ok = fclose(w->cur) == 0;
+            w->cur = NULL;
+            if (!ok) return -EIO;
+            if (w->remove_after && remove(w->paths[w->next]) != 0) return -errno;
+            w->next++;
+            continue;
         }
 
-        if (R_FAILED(rc)) break;
-        fflush(f);
+        if (budget == 0) return 0;
+        if (w->pass == SECURE_WIPE_PASSES - 1 && !w->random.started) {
+            int rc = wipe_random_start(&w->random);
+            if (rc != 0) return rc;
+        }
+        size_t n = size - w->pos < SECURE_WIPE_BUFFER ? (size_t)(size - w->pos) : SECURE_WIPE_BUFFER;
+        const u8* buf = wipe_buffer(w);
+        bool ok = fwrite(buf, 1, n, w->cur) == n;
+        if (w->pass == SECURE_WIPE_PASSES - 1) wipe_random_release(&w->random);
+        if (!ok) return -EIO;
+        w->pos += n;
+        w->done += n;
+        budget = budget > n ? budget - n : 0;
+    }
+
+    if (w->remove_after) {
+        // Children were listed after their parents
+        while (w->dir_count > 0) {
+            if (rmdir(w->dirs[w->dir_count - 1]) != 0) return -errno;
+            free(w->dirs[--w->dir_count]);
+        }
     }
+    return 1;
+}
 
-    secure_free(buffer);
-    fclose(f);
-    return rc;
+int secure_wipe_progress(const SecureWipe* w) {
+    if (!w) return 0;
+    if (w->total == 0) return w->next == w->count ? 100 : 0;
+    return (int)(w->done * 100 / w->total);
+}
+
+void secure_wipe_finish(SecureWipe* w) {
+    if (!w) return;
+    if (w->cur) fclose(w->cur);
+    wipe_random_stop(&w->random);
+    for (size_t i = 0; i < w->count; i++) free(w->paths[i]);
+    for (size_t i = 0; i < w->dir_count; i++) free(w->dirs[i]);
+    free(w->paths);
+    free(w->sizes);
+    free(w->dirs);
+    free(w->pattern);
+    free(w);
+}
+
+static Result wipe_errno_result(int rc) {
+    switch (rc) {
+        case -ENOENT: return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+        case -ENOMEM: return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        case -EINVAL: return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+        default:      return MAKERESULT(Module_Libnx, LibnxError_IoError);
+    }
+}
+
+Result secure_wipe_file(const char* path) {
+    if (!s_initialized || !path) {
+        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+    }
+
+    SecureWipe* w = NULL;
+    int rc = secure_wipe_begin(path, false, &w);
+    if (rc != 0) return wipe_errno_result(rc);
+    while ((rc = secure_wipe_step(w, SIZE_MAX, NULL)) == 0) {}
+    secure_wipe_finish(w);
+    return rc == 1 ? 0 : wipe_errno_result(rc);
 }
 
 Result secure_move_file(const char* src, const char* dst) {
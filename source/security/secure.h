@@ -39,6 +39,22 @@ Result secure_remove_file(const char* path);
 Result secure_wipe_file(const char* path);
 Result secure_move_file(const char* src, const char* dst);
 
+// Stepped wipe of a file or a whole directory tree, for the task queue.
+// Each file gets three passes (0x00, 0xFF, random) written in
+// SECURE_WIPE_BUFFER pieces; the random pass is AES-CTR keystream made on a
+// second thread while the previous piece is written.
+#define SECURE_WIPE_BUFFER (1024 * 1024)
+
+typedef struct SecureWipe SecureWipe;
+
+// remove_after deletes each file once wiped, then the directories
+int secure_wipe_begin(const char* path, bool remove_after, SecureWipe** out);
+// Write up to 'budget' bytes. Returns 1 when done, 0 if there is more to
+// do, -EINTR if *cancel was set, other negative errno on failure.
+int secure_wipe_step(SecureWipe* w, size_t budget, const bool* cancel);
+int secure_wipe_progress(const SecureWipe* w);   // 0..100, by bytes written
+void secure_wipe_finish(SecureWipe* w);
+
 // Path validation
 bool secure_validate_path(const char* path);
 bool secure_is_path_allowed(const char* path);
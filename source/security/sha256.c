@@ -0,0 +1,538 @@
+// sha256.c - SHA-256 with runtime-selected block functions
+// Notes:
+// - Backends only differ in sha256 block compression; padding, contexts
+//   and the multi-stream scheduling are shared.
+// - The hardware backends are built with per-function target attributes,
+//   so the rest of the program keeps the baseline -march and only runs
+//   them after the CPU check passed.
+
+#include "sha256.h"
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+#define SHA256_HAVE_ARM   1
+#define SHA256_HAVE_VEC4  1
+#elif defined(__x86_64__)
+#include <immintrin.h>
+#include <cpuid.h>
+#define SHA256_HAVE_SHANI 1
+#define SHA256_HAVE_VEC4  1
+#define SHA256_HAVE_AVX2  1
+#endif
+
+typedef void (*sha256_blocks_fn)(uint32_t state[8], const unsigned char *data, size_t blocks);
+
+// Compress 'blocks' blocks for each lane in 'mask'. Lanes outside the mask
+// hash a zero block and their state is left alone.
+typedef void (*sha256_lanes_fn)(uint32_t state[][8], const unsigned char *const ptr[],
+                                unsigned mask, size_t blocks);
+
+static const uint32_t K[64] = {
+    0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+    0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+    0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+    0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+    0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+    0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+    0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+    0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
+};
+
+static const uint32_t IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static uint32_t load_be32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static void store_be32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24); p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);  p[3] = (unsigned char)v;
+}
+
+// ---------------------------------------------------------------------------
+// Scalar reference
+// ---------------------------------------------------------------------------
+
+static uint32_t ROR(uint32_t x, int r) { return (x >> r) | (x << (32 - r)); }
+
+void sha256_blocks_scalar(uint32_t state[8], const unsigned char *data, size_t blocks) {
+    for (; blocks; blocks--, data += SHA256_BLOCK_SIZE) {
+        uint32_t W[64];
+        for (int i = 0; i < 16; ++i) W[i] = load_be32(data + i * 4);
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = ROR(W[i-15], 7) ^ ROR(W[i-15], 18) ^ (W[i-15] >> 3);
+            uint32_t s1 = ROR(W[i-2], 17) ^ ROR(W[i-2], 19) ^ (W[i-2] >> 10);
+            W[i] = W[i-16] + s0 + W[i-7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t S1 = ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25);
+            uint32_t ch = (e & f) ^ ((~e) & g);
+            uint32_t temp1 = h + S1 + ch + K[i] + W[i];
+            uint32_t S0 = ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t temp2 = S0 + maj;
+            h = g; g = f; f = e; e = d + temp1; d = c; c = b; b = a; a = temp1 + temp2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// ARMv8 SHA2 instructions
+// ---------------------------------------------------------------------------
+
+#ifdef SHA256_HAVE_ARM
+
+static bool cpu_has_arm_sha2(void) {
+#if defined(__SWITCH__)
+    return true;    // the Cortex-A57 in every Switch has the crypto extension
+#elif defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#else
+    return false;
+#endif
+}
+
+__attribute__((target("+crypto")))
+static void sha256_blocks_arm(uint32_t state[8], const unsigned char *data, size_t blocks) {
+    uint32x4_t abcd = vld1q_u32(&state[0]);
+    uint32x4_t efgh = vld1q_u32(&state[4]);
+
+    for (; blocks; blocks--, data += SHA256_BLOCK_SIZE) {
+        uint32x4_t abcd_save = abcd, efgh_save = efgh;
+        uint32x4_t msg[4];
+        for (int i = 0; i < 4; i++) {
+            msg[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+        }
+#pragma GCC unroll 16
+        for (int g = 0; g < 16; g++) {
+            uint32x4_t wk = vaddq_u32(msg[g & 3], vld1q_u32(&K[g * 4]));
+            if (g < 12) {
+                // Schedule the words for group g + 4 while this one runs
+                msg[g & 3] = vsha256su1q_u32(vsha256su0q_u32(msg[g & 3], msg[(g + 1) & 3]),
+                                             msg[(g + 2) & 3], msg[(g + 3) & 3]);
+            }
+            uint32x4_t prev = abcd;
+            abcd = vsha256hq_u32(abcd, efgh, wk);
+            efgh = vsha256h2q_u32(efgh, prev, wk);
+        }
+        abcd = vaddq_u32(abcd, abcd_save);
+        efgh = vaddq_u32(efgh, efgh_save);
+    }
+
+    vst1q_u32(&state[0], abcd);
+    vst1q_u32(&state[4], efgh);
+}
+
+#endif // SHA256_HAVE_ARM
+
+// ---------------------------------------------------------------------------
+// x86 SHA extensions
+// ---------------------------------------------------------------------------
+
+#ifdef SHA256_HAVE_SHANI
+
+static bool cpu_has_shani(void) {
+    unsigned int a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_1)) return false;
+    if (!__get_cpuid_count(7, 0, &a, &b, &c, &d)) return false;
+    return (b & (1u << 29)) != 0;
+}
+
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_shani(uint32_t state[8], const unsigned char *data, size_t blocks) {
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // The instructions want the state as ABEF / CDGH
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);
+    __m128i cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);
+    __m128i abef = _mm_alignr_epi8(tmp, cdgh, 8);
+    cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+
+    for (; blocks; blocks--, data += SHA256_BLOCK_SIZE) {
+        __m128i abef_save = abef, cdgh_save = cdgh;
+        __m128i msg[4];
+        for (int i = 0; i < 4; i++) {
+            msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + i * 16)), bswap);
+        }
+#pragma GCC unroll 16
+        for (int g = 0; g < 16; g++) {
+            if (g >= 4) {
+                __m128i w = _mm_sha256msg1_epu32(msg[g & 3], msg[(g + 1) & 3]);
+                w = _mm_add_epi32(w, _mm_alignr_epi8(msg[(g + 3) & 3], msg[(g + 2) & 3], 4));
+                msg[g & 3] = _mm_sha256msg2_epu32(w, msg[(g + 3) & 3]);
+            }
+            __m128i wk = _mm_add_epi32(msg[g & 3], _mm_loadu_si128((const __m128i*)&K[g * 4]));
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);
+            abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0E));
+        }
+        abef = _mm_add_epi32(abef, abef_save);
+        cdgh = _mm_add_epi32(cdgh, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(abef, 0x1B);
+    cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(tmp, cdgh, 0xF0));
+    _mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(cdgh, tmp, 8));
+}
+
+#endif // SHA256_HAVE_SHANI
+
+// ---------------------------------------------------------------------------
+// SIMD lanes: one independent message per 32-bit lane
+// ---------------------------------------------------------------------------
+
+static const unsigned char s_zero_block[SHA256_BLOCK_SIZE];
+
+#define VROR(x, r)  (((x) >> (r)) | ((x) << (32 - (r))))
+
+// The round code is the scalar one with every variable widened to a
+// vector, so it is written once and instantiated per lane count
+#define DEFINE_SHA256_LANES(NAME, VEC, N, ATTR)                                         \
+ATTR static void NAME(uint32_t state[][8], const unsigned char *const ptr[],            \
+                      unsigned mask, size_t blocks) {                                   \
+    VEC s[8], w[16];                                                                    \
+    const unsigned char *p[N];                                                          \
+    size_t step[N];                                                                     \
+    for (int l = 0; l < N; l++) {                                                       \
+        bool on = (mask >> l) & 1;                                                      \
+        p[l] = on ? ptr[l] : s_zero_block;                                              \
+        step[l] = on ? SHA256_BLOCK_SIZE : 0;                                           \
+        for (int j = 0; j < 8; j++) s[j][l] = on ? state[l][j] : IV[j];                 \
+    }                                                                                   \
+    for (; blocks; blocks--) {                                                          \
+        for (int i = 0; i < 16; i++) {                                                  \
+            for (int l = 0; l < N; l++) w[i][l] = load_be32(p[l] + i * 4);              \
+        }                                                                               \
+        for (int l = 0; l < N; l++) p[l] += step[l];                                    \
+        VEC a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7]; \
+        for (int i = 0; i < 64; i++) {                                                  \
+            if (i >= 16) {                                                              \
+                VEC w15 = w[(i + 1) & 15], w2 = w[(i + 14) & 15];                       \
+                w[i & 15] += (VROR(w15, 7) ^ VROR(w15, 18) ^ (w15 >> 3)) + w[(i + 9) & 15] \
+                           + (VROR(w2, 17) ^ VROR(w2, 19) ^ (w2 >> 10));                \
+            }                                                                           \
+            VEC t1 = h + (VROR(e, 6) ^ VROR(e, 11) ^ VROR(e, 25)) + ((e & f) ^ (~e & g))  \
+                   + K[i] + w[i & 15];                                                  \
+            VEC t2 = (VROR(a, 2) ^ VROR(a, 13) ^ VROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c)); \
+            h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;          \
+        }                                                                               \
+        s[0] += a; s[1] += b; s[2] += c; s[3] += d;                                     \
+        s[4] += e; s[5] += f; s[6] += g; s[7] += h;                                     \
+    }                                                                                   \
+    for (int l = 0; l < N; l++) {                                                       \
+        if (!((mask >> l) & 1)) continue;                                               \
+        for (int j = 0; j < 8; j++) state[l][j] = s[j][l];                              \
+    }                                                                                   \
+}
+
+#ifdef SHA256_HAVE_VEC4
+typedef uint32_t sha256_vec4 __attribute__((vector_size(16)));
+DEFINE_SHA256_LANES(sha256_lanes_vec4, sha256_vec4, 4, )
+#endif
+
+#ifdef SHA256_HAVE_AVX2
+typedef uint32_t sha256_vec8 __attribute__((vector_size(32)));
+DEFINE_SHA256_LANES(sha256_lanes_avx2, sha256_vec8, 8, __attribute__((target("avx2"))))
+
+static bool cpu_has_avx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// Selection
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    const char *name;
+    sha256_blocks_fn fn;
+    bool (*usable)(void);
+} BlocksBackend;
+
+typedef struct {
+    const char *name;
+    sha256_lanes_fn fn;
+    unsigned lanes;
+    bool (*usable)(void);
+} LanesBackend;
+
+// Best first
+static const BlocksBackend s_blocks_backends[] = {
+#ifdef SHA256_HAVE_ARM
+    { "arm", sha256_blocks_arm, cpu_has_arm_sha2 },
+#endif
+#ifdef SHA256_HAVE_SHANI
+    { "shani", sha256_blocks_shani, cpu_has_shani },
+#endif
+    { "scalar", sha256_blocks_scalar, NULL },
+};
+
+static const LanesBackend s_lanes_backends[] = {
+#ifdef SHA256_HAVE_AVX2
+    { "avx2x8", sha256_lanes_avx2, 8, cpu_has_avx2 },
+#endif
+#ifdef SHA256_HAVE_VEC4
+    { "simdx4", sha256_lanes_vec4, 4, NULL },
+#endif
+    { NULL, NULL, 0, NULL },
+};
+
+static pthread_once_t s_once = PTHREAD_ONCE_INIT;
+static sha256_blocks_fn s_blocks = sha256_blocks_scalar;
+static const LanesBackend *s_lanes;     // NULL: sha256_multi hashes one at a time
+static char s_name[32] = "scalar";
+
+// Deterministic, non-repeating test input
+static void fill_pattern(unsigned char *buf, size_t len) {
+    uint32_t x = 0x2545F491;
+    for (size_t i = 0; i < len; i++) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        buf[i] = (unsigned char)x;
+    }
+}
+
+static bool blocks_match_scalar(sha256_blocks_fn fn) {
+    static const size_t counts[] = { 1, 2, 3, 7, 16 };
+    unsigned char msg[16 * SHA256_BLOCK_SIZE];
+    fill_pattern(msg, sizeof(msg));
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        uint32_t want[8], got[8];
+        memcpy(want, IV, sizeof(want));
+        memcpy(got, IV, sizeof(got));
+        sha256_blocks_scalar(want, msg, counts[i]);
+        fn(got, msg, counts[i]);
+        if (memcmp(want, got, sizeof(want)) != 0) return false;
+    }
+    return true;
+}
+
+static bool lanes_match_scalar(const LanesBackend *b) {
+    unsigned char msg[SHA256_MAX_LANES * 4 * SHA256_BLOCK_SIZE];
+    const unsigned char *ptr[SHA256_MAX_LANES];
+    uint32_t want[SHA256_MAX_LANES][8], got[SHA256_MAX_LANES][8];
+    fill_pattern(msg, sizeof(msg));
+    for (unsigned l = 0; l < b->lanes; l++) {
+        ptr[l] = msg + (size_t)l * 4 * SHA256_BLOCK_SIZE;
+        for (int j = 0; j < 8; j++) want[l][j] = got[l][j] = IV[j] + l;
+        sha256_blocks_scalar(want[l], ptr[l], 3);
+    }
+    // Every other lane idle: its state must come back untouched
+    unsigned mask = 0x55u & ((1u << b->lanes) - 1);
+    b->fn(got, ptr, mask, 3);
+    for (unsigned l = 0; l < b->lanes; l++) {
+        if ((mask >> l) & 1) {
+            if (memcmp(want[l], got[l], sizeof(want[l])) != 0) return false;
+        } else {
+            for (int j = 0; j < 8; j++) if (got[l][j] != IV[j] + l) return false;
+        }
+    }
+    return true;
+}
+
+static bool scalar_known_answer(void) {
+    // FIPS 180-2 "abc"
+    static const uint32_t abc[8] = {
+        0xba7816bf, 0x8f01cfea, 0x414140de, 0x5dae2223, 0xb00361a3, 0x96177a9c, 0xb410ff61, 0xf20015ad
+    };
+    unsigned char block[SHA256_BLOCK_SIZE] = { 'a', 'b', 'c', 0x80 };
+    block[63] = 24;
+    uint32_t st[8];
+    memcpy(st, IV, sizeof(st));
+    sha256_blocks_scalar(st, block, 1);
+    return memcmp(st, abc, sizeof(st)) == 0;
+}
+
+static void select_backend(void) {
+    // Nothing is checked against a broken reference
+    if (!scalar_known_answer()) return;
+    for (size_t i = 0; i < sizeof(s_blocks_backends) / sizeof(s_blocks_backends[0]); i++) {
+        const BlocksBackend *b = &s_blocks_backends[i];
+        if (b->usable && !b->usable()) continue;
+        if (b->fn != sha256_blocks_scalar && !blocks_match_scalar(b->fn)) continue;
+        s_blocks = b->fn;
+        strcpy(s_name, b->name);
+        break;
+    }
+    // Lanes only beat a single stream on the plain C path
+    if (s_blocks != sha256_blocks_scalar) return;
+    for (const LanesBackend *b = s_lanes_backends; b->fn; b++) {
+        if (b->usable && !b->usable()) continue;
+        if (!lanes_match_scalar(b)) continue;
+        s_lanes = b;
+        strcat(s_name, "+");
+        strcat(s_name, b->name);
+        break;
+    }
+}
+
+const char *sha256_backend_name(void) {
+    pthread_once(&s_once, select_backend);
+    return s_name;
+}
+
+void sha256_blocks(uint32_t state[8], const unsigned char *data, size_t blocks) {
+    pthread_once(&s_once, select_backend);
+    s_blocks(state, data, blocks);
+}
+
+// ---------------------------------------------------------------------------
+// Contexts
+// ---------------------------------------------------------------------------
+
+void sha256_init(sha256_ctx *ctx) {
+    memcpy(ctx->state, IV, sizeof(IV));
+    ctx->bitcount = 0;
+}
+
+void sha256_update(sha256_ctx *ctx, const void *data, size_t len) {
+    const unsigned char *in = (const unsigned char*)data;
+    size_t fill = ctx->bitcount / 8 % SHA256_BLOCK_SIZE;
+    ctx->bitcount += (uint64_t)len * 8;
+    if (fill) {
+        size_t need = SHA256_BLOCK_SIZE - fill;
+        if (len < need) {
+            memcpy(ctx->buffer + fill, in, len);
+            return;
+        }
+        memcpy(ctx->buffer + fill, in, need);
+        sha256_blocks(ctx->state, ctx->buffer, 1);
+        in += need; len -= need;
+    }
+    if (len >= SHA256_BLOCK_SIZE) {
+        size_t blocks = len / SHA256_BLOCK_SIZE;
+        sha256_blocks(ctx->state, in, blocks);
+        in += blocks * SHA256_BLOCK_SIZE;
+        len -= blocks * SHA256_BLOCK_SIZE;
+    }
+    if (len) memcpy(ctx->buffer, in, len);
+}
+
+// Padding for a message whose last partial block is tail[0..rem); returns
+// the number of blocks (1 or 2) written to 'out'
+static size_t pad_tail(const unsigned char *tail, size_t rem, uint64_t bitcount,
+                       unsigned char out[2 * SHA256_BLOCK_SIZE]) {
+    size_t blocks = rem < 56 ? 1 : 2;
+    memcpy(out, tail, rem);
+    out[rem] = 0x80;
+    memset(out + rem + 1, 0, blocks * SHA256_BLOCK_SIZE - rem - 1);
+    store_be32(out + blocks * SHA256_BLOCK_SIZE - 8, (uint32_t)(bitcount >> 32));
+    store_be32(out + blocks * SHA256_BLOCK_SIZE - 4, (uint32_t)bitcount);
+    return blocks;
+}
+
+static void state_to_digest(const uint32_t state[8], unsigned char digest[SHA256_DIGEST_SIZE]) {
+    for (int i = 0; i < 8; ++i) store_be32(digest + i * 4, state[i]);
+}
+
+void sha256_final(sha256_ctx *ctx, unsigned char digest[SHA256_DIGEST_SIZE]) {
+    unsigned char last[2 * SHA256_BLOCK_SIZE];
+    size_t blocks = pad_tail(ctx->buffer, ctx->bitcount / 8 % SHA256_BLOCK_SIZE, ctx->bitcount, last);
+    sha256_blocks(ctx->state, last, blocks);
+    state_to_digest(ctx->state, digest);
+}
+
+// ---------------------------------------------------------------------------
+// Many messages at once
+// ---------------------------------------------------------------------------
+
+// A message in a lane: its whole blocks straight from the caller's buffer,
+// then the padded tail
+typedef struct {
+    size_t index;
+    const unsigned char *ptr;
+    size_t left;
+    bool in_tail;
+    size_t tail_blocks;
+    unsigned char tail[2 * SHA256_BLOCK_SIZE];
+} LaneJob;
+
+static void lane_job_start(LaneJob *j, size_t index, const void *data, size_t len, uint32_t state[8]) {
+    size_t whole = len / SHA256_BLOCK_SIZE;
+    j->index = index;
+    j->tail_blocks = pad_tail((const unsigned char*)data + whole * SHA256_BLOCK_SIZE,
+                              len % SHA256_BLOCK_SIZE, (uint64_t)len * 8, j->tail);
+    j->in_tail = whole == 0;
+    j->ptr = j->in_tail ? j->tail : (const unsigned char*)data;
+    j->left = j->in_tail ? j->tail_blocks : whole;
+    memcpy(state, IV, sizeof(IV));
+}
+
+void sha256_multi(const void *const data[], const size_t len[], size_t count,
+                  unsigned char out[][SHA256_DIGEST_SIZE]) {
+    pthread_once(&s_once, select_backend);
+    if (!s_lanes || count < 2) {
+        for (size_t i = 0; i < count; i++) {
+            sha256_ctx ctx;
+            sha256_init(&ctx);
+            sha256_update(&ctx, data[i], len[i]);
+            sha256_final(&ctx, out[i]);
+        }
+        return;
+    }
+
+    const unsigned lanes = s_lanes->lanes;
+    LaneJob job[SHA256_MAX_LANES];
+    uint32_t state[SHA256_MAX_LANES][8];
+    const unsigned char *ptr[SHA256_MAX_LANES];
+    unsigned busy = 0;
+    size_t next = 0;
+
+    for (;;) {
+        for (unsigned l = 0; l < lanes && next < count; l++) {
+            if ((busy >> l) & 1) continue;
+            lane_job_start(&job[l], next, data[next], len[next], state[l]);
+            next++;
+            busy |= 1u << l;
+        }
+        if (!busy) break;
+
+        // A lone message left over runs faster outside the lanes
+        if (next == count && (busy & (busy - 1)) == 0) {
+            unsigned l = (unsigned)__builtin_ctz(busy);
+            s_blocks(state[l], job[l].ptr, job[l].left);
+            if (!job[l].in_tail) s_blocks(state[l], job[l].tail, job[l].tail_blocks);
+            state_to_digest(state[l], out[job[l].index]);
+            break;
+        }
+
+        // Run every busy lane up to the end of its shortest segment
+        size_t run = SIZE_MAX;
+        for (unsigned l = 0; l < lanes; l++) {
+            if (!((busy >> l) & 1)) continue;
+            ptr[l] = job[l].ptr;
+            if (job[l].left < run) run = job[l].left;
+        }
+        s_lanes->fn(state, ptr, busy, run);
+
+        for (unsigned l = 0; l < lanes; l++) {
+            if (!((busy >> l) & 1)) continue;
+            LaneJob *j = &job[l];
+            j->ptr += run * SHA256_BLOCK_SIZE;
+            j->left -= run;
+            if (j->left) continue;
+            if (!j->in_tail) {
+                j->in_tail = true;
+                j->ptr = j->tail;
+                j->left = j->tail_blocks;
+                continue;
+            }
+            state_to_digest(state[l], out[j->index]);
+            busy &= ~(1u << l);
+        }
+    }
+}
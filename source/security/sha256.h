@@ -0,0 +1,50 @@
+// sha256.h - SHA-256 with runtime-selected block functions
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// The compression function is picked once, on first use:
+//   arm      ARMv8 SHA2 instructions (every Switch CPU has them)
+//   shani    x86 SHA extensions, for host builds
+//   scalar   portable C, the reference the others are checked against
+// A candidate only gets picked after it reproduces the scalar results on a
+// set of known inputs, so a miscompiled or misdetected backend falls back
+// to scalar instead of producing bad hashes.
+//
+// sha256_multi() hashes several independent buffers at once. Without
+// hardware SHA it runs them through SIMD lanes (8 with AVX2, 4 with
+// NEON/SSE2), which is several times faster than one stream at a time;
+// with hardware SHA it simply hashes them in turn, which is faster still.
+
+#define SHA256_DIGEST_SIZE  32
+#define SHA256_BLOCK_SIZE   64
+#define SHA256_MAX_LANES    8
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t bitcount;
+    unsigned char buffer[SHA256_BLOCK_SIZE];
+} sha256_ctx;
+
+void sha256_init(sha256_ctx *ctx);
+void sha256_update(sha256_ctx *ctx, const void *data, size_t len);
+void sha256_final(sha256_ctx *ctx, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+// One-shot hash of each data[i] (len[i] bytes) into out[i]
+void sha256_multi(const void *const data[], const size_t len[], size_t count,
+                  unsigned char out[][SHA256_DIGEST_SIZE]);
+
+// Name of the selected backend ("arm", "shani" or "scalar"), with the
+// lane backend sha256_multi() uses appended ("scalar+avx2x8")
+const char *sha256_backend_name(void);
+
+// Compress whole blocks with the selected backend
+void sha256_blocks(uint32_t state[8], const unsigned char *data, size_t blocks);
+
+// Portable reference implementation
+void sha256_blocks_scalar(uint32_t state[8], const unsigned char *data, size_t blocks);
+
+#endif // SHA256_H
@@ -1,14 +1,23 @@
 #include "verify.h"
 #include "crypto.h"
+#include "hash_pipeline.h"
+#include "hash_db.h"
+#include "nca_header.h"
 #include "fs.h"
 #include "../..//include/libnx_errors.h"
 #include <string.h>
 #include <malloc.h>
 #include <stdio.h>
+#include <ctype.h>
 
-#define NCA_HEADER_SIZE 0xC00
 #define NSP_READ_BUFFER_SIZE 0x800000 // 8MB buffer
 
+#define PFS0_MAGIC          0x30534650 // "PFS0"
+#define PFS0_ENTRY_SIZE     0x18
+#define PFS0_MAX_FILES      0x1000
+#define PFS0_MAX_NAMES      0x100000
+#define CNMT_XML_MAX        0x100000
+
 static bool s_initialized = false;
 
 Result verify_init(void) {
@@ -16,6 +25,8 @@ Result verify_init(void) {
     
     Result rc = crypto_init();
     if (R_SUCCEEDED(rc)) {
+        // Without the key only headers stored decrypted can be read
+        if (!nca_header_has_key()) nca_header_load_keys(NCA_KEYS_PATH);
         s_initialized = true;
     }
     return rc;
@@ -28,40 +39,31 @@ void verify_exit(void) {
     }
 }
 
-static Result verify_nca_header(const void* header, NcaVerifyResult* out_result) {
-    if (!header || !out_result) {
-        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
-    }
+// Fields of a decrypted header
+static Result parse_nca_header(const u8* h, NcaVerifyResult* out_result) {
+    static const u8 no_rights_id[16];
 
     memset(out_result, 0, sizeof(NcaVerifyResult));
-
-    // Verify magic "NCA3"
-    if (memcmp(header, "NCA3", 4) != 0) {
-        return MAKERESULT(Module_Libnx, LibnxError_BadMagic);
-    }
-
     out_result->valid_header = true;
 
-    // Parse header fields
-    const u8* h = (const u8*)header;
     memcpy(&out_result->title_id, h + 0x210, sizeof(u64));
-    out_result->content_type = *(u8*)(h + 0x205);
-    out_result->crypto_type = *(u8*)(h + 0x206);
-    out_result->key_gen = *(u8*)(h + 0x207);
+    out_result->content_type = h[0x205];
+    out_result->crypto_type = h[0x206];
+    // The key generation moved to 0x220 once 0x206 ran out; the larger counts
+    out_result->key_gen = h[0x220] > h[0x206] ? h[0x220] : h[0x206];
 
-    // Check for rights ID
-    if (*(u8*)(h + 0x204) & 0x1) {
+    // Titlekey crypto is in use when the rights ID is not all zero
+    if (memcmp(h + 0x230, no_rights_id, sizeof(no_rights_id)) != 0) {
         out_result->has_rights_id = true;
         memcpy(out_result->rights_id, h + 0x230, 16);
     }
 
-    // Determine NCA type
     switch (out_result->content_type) {
-        case 0: out_result->type = NcaType_Meta; break;
-        case 1: out_result->type = NcaType_Program; break;
-        case 2: out_result->type = NcaType_Data; break;
-        case 3: out_result->type = NcaType_Control; break;
-        case 4: out_result->type = NcaType_Manual; break;
+        case 0: out_result->type = NcaType_Program; break;
+        case 1: out_result->type = NcaType_Meta; break;
+        case 2: out_result->type = NcaType_Control; break;
+        case 3: out_result->type = NcaType_Manual; break;
+        case 4: out_result->type = NcaType_Data; break;
         case 5: out_result->type = NcaType_PublicData; break;
         default: return MAKERESULT(Module_Libnx, LibnxError_BadInput);
     }
@@ -81,6 +83,32 @@ static Result verify_nca_header(const void* header, NcaVerifyResult* out_result)
     return 0;
 }
 
+// Decrypt 'count' raw headers in place as one batch and parse each
+static void decode_nca_headers(u8* headers, size_t count, NcaVerifyResult* results, Result* rcs) {
+    nca_header_decrypt(headers, count, rcs);
+    for (size_t i = 0; i < count; i++) {
+        if (R_SUCCEEDED(rcs[i])) {
+            rcs[i] = parse_nca_header(headers + i * NCA_HEADER_SIZE, &results[i]);
+        } else {
+            memset(&results[i], 0, sizeof(NcaVerifyResult));
+        }
+    }
+}
+
+Result verify_nca_headers(const void* headers, size_t count, NcaVerifyResult* results, Result* rcs) {
+    if (!s_initialized || (count && (!headers || !results || !rcs))) {
+        return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
+    }
+    if (count == 0) return 0;
+
+    u8* buf = malloc(count * NCA_HEADER_SIZE);
+    if (!buf) return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    memcpy(buf, headers, count * NCA_HEADER_SIZE);
+    decode_nca_headers(buf, count, results, rcs);
+    free(buf);
+    return 0;
+}
+
 Result verify_nca_file(const char* path, NcaVerifyResult* out_result) {
     if (!s_initialized || !path || !out_result) {
         return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
@@ -99,7 +127,9 @@ Result verify_nca_file(const char* path, NcaVerifyResult* out_result) {
         return MAKERESULT(Module_Libnx, LibnxError_IoError);
     }
 
-    return verify_nca_header(header, out_result);
+    Result rc;
+    decode_nca_headers(header, 1, out_result, &rc);
+    return rc;
 }
 
 Result verify_nca_memory(const void* data, size_t size, NcaVerifyResult* out_result) {
@@ -107,7 +137,75 @@ Result verify_nca_memory(const void* data, size_t size, NcaVerifyResult* out_res
         return MAKERESULT(Module_Libnx, LibnxError_NotInitialized);
     }
 
-    return verify_nca_header(data, out_result);
+    u8 header[NCA_HEADER_SIZE];
+    memcpy(header, data, sizeof(header));
+    Result rc;
+    decode_nca_headers(header, 1, out_result, &rc);
+    return rc;
+}
+
+// File table of a PFS0 (NSP) container
+typedef struct {
+    u32 count;
+    u8* entries;
+    char* names;
+    u32 names_size;
+    u64 data_offset;    // file offset that entry offsets are relative to
+} Pfs0Listing;
+
+static void pfs0_free(Pfs0Listing* l) {
+    free(l->entries);
+    free(l->names);
+    memset(l, 0, sizeof(*l));
+}
+
+static Result pfs0_read(FILE* f, Pfs0Listing* out) {
+    memset(out, 0, sizeof(*out));
+
+    // magic, file count, string table size, reserved
+    u32 head[4];
+    if (fread(head, 1, sizeof(head), f) != sizeof(head)) {
+        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+    }
+    if (head[0] != PFS0_MAGIC) {
+        return MAKERESULT(Module_Libnx, LibnxError_BadMagic);
+    }
+    if (head[1] > PFS0_MAX_FILES || head[2] > PFS0_MAX_NAMES) {
+        return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    }
+
+    out->count = head[1];
+    out->names_size = head[2];
+    out->entries = malloc((size_t)out->count * PFS0_ENTRY_SIZE + 1);
+    out->names = malloc(out->names_size + 1);
+    if (!out->entries || !out->names) {
+        pfs0_free(out);
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    }
+    if (fread(out->entries, 1, (size_t)out->count * PFS0_ENTRY_SIZE, f) != (size_t)out->count * PFS0_ENTRY_SIZE ||
+        fread(out->names, 1, out->names_size, f) != out->names_size) {
+        pfs0_free(out);
+        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+    }
+    out->names[out->names_size] = '\0';
+    out->data_offset = sizeof(head) + (u64)out->count * PFS0_ENTRY_SIZE + out->names_size;
+    return 0;
+}
+
+// Absolute offset, size and name of entry i
+static void pfs0_entry(const Pfs0Listing* l, u32 i, u64* offset, u64* size, const char** name) {
+    const u8* e = l->entries + (size_t)i * PFS0_ENTRY_SIZE;
+    u32 name_offset;
+    memcpy(offset, e, sizeof(u64));
+    memcpy(size, e + 8, sizeof(u64));
+    memcpy(&name_offset, e + 16, sizeof(u32));
+    *offset += l->data_offset;
+    *name = name_offset < l->names_size ? l->names + name_offset : "";
+}
+
+static bool name_has_suffix(const char* name, const char* suffix) {
+    size_t n = strlen(name), k = strlen(suffix);
+    return n > k && strcmp(name + n - k, suffix) == 0;
 }
 
 Result verify_nsp_file(const char* path, NspVerifyResult* out_result) {
@@ -122,126 +220,337 @@ Result verify_nsp_file(const char* path, NspVerifyResult* out_result) {
         return MAKERESULT(Module_Libnx, LibnxError_NotFound);
     }
 
-    // Read PFS0 header
-    u32 magic;
-    if (fread(&magic, 1, 4, f) != 4 || magic != 0x30534650) { // "PFS0"
+    Pfs0Listing pfs;
+    Result rc = pfs0_read(f, &pfs);
+    if (R_FAILED(rc)) {
         fclose(f);
-        return MAKERESULT(Module_Libnx, LibnxError_BadMagic);
+        return rc;
     }
 
-    u32 num_files;
-    if (fread(&num_files, 1, 4, f) != 4) {
+    out_result->valid_format = true;
+    out_result->nca_results = calloc(pfs.count ? pfs.count : 1, sizeof(NcaVerifyResult));
+    if (!out_result->nca_results) {
+        pfs0_free(&pfs);
         fclose(f);
-        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
     }
 
-    // Skip string table size and reserved
-    fseek(f, 8, SEEK_CUR);
-
-    // Allocate space for file entries
-    size_t entries_size = num_files * 0x18;
-    u8* entries = malloc(entries_size);
-    if (!entries) {
+    // Read every NCA header first so they are all decrypted in one batch
+    u32 nca_files = 0;
+    for (u32 i = 0; i < pfs.count; i++) {
+        u64 offset, size;
+        const char* name;
+        pfs0_entry(&pfs, i, &offset, &size, &name);
+        if (name_has_suffix(name, ".nca")) nca_files++;
+        else if (name_has_suffix(name, ".tik")) out_result->has_ticket = true;
+    }
+    u8* headers = malloc((size_t)(nca_files ? nca_files : 1) * NCA_HEADER_SIZE);
+    Result* rcs = malloc((nca_files ? nca_files : 1) * sizeof(Result));
+    if (!headers || !rcs) {
+        free(headers);
+        free(rcs);
+        verify_free_nsp_result(out_result);
+        pfs0_free(&pfs);
         fclose(f);
         return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
     }
 
-    if (fread(entries, 1, entries_size, f) != entries_size) {
-        free(entries);
-        fclose(f);
-        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+    u32 read_count = 0;
+    for (u32 i = 0; i < pfs.count; i++) {
+        u64 offset, size;
+        const char* name;
+        pfs0_entry(&pfs, i, &offset, &size, &name);
+        if (!name_has_suffix(name, ".nca")) continue;
+        u8* header = headers + (size_t)read_count * NCA_HEADER_SIZE;
+        if (size < NCA_HEADER_SIZE || fseeko(f, (off_t)offset, SEEK_SET) != 0 ||
+            fread(header, 1, NCA_HEADER_SIZE, f) != NCA_HEADER_SIZE) {
+            continue;
+        }
+        read_count++;
     }
+    decode_nca_headers(headers, read_count, out_result->nca_results, rcs);
+    free(headers);
+
+    // Keep the NCAs whose header checked out, in package order
+    for (u32 k = 0; k < read_count; k++) {
+        if (R_FAILED(rcs[k])) continue;
+        NcaVerifyResult* nca = &out_result->nca_results[out_result->nca_count];
+        if (nca != &out_result->nca_results[k]) *nca = out_result->nca_results[k];
+
+        // Update NSP result based on NCA type
+        switch (nca->type) {
+            case NcaType_Program:
+                out_result->has_program = true;
+                out_result->title_id = nca->title_id;
+                if (nca->key_gen > out_result->min_key_gen) {
+                    out_result->min_key_gen = nca->key_gen;
+                }
+                break;
+            case NcaType_Control:
+                out_result->has_control = true;
+                break;
+            case NcaType_Meta:
+                out_result->has_meta = true;
+                break;
+            default:
+                break;
+        }
 
-    // Get string table size and read it
-    u32 string_table_size;
-    fseek(f, 0x10, SEEK_SET);
-    fread(&string_table_size, 1, 4, f);
-    
-    char* string_table = malloc(string_table_size);
-    if (!string_table) {
-        free(entries);
-        fclose(f);
-        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+        if (nca->has_rights_id) {
+            out_result->requires_ticket = true;
+        }
+
+        out_result->nca_count++;
     }
+    free(rcs);
 
-    fseek(f, 0x18 + entries_size, SEEK_SET);
-    if (fread(string_table, 1, string_table_size, f) != string_table_size) {
-        free(string_table);
-        free(entries);
-        fclose(f);
-        return MAKERESULT(Module_Libnx, LibnxError_IoError);
+    // Clean up
+    pfs0_free(&pfs);
+    fclose(f);
+
+    return 0;
+}
+
+// Content hash listed in a .cnmt.xml
+typedef struct {
+    u8 id[16];
+    u8 hash[32];
+} CnmtContentHash;
+
+// Parse exactly 'len' hex digits into out
+static bool parse_hex(const char* s, size_t len, u8* out) {
+    char tmp[65];
+    if (len >= sizeof(tmp)) return false;
+    for (size_t i = 0; i < len; i++) {
+        if (!isxdigit((unsigned char)s[i])) return false;
     }
+    memcpy(tmp, s, len);
+    tmp[len] = '\0';
+    return hex_to_bin(tmp, out, len / 2) == (int)(len / 2);
+}
 
-    out_result->valid_format = true;
-    out_result->nca_results = calloc(num_files, sizeof(NcaVerifyResult));
-    if (!out_result->nca_results) {
-        free(string_table);
-        free(entries);
+// Text between <tag> and </tag> inside [from, end), or NULL
+static const char* xml_value(const char* from, const char* end, const char* tag, size_t* len) {
+    char open[32], close[32];
+    snprintf(open, sizeof(open), "<%s>", tag);
+    snprintf(close, sizeof(close), "</%s>", tag);
+    const char* v = strstr(from, open);
+    if (!v || v >= end) return NULL;
+    v += strlen(open);
+    const char* e = strstr(v, close);
+    if (!e || e > end) return NULL;
+    *len = (size_t)(e - v);
+    return v;
+}
+
+// Id/Hash pairs of every <Content> in a cnmt.xml; returns how many
+static size_t parse_cnmt_xml(const char* xml, CnmtContentHash* out, size_t max) {
+    size_t n = 0;
+    const char* p = xml;
+    while (n < max && (p = strstr(p, "<Content>")) != NULL) {
+        const char* end = strstr(p, "</Content>");
+        if (!end) break;
+        size_t id_len, hash_len;
+        const char* id = xml_value(p, end, "Id", &id_len);
+        const char* hash = xml_value(p, end, "Hash", &hash_len);
+        if (id && hash && id_len == 32 && hash_len == 64 &&
+            parse_hex(id, 32, out[n].id) && parse_hex(hash, 64, out[n].hash)) {
+            n++;
+        }
+        p = end;
+    }
+    return n;
+}
+
+static char* read_cnmt_xml(FILE* f, u64 offset, u64 size) {
+    if (size == 0 || size > CNMT_XML_MAX) return NULL;
+    char* xml = malloc((size_t)size + 1);
+    if (!xml) return NULL;
+    if (fseeko(f, (off_t)offset, SEEK_SET) != 0 || fread(xml, 1, (size_t)size, f) != size) {
+        free(xml);
+        return NULL;
+    }
+    xml[size] = '\0';
+    return xml;
+}
+
+struct NspDeepVerify {
+    char* path;
+    NspVerifyResult* out;
+    HashRange* ranges;          // every NCA
+    NcaHashResult* results;
+    u32 n;
+    CnmtContentHash* listed;
+    size_t listed_count;
+    HashRange* todo;            // the NCAs the hash database had no digest for
+    u32* todo_index;
+    u32 pending;
+    HashPipeline* pipeline;
+};
+
+void verify_nsp_deep_finish(NspDeepVerify* v) {
+    if (!v) return;
+    hash_pipeline_destroy(v->pipeline);
+    free(v->todo);
+    free(v->todo_index);
+    free(v->ranges);
+    free(v->results);
+    free(v->listed);
+    free(v->path);
+    free(v);
+}
+
+Result verify_nsp_deep_begin(const char* path, NspVerifyResult* out_result, NspDeepVerify** out) {
+    if (!out) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    *out = NULL;
+    Result rc = verify_nsp_file(path, out_result);
+    if (R_FAILED(rc)) return rc;
+
+    FILE* f = fopen(path, "rb");
+    if (!f) return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+    Pfs0Listing pfs;
+    rc = pfs0_read(f, &pfs);
+    if (R_FAILED(rc)) {
         fclose(f);
+        return rc;
+    }
+
+    u32 nca_count = 0;
+    char* xml = NULL;
+    for (u32 i = 0; i < pfs.count; i++) {
+        u64 offset, size;
+        const char* name;
+        pfs0_entry(&pfs, i, &offset, &size, &name);
+        if (name_has_suffix(name, ".nca")) nca_count++;
+        else if (!xml && name_has_suffix(name, ".cnmt.xml")) xml = read_cnmt_xml(f, offset, size);
+    }
+    fclose(f);
+
+    NspDeepVerify* v = calloc(1, sizeof(NspDeepVerify));
+    if (v) {
+        v->path = strdup(path);
+        v->out = out_result;
+        v->ranges = calloc(nca_count ? nca_count : 1, sizeof(HashRange));
+        v->results = calloc(nca_count ? nca_count : 1, sizeof(NcaHashResult));
+        v->listed = calloc(nca_count ? nca_count : 1, sizeof(CnmtContentHash));
+        v->todo = calloc(nca_count ? nca_count : 1, sizeof(HashRange));
+        v->todo_index = calloc(nca_count ? nca_count : 1, sizeof(u32));
+    }
+    if (!v || !v->path || !v->ranges || !v->results || !v->listed || !v->todo || !v->todo_index) {
+        verify_nsp_deep_finish(v);
+        free(xml);
+        pfs0_free(&pfs);
         return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
     }
+    v->listed_count = xml ? parse_cnmt_xml(xml, v->listed, nca_count) : 0;
+    free(xml);
+
+    for (u32 i = 0; i < pfs.count; i++) {
+        u64 offset, size;
+        const char* name;
+        pfs0_entry(&pfs, i, &offset, &size, &name);
+        if (!name_has_suffix(name, ".nca")) continue;
+        v->ranges[v->n].offset = offset;
+        v->ranges[v->n].size = size;
+        snprintf(v->results[v->n].name, sizeof(v->results[v->n].name), "%s", name);
+        v->results[v->n].size = size;
+        v->n++;
+    }
+    pfs0_free(&pfs);
+
+    // Only NCAs the hash database has no digest for need to be read
+    for (u32 i = 0; i < v->n; i++) {
+        HashDbEntry cached;
+        if (hash_db_lookup(path, v->results[i].name, &cached) && cached.has_sha256) {
+            memcpy(v->ranges[i].sha256, cached.sha256, sizeof(cached.sha256));
+            out_result->hash_cached++;
+        } else {
+            v->todo[v->pending] = v->ranges[i];
+            v->todo_index[v->pending++] = i;
+        }
+    }
 
-    // Process each file in the NSP
-    for (u32 i = 0; i < num_files; i++) {
-        u64 offset = *(u64*)(entries + (i * 0x18));
-        u64 size = *(u64*)(entries + (i * 0x18) + 8);
-        u32 name_offset = *(u32*)(entries + (i * 0x18) + 16);
-        const char* name = string_table + name_offset;
-
-        // Check file extension
-        size_t name_len = strlen(name);
-        if (name_len > 4) {
-            if (strcmp(name + name_len - 4, ".nca") == 0) {
-                // Verify NCA
-                fseek(f, offset, SEEK_SET);
-                u8* buffer = malloc(NCA_HEADER_SIZE);
-                if (buffer) {
-                    if (fread(buffer, 1, NCA_HEADER_SIZE, f) == NCA_HEADER_SIZE) {
-                        Result rc = verify_nca_header(buffer, &out_result->nca_results[out_result->nca_count]);
-                        if (R_SUCCEEDED(rc)) {
-                            NcaVerifyResult* nca = &out_result->nca_results[out_result->nca_count];
-                            
-                            // Update NSP result based on NCA type
-                            switch (nca->type) {
-                                case NcaType_Program:
-                                    out_result->has_program = true;
-                                    out_result->title_id = nca->title_id;
-                                    if (nca->key_gen > out_result->min_key_gen) {
-                                        out_result->min_key_gen = nca->key_gen;
-                                    }
-                                    break;
-                                case NcaType_Control:
-                                    out_result->has_control = true;
-                                    break;
-                                case NcaType_Meta:
-                                    out_result->has_meta = true;
-                                    break;
-                                default:
-                                    break;
-                            }
-
-                            if (nca->has_rights_id) {
-                                out_result->requires_ticket = true;
-                            }
-
-                            out_result->nca_count++;
-                        }
-                    }
-                    free(buffer);
-                }
-            }
-            else if (strcmp(name + name_len - 4, ".tik") == 0) {
-                out_result->has_ticket = true;
-            }
+    if (v->pending > 0) {
+        rc = hash_pipeline_create(path, &v->pipeline);
+        if (R_SUCCEEDED(rc)) rc = hash_pipeline_start(v->pipeline, v->todo, v->pending);
+        if (R_FAILED(rc)) {
+            verify_nsp_deep_finish(v);
+            return rc;
         }
     }
+    *out = v;
+    return 0;
+}
 
-    // Clean up
-    free(string_table);
-    free(entries);
-    fclose(f);
+// Compare every NCA's digest with its reference and fill in the result
+static Result deep_compare(NspDeepVerify* v) {
+    NspVerifyResult* out_result = v->out;
+    for (u32 k = 0; k < v->pending; k++) {
+        u32 i = v->todo_index[k];
+        memcpy(v->ranges[i].sha256, v->todo[k].sha256, sizeof(v->todo[k].sha256));
+        hash_db_put_sha256(v->path, v->results[i].name, v->todo[k].sha256);
+    }
 
-    return 0;
+    // An NCA is named after its content ID, the first half of its SHA-256
+    for (u32 i = 0; i < v->n; i++) {
+        NcaHashResult* r = &v->results[i];
+        memcpy(r->sha256, v->ranges[i].sha256, sizeof(r->sha256));
+        u8 id[16];
+        if (strlen(r->name) < 33 || r->name[32] != '.' || !parse_hex(r->name, 32, id)) {
+            r->status = NcaHash_NoReference;
+            continue;
+        }
+        const u8* expect = NULL;
+        for (size_t k = 0; k < v->listed_count; k++) {
+            if (memcmp(v->listed[k].id, id, sizeof(id)) == 0) expect = v->listed[k].hash;
+        }
+        r->full_hash = expect != NULL;
+        bool ok = expect ? memcmp(r->sha256, expect, 32) == 0 : memcmp(r->sha256, id, sizeof(id)) == 0;
+        r->status = ok ? NcaHash_Match : NcaHash_Mismatch;
+        if (!ok) out_result->hash_failures++;
+    }
+
+    out_result->hash_results = v->results;
+    out_result->hash_count = v->n;
+    v->results = NULL;
+    hash_db_put_verdict(v->path, out_result->hash_failures ? HASH_DB_VERIFIED_BAD : HASH_DB_VERIFIED_OK);
+    return out_result->hash_failures ? MAKERESULT(Module_Libnx, LibnxError_VerificationFailed) : 0;
+}
+
+Result verify_nsp_deep_step(NspDeepVerify* v, size_t budget, bool* done) {
+    if (!v || !done) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    *done = false;
+    if (v->pipeline) {
+        bool hashed = false;
+        Result rc = hash_pipeline_step(v->pipeline, budget, &hashed);
+        if (R_FAILED(rc) || !hashed) return rc;
+    }
+    *done = true;
+    return deep_compare(v);
+}
+
+int verify_nsp_deep_progress(const NspDeepVerify* v) {
+    u64 current = 0, total = 0;
+    if (v) hash_pipeline_position(v->pipeline, &current, &total);
+    return total ? (int)(current * 100 / total) : 100;
+}
+
+Result verify_nsp_file_deep(const char* path, NspVerifyResult* out_result,
+                            void (*progress)(size_t current, size_t total)) {
+    NspDeepVerify* v = NULL;
+    Result rc = verify_nsp_deep_begin(path, out_result, &v);
+    bool done = false;
+    while (R_SUCCEEDED(rc) && !done) {
+        // A block at a time, so progress moves as the card is read
+        rc = verify_nsp_deep_step(v, HASH_PIPELINE_BLOCK, &done);
+        if (progress && R_SUCCEEDED(rc) && !done) {
+            u64 current, total;
+            hash_pipeline_position(v->pipeline, &current, &total);
+            progress((size_t)current, (size_t)total);
+        }
+    }
+    verify_nsp_deep_finish(v);
+    return rc;
 }
 
 void verify_free_nsp_result(NspVerifyResult* result) {
@@ -249,6 +558,11 @@ void verify_free_nsp_result(NspVerifyResult* result) {
         free(result->nca_results);
         result->nca_results = NULL;
         result->nca_count = 0;
+        free(result->hash_results);
+        result->hash_results = NULL;
+        result->hash_count = 0;
+        result->hash_failures = 0;
+        result->hash_cached = 0;
     }
 }
 
@@ -268,6 +582,10 @@ const char* verify_get_error_message(Result rc) {
             return "I/O error while reading file";
         case MAKERESULT(Module_Libnx, LibnxError_OutOfMemory):
             return "Out of memory";
+        case MAKERESULT(Module_Libnx, LibnxError_VerificationFailed):
+            return "Content hash mismatch (corrupted dump)";
+        case MAKERESULT(Module_Libnx, LibnxError_InvalidKey):
+            return "NCA header key missing (" NCA_KEYS_PATH ")";
         default:
             return "Unknown error";
     }
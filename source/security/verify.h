@@ -27,6 +27,21 @@ typedef struct {
     bool is_ticket_missing;
 } NcaVerifyResult;
 
+// Deep verification: how one NCA's contents compared
+typedef enum {
+    NcaHash_NoReference,    // neither a content ID name nor a CNMT hash to compare with
+    NcaHash_Match,
+    NcaHash_Mismatch
+} NcaHashStatus;
+
+typedef struct {
+    char name[0x40];
+    u64 size;
+    u8 sha256[32];
+    NcaHashStatus status;
+    bool full_hash;         // compared with the full CNMT hash, not just the content ID
+} NcaHashResult;
+
 // NSP verification result
 typedef struct {
     bool valid_format;
@@ -41,6 +56,11 @@ typedef struct {
     bool requires_ticket;
     bool has_ticket;
     NcaVerifyResult* nca_results;
+    // Filled in by verify_nsp_file_deep()
+    NcaHashResult* hash_results;
+    size_t hash_count;
+    size_t hash_failures;
+    size_t hash_cached;     // digests taken from the hash database, not re-read
 } NspVerifyResult;
 
 // Initialize verification system
@@ -50,9 +70,30 @@ void verify_exit(void);
 // NCA verification
 Result verify_nca_file(const char* path, NcaVerifyResult* out_result);
 Result verify_nca_memory(const void* data, size_t size, NcaVerifyResult* out_result);
+// Many raw 0xC00-byte headers stored back to back (from one NSP or a whole
+// library), decrypted as one batch with the header key from prod.keys.
+// results[i] and rcs[i] describe header i; LibnxError_InvalidKey means the
+// header is encrypted and no key was found.
+Result verify_nca_headers(const void* headers, size_t count, NcaVerifyResult* results, Result* rcs);
 
 // NSP verification
 Result verify_nsp_file(const char* path, NspVerifyResult* out_result);
+// verify_nsp_file() plus a SHA-256 of every NCA's full contents, compared
+// with its content ID (the first half of the hash) or, when the package
+// carries a .cnmt.xml, the full hash listed there. Returns
+// LibnxError_VerificationFailed if any NCA does not match. Digests are kept
+// in the hash database, so NCAs of an unchanged NSP are not read again.
+Result verify_nsp_file_deep(const char* path, NspVerifyResult* out_result,
+                            void (*progress)(size_t current, size_t total));
+// The same check stepped, for the task queue. begin reads the headers and
+// looks up cached digests; each step hashes up to 'budget' bytes of NCA
+// data (0 = the rest). Once *done is set the step's return value is what
+// verify_nsp_file_deep() would have returned.
+typedef struct NspDeepVerify NspDeepVerify;
+Result verify_nsp_deep_begin(const char* path, NspVerifyResult* out_result, NspDeepVerify** out);
+Result verify_nsp_deep_step(NspDeepVerify* v, size_t budget, bool* done);
+int verify_nsp_deep_progress(const NspDeepVerify* v); // 0..100
+void verify_nsp_deep_finish(NspDeepVerify* v);
 void verify_free_nsp_result(NspVerifyResult* result);
 
 // Error handling
@@ -5,6 +5,7 @@
 #include <sys/stat.h>
 #include <stdlib.h>
 #include "system/system_manager.h"
+#include "net/download_manager.h"
 
 static const char *settings_path = "sdmc:/switch/hello-world/settings.cfg";
 
@@ -83,10 +84,16 @@ void save_settings(void) {
     fprintf(f, "battery_threshold_percent=%d\n", g_settings.battery_threshold_percent);
     fprintf(f, "storage_threshold_bytes=%llu\n", (unsigned long long)g_settings.storage_threshold_bytes);
     fprintf(f, "language=%s\n", g_settings.language[0] ? g_settings.language : "en");
+    fprintf(f, "download_concurrency=%d\n", g_settings.download_concurrency);
+    fprintf(f, "download_limit_kib=%u\n", g_settings.download_limit_kib);
+    fprintf(f, "download_job_limit_kib=%u\n", g_settings.download_job_limit_kib);
     fclose(f);
 }
 
 void load_settings(void) {
+    g_settings.download_concurrency = DLMGR_DEFAULT_CONCURRENCY;
+    g_settings.download_limit_kib = 0;
+    g_settings.download_job_limit_kib = 0;
     FILE *f = fopen(settings_path, "r");
     if (!f) {
         // defaults
@@ -98,6 +105,7 @@ void load_settings(void) {
         g_settings.battery_threshold_percent = 20; // percent
         g_settings.storage_threshold_bytes = 2ULL * 1024ULL * 1024ULL * 1024ULL; // 2GB
         strcpy(g_settings.language, "en");
+        settings_apply_downloads();
         return;
     }
     char line[512];
@@ -112,8 +120,12 @@ void load_settings(void) {
         else if (strcmp(key, "battery_threshold_percent") == 0) g_settings.battery_threshold_percent = atoi(val);
     else if (strcmp(key, "storage_threshold_bytes") == 0) g_settings.storage_threshold_bytes = strtoull(val, NULL, 10);
         else if (strcmp(key, "language") == 0) strncpy(g_settings.language, val, sizeof(g_settings.language)-1);
+        else if (strcmp(key, "download_concurrency") == 0) g_settings.download_concurrency = atoi(val);
+        else if (strcmp(key, "download_limit_kib") == 0) g_settings.download_limit_kib = (unsigned int)strtoul(val, NULL, 10);
+        else if (strcmp(key, "download_job_limit_kib") == 0) g_settings.download_job_limit_kib = (unsigned int)strtoul(val, NULL, 10);
     }
     fclose(f);
+    settings_apply_downloads();
 
     // Apply derived flags for the currently selected mode
     switch (g_settings.app_mode) {
@@ -217,6 +229,23 @@ void settings_check_auto_mode(void) {
     }
 }
 
+void settings_apply_downloads(void) {
+    if (g_settings.download_concurrency < 1) g_settings.download_concurrency = 1;
+    if (g_settings.download_concurrency > DLMGR_MAX_CONCURRENCY) g_settings.download_concurrency = DLMGR_MAX_CONCURRENCY;
+    dlmgr_set_concurrency(g_settings.download_concurrency);
+    dlmgr_set_global_limit(g_settings.download_limit_kib * 1024u);
+}
+
+// Next bandwidth cap preset in KiB/s, 0 meaning none
+static unsigned int next_limit_kib(unsigned int kib) {
+    static const unsigned int presets[] = { 0, 512, 1024, 2048, 4096, 8192 };
+    const int count = sizeof(presets) / sizeof(presets[0]);
+    for (int i = 0; i < count - 1; i++) {
+        if (kib == presets[i]) return presets[i + 1];
+    }
+    return presets[0];
+}
+
 void apply_theme(const char *name) {
     (void)name; // for now the theme name is stored; UI uses accessors to query sequences
     // Could map named themes to different sequences here in future
@@ -239,7 +268,8 @@ void settings_mark_parental_report(long epoch_seconds) {
 
 // Simple settings menu: toggle confirm_installs and cycle theme list
 void settings_menu(int view_rows, int view_cols) {
-    const char *options[] = { "Confirm installs", "Theme", "App Mode", "Auto Mode (battery/storage)", "Battery threshold", "Storage threshold (bytes)", "Save and return" };
+    const char *options[] = { "Confirm installs", "Theme", "App Mode", "Auto Mode (battery/storage)", "Battery threshold", "Storage threshold (bytes)",
+                              "Parallel downloads", "Download limit (all, KiB/s)", "Download limit (each, KiB/s)", "Save and return" };
     const int opt_count = sizeof(options) / sizeof(options[0]);
     int sel = 0;
     // Clear the screen before rendering settings UI to avoid leftover text
@@ -253,6 +283,7 @@ void settings_menu(int view_rows, int view_cols) {
         }
         const char *mode_names[] = { "Normal", "Battery Saver", "Storage Saver", "Efficient" };
     printf("\nCurrent: Confirm=%d Theme=%s Mode=%s Auto=%d BatThr=%d%% StorThr=%llu\n", g_settings.confirm_installs, g_settings.theme, mode_names[g_settings.app_mode], g_settings.auto_mode_enabled, g_settings.battery_threshold_percent, (unsigned long long)g_settings.storage_threshold_bytes);
+        printf("Downloads: Parallel=%d Limit=%u Each=%u (KiB/s, 0 = none)\n", g_settings.download_concurrency, g_settings.download_limit_kib, g_settings.download_job_limit_kib);
         fflush(stdout);
 
         padUpdate(&pad); u64 kd = padGetButtonsDown(&pad);
@@ -281,6 +312,16 @@ void settings_menu(int view_rows, int view_cols) {
                 else if (g_settings.storage_threshold_bytes == 5ULL * 1024ULL * 1024ULL * 1024ULL) g_settings.storage_threshold_bytes = 1ULL * 1024ULL * 1024ULL * 1024ULL;
                 else g_settings.storage_threshold_bytes = 2ULL * 1024ULL * 1024ULL * 1024ULL;
                 save_settings();
+            } else if (sel == 6) {
+                g_settings.download_concurrency = g_settings.download_concurrency >= DLMGR_MAX_CONCURRENCY ? 1 : g_settings.download_concurrency + 1;
+                settings_apply_downloads(); save_settings();
+            } else if (sel == 7) {
+                g_settings.download_limit_kib = next_limit_kib(g_settings.download_limit_kib);
+                settings_apply_downloads(); save_settings();
+            } else if (sel == 8) {
+                // Applies to downloads queued from now on
+                g_settings.download_job_limit_kib = next_limit_kib(g_settings.download_job_limit_kib);
+                save_settings();
             } else { break; }
         }
         if (kd & HidNpadButton_B) break;
@@ -38,6 +38,11 @@ typedef struct {
     int parental_report_days;             // report interval in days
     long parental_last_report;            // epoch seconds of last report
     char parental_contact[128];           // optional parent contact/email
+
+    // Download manager
+    int download_concurrency;             // transfers running at once
+    unsigned int download_limit_kib;      // all downloads together, KiB/s (0 = no cap)
+    unsigned int download_job_limit_kib;  // each queued download, KiB/s (0 = no cap)
 } AppSettings;
 
 extern AppSettings g_settings;
@@ -60,6 +65,8 @@ void settings_mark_parental_report(long epoch_seconds);
 // Apply and auto-switch helpers
 void settings_check_auto_mode(void);
 void settings_apply_mode(int mode);
+// Push the download settings to the download manager
+void settings_apply_downloads(void);
 
 #endif // HELLO_SETTINGS_H
 #ifndef HELLO_SETTINGS_H
@@ -5,6 +5,7 @@
 #include "features/firmware_ui.h"
 #include "firmware_manager.h"
 #include "../file/fs.h"
+#include "../security/manifest.h"
 #include <stdio.h>
 #include <stdarg.h>
 
@@ -352,6 +353,14 @@ Result emummc_dump(const char* dump_path) {
         return -1;
     }
     
+    // Chunk digests are taken on the way through, so the dump can be
+    // checked later without reading it back first
+    Manifest* manifest = NULL;
+    if (manifest_create(&manifest) != 0 || manifest_begin_file(manifest, "SYSTEM.img") != 0) {
+        manifest_free(manifest);
+        manifest = NULL;
+    }
+    
     // Dump in chunks
     u64 offset = 0;
     while (offset < total_size) {
@@ -365,6 +374,7 @@ Result emummc_dump(const char* dump_path) {
             rc = -2;
             break;
         }
+        manifest_update(manifest, transfer_buffer, read_size);
         
         offset += read_size;
     }
@@ -385,7 +395,17 @@ Result emummc_dump(const char* dump_path) {
         }
     }
     
-    fclose(out);
+    if (fclose(out) != 0 && R_SUCCEEDED(rc)) rc = -2;
+    if (manifest) {
+        if (R_SUCCEEDED(rc)) {
+            char manifest_path[PATH_MAX];
+            snprintf(manifest_path, PATH_MAX, "%s" MANIFEST_EXT, dump_file);
+            int mrc = manifest_end_file(manifest);
+            if (mrc == 0) mrc = manifest_save(manifest, manifest_path);
+            if (mrc != 0) system_log(SYSTEM_LOG_ERROR, "Failed to write manifest %s (%d)", manifest_path, mrc);
+        }
+        manifest_free(manifest);
+    }
     fsStorageClose(&storage);
     fsDeviceOperatorClose(&dev_op);
     return rc;
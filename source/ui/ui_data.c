@@ -7,9 +7,11 @@
 #include <stdarg.h>
 #include <sys/stat.h>
 #include "ui_data.h"
+#include "../net/download_manager.h"
 #include <fcntl.h>
 #include <errno.h>
 #include <ctype.h>
+#include <pthread.h>
 
 void ui_state_init(UIState* state) {
     memset(state, 0, sizeof(UIState));
@@ -72,68 +74,23 @@ static void write_ui_log(const char *fmt, ...) {
     fclose(f);
 }
 
-// Downloads queue (simple FIFO list)
-#define MAX_DOWNLOADS 16
-typedef struct {
-    char label[128];
-    int progress; // 0-100
-    bool active;
-} DownloadEntry;
-
-static DownloadEntry g_downloads[MAX_DOWNLOADS];
-
-static int downloads_count(void) {
-    int c = 0; for (int i = 0; i < MAX_DOWNLOADS; ++i) if (g_downloads[i].active) c++; return c;
-}
-
-static void downloads_push_or_update(const char *label, int progress) {
-    if (!label) return;
-    // find existing
-    for (int i = 0; i < MAX_DOWNLOADS; ++i) {
-        if (g_downloads[i].active && strcmp(g_downloads[i].label, label) == 0) { g_downloads[i].progress = progress; return; }
-    }
-    // find free slot
-    for (int i = 0; i < MAX_DOWNLOADS; ++i) {
-        if (!g_downloads[i].active) { strncpy(g_downloads[i].label, label, sizeof(g_downloads[i].label)-1); g_downloads[i].label[sizeof(g_downloads[i].label)-1] = '\0'; g_downloads[i].progress = progress; g_downloads[i].active = true; return; }
-    }
-    // no space: replace oldest (slot 0)
-    strncpy(g_downloads[0].label, label, sizeof(g_downloads[0].label)-1); g_downloads[0].label[sizeof(g_downloads[0].label)-1] = '\0'; g_downloads[0].progress = progress; g_downloads[0].active = true;
-}
-
-// Public wrappers for other modules
+// Downloads queue: entries live in the download manager, which also tracks
+// transfers it did not start from the progress they report here.
 void ui_downloads_push_update(const char *label, int progress) {
-    downloads_push_or_update(label, progress < 0 ? 0 : (progress > 100 ? 100 : progress));
+    if (!label) return;
+    if (progress < 0) { ui_downloads_remove(label); return; }
+    if (progress > 100) progress = 100;
+    dlmgr_report(label, progress);
     // Also update the global task area when active
-    if (label && progress >= 0) {
-        char taskbuf[128]; snprintf(taskbuf, sizeof(taskbuf), "Downloading: %s", label);
-        ui_set_task(taskbuf, progress);
-    } else if (label && progress < 0) {
-        ui_downloads_remove(label);
-    }
+    char taskbuf[128]; snprintf(taskbuf, sizeof(taskbuf), "Downloading: %s", label);
+    ui_set_task(taskbuf, progress);
 }
 
 void ui_downloads_remove(const char *label) {
     if (!label) return;
-    for (int i = 0; i < MAX_DOWNLOADS; ++i) {
-        if (g_downloads[i].active && strcmp(g_downloads[i].label, label) == 0) {
-            g_downloads[i].active = false;
-            g_downloads[i].label[0] = '\0';
-            g_downloads[i].progress = 0;
-            break;
-        }
-    }
+    dlmgr_report_done(label);
     // Clear task area when no more downloads active
-    if (downloads_count() == 0) ui_clear_task();
-}
-
-static void downloads_pop_front(void) {
-    // remove first active and compact
-    int first = -1; for (int i = 0; i < MAX_DOWNLOADS; ++i) if (g_downloads[i].active) { first = i; break; }
-    if (first == -1) return;
-    // shift
-    for (int i = first; i < MAX_DOWNLOADS-1; ++i) g_downloads[i] = g_downloads[i+1];
-    // clear last
-    g_downloads[MAX_DOWNLOADS-1].active = false; g_downloads[MAX_DOWNLOADS-1].label[0] = '\0'; g_downloads[MAX_DOWNLOADS-1].progress = 0;
+    if (dlmgr_count() == 0) ui_clear_task();
 }
 
 // Favorites persistence (simple label list, one per line)
@@ -219,24 +176,33 @@ bool ui_probe_terminal_size(int *out_rows, int *out_cols) {
     int r=0,c=0; if (sscanf(p, "\x1b[%d;%dR", &r, &c) != 2) return false; if (r <= 0 || c <= 0) return false; *out_rows = r; *out_cols = c; return true;
 }
 
-// Show minimal downloads queue UI
+static const char *download_state_name(const DownloadInfo *d) {
+    switch (d->state) {
+        case DOWNLOAD_QUEUED: return "queued";
+        case DOWNLOAD_CANCELLING: return "cancel";
+        default: return "";
+    }
+}
+
+// Show the downloads queue, rendered from the download manager's state
 void ui_show_downloads_queue(int view_rows, int view_cols) {
-    // Build active list snapshot (indices)
-    int active_idx[MAX_DOWNLOADS]; int active_count = 0;
-    for (int i = 0; i < MAX_DOWNLOADS; ++i) if (g_downloads[i].active) active_idx[active_count++] = i;
+    DownloadInfo *items = NULL;
+    int count = (int)dlmgr_snapshot(&items);
 
     consoleClear();
     PadState pad; padInitializeDefault(&pad);
-    int sel = 0; if (active_count == 0) sel = -1;
+    int sel = count > 0 ? 0 : -1;
 
     while (appletMainLoop()) {
         // Render
         consoleClear();
-        printf("Downloads Queue:\n\n");
-        if (active_count == 0) {
+        u32 limit = dlmgr_get_global_limit();
+        printf("Downloads Queue: %d item(s), %d at a time", count, dlmgr_get_concurrency());
+        if (limit) printf(", limit %u KiB/s", limit / 1024);
+        printf("\n\n");
+        if (count == 0) {
             printf("(no active downloads)\n");
         } else {
-            int start_row = 2;
             int max_rows = view_rows - 6; if (max_rows < 3) max_rows = 3;
             int top = 0;
             // ensure selection visible
@@ -245,38 +211,45 @@ void ui_show_downloads_queue(int view_rows, int view_cols) {
 
             for (int r = 0; r < max_rows; ++r) {
                 int idx = top + r;
-                if (idx >= active_count) { printf("\n"); continue; }
-                int gi = active_idx[idx];
+                if (idx >= count) { printf("\n"); continue; }
+                const DownloadInfo *d = &items[idx];
                 if (idx == sel) printf("\x1b[7m"); else printf("\x1b[0m");
-                char labelbuf[64]; snprintf(labelbuf, sizeof(labelbuf), "%s", g_downloads[gi].label);
+                char labelbuf[64]; snprintf(labelbuf, sizeof(labelbuf), "%s", d->label);
                 // clamp label to view_cols - progress area
-                int labw = view_cols - 20; if (labw < 10) labw = 10;
+                int labw = view_cols - 32; if (labw < 10) labw = 10;
+                if (labw > (int)sizeof(labelbuf) - 1) labw = (int)sizeof(labelbuf) - 1;
                 if ((int)strlen(labelbuf) > labw) labelbuf[labw-3] = '\0', labelbuf[labw-2] = labelbuf[labw-1] = '.';
                 printf(" %-*s ", labw, labelbuf);
                 // progress bar
                 int barw = 12;
-                int filled = (g_downloads[gi].progress * barw) / 100;
+                int filled = (d->progress * barw) / 100;
                 printf("[");
                 for (int b = 0; b < barw; ++b) putchar(b < filled ? '=' : ' ');
-                printf("] %3d%%\n", g_downloads[gi].progress);
+                if (d->state == DOWNLOAD_ACTIVE && d->rate) printf("] %3d%% %6u KiB/s\n", d->progress, d->rate / 1024);
+                else printf("] %3d%% %12s\n", d->progress, download_state_name(d));
             }
+            printf("\x1b[0m");
         }
 
-        printf("\nA: Details  B: Back  ↑/↓: Navigate\n");
+        printf("\nA: Details  X: Cancel  B: Back  ↑/↓: Navigate\n");
         fflush(stdout);
 
         // Input
         padUpdate(&pad); u64 kDown = padGetButtonsDown(&pad);
         if (kDown & HidNpadButton_B) break;
-        if (active_count > 0) {
+        if (count > 0) {
             if (kDown & HidNpadButton_Up) { if (sel > 0) sel--; }
-            if (kDown & HidNpadButton_Down) { if (sel < active_count - 1) sel++; }
+            if (kDown & HidNpadButton_Down) { if (sel < count - 1) sel++; }
+            // Only downloads the manager started can be cancelled from here
+            if ((kDown & HidNpadButton_X) && items[sel].id) dlmgr_cancel(items[sel].id);
             if (kDown & HidNpadButton_A) {
                 // Show simple details for selected entry
-                int gi = active_idx[sel];
+                const DownloadInfo *d = &items[sel];
                 consoleClear();
-                printf("Download: %s\n", g_downloads[gi].label);
-                printf("Progress: %d%%\n", g_downloads[gi].progress);
+                printf("Download: %s\n", d->label);
+                printf("Progress: %d%%\n", d->progress);
+                if (d->total) printf("Bytes: %llu / %llu\n", (unsigned long long)d->current, (unsigned long long)d->total);
+                if (d->rate_limit) printf("Limit: %u KiB/s\n", d->rate_limit / 1024);
                 printf("Press B to return\n"); fflush(stdout);
                 // wait for B
                 while (appletMainLoop()) {
@@ -289,10 +262,13 @@ void ui_show_downloads_queue(int view_rows, int view_cols) {
 
         consoleUpdate(NULL);
         svcSleepThread(16666666ULL); // ~60Hz
-        // refresh active list snapshot each loop in case entries change
-        active_count = 0; for (int i = 0; i < MAX_DOWNLOADS; ++i) if (g_downloads[i].active) active_idx[active_count++] = i;
-        if (active_count == 0) sel = -1; if (sel >= active_count) sel = active_count - 1;
+        // refresh the snapshot each loop in case entries change
+        free(items);
+        count = (int)dlmgr_snapshot(&items);
+        if (sel >= count) sel = count - 1;
+        if (sel < 0 && count > 0) sel = 0;
     }
+    free(items);
 }
 
 MenuAction ui_handle_input(UIState* state) {
@@ -394,23 +370,30 @@ static const char *get_protocol_string(void) {
 }
 #endif
 
-// Task/progress state shown under the homescreen
+// Task/progress state shown under the homescreen. Download workers, segment
+// threads and the net loop report here while the UI thread renders it, so
+// all of it is guarded by g_ui_task_lock.
+static pthread_mutex_t g_ui_task_lock = PTHREAD_MUTEX_INITIALIZER;
 static bool g_ui_task_active = false;
 static char g_ui_task_label[128] = "";
 static int g_ui_task_progress = 0; // percent 0-100
 
 void ui_set_task(const char *label, int progress_percent) {
     if (!label) label = "";
+    pthread_mutex_lock(&g_ui_task_lock);
     strncpy(g_ui_task_label, label, sizeof(g_ui_task_label)-1);
     g_ui_task_label[sizeof(g_ui_task_label)-1] = '\0';
     g_ui_task_progress = progress_percent < 0 ? 0 : (progress_percent > 100 ? 100 : progress_percent);
     g_ui_task_active = true;
+    pthread_mutex_unlock(&g_ui_task_lock);
 }
 
 void ui_clear_task(void) {
+    pthread_mutex_lock(&g_ui_task_lock);
     g_ui_task_active = false;
     g_ui_task_label[0] = '\0';
     g_ui_task_progress = 0;
+    pthread_mutex_unlock(&g_ui_task_lock);
 }
 
 // Render a modern homescreen: top bar with system info, main action grid (2x3),
@@ -463,20 +446,25 @@ void render_homescreen(int top_row, int selected_row, int view_rows, int view_co
     int status_row = list_top + max_rows + 1;
     if (status_row < list_top + 1) status_row = list_top + 1;
     printf("\x1b[%d;1H", status_row);
-    if (g_ui_task_active) {
+    // Copy the task out so the lock is not held while printing
+    pthread_mutex_lock(&g_ui_task_lock);
+    bool task_active = g_ui_task_active;
+    int task_progress = g_ui_task_progress;
+    char labelbuf[80]; snprintf(labelbuf, sizeof(labelbuf), "%s", g_ui_task_label);
+    pthread_mutex_unlock(&g_ui_task_lock);
+    if (task_active) {
         // Render task label and progress bar
-        char labelbuf[80]; snprintf(labelbuf, sizeof(labelbuf), "%s", g_ui_task_label);
         printf("%s\n", labelbuf);
 
         // progress bar
         int bar_width = view_cols - 10;
         if (bar_width < 10) bar_width = 10;
-        int filled = (g_ui_task_progress * bar_width) / 100;
+        int filled = (task_progress * bar_width) / 100;
         printf("[");
         for (int i = 0; i < bar_width; ++i) {
             if (i < filled) putchar('='); else putchar(' ');
         }
-        printf("] %d%%\n", g_ui_task_progress);
+        printf("] %d%%\n", task_progress);
     } else {
         printf("Status: Idle\n");
     }
@@ -0,0 +1,181 @@
+// bench_sha256.c - host check and benchmark for source/security/sha256.c
+//
+// Every block backend this CPU can run, every SIMD lane backend and
+// sha256_multi() are checked against the scalar reference on messages of
+// many lengths, then timed. Includes sha256.c directly to reach the backend
+// tables, so it builds on its own:
+//
+//   gcc -O2 -o bench_sha256 tools/bench_sha256.c -lpthread
+//
+// Exits non-zero if any result differs from the reference.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../source/security/sha256.c"
+
+#define BENCH_BYTES     (64 * 1024 * 1024)
+#define MULTI_COUNT     256
+#define MULTI_SIZE      (64 * 1024)
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static double mb_per_sec(size_t bytes, double secs) {
+    return secs > 0 ? (double)bytes / (1024.0 * 1024.0) / secs : 0;
+}
+
+// One-shot hash through a given block function
+static void hash_with(sha256_blocks_fn fn, const unsigned char *data, size_t len,
+                      unsigned char out[SHA256_DIGEST_SIZE]) {
+    uint32_t st[8];
+    unsigned char tail[2 * SHA256_BLOCK_SIZE];
+    memcpy(st, IV, sizeof(st));
+    size_t whole = len / SHA256_BLOCK_SIZE;
+    if (whole) fn(st, data, whole);
+    size_t blocks = pad_tail(data + whole * SHA256_BLOCK_SIZE, len % SHA256_BLOCK_SIZE, (uint64_t)len * 8, tail);
+    fn(st, tail, blocks);
+    state_to_digest(st, out);
+}
+
+// Lengths around every padding edge plus a few multi-block sizes
+static const size_t s_lengths[] = {
+    0, 1, 3, 55, 56, 57, 63, 64, 65, 119, 120, 127, 128, 129, 1000, 4096, 65537, 1048576 + 13
+};
+#define LENGTH_COUNT (sizeof(s_lengths) / sizeof(s_lengths[0]))
+
+static int check_known_answers(void) {
+    // FIPS 180-2 "abc" and the empty message
+    static const unsigned char abc[SHA256_DIGEST_SIZE] = {
+        0xba,0x78,0x16,0xbf,0x8f,0x01,0xcf,0xea,0x41,0x41,0x40,0xde,0x5d,0xae,0x22,0x23,
+        0xb0,0x03,0x61,0xa3,0x96,0x17,0x7a,0x9c,0xb4,0x10,0xff,0x61,0xf2,0x00,0x15,0xad
+    };
+    static const unsigned char empty[SHA256_DIGEST_SIZE] = {
+        0xe3,0xb0,0xc4,0x42,0x98,0xfc,0x1c,0x14,0x9a,0xfb,0xf4,0xc8,0x99,0x6f,0xb9,0x24,
+        0x27,0xae,0x41,0xe4,0x64,0x9b,0x93,0x4c,0xa4,0x95,0x99,0x1b,0x78,0x52,0xb8,0x55
+    };
+    unsigned char d[SHA256_DIGEST_SIZE];
+    int bad = 0;
+    hash_with(sha256_blocks_scalar, (const unsigned char*)"abc", 3, d);
+    if (memcmp(d, abc, sizeof(d)) != 0) { printf("scalar: \"abc\" known answer FAILED\n"); bad++; }
+    hash_with(sha256_blocks_scalar, (const unsigned char*)"", 0, d);
+    if (memcmp(d, empty, sizeof(d)) != 0) { printf("scalar: empty known answer FAILED\n"); bad++; }
+    return bad;
+}
+
+static int check_blocks(const BlocksBackend *b, const unsigned char *buf) {
+    int bad = 0;
+    for (size_t i = 0; i < LENGTH_COUNT; i++) {
+        unsigned char want[SHA256_DIGEST_SIZE], got[SHA256_DIGEST_SIZE];
+        hash_with(sha256_blocks_scalar, buf, s_lengths[i], want);
+        hash_with(b->fn, buf, s_lengths[i], got);
+        if (memcmp(want, got, sizeof(want)) != 0) {
+            printf("%-8s length %zu differs from scalar\n", b->name, s_lengths[i]);
+            bad++;
+        }
+    }
+    uint32_t st[8];
+    memcpy(st, IV, sizeof(st));
+    double t = now_sec();
+    b->fn(st, buf, BENCH_BYTES / SHA256_BLOCK_SIZE);
+    t = now_sec() - t;
+    printf("%-8s %s  %8.1f MB/s\n", b->name, bad ? "MISMATCH" : "ok      ", mb_per_sec(BENCH_BYTES, t));
+    return bad;
+}
+
+static int check_lanes(const LanesBackend *b, const unsigned char *buf) {
+    // Each lane hashes its own slice, some of them idle, as in sha256_multi()
+    const size_t slice = BENCH_BYTES / SHA256_MAX_LANES;
+    const size_t blocks = slice / SHA256_BLOCK_SIZE;
+    uint32_t want[SHA256_MAX_LANES][8], got[SHA256_MAX_LANES][8];
+    const unsigned char *ptr[SHA256_MAX_LANES];
+    int bad = 0;
+    unsigned masks[] = { (1u << b->lanes) - 1, 0x5u & ((1u << b->lanes) - 1) };
+    double t = 0;
+    for (size_t m = 0; m < sizeof(masks) / sizeof(masks[0]); m++) {
+        for (unsigned l = 0; l < b->lanes; l++) {
+            ptr[l] = buf + l * slice;
+            for (int j = 0; j < 8; j++) want[l][j] = got[l][j] = IV[j] ^ l;
+            if ((masks[m] >> l) & 1) sha256_blocks_scalar(want[l], ptr[l], blocks);
+        }
+        double t0 = now_sec();
+        b->fn(got, ptr, masks[m], blocks);
+        if (m == 0) t = now_sec() - t0;
+        for (unsigned l = 0; l < b->lanes; l++) {
+            if (memcmp(want[l], got[l], sizeof(want[l])) != 0) {
+                printf("%-8s lane %u (mask 0x%x) differs from scalar\n", b->name, l, masks[m]);
+                bad++;
+            }
+        }
+    }
+    printf("%-8s %s  %8.1f MB/s (%u lanes)\n", b->name, bad ? "MISMATCH" : "ok      ",
+           mb_per_sec(slice * b->lanes, t), b->lanes);
+    return bad;
+}
+
+static int check_multi(const unsigned char *buf) {
+    int bad = 0;
+    const void *data[MULTI_COUNT];
+    size_t len[MULTI_COUNT];
+    unsigned char (*out)[SHA256_DIGEST_SIZE] = malloc(MULTI_COUNT * SHA256_DIGEST_SIZE);
+    if (!out) return 1;
+
+    // Uneven lengths, so lanes finish at different times
+    for (size_t i = 0; i < MULTI_COUNT; i++) {
+        data[i] = buf + i * 997;
+        len[i] = s_lengths[i % LENGTH_COUNT];
+    }
+    sha256_multi(data, len, MULTI_COUNT, out);
+    for (size_t i = 0; i < MULTI_COUNT; i++) {
+        unsigned char want[SHA256_DIGEST_SIZE];
+        hash_with(sha256_blocks_scalar, data[i], len[i], want);
+        if (memcmp(want, out[i], sizeof(want)) != 0) {
+            printf("multi    message %zu (length %zu) differs from scalar\n", i, len[i]);
+            bad++;
+        }
+    }
+
+    // Many equal buffers, the manifest/hash pipeline case
+    for (size_t i = 0; i < MULTI_COUNT; i++) {
+        data[i] = buf + i * MULTI_SIZE;
+        len[i] = MULTI_SIZE;
+    }
+    double t = now_sec();
+    sha256_multi(data, len, MULTI_COUNT, out);
+    t = now_sec() - t;
+    for (size_t i = 0; i < MULTI_COUNT; i += 17) {
+        unsigned char want[SHA256_DIGEST_SIZE];
+        hash_with(sha256_blocks_scalar, data[i], len[i], want);
+        if (memcmp(want, out[i], sizeof(want)) != 0) { printf("multi    buffer %zu differs from scalar\n", i); bad++; }
+    }
+    printf("multi    %s  %8.1f MB/s (%d x %d KiB)\n", bad ? "MISMATCH" : "ok      ",
+           mb_per_sec((size_t)MULTI_COUNT * MULTI_SIZE, t), MULTI_COUNT, MULTI_SIZE / 1024);
+    free(out);
+    return bad;
+}
+
+int main(void) {
+    unsigned char *buf = malloc(BENCH_BYTES);
+    if (!buf) { printf("out of memory\n"); return 1; }
+    fill_pattern(buf, BENCH_BYTES);
+
+    printf("selected backend: %s\n", sha256_backend_name());
+    int bad = check_known_answers();
+    for (size_t i = 0; i < sizeof(s_blocks_backends) / sizeof(s_blocks_backends[0]); i++) {
+        const BlocksBackend *b = &s_blocks_backends[i];
+        if (b->usable && !b->usable()) { printf("%-8s not supported by this CPU\n", b->name); continue; }
+        bad += check_blocks(b, buf);
+    }
+    for (const LanesBackend *b = s_lanes_backends; b->fn; b++) {
+        if (b->usable && !b->usable()) { printf("%-8s not supported by this CPU\n", b->name); continue; }
+        bad += check_lanes(b, buf);
+    }
+    bad += check_multi(buf);
+
+    free(buf);
+    printf(bad ? "%d mismatch(es)\n" : "all backends match the scalar reference\n", bad);
+    return bad ? 1 : 0;
+}
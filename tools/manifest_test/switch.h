@@ -0,0 +1,22 @@
+// switch.h - the libnx types and result macros the security code needs, so
+// the manifest code builds on a host
+#ifndef HOST_SWITCH_H
+#define HOST_SWITCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t  s64;
+typedef u32 Result;
+
+#define MAKERESULT(module, description) ((((module) & 0x1FF)) | ((description) & 0x1FFF) << 9)
+#define R_SUCCEEDED(res)    ((res) == 0)
+#define R_FAILED(res)       ((res) != 0)
+#define Module_Libnx        345
+
+#endif // HOST_SWITCH_H
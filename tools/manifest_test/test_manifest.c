@@ -0,0 +1,248 @@
+// test_manifest.c - host check for source/security/manifest.c
+//
+// Builds a manifest over files of awkward sizes, fed in odd pieces, and
+// checks every root against an independent Merkle computation. Then runs
+// the stepped verification on a clean copy, on a damaged one (flipped
+// bytes, a truncated file, an extended file, a missing file), resumed part
+// way through, cancelled, and against a tampered and a torn manifest. From
+// the repo root:
+//
+//   gcc -O2 -D_GNU_SOURCE -Itools/manifest_test -Isource/security -o test_manifest
+//       tools/manifest_test/test_manifest.c source/security/manifest.c
+//       source/security/hash_pipeline.c source/security/crypto.c source/security/aes.c
+//       source/security/sha256.c source/security/checksum.c -lpthread
+//   ./test_manifest
+//
+// Works in a fresh directory under /tmp. Exits non-zero if a check fails.
+
+#include "manifest.h"
+#include "sha256.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define CHUNK   MANIFEST_CHUNK_SIZE
+#define FILES   6
+
+static int s_failures;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        s_failures++; \
+        printf("FAIL line %d: ", __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+    } \
+} while (0)
+
+static const char *const s_names[FILES] = { "empty", "five", "one", "one_plus", "seven", "sub/big" };
+static const size_t s_sizes[FILES] = { 0, 5, CHUNK, CHUNK + 1, 7 * CHUNK + 123, 40 * CHUNK + 7 };
+static char s_dir[] = "/tmp/test_manifest.XXXXXX";
+
+static u8 *make_data(size_t len, unsigned seed) {
+    u8 *data = malloc(len ? len : 1);
+    for (size_t i = 0; i < len; i++) data[i] = (u8)((i * 2654435761u + seed) >> 7);
+    return data;
+}
+
+static const char *path_of(const char *name) {
+    static char path[512];
+    snprintf(path, sizeof(path), "%s/%s", s_dir, name);
+    return path;
+}
+
+static void write_file(const char *name, const void *data, size_t len) {
+    FILE *f = fopen(path_of(name), "wb");
+    if (!f) return;
+    fwrite(data, 1, len, f);
+    fclose(f);
+}
+
+static void sha256_of(const void *data, size_t len, u8 out[32]) {
+    sha256_ctx ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, out);
+}
+
+// The tree as manifest.h describes it, computed the slow way
+static void reference_root(const u8 *data, size_t len, char hex[65]) {
+    size_t count = (len + CHUNK - 1) / CHUNK;
+    u8 (*level)[32] = malloc((count ? count : 1) * 32);
+    u8 root[32];
+    if (count == 0) sha256_of("", 0, root);
+    for (size_t i = 0; i < count; i++) sha256_of(data + i * CHUNK, len - i * CHUNK < CHUNK ? len - i * CHUNK : CHUNK, level[i]);
+    while (count > 1) {
+        size_t pairs = count / 2;
+        for (size_t i = 0; i < pairs; i++) {
+            u8 node[65];
+            node[0] = 0x01;
+            memcpy(node + 1, level[2 * i], 32);
+            memcpy(node + 33, level[2 * i + 1], 32);
+            sha256_of(node, sizeof(node), level[i]);
+        }
+        if (count & 1) memcpy(level[pairs], level[count - 1], 32);
+        count = pairs + (count & 1);
+    }
+    if (len) memcpy(root, level[0], 32);
+    free(level);
+    for (int i = 0; i < 32; i++) sprintf(hex + 2 * i, "%02x", root[i]);
+}
+
+// Run a verification to the end. Returns the last step result.
+static int verify_all(const char *manifest, u64 resume, ManifestVerify **out) {
+    int rc = manifest_verify_begin(manifest, resume, out);
+    if (rc != 0) return rc;
+    int last = -1;
+    while ((rc = manifest_verify_step(*out, NULL)) == 0) {
+        int pct = manifest_verify_progress(*out);
+        CHECK(pct >= last, "progress went back from %d to %d", last, pct);
+        last = pct;
+    }
+    return rc;
+}
+
+static void expect_damage(const ManifestDamage *d, const char *name, u64 offset, u64 size) {
+    CHECK(strcmp(d->name, name) == 0 && d->offset == offset && d->size == size,
+          "damage %s +0x%llx 0x%llx, expected %s +0x%llx 0x%llx", d->name, (unsigned long long)d->offset,
+          (unsigned long long)d->size, name, (unsigned long long)offset, (unsigned long long)size);
+}
+
+static char *read_text(const char *name, size_t *len) {
+    FILE *f = fopen(path_of(name), "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    *len = (size_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *text = calloc(1, *len + 1);
+    if (text && fread(text, 1, *len, f) != *len) { free(text); text = NULL; }
+    fclose(f);
+    return text;
+}
+
+int main(void) {
+    if (!mkdtemp(s_dir)) { printf("cannot create a work directory\n"); return 1; }
+    mkdir(path_of("sub"), 0755);
+
+    // Build: odd piece sizes, a dropped file and a header patched afterwards
+    u8 *data[FILES];
+    Manifest *m = NULL;
+    CHECK(manifest_create(&m) == 0, "manifest_create");
+    for (int i = 0; i < FILES; i++) {
+        data[i] = make_data(s_sizes[i], (unsigned)i * 77);
+        write_file(s_names[i], data[i], s_sizes[i]);
+        CHECK(manifest_begin_file(m, s_names[i]) == 0, "begin %s", s_names[i]);
+        size_t off = 0, piece = 1 + (size_t)i * 99991;
+        while (off < s_sizes[i]) {
+            size_t n = s_sizes[i] - off < piece ? s_sizes[i] - off : piece;
+            manifest_update(m, data[i] + off, n);
+            off += n;
+            piece = piece * 3 % 3000017 + 1;
+        }
+        CHECK(manifest_end_file(m) == 0, "end %s", s_names[i]);
+    }
+    CHECK(manifest_begin_file(m, "dropped") == 0, "begin dropped");
+    manifest_update(m, "abc", 3);
+    manifest_drop_file(m);
+
+    u8 *patched = make_data(s_sizes[4], 4 * 77);
+    memset(patched, 0, 16);
+    CHECK(manifest_begin_file(m, "patched") == 0, "begin patched");
+    manifest_update(m, patched, s_sizes[4]);
+    CHECK(manifest_end_file(m) == 0, "end patched");
+    write_file("patched", data[4], s_sizes[4]);
+    CHECK(manifest_rehash(m, path_of("patched"), 4, 8) == 0, "rehash");
+    CHECK(manifest_save(m, path_of("all" MANIFEST_EXT)) == 0, "save");
+    manifest_free(m);
+    free(patched);
+
+    size_t text_len = 0;
+    char *text = read_text("all" MANIFEST_EXT, &text_len);
+    int files = 0;
+    for (char *line = text; line && *line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : line + strlen(line)) {
+        if (line[0] != 'F') continue;
+        char hex[65];
+        int i = files < FILES ? files : 4;
+        reference_root(data[i], s_sizes[i], hex);
+        CHECK(strncmp(strchr(line + 2, ' ') + 1, hex, 64) == 0, "root of file %d", files);
+        files++;
+    }
+    CHECK(files == FILES + 1, "%d files listed, expected %d", files, FILES + 1);
+
+    // Clean copy
+    u64 total = s_sizes[4];
+    for (int i = 0; i < FILES; i++) total += s_sizes[i];
+    ManifestVerify *v = NULL;
+    size_t count = 0;
+    CHECK(verify_all(path_of("all" MANIFEST_EXT), 0, &v) == 1, "clean run");
+    manifest_verify_damage(v, &count);
+    CHECK(count == 0, "clean copy reported %zu damaged ranges", count);
+    CHECK(manifest_verify_position(v) == total && manifest_verify_progress(v) == 100, "clean position");
+    manifest_verify_finish(v);
+
+    // Damage: adjacent chunks 3 and 4 merge, chunk 20 stands alone
+    u8 *big = data[5];
+    big[3 * CHUNK + 10] ^= 1;
+    big[4 * CHUNK] ^= 1;
+    big[20 * CHUNK + 5] ^= 1;
+    write_file("sub/big", big, s_sizes[5]);
+    write_file("one_plus", data[3], CHUNK);
+    u8 longer[7];
+    memcpy(longer, data[1], 5);
+    memcpy(longer + 5, "xx", 2);
+    write_file("five", longer, sizeof(longer));
+    remove(path_of("one"));
+    CHECK(verify_all(path_of("all" MANIFEST_EXT), 0, &v) == 1, "damaged run");
+    const ManifestDamage *d = manifest_verify_damage(v, &count);
+    CHECK(count == 5, "%zu damaged ranges, expected 5", count);
+    if (count == 5) {
+        expect_damage(&d[0], "five", 5, 2);
+        expect_damage(&d[1], "one", 0, CHUNK);
+        expect_damage(&d[2], "one_plus", CHUNK, 1);
+        expect_damage(&d[3], "sub/big", 3 * CHUNK, 2 * CHUNK);
+        expect_damage(&d[4], "sub/big", 20 * CHUNK, CHUNK);
+    }
+    // "empty" and the first five bytes of "five" are all that is known good
+    CHECK(manifest_verify_position(v) == s_sizes[1], "position moved past the first damage");
+    manifest_verify_finish(v);
+
+    // Resume past the repaired small files: only the big file's damage is left
+    write_file("five", data[1], s_sizes[1]);
+    write_file("one", data[2], s_sizes[2]);
+    write_file("one_plus", data[3], s_sizes[3]);
+    u64 resume = s_sizes[1] + s_sizes[2] + s_sizes[3] + 2 * CHUNK + 17;
+    CHECK(verify_all(path_of("all" MANIFEST_EXT), resume, &v) == 1, "resumed run");
+    d = manifest_verify_damage(v, &count);
+    CHECK(count == 2 && d[0].offset == 3 * CHUNK, "resumed run reported %zu damaged ranges", count);
+    manifest_verify_finish(v);
+
+    bool cancel = true;
+    CHECK(manifest_verify_begin(path_of("all" MANIFEST_EXT), 0, &v) == 0, "begin for cancel");
+    CHECK(manifest_verify_step(v, &cancel) == -EINTR, "cancel");
+    manifest_verify_finish(v);
+
+    // A changed chunk digest no longer matches its root; a torn file is short
+    char *tampered = malloc(text_len + 1);
+    memcpy(tampered, text, text_len + 1);
+    char *leaf = strchr(strstr(tampered, "\nF 5 ") + 1, '\n') + 1;
+    leaf[0] = leaf[0] == 'a' ? 'b' : 'a';
+    write_file("tampered" MANIFEST_EXT, tampered, text_len);
+    CHECK(manifest_verify_begin(path_of("tampered" MANIFEST_EXT), 0, &v) == -EBADMSG, "tampered manifest accepted");
+    write_file("torn" MANIFEST_EXT, text, text_len - 1);
+    CHECK(manifest_verify_begin(path_of("torn" MANIFEST_EXT), 0, &v) == -EBADMSG, "torn manifest accepted");
+    CHECK(manifest_verify_begin(path_of("missing" MANIFEST_EXT), 0, &v) == -ENOENT, "missing manifest");
+    free(tampered);
+    free(text);
+
+    static const char *const extra[] = { "patched", "all" MANIFEST_EXT, "tampered" MANIFEST_EXT, "torn" MANIFEST_EXT };
+    for (int i = 0; i < FILES; i++) { remove(path_of(s_names[i])); free(data[i]); }
+    for (size_t i = 0; i < sizeof(extra) / sizeof(extra[0]); i++) remove(path_of(extra[i]));
+    rmdir(path_of("sub"));
+    rmdir(s_dir);
+
+    printf(s_failures ? "%d check(s) failed\n" : "all checks pass\n", s_failures);
+    return s_failures ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+// bench_keepalive.c - host check and benchmark for simple_http's connection pool
+//
+// Fetches a small body repeatedly over a new connection per request and over
+// the keep-alive pool, then from several threads at once, and checks every
+// response against the body the stand-in wrote. It also checks that a pooled
+// connection the server closed, or a response cut short, costs at most the
+// one request that saw it. Run it against http_standin.py with a round trip
+// delay so connection setup shows; from the repo root:
+//
+//   gcc -O2 -Itools/net_bench -Isource/net -o bench_keepalive
+//       tools/net_bench/bench_keepalive.c tools/net_bench/net_bench.c
+//       source/net/simple_http.c source/net/http_inflate.c source/net/tls_conn.c -lpthread
+//   python3 tools/net_bench/http_standin.py 18880 body.bin 1 2 &
+//   ./bench_keepalive http://127.0.0.1:18880/asset body.bin
+//
+// Exits non-zero if a request fails or a body differs.
+
+#include "net_bench.h"
+#include "simple_http.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+
+#define BENCH_REQUESTS  100
+#define BENCH_THREADS   8
+#define BENCH_LEN       2000    // bytes per response, an index or an icon
+
+typedef struct {
+    const char *url;
+    const NetBenchBody *want;
+    int ok;
+} Client;
+
+static bool fetch(const char *url, const NetBenchBody *want, size_t len) {
+    char *body = NULL;
+    size_t got = 0;
+    bool ok = simple_http_get(url, &body, &got) == 0 && got == len && memcmp(body, want->data, len) == 0;
+    free(body);
+    return ok;
+}
+
+static int run(const char *name, const char *url, const NetBenchBody *want, bool pooled) {
+    long long conns0, reqs0, sent0, conns1, reqs1, sent1;
+    net_bench_stats(url, &conns0, &reqs0, &sent0);
+    int ok = 0;
+    double t = net_bench_now();
+    for (int i = 0; i < BENCH_REQUESTS; i++) {
+        if (!pooled) simple_http_close_idle();
+        if (fetch(url, want, BENCH_LEN)) ok++;
+    }
+    t = net_bench_now() - t;
+    net_bench_stats(url, &conns1, &reqs1, &sent1);
+    printf("%-16s %3d/%d ok  %6.2f ms/request  %lld connection(s)\n", name, ok, BENCH_REQUESTS,
+           t * 1000.0 / BENCH_REQUESTS, conns1 - conns0);
+    return ok == BENCH_REQUESTS ? 0 : 1;
+}
+
+static void *client_main(void *arg) {
+    Client *c = arg;
+    for (int i = 0; i < BENCH_REQUESTS; i++) {
+        if (fetch(c->url, c->want, BENCH_LEN)) c->ok++;
+    }
+    return NULL;
+}
+
+// Several threads sharing the pool must each get whole, correct responses
+static int run_threads(const char *url, const NetBenchBody *want) {
+    long long conns0, reqs0, sent0, conns1, reqs1, sent1;
+    net_bench_stats(url, &conns0, &reqs0, &sent0);
+    Client clients[BENCH_THREADS];
+    pthread_t threads[BENCH_THREADS];
+    double t = net_bench_now();
+    int started = 0;
+    for (int i = 0; i < BENCH_THREADS; i++) {
+        clients[i] = (Client){ url, want, 0 };
+        if (pthread_create(&threads[i], NULL, client_main, &clients[i]) != 0) break;
+        started++;
+    }
+    int ok = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        ok += clients[i].ok;
+    }
+    t = net_bench_now() - t;
+    net_bench_stats(url, &conns1, &reqs1, &sent1);
+    printf("%d threads        %3d/%d ok  %6.2f ms/request  %lld connection(s)\n", BENCH_THREADS, ok,
+           BENCH_THREADS * BENCH_REQUESTS, t * 1000.0 / (BENCH_THREADS * BENCH_REQUESTS), conns1 - conns0);
+    return ok == BENCH_THREADS * BENCH_REQUESTS ? 0 : 1;
+}
+
+// A dead pooled connection is retried on a new one; a cut response fails
+// only its own request and is not parked in the pool
+static int run_faults(const char *base, const NetBenchBody *want) {
+    char url[1024];
+    int bad = 0;
+
+    snprintf(url, sizeof(url), "%s&close", base);
+    for (int i = 0; i < 3; i++) {
+        if (!fetch(url, want, BENCH_LEN)) { printf("server closed idle  FAILED (request %d)\n", i); bad++; }
+    }
+    if (!fetch(base, want, BENCH_LEN)) { printf("server closed idle  FAILED (next request)\n"); bad++; }
+
+    snprintf(url, sizeof(url), "%s&drop=%d", base, BENCH_LEN / 2);
+    if (fetch(url, want, BENCH_LEN)) { printf("cut response  FAILED (reported success)\n"); bad++; }
+    if (!fetch(base, want, BENCH_LEN)) { printf("cut response  FAILED (next request)\n"); bad++; }
+
+    printf(bad ? "faults           FAILED\n" : "faults           ok\n");
+    return bad ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("Usage: %s <http url> <expected body file>\n", argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    NetBenchBody want;
+    if (net_bench_load(argv[2], &want) != 0) return 1;
+    if (want.len < BENCH_LEN) { printf("body shorter than %d bytes\n", BENCH_LEN); free(want.data); return 1; }
+
+    char url[512];
+    snprintf(url, sizeof(url), "%s?len=%d", argv[1], BENCH_LEN);
+    int bad = 0;
+    bad += run("new connection", url, &want, false);
+    bad += run("pooled", url, &want, true);
+    bad += run_threads(url, &want);
+    bad += run_faults(url, &want);
+
+    simple_http_close_idle();
+    free(want.data);
+    printf(bad ? "%d run(s) failed\n" : "all responses match\n", bad);
+    return bad ? 1 : 0;
+}
@@ -0,0 +1,131 @@
+# http_standin.py - local HTTP server for the net_bench harnesses
+#
+# Serves one random body with keep-alive, a strong ETag and Range/If-Range
+# support, plus "<connections> <requests> <body bytes sent>" for /stats so a
+# harness can tell a resumed transfer from one that started over:
+#
+#   python3 tools/net_bench/http_standin.py 18880 body.bin [MiB] [rtt ms]
+#
+# body.bin is written with the body (16 MiB by default). Every new connection
+# and every request waits one round trip. Query options on any other path:
+#   len=N        serve only the first N bytes of the body
+#   rate=K       send at most K KiB/s on this connection
+#   drop=N       cut each of the first two responses on this path after N bytes
+#   noranges     ignore Range, as servers without range support do
+#   close        close the connection after the response without saying so,
+#                as a server dropping an idle keep-alive connection does
+
+import hashlib
+import os
+import socket
+import sys
+import threading
+import time
+from urllib.parse import parse_qs, urlsplit
+
+port = int(sys.argv[1])
+body_path = sys.argv[2]
+body = os.urandom((int(sys.argv[3]) if len(sys.argv) > 3 else 16) * 1024 * 1024)
+rtt = (int(sys.argv[4]) if len(sys.argv) > 4 else 0) / 1000.0
+with open(body_path, "wb") as f:
+    f.write(body)
+etag = '"%s"' % hashlib.sha1(body).hexdigest()
+
+stats = {"connections": 0, "requests": 0, "sent": 0}
+drops = {}
+lock = threading.Lock()
+
+
+def parse(head):
+    lines = head.decode("latin-1").split("\r\n")
+    target = lines[0].split(" ")[1]
+    headers = {}
+    for line in lines[1:]:
+        name, _, value = line.partition(":")
+        headers[name.strip().lower()] = value.strip()
+    return target, headers
+
+
+def send_body(conn, data, rate, cut):
+    pos, piece = 0, 64 * 1024
+    while pos < len(data):
+        n = min(piece, len(data) - pos)
+        if cut is not None and pos + n > cut:
+            n = cut - pos
+        conn.sendall(data[pos:pos + n])
+        pos += n
+        with lock:
+            stats["sent"] += n
+        if cut is not None and pos >= cut:
+            return False
+        if rate:
+            time.sleep(n / rate)
+    return True
+
+
+def serve(conn):
+    try:
+        time.sleep(rtt)
+        buf = b""
+        while True:
+            while b"\r\n\r\n" not in buf:
+                data = conn.recv(65536)
+                if not data:
+                    return
+                buf += data
+            head, buf = buf.split(b"\r\n\r\n", 1)
+            target, headers = parse(head)
+            time.sleep(rtt)
+            with lock:
+                stats["requests"] += 1
+            url = urlsplit(target)
+            if url.path == "/stats":
+                with lock:
+                    out = ("%d %d %d" % (stats["connections"], stats["requests"], stats["sent"])).encode()
+                conn.sendall(b"HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n" % len(out) + out)
+                continue
+
+            opts = parse_qs(url.query, keep_blank_values=True)
+            data = body[:int(opts["len"][0])] if "len" in opts else body
+            rate = int(opts["rate"][0]) * 1024 if "rate" in opts else 0
+            cut = None
+            if "drop" in opts:
+                with lock:
+                    if drops.get(target, 0) < 2:
+                        drops[target] = drops.get(target, 0) + 1
+                        cut = int(opts["drop"][0])
+
+            status, extra = b"200 OK", b""
+            rng = headers.get("range")
+            if_range = headers.get("if-range")
+            if rng and "noranges" not in opts and (if_range is None or if_range == etag):
+                first, _, last = rng.split("=", 1)[1].partition("-")
+                start = int(first)
+                end = min(int(last), len(data) - 1) if last else len(data) - 1
+                if start >= len(data):
+                    conn.sendall(b"HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%d\r\n"
+                                 b"Content-Length: 0\r\n\r\n" % len(data))
+                    continue
+                status = b"206 Partial Content"
+                extra = b"Content-Range: bytes %d-%d/%d\r\n" % (start, end, len(data))
+                data = data[start:end + 1]
+            conn.sendall(b"HTTP/1.1 " + status + b"\r\nETag: " + etag.encode() + b"\r\n" + extra +
+                         b"Content-Length: %d\r\n\r\n" % len(data))
+            if not send_body(conn, data, rate, cut) or "close" in opts:
+                return
+    except OSError:
+        pass
+    finally:
+        conn.close()
+
+
+listener = socket.socket()
+listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+listener.bind(("127.0.0.1", port))
+listener.listen(64)
+while True:
+    sock, _ = listener.accept()
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    with lock:
+        stats["connections"] += 1
+    threading.Thread(target=serve, args=(sock,), daemon=True).start()
@@ -0,0 +1,84 @@
+// net_bench.c - shared helpers for the net_bench harnesses, and stand-ins for
+// the UI hooks the download code reports progress through
+
+#include "net_bench.h"
+#include "simple_http.h"
+#include "../../source/logger.h"
+#include "../../source/ui/ui_data.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+// The harnesses watch results, not the queue UI
+void ui_downloads_push_update(const char *label, int progress) { (void)label; (void)progress; }
+void ui_downloads_remove(const char *label) { (void)label; }
+void ui_set_task(const char *label, int progress_percent) { (void)label; (void)progress_percent; }
+void ui_clear_task(void) {}
+
+Result log_event(LogLevel level, const char *fmt, ...) {
+    va_list ap;
+    (void)level;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    return 0;
+}
+
+double net_bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static char *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = malloc(size > 0 ? (size_t)size : 1);
+    if (!data || size < 0 || fread(data, 1, (size_t)size, f) != (size_t)size) {
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    *len = (size_t)size;
+    return data;
+}
+
+int net_bench_load(const char *path, NetBenchBody *body) {
+    body->data = read_file(path, &body->len);
+    if (!body->data) { printf("cannot read %s\n", path); return -1; }
+    return 0;
+}
+
+bool net_bench_file_matches(const char *path, const NetBenchBody *body) {
+    size_t len = 0;
+    char *data = read_file(path, &len);
+    bool same = data && len == body->len && memcmp(data, body->data, len) == 0;
+    free(data);
+    return same;
+}
+
+int net_bench_stats(const char *url, long long *connections, long long *requests, long long *sent) {
+    char stats_url[512];
+    const char *host = strstr(url, "://");
+    const char *path = host ? strchr(host + 3, '/') : NULL;
+    size_t base = path ? (size_t)(path - url) : strlen(url);
+    snprintf(stats_url, sizeof(stats_url), "%.*s/stats", (int)base, url);
+    char *stats = NULL;
+    size_t len = 0;
+    if (simple_http_get(stats_url, &stats, &len) != 0) return -1;
+    int n = sscanf(stats, "%lld %lld %lld", connections, requests, sent);
+    free(stats);
+    return n == 3 ? 0 : -1;
+}
+
+long long net_bench_sent(const char *url) {
+    long long connections, requests, sent;
+    return net_bench_stats(url, &connections, &requests, &sent) == 0 ? sent : -1;
+}
@@ -0,0 +1,25 @@
+// net_bench.h - shared helpers for the net_bench harnesses
+#ifndef NET_BENCH_H
+#define NET_BENCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct {
+    char *data;
+    size_t len;
+} NetBenchBody;
+
+double net_bench_now(void);
+
+// Read the body http_standin.py wrote. Returns 0 on success.
+int net_bench_load(const char *path, NetBenchBody *body);
+
+bool net_bench_file_matches(const char *path, const NetBenchBody *body);
+
+// The stand-in's /stats for the server behind url: connections accepted,
+// requests answered and body bytes sent. Returns -1 on failure.
+int net_bench_stats(const char *url, long long *connections, long long *requests, long long *sent);
+long long net_bench_sent(const char *url);
+
+#endif // NET_BENCH_H
@@ -0,0 +1,17 @@
+// switch.h - the libnx types the net and UI headers need, so the download
+// code builds on a host
+#ifndef HOST_SWITCH_H
+#define HOST_SWITCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t  s64;
+typedef u32 Result;
+
+#endif // HOST_SWITCH_H
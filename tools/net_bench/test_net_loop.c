@@ -0,0 +1,244 @@
+// test_net_loop.c - host check for net_loop downloads and their writer thread
+//
+// Runs net_loop_download() against http_standin.py with a rate hook standing
+// in for the SD card (the hook runs right after each write, on the same
+// thread), and checks the file after each case:
+//   plain      - a download with nothing in the way
+//   slow card  - every 16th write stalls for SLOW_STALL_MS while small GETs
+//                run on the same loop; none of them may wait for the card
+//   dropped    - the first two responses are cut; the retries must resume
+//                from the part file, so the body is sent once
+//   cancel     - cancelled while writes are queued: reported once, as -1
+//   stop       - net_loop_stop() mid-download: the part file is closed and
+//                the download reported before stop returns
+// From the repo root:
+//
+//   gcc -O2 -Itools/net_bench -Isource/net -o test_net_loop
+//       tools/net_bench/test_net_loop.c tools/net_bench/net_bench.c
+//       source/net/net_loop.c source/net/downloader.c source/net/segmented_download.c
+//       source/net/simple_http.c source/net/http_inflate.c source/net/tls_conn.c -lpthread
+//   python3 tools/net_bench/http_standin.py 18880 body.bin &
+//   ./test_net_loop http://127.0.0.1:18880 body.bin
+//
+// Exits non-zero if a case fails.
+
+#include "net_bench.h"
+#include "net_loop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#define TEST_OUT        "test_net_loop.out"
+#define TEST_LEN        (4 * 1024 * 1024)
+#define SLOW_STALL_MS   200
+#define SLOW_GETS       20
+#define SLOW_GET_MAX_MS 100     // a GET that waited on a stalled write would take SLOW_STALL_MS
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int done;                   // on_done calls
+    int rc;
+    int writes;
+    bool slow;
+} Transfer;
+
+static void transfer_init(Transfer *t, bool slow) {
+    memset(t, 0, sizeof(*t));
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->cond, NULL);
+    t->slow = slow;
+}
+
+static void transfer_destroy(Transfer *t) {
+    pthread_mutex_destroy(&t->lock);
+    pthread_cond_destroy(&t->cond);
+}
+
+static void on_done(void *user, int rc) {
+    Transfer *t = user;
+    pthread_mutex_lock(&t->lock);
+    t->done++;
+    t->rc = rc;
+    pthread_cond_broadcast(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+}
+
+// Returns false if the transfer did not end within secs
+static bool transfer_wait(Transfer *t, int secs) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += secs;
+    pthread_mutex_lock(&t->lock);
+    int err = 0;
+    while (!t->done && err == 0) err = pthread_cond_timedwait(&t->cond, &t->lock, &ts);
+    bool done = t->done > 0;
+    pthread_mutex_unlock(&t->lock);
+    return done;
+}
+
+// Wait until the card has taken n writes, or the transfer ended
+static void wait_writes(Transfer *t, int n) {
+    pthread_mutex_lock(&t->lock);
+    while (t->writes < n && !t->done) {
+        pthread_mutex_unlock(&t->lock);
+        struct timespec ts = { 0, 1000000L };
+        nanosleep(&ts, NULL);
+        pthread_mutex_lock(&t->lock);
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+// The card: every 16th write of a slow one stalls
+static s64 card_hook(void *user, size_t chunk, size_t current, size_t total) {
+    Transfer *t = user;
+    (void)chunk; (void)current; (void)total;
+    pthread_mutex_lock(&t->lock);
+    int n = ++t->writes;
+    pthread_mutex_unlock(&t->lock);
+    if (t->slow && n % 16 == 0) {
+        struct timespec ts = { 0, SLOW_STALL_MS * 1000000L };
+        nanosleep(&ts, NULL);
+    }
+    return 0;
+}
+
+static void clean(void) {
+    remove(TEST_OUT);
+    remove(TEST_OUT ".part");
+    remove(TEST_OUT ".part.meta");
+}
+
+static bool exists(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f) fclose(f);
+    return f != NULL;
+}
+
+static int download(const char *name, const char *url, const NetBenchBody *want, long long max_sent) {
+    clean();
+    Transfer t;
+    transfer_init(&t, false);
+    long long before = net_bench_sent(url);
+    int bad = 0;
+    if (!net_loop_download(url, TEST_OUT, card_hook, on_done, &t)) {
+        printf("%-10s cannot queue\n", name);
+        bad = 1;
+    } else if (!transfer_wait(&t, 30)) {
+        printf("%-10s TIMED OUT\n", name);
+        bad = 1;
+    } else {
+        long long sent = net_bench_sent(url) - before;
+        if (t.rc != 0) { printf("%-10s FAILED\n", name); bad = 1; }
+        else if (!net_bench_file_matches(TEST_OUT, want)) { printf("%-10s MISMATCH\n", name); bad = 1; }
+        else if (max_sent >= 0 && sent > max_sent) {
+            printf("%-10s RESENT (%lld of %zu body bytes sent)\n", name, sent, want->len);
+            bad = 1;
+        } else {
+            printf("%-10s ok  %lld body bytes sent\n", name, sent);
+        }
+    }
+    transfer_destroy(&t);
+    clean();
+    return bad;
+}
+
+static int slow_card(const char *base, const NetBenchBody *want) {
+    clean();
+    char url[512], small[512];
+    snprintf(url, sizeof(url), "%s/slow?len=%d&rate=8192", base, TEST_LEN);
+    snprintf(small, sizeof(small), "%s/small?len=1000", base);
+    Transfer t;
+    transfer_init(&t, true);
+    int bad = 0;
+    if (!net_loop_download(url, TEST_OUT, card_hook, on_done, &t)) {
+        printf("%-10s cannot queue\n", "slow card");
+        transfer_destroy(&t);
+        return 1;
+    }
+    // Once the card has stalled, reads are also held back by the writer
+    wait_writes(&t, 16);
+    double worst = 0;
+    int failed = 0;
+    for (int i = 0; i < SLOW_GETS; i++) {
+        Transfer g;
+        transfer_init(&g, false);
+        NetHttpHandlers h = { NULL, NULL, on_done, &g };
+        double start = net_bench_now();
+        if (!net_loop_http_get(small, NULL, &h) || !transfer_wait(&g, 10) || g.rc != 0) failed++;
+        double ms = (net_bench_now() - start) * 1000.0;
+        if (ms > worst) worst = ms;
+        transfer_destroy(&g);
+    }
+    if (!transfer_wait(&t, 60)) { printf("%-10s TIMED OUT\n", "slow card"); bad = 1; }
+    else if (t.rc != 0) { printf("%-10s FAILED\n", "slow card"); bad = 1; }
+    else if (!net_bench_file_matches(TEST_OUT, want)) { printf("%-10s MISMATCH\n", "slow card"); bad = 1; }
+    else if (failed) { printf("%-10s %d GET(s) FAILED\n", "slow card", failed); bad = 1; }
+    else if (worst > SLOW_GET_MAX_MS) {
+        printf("%-10s GETs HELD UP (worst %.1f ms)\n", "slow card", worst);
+        bad = 1;
+    } else {
+        printf("%-10s ok  %d writes, worst GET %.1f ms\n", "slow card", t.writes, worst);
+    }
+    transfer_destroy(&t);
+    clean();
+    return bad;
+}
+
+// Cancel (or stop the loop) once writes are under way
+static int interrupt(const char *name, const char *base, bool stop) {
+    clean();
+    char url[512];
+    snprintf(url, sizeof(url), "%s/%s?len=%d", base, stop ? "stop" : "cancel", TEST_LEN);
+    Transfer t;
+    transfer_init(&t, true);
+    int bad = 0;
+    u32 id = net_loop_download(url, TEST_OUT, card_hook, on_done, &t);
+    if (!id) {
+        printf("%-10s cannot queue\n", name);
+        transfer_destroy(&t);
+        return 1;
+    }
+    wait_writes(&t, 8);
+    if (stop) net_loop_stop();
+    else net_loop_cancel(id);
+    bool ended = stop ? t.done > 0 : transfer_wait(&t, 10);
+    if (!ended) { printf("%-10s NOT REPORTED\n", name); bad = 1; }
+    else if (t.done != 1 || t.rc != -1) { printf("%-10s reported %d time(s), rc %d\n", name, t.done, t.rc); bad = 1; }
+    else if (exists(TEST_OUT)) { printf("%-10s COMPLETED\n", name); bad = 1; }
+    else printf("%-10s ok  %d writes before it ended\n", name, t.writes);
+    if (stop && net_loop_start() != 0) { printf("cannot restart the loop\n"); bad = 1; }
+    transfer_destroy(&t);
+    clean();
+    return bad;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("Usage: %s <stand-in base url> <body file>\n", argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    NetBenchBody body;
+    if (net_bench_load(argv[2], &body) != 0) { printf("cannot read %s\n", argv[2]); return 1; }
+    if (body.len > TEST_LEN) body.len = TEST_LEN;
+    if (net_loop_start() != 0) { printf("cannot start the loop\n"); return 1; }
+
+    char url[512];
+    int bad = 0;
+    snprintf(url, sizeof(url), "%s/plain?len=%d", argv[1], TEST_LEN);
+    bad += download("plain", url, &body, -1);
+    bad += slow_card(argv[1], &body);
+    snprintf(url, sizeof(url), "%s/dropped?len=%d&drop=%d", argv[1], TEST_LEN, TEST_LEN / 3);
+    bad += download("dropped", url, &body, (long long)body.len);
+    bad += interrupt("cancel", argv[1], false);
+    bad += interrupt("stop", argv[1], true);
+
+    net_loop_stop();
+    free(body.data);
+    printf(bad ? "%d case(s) failed\n" : "all cases pass\n", bad);
+    return bad ? 1 : 0;
+}
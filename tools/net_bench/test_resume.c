@@ -0,0 +1,113 @@
+// test_resume.c - host check for resumable single-stream downloads
+//
+// Runs download_url_to_file() against http_standin.py in the cases the
+// "<out>.part" resume state has to handle, checking the file and how many
+// body bytes the server sent each time:
+//   dropped    - the first two responses are cut mid-transfer; the retries
+//                must continue with Range/If-Range, so the body is sent once
+//   stale      - a part file left for another version of the resource must
+//                be thrown away, not glued to the new one
+//   no ranges  - a server that answers a ranged request with 200 must get
+//                the part started over
+// From the repo root:
+//
+//   gcc -O2 -Itools/net_bench -Isource/net -o test_resume
+//       tools/net_bench/test_resume.c tools/net_bench/net_bench.c
+//       source/net/downloader.c source/net/segmented_download.c
+//       source/net/simple_http.c source/net/http_inflate.c source/net/tls_conn.c -lpthread
+//   python3 tools/net_bench/http_standin.py 18880 body.bin &
+//   ./test_resume http://127.0.0.1:18880/asset body.bin
+//
+// Exits non-zero if a case fails.
+
+#include "net_bench.h"
+#include "downloader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#define TEST_OUT    "test_resume.out"
+#define TEST_PART   TEST_OUT ".part"
+#define TEST_META   TEST_OUT ".part.meta"
+
+static void clean(void) {
+    remove(TEST_OUT);
+    remove(TEST_PART);
+    remove(TEST_META);
+}
+
+// Leave a part file holding the first len bytes of data, as an interrupted
+// attempt would, with the given validator
+static void plant_part(const char *url, const char *validator, const char *data, size_t len, size_t total) {
+    FILE *f = fopen(TEST_PART, "wb");
+    if (f) {
+        fwrite(data, 1, len, f);
+        fclose(f);
+    }
+    DownloadPartMeta meta;
+    memset(&meta, 0, sizeof(meta));
+    snprintf(meta.url, sizeof(meta.url), "%s", url);
+    snprintf(meta.validator, sizeof(meta.validator), "%s", validator);
+    meta.total = (long long)total;
+    download_part_meta_save(TEST_META, &meta);
+}
+
+// Download url and check the file; max_sent bounds the body bytes sent
+static int check(const char *name, const char *url, const NetBenchBody *want, long long max_sent) {
+    long long before = net_bench_sent(url);
+    int rc = download_url_to_file(url, TEST_OUT, NULL);
+    long long sent = net_bench_sent(url) - before;
+    if (rc != 0 || !net_bench_file_matches(TEST_OUT, want)) {
+        printf("%-10s FAILED (rc %d)\n", name, rc);
+        return 1;
+    }
+    if (sent > max_sent) {
+        printf("%-10s FAILED (%lld bytes sent, expected at most %lld)\n", name, sent, max_sent);
+        return 1;
+    }
+    FILE *part = fopen(TEST_PART, "rb"), *meta = fopen(TEST_META, "rb");
+    int left = (part != NULL) + (meta != NULL);
+    if (part) fclose(part);
+    if (meta) fclose(meta);
+    if (left) { printf("%-10s FAILED (resume state left behind)\n", name); return 1; }
+    printf("%-10s ok  %lld bytes sent\n", name, sent);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("Usage: %s <http url> <expected body file>\n", argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    NetBenchBody want;
+    if (net_bench_load(argv[2], &want) != 0) return 1;
+    long long len = (long long)want.len;
+    char url[1024];
+    int bad = 0;
+
+    clean();
+    snprintf(url, sizeof(url), "%s?drop=%lld", argv[1], len / 3);
+    bad += check("dropped", url, &want, len);
+
+    clean();
+    snprintf(url, sizeof(url), "%s", argv[1]);
+    char *other = malloc(want.len);
+    if (other) {
+        for (size_t i = 0; i < want.len; i++) other[i] = (char)~want.data[i];
+        plant_part(url, "\"an-older-version\"", other, want.len / 2, want.len);
+        bad += check("stale", url, &want, len + len / 2);
+        free(other);
+    }
+
+    clean();
+    snprintf(url, sizeof(url), "%s?noranges", argv[1]);
+    plant_part(url, "", want.data, want.len / 2, want.len);
+    bad += check("no ranges", url, &want, len + len / 2);
+
+    clean();
+    free(want.data);
+    printf(bad ? "%d case(s) failed\n" : "all cases pass\n", bad);
+    return bad ? 1 : 0;
+}
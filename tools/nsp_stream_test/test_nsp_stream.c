@@ -0,0 +1,323 @@
+// test_nsp_stream.c - host check for the streaming NSP installer
+//
+// Builds PFS0 packages in memory and pushes them through nsp_stream.c into
+// a fake content sink that keeps every placeholder in memory and writes
+// slowly, so the ring fills and the feeding side has to wait. Each package
+// is fed whole and in pieces of several sizes; every NCA must arrive intact
+// and be registered, and tickets and certificates must reach aux_file.
+// Truncated packages, sink failures and bad headers must fail and leave no
+// placeholder behind. From the repo root:
+//
+//   gcc -O2 -Itools/nsp_stream_test -Isource/game -o test_nsp_stream
+//       tools/nsp_stream_test/test_nsp_stream.c source/game/nsp_stream.c -lpthread
+//   ./test_nsp_stream
+//
+// Exits non-zero if a check fails.
+
+#include "nsp_stream.h"
+#include "../../source/logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define MAX_FILES       8
+#define WRITE_DELAY_US  500     // per sink write, roughly an SD card
+
+static int s_failures;
+static bool s_verbose;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        s_failures++; \
+        printf("FAIL line %d: ", __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+    } \
+} while (0)
+
+// nsp_stream.c logs bad packages; only show that with -v
+Result log_event(LogLevel level, const char *fmt, ...) {
+    va_list ap;
+    (void)level;
+    if (!s_verbose) return 0;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    return 0;
+}
+
+typedef struct {
+    const char *name;
+    size_t size;
+    size_t gap;                 // padding before this file in the data area
+} TestFile;
+
+typedef struct {
+    u8 *data;
+    size_t len;
+    size_t header_size;
+    size_t offset[MAX_FILES];   // of each file's data in the package
+} Package;
+
+// Content placeholders held in memory
+typedef struct {
+    pthread_mutex_t lock;       // the writer thread and aux_file both report here
+    struct {
+        NcmContentId id;
+        u8 *data;
+        size_t size;
+        size_t written;         // bytes received in order from offset 0
+        bool committed;
+        bool aborted;
+    } ph[MAX_FILES];
+    int created;
+    int fail_write_at;          // fail the n-th write (1-based), 0 = never
+    int writes;
+    char aux_names[MAX_FILES][64];
+    size_t aux_len[MAX_FILES];
+    bool aux_ok[MAX_FILES];
+    int aux_count;
+    const Package *pkg;
+    const TestFile *files;
+    int file_count;
+} FakeSink;
+
+static u8 byte_at(size_t file, size_t off) {
+    return (u8)((off * 2654435761u + file * 40503u) >> 11);
+}
+
+// Lay the files out as a PFS0, listed in 'list_order' but stored in array order
+static Package build_package(const TestFile *files, int count, const int *list_order) {
+    Package p;
+    memset(&p, 0, sizeof(p));
+    size_t strtab = 0;
+    for (int i = 0; i < count; i++) strtab += strlen(files[i].name) + 1;
+    strtab = (strtab + 0x1F) & ~(size_t)0x1F;
+    p.header_size = 0x10 + (size_t)count * 0x18 + strtab;
+    size_t data_len = 0;
+    for (int i = 0; i < count; i++) {
+        data_len += files[i].gap;
+        p.offset[i] = p.header_size + data_len;
+        data_len += files[i].size;
+    }
+    p.len = p.header_size + data_len + 64; // trailing padding
+    p.data = calloc(1, p.len);
+    memcpy(p.data, "PFS0", 4);
+    u32 n = (u32)count, st = (u32)strtab;
+    memcpy(p.data + 4, &n, 4);
+    memcpy(p.data + 8, &st, 4);
+    char *names = (char*)p.data + 0x10 + (size_t)count * 0x18;
+    u32 name_off = 0;
+    for (int k = 0; k < count; k++) {
+        int i = list_order ? list_order[k] : k;
+        u8 *entry = p.data + 0x10 + (size_t)k * 0x18;
+        u64 off = p.offset[i] - p.header_size, size = files[i].size;
+        memcpy(entry, &off, 8);
+        memcpy(entry + 8, &size, 8);
+        memcpy(entry + 16, &name_off, 4);
+        strcpy(names + name_off, files[i].name);
+        name_off += (u32)strlen(files[i].name) + 1;
+        for (size_t b = 0; b < files[i].size; b++) p.data[p.offset[i] + b] = byte_at((size_t)i, b);
+    }
+    return p;
+}
+
+static Result sink_create(void *user, const NcmContentId *id, s64 size, NcmPlaceHolderId *out_ph) {
+    FakeSink *f = user;
+    pthread_mutex_lock(&f->lock);
+    int slot = f->created++;
+    pthread_mutex_unlock(&f->lock);
+    if (slot >= MAX_FILES) return MAKERESULT(Module_Libnx, 99);
+    f->ph[slot].id = *id;
+    f->ph[slot].data = malloc(size ? (size_t)size : 1);
+    f->ph[slot].size = (size_t)size;
+    memset(out_ph, 0, sizeof(*out_ph));
+    out_ph->uuid[0] = (u8)slot;
+    return 0;
+}
+
+static Result sink_write(void *user, const NcmPlaceHolderId *ph, u64 offset, const void *data, size_t len) {
+    FakeSink *f = user;
+    if (f->fail_write_at && ++f->writes == f->fail_write_at) return MAKERESULT(Module_Libnx, 98);
+    usleep(WRITE_DELAY_US);
+    int slot = ph->uuid[0];
+    // Writes of one NCA must arrive in order and inside the placeholder
+    if (offset != f->ph[slot].written || offset + len > f->ph[slot].size) return MAKERESULT(Module_Libnx, 97);
+    memcpy(f->ph[slot].data + offset, data, len);
+    f->ph[slot].written += len;
+    return 0;
+}
+
+static Result sink_commit(void *user, const NcmContentId *id, const NcmPlaceHolderId *ph) {
+    FakeSink *f = user;
+    int slot = ph->uuid[0];
+    if (memcmp(id, &f->ph[slot].id, sizeof(*id)) != 0 || f->ph[slot].written != f->ph[slot].size)
+        return MAKERESULT(Module_Libnx, 96);
+    f->ph[slot].committed = true;
+    return 0;
+}
+
+static void sink_abort(void *user, const NcmPlaceHolderId *ph) {
+    FakeSink *f = user;
+    f->ph[ph->uuid[0]].aborted = true;
+}
+
+static void sink_aux(void *user, const char *name, const void *data, size_t len) {
+    FakeSink *f = user;
+    pthread_mutex_lock(&f->lock);
+    int n = f->aux_count < MAX_FILES ? f->aux_count++ : MAX_FILES - 1;
+    pthread_mutex_unlock(&f->lock);
+    snprintf(f->aux_names[n], sizeof(f->aux_names[n]), "%s", name);
+    f->aux_len[n] = len;
+    for (int i = 0; i < f->file_count; i++) {
+        if (strcmp(f->files[i].name, name) != 0) continue;
+        f->aux_ok[n] = len == f->files[i].size && memcmp(data, f->pkg->data + f->pkg->offset[i], len) == 0;
+    }
+}
+
+static void sink_init(FakeSink *f, const Package *pkg, const TestFile *files, int count) {
+    memset(f, 0, sizeof(*f));
+    pthread_mutex_init(&f->lock, NULL);
+    f->pkg = pkg;
+    f->files = files;
+    f->file_count = count;
+}
+
+static void sink_free(FakeSink *f) {
+    for (int i = 0; i < MAX_FILES; i++) free(f->ph[i].data);
+    pthread_mutex_destroy(&f->lock);
+}
+
+static bool is_nca(const char *name) {
+    size_t n = strlen(name);
+    return n >= 4 && strcmp(name + n - 4, ".nca") == 0;
+}
+
+// Feed 'len' bytes of the package in pieces of 'piece'. Returns the result of
+// nsp_stream_finish(), or -1 if a feed was refused.
+static Result feed(FakeSink *f, const Package *pkg, size_t len, size_t piece, u32 *installed) {
+    NspContentSink sink = { f, sink_create, sink_write, sink_commit, sink_abort, sink_aux };
+    NspStream *s = nsp_stream_create(&sink, NULL);
+    if (!s) return MAKERESULT(Module_Libnx, 95);
+    Result rc = 0;
+    for (size_t off = 0; off < len; off += piece) {
+        size_t n = len - off < piece ? len - off : piece;
+        if (nsp_stream_feed(s, pkg->data + off, n) != 0) { rc = (Result)-1; break; }
+    }
+    Result frc = nsp_stream_finish(s);
+    if (R_SUCCEEDED(rc)) rc = frc;
+    if (installed) *installed = nsp_stream_installed_count(s);
+    if (R_SUCCEEDED(rc)) CHECK(nsp_stream_total_size(s) + 64 == pkg->len, "total size");
+    nsp_stream_destroy(s);
+    return rc;
+}
+
+// Every placeholder is either registered or dropped
+static void check_no_leftovers(const FakeSink *f, const char *what) {
+    for (int i = 0; i < f->created; i++)
+        CHECK(f->ph[i].committed || f->ph[i].aborted, "%s: placeholder %d left behind", what, i);
+}
+
+static void run_good(const char *what, const TestFile *files, int count, const int *list_order, size_t piece) {
+    Package pkg = build_package(files, count, list_order);
+    FakeSink f;
+    sink_init(&f, &pkg, files, count);
+    u32 installed = 0;
+    Result rc = feed(&f, &pkg, pkg.len, piece, &installed);
+    CHECK(rc == 0, "%s, pieces of %zu: failed 0x%x", what, piece, rc);
+
+    int ncas = 0, aux = 0;
+    for (int i = 0; i < count; i++) {
+        if (!is_nca(files[i].name)) {
+            if (files[i].size <= NSP_STREAM_MAX_AUX) aux++;
+            continue;
+        }
+        // Placeholders are created in package order
+        int slot = ncas++;
+        CHECK(slot < f.created && f.ph[slot].committed, "%s: %s not registered", what, files[i].name);
+        if (slot < f.created) {
+            CHECK(f.ph[slot].size == files[i].size &&
+                  memcmp(f.ph[slot].data, pkg.data + pkg.offset[i], files[i].size) == 0,
+                  "%s, pieces of %zu: %s differs", what, piece, files[i].name);
+        }
+    }
+    CHECK(installed == (u32)ncas && f.created == ncas, "%s: %u of %d NCAs installed", what, installed, ncas);
+    CHECK(f.aux_count == aux, "%s: %d aux files, expected %d", what, f.aux_count, aux);
+    for (int i = 0; i < f.aux_count; i++) CHECK(f.aux_ok[i], "%s: aux file %s differs", what, f.aux_names[i]);
+    sink_free(&f);
+    free(pkg.data);
+}
+
+// Feed the first 'keep' bytes of the package (all of it if FEED_ALL)
+#define FEED_ALL ((size_t)-1)
+
+static void run_bad(const char *what, const TestFile *files, int count, size_t keep, int fail_write_at) {
+    Package pkg = build_package(files, count, NULL);
+    FakeSink f;
+    sink_init(&f, &pkg, files, count);
+    f.fail_write_at = fail_write_at;
+    Result rc = feed(&f, &pkg, keep < pkg.len ? keep : pkg.len, 64 * 1024 + 3, NULL);
+    CHECK(R_FAILED(rc), "%s: accepted", what);
+    check_no_leftovers(&f, what);
+    sink_free(&f);
+    free(pkg.data);
+}
+
+int main(int argc, char **argv) {
+    s_verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+
+    // Several blocks, a partial block, an empty NCA, gaps, tickets and a
+    // file too large to keep for aux_file
+    static const TestFile files[] = {
+        { "0123456789abcdef0123456789abcdef.nca", 5 * NSP_STREAM_BLOCK_SIZE + 4093, 0 },
+        { "00112233445566778899aabbccddeeff.cnmt.nca", 3 * 1024 + 1, 17 },
+        { "fedcba9876543210fedcba9876543210.nca", 0, 0 },
+        { "0123456789abcdef0123456789abcde0.tik", 0x2C0, 5 },
+        { "0123456789abcdef0123456789abcde0.cert", 0x700, 0 },
+        { "ffffffffffffffffffffffffffffffff.nca", NSP_STREAM_BLOCK_SIZE, 0 },
+        { "readme.bin", NSP_STREAM_MAX_AUX + 1, 100 },
+    };
+    const int count = (int)(sizeof(files) / sizeof(files[0]));
+    static const int shuffled[] = { 3, 0, 6, 2, 5, 1, 4 };
+    static const size_t pieces[] = { 1u << 30, 1, 4093, NSP_STREAM_BLOCK_SIZE, NSP_STREAM_BLOCK_SIZE + 1 };
+
+    for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) run_good("in order", files, count, NULL, pieces[i]);
+    run_good("entries listed out of order", files, count, shuffled, 65536);
+
+    Package pkg = build_package(files, count, NULL);
+    size_t mid_nca = pkg.offset[5] + NSP_STREAM_BLOCK_SIZE / 2;
+    free(pkg.data);
+    run_bad("truncated inside an NCA", files, count, mid_nca, 0);
+    run_bad("truncated inside the header", files, count, 0x20, 0);
+    run_bad("sink write fails", files, count, FEED_ALL, 3);
+
+    static const TestFile ncz[] = { { "0123456789abcdef0123456789abcdef.ncz", 100, 0 } };
+    run_bad("compressed NCA", ncz, 1, FEED_ALL, 0);
+    static const TestFile bad_id[] = { { "not-a-content-id-at-all-xxxxxxxx.nca", 100, 0 } };
+    run_bad("bad content id", bad_id, 1, FEED_ALL, 0);
+
+    pkg = build_package(files, 2, NULL);
+    FakeSink f;
+    sink_init(&f, &pkg, files, 2);
+    memcpy(pkg.data, "PFS1", 4);
+    CHECK(R_FAILED(feed(&f, &pkg, pkg.len, 4096, NULL)), "bad magic accepted");
+    sink_free(&f);
+    free(pkg.data);
+
+    // Second entry starts inside the first
+    pkg = build_package(files, 2, NULL);
+    sink_init(&f, &pkg, files, 2);
+    u64 overlap = 16;
+    memcpy(pkg.data + 0x10 + 0x18, &overlap, 8);
+    CHECK(R_FAILED(feed(&f, &pkg, pkg.len, 4096, NULL)), "overlapping entries accepted");
+    check_no_leftovers(&f, "overlapping entries");
+    sink_free(&f);
+    free(pkg.data);
+
+    printf(s_failures ? "%d check(s) failed\n" : "all checks pass\n", s_failures);
+    return s_failures ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+// bench_tls.c - host benchmark for the cached TLS state in tls_conn.c
+//
+// Fetches a small body repeatedly over https three ways and checks every
+// response against the file the server wrote:
+//   fresh state     - shared state dropped before each request, so every
+//                     request seeds the DRBG and runs a full handshake, as
+//                     the old one-shot client did
+//   resumed session - new TCP connection per request, cached session
+//   pooled          - simple_http's keep-alive pool, no handshake at all
+// then asks the server how many handshakes it saw resumed. Run it against
+// tls_standin.py (see there for the certificate). From the repo root, with
+// the mbedTLS and zlib development packages installed:
+//
+//   gcc -O2 -DUSE_MBEDTLS -DUSE_ZLIB -Itools/tls_bench -Isource/net -o bench_tls
+//       tools/tls_bench/bench_tls.c source/net/tls_conn.c source/net/simple_http.c
+//       source/net/http_inflate.c -lmbedtls -lmbedx509 -lmbedcrypto -lz -lpthread
+//   ./bench_tls https://127.0.0.1:18843/asset body.bin
+//
+// Exits non-zero if a request fails or a body differs.
+
+#include "simple_http.h"
+#include "tls_conn.h"
+#include "../../source/logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#define BENCH_REQUESTS  40
+
+typedef enum { Mode_Fresh, Mode_Resumed, Mode_Pooled } BenchMode;
+
+// tls_conn.c logs handshake failures; show them
+Result log_event(LogLevel level, const char *fmt, ...) {
+    va_list ap;
+    (void)level;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    return 0;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int run(const char *name, BenchMode mode, const char *url, const char *want, size_t want_len) {
+    int ok = 0;
+    double t = now_sec();
+    for (int i = 0; i < BENCH_REQUESTS; i++) {
+        if (mode != Mode_Pooled) simple_http_close_idle();
+        if (mode == Mode_Fresh) tls_cleanup();
+        char *body = NULL;
+        size_t len = 0;
+        if (simple_http_get(url, &body, &len) == 0 && len == want_len && memcmp(body, want, len) == 0) ok++;
+        free(body);
+    }
+    t = now_sec() - t;
+    printf("%-16s %2d/%d ok  %7.2f ms/request\n", name, ok, BENCH_REQUESTS, t * 1000.0 / BENCH_REQUESTS);
+    return ok == BENCH_REQUESTS ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("Usage: %s <https url> <expected body file>\n", argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    if (!tls_available()) { printf("built without USE_MBEDTLS\n"); return 1; }
+
+    FILE *f = fopen(argv[2], "rb");
+    if (!f) { printf("cannot open %s\n", argv[2]); return 1; }
+    fseek(f, 0, SEEK_END);
+    long want_len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *want = malloc(want_len > 0 ? (size_t)want_len : 1);
+    if (!want || fread(want, 1, (size_t)want_len, f) != (size_t)want_len) {
+        printf("cannot read %s\n", argv[2]);
+        fclose(f);
+        free(want);
+        return 1;
+    }
+    fclose(f);
+
+    int bad = 0;
+    bad += run("fresh state", Mode_Fresh, argv[1], want, (size_t)want_len);
+    bad += run("resumed session", Mode_Resumed, argv[1], want, (size_t)want_len);
+    bad += run("pooled", Mode_Pooled, argv[1], want, (size_t)want_len);
+    free(want);
+
+    // Ask the stand-in how many of its handshakes were abbreviated
+    char stats_url[512];
+    const char *path = strchr(argv[1] + strlen("https://"), '/');
+    size_t base = path ? (size_t)(path - argv[1]) : strlen(argv[1]);
+    snprintf(stats_url, sizeof(stats_url), "%.*s/stats", (int)base, argv[1]);
+    char *stats = NULL;
+    size_t len = 0;
+    if (simple_http_get(stats_url, &stats, &len) == 0)
+        printf("server: %.*s (handshakes, resumed)\n", (int)len, stats);
+    free(stats);
+
+    simple_http_close_idle();
+    tls_cleanup();
+    printf(bad ? "%d run(s) failed\n" : "all responses match\n", bad);
+    return bad ? 1 : 0;
+}
@@ -0,0 +1,69 @@
+# tls_standin.py - local HTTPS server for bench_tls
+#
+# Serves a fixed body for any path over TLS 1.2 with keep-alive, and
+# "<handshakes> <resumed>" for /stats so the benchmark can check that
+# sessions really were resumed. Needs a certificate, e.g.:
+#
+#   openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=127.0.0.1 \
+#       -keyout key.pem -out cert.pem
+#   python3 tools/tls_bench/tls_standin.py 18843 cert.pem key.pem body.bin
+#
+# body.bin is written with random bytes (2000 by default) for bench_tls to
+# compare against.
+
+import os
+import socket
+import ssl
+import sys
+import threading
+
+port = int(sys.argv[1])
+cert, key, body_path = sys.argv[2], sys.argv[3], sys.argv[4]
+body = os.urandom(int(sys.argv[5]) if len(sys.argv) > 5 else 2000)
+with open(body_path, "wb") as f:
+    f.write(body)
+
+stats = {"handshakes": 0, "resumed": 0}
+lock = threading.Lock()
+
+ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+ctx.maximum_version = ssl.TLSVersion.TLSv1_2
+ctx.load_cert_chain(cert, key)
+
+
+def serve(conn):
+    try:
+        conn.do_handshake()
+        with lock:
+            stats["handshakes"] += 1
+            if conn.session_reused:
+                stats["resumed"] += 1
+        buf = b""
+        while True:
+            while b"\r\n\r\n" not in buf:
+                data = conn.recv(65536)
+                if not data:
+                    return
+                buf += data
+            head, buf = buf.split(b"\r\n\r\n", 1)
+            path = head.split(b" ")[1]
+            if path == b"/stats":
+                with lock:
+                    out = ("%d %d" % (stats["handshakes"], stats["resumed"])).encode()
+            else:
+                out = body
+            conn.sendall(b"HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n" % len(out) + out)
+    except (OSError, ssl.SSLError):
+        pass
+    finally:
+        conn.close()
+
+
+listener = socket.socket()
+listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+listener.bind(("127.0.0.1", port))
+listener.listen(64)
+while True:
+    sock, _ = listener.accept()
+    tls = ctx.wrap_socket(sock, server_side=True, do_handshake_on_connect=False)
+    threading.Thread(target=serve, args=(tls,), daemon=True).start()
@@ -0,0 +1,142 @@
+// bench_usb_stream.c - host check and benchmark for the pipelined USB stream
+//
+// Pushes a pattern through usb_stream_send_from()/usb_stream_recv_to() over
+// the loopback stand-in at a simulated link and disk rate, for several ring
+// depths, and checks every byte that comes out the other end. The receive
+// side is also run with a host that answers in odd-sized pieces, as a PC
+// client sending short packets would. Builds on its own from the repo root:
+//
+//   gcc -O2 -Itools/usb_loopback -Isource/net -o bench_usb_stream tools/usb_loopback/*.c
+//       source/net/usb_transport.c source/net/link_lz4.c -lpthread
+//
+// Raw streams only; the LZ4 framing needs a host-side encoder. Exits
+// non-zero if any transfer fails or any byte differs.
+
+#include "usb_loopback.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_BYTES     (64ull * 1024 * 1024)
+#define LINK_RATE       (40ull * 1024 * 1024)   // roughly what usb:ds sustains
+#define LINK_LATENCY_US 125
+#define DISK_RATE       (60ull * 1024 * 1024)   // SD card read/write
+
+typedef struct {
+    u64 pos;                    // bytes produced or consumed so far
+    u64 bad_at;                 // first mismatching offset + 1, 0 if none
+    size_t piece;               // host: max bytes per transfer, 0 = as asked
+} Stream;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Cheap position-dependent pattern, so a dropped or repeated block shows
+static u8 pattern_at(u64 off) {
+    return (u8)((off * 2654435761u) >> 13 ^ (off >> 20));
+}
+
+static void fill(u64 off, u8 *p, size_t len) {
+    for (size_t i = 0; i < len; i++) p[i] = pattern_at(off + i);
+}
+
+static void check(Stream *s, const u8 *p, size_t len) {
+    if (s->bad_at) return;
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] != pattern_at(s->pos + i)) { s->bad_at = s->pos + i + 1; return; }
+    }
+}
+
+// Hold the caller for as long as the SD card would take to move len bytes
+static void disk_delay(size_t len) {
+    u64 ns = (u64)len * 1000000000ull / DISK_RATE;
+    struct timespec ts = { (time_t)(ns / 1000000000ull), (long)(ns % 1000000000ull) };
+    nanosleep(&ts, NULL);
+}
+
+// Device side
+static size_t disk_source(void *user, void *buf, size_t len) {
+    Stream *s = user;
+    disk_delay(len);
+    fill(s->pos, buf, len);
+    s->pos += len;
+    return len;
+}
+
+static int disk_sink(void *user, const void *buf, size_t len) {
+    Stream *s = user;
+    disk_delay(len);
+    check(s, buf, len);
+    s->pos += len;
+    return 0;
+}
+
+// Host side
+static int host_rx(void *user, const void *data, size_t len) {
+    Stream *s = user;
+    check(s, data, len);
+    s->pos += len;
+    return 0;
+}
+
+static size_t host_tx(void *user, void *data, size_t len) {
+    Stream *s = user;
+    if (s->piece && len > s->piece) len = s->piece;
+    if (len > BENCH_BYTES - s->pos) len = BENCH_BYTES - s->pos;
+    fill(s->pos, data, len);
+    s->pos += len;
+    return len;
+}
+
+static int run(const char *what, UsbTransferMode mode, u32 slots, size_t piece) {
+    Stream dev = {0}, host = {0};
+    host.piece = piece;
+    UsbLoopbackConfig cfg = {
+        .bytes_per_sec = LINK_RATE,
+        .latency_us = LINK_LATENCY_US,
+        .host_rx = host_rx,
+        .host_tx = host_tx,
+        .user = &host,
+    };
+    UsbTransport *t = usb_loopback_create(&cfg);
+    if (!t) { printf("%-24s cannot create the loopback\n", what); return 1; }
+
+    double secs = now_sec();
+    Result rc = mode == UsbTransfer_Send
+        ? usb_stream_send_from(t, disk_source, &dev, BENCH_BYTES, slots, 0, NULL)
+        : usb_stream_recv_to(t, disk_sink, &dev, BENCH_BYTES, slots, 0, NULL);
+    secs = now_sec() - secs;
+    usb_loopback_destroy(t);
+
+    Stream *out = mode == UsbTransfer_Send ? &host : &dev;
+    int bad = 0;
+    if (R_FAILED(rc)) { printf("%-24s slots %u  FAILED (0x%x)\n", what, slots, rc); return 1; }
+    if (out->bad_at) { printf("%-24s slots %u  MISMATCH at offset %llu\n", what, slots,
+                              (unsigned long long)(out->bad_at - 1)); bad = 1; }
+    else if (out->pos != BENCH_BYTES) { printf("%-24s slots %u  SHORT (%llu bytes)\n", what, slots,
+                                               (unsigned long long)out->pos); bad = 1; }
+    else printf("%-24s slots %u  ok  %7.1f MB/s\n", what, slots,
+                (double)BENCH_BYTES / (1024.0 * 1024.0) / secs);
+    return bad;
+}
+
+int main(void) {
+    static const u32 slots[] = { 1, USB_RING_SLOTS, USB_RING_MAX_SLOTS };
+    int bad = 0;
+
+    printf("link %llu MB/s, disk %llu MB/s, %llu MiB per run\n",
+           LINK_RATE >> 20, DISK_RATE >> 20, BENCH_BYTES >> 20);
+    for (size_t i = 0; i < sizeof(slots) / sizeof(slots[0]); i++) {
+        bad += run("send", UsbTransfer_Send, slots[i], 0);
+        bad += run("receive", UsbTransfer_Receive, slots[i], 0);
+    }
+    // Host answering in pieces that are not a multiple of the packet size
+    bad += run("receive, short packets", UsbTransfer_Receive, USB_RING_SLOTS, 300 * 1024 + 7);
+
+    printf(bad ? "%d run(s) failed\n" : "all runs match\n", bad);
+    return bad ? 1 : 0;
+}
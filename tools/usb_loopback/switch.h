@@ -0,0 +1,27 @@
+// switch.h - the few libnx types and result codes the USB stream code uses,
+// so it builds on a host against usb_loopback.c
+#ifndef HOST_SWITCH_H
+#define HOST_SWITCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t  s64;
+typedef u32 Result;
+
+#define R_SUCCEEDED(rc) ((rc) == 0)
+#define R_FAILED(rc)    ((rc) != 0)
+#define MAKERESULT(module, description) ((((module) & 0x1FF)) | ((description) & 0x1FFF) << 9)
+
+#define Module_Libnx                345
+#define LibnxError_OutOfMemory      2
+#define LibnxError_BadInput         3
+#define LibnxError_NotFound         4
+#define LibnxError_IoError          5
+
+#endif // HOST_SWITCH_H
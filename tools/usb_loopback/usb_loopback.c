@@ -0,0 +1,229 @@
+// usb_loopback.c - in-process stand-in for the usb:ds bulk endpoints
+// Notes:
+// - Each direction has a FIFO of posted transfers and a thread playing the
+//   host: it takes the oldest transfer, holds it for latency + size / rate
+//   (the link is busy back to back, like a bus), moves the bytes through
+//   the configured callback and completes it.
+// - cancel() completes everything queued in that direction as failed; the
+//   transfer the host thread is already moving finishes normally, as a
+//   real controller finishes the DMA in progress.
+
+#include "usb_loopback.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define LOOPBACK_QUEUE 16
+
+typedef struct {
+    u32 id;
+    void *buf;
+    size_t size;
+    size_t transferred;
+    bool active;                // the host thread is moving its bytes
+    bool done;
+    bool failed;
+} LoopbackUrb;
+
+typedef struct Loopback Loopback;
+
+typedef struct {
+    Loopback *lb;
+    UsbTransferMode mode;
+    LoopbackUrb q[LOOPBACK_QUEUE];
+    u32 head, count;            // FIFO of posted transfers, done ones included
+    u32 next_id;
+    pthread_t thread;
+} LoopbackDir;
+
+struct Loopback {
+    UsbTransport transport;
+    UsbLoopbackConfig config;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool stop;
+    LoopbackDir dirs[2];
+};
+
+static u64 mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static void sleep_until(u64 deadline) {
+    u64 now = mono_ns();
+    if (deadline <= now) return;
+    u64 d = deadline - now;
+    struct timespec ts = { (time_t)(d / 1000000000ull), (long)(d % 1000000000ull) };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+}
+
+// Caller holds lock. First transfer not yet picked up, or NULL.
+static LoopbackUrb *next_pending(LoopbackDir *d) {
+    for (u32 i = 0; i < d->count; i++) {
+        LoopbackUrb *u = &d->q[(d->head + i) % LOOPBACK_QUEUE];
+        if (!u->done && !u->active) return u;
+    }
+    return NULL;
+}
+
+static void *host_thread(void *arg) {
+    LoopbackDir *d = (LoopbackDir*)arg;
+    Loopback *lb = d->lb;
+    u64 link_free = mono_ns();
+    pthread_mutex_lock(&lb->lock);
+    for (;;) {
+        LoopbackUrb *u = NULL;
+        while (!lb->stop && !(u = next_pending(d))) pthread_cond_wait(&lb->cond, &lb->lock);
+        if (lb->stop) break;
+        u->active = true;
+        u32 id = u->id;
+        void *buf = u->buf;
+        size_t size = u->size;
+        pthread_mutex_unlock(&lb->lock);
+
+        size_t moved = 0;
+        bool failed = false;
+        if (d->mode == UsbTransfer_Send) {
+            failed = lb->config.host_rx && lb->config.host_rx(lb->config.user, buf, size) != 0;
+            moved = failed ? 0 : size;
+        } else if (lb->config.host_tx) {
+            moved = lb->config.host_tx(lb->config.user, buf, size);
+            if (moved > size) moved = size;
+        }
+
+        // The bus moves one transfer at a time; a short OUT transfer only
+        // costs the bytes the host actually sent
+        u64 start = mono_ns();
+        if (start > link_free) link_free = start;
+        link_free += (u64)lb->config.latency_us * 1000;
+        if (lb->config.bytes_per_sec) link_free += (u64)moved * 1000000000ull / lb->config.bytes_per_sec;
+        sleep_until(link_free);
+
+        pthread_mutex_lock(&lb->lock);
+        // Cancel leaves an active transfer alone, so it is still queued
+        for (u32 i = 0; i < d->count; i++) {
+            LoopbackUrb *q = &d->q[(d->head + i) % LOOPBACK_QUEUE];
+            if (q->id != id) continue;
+            q->active = false;
+            q->transferred = moved;
+            q->failed = failed;
+            q->done = true;
+        }
+        pthread_cond_broadcast(&lb->cond);
+    }
+    pthread_mutex_unlock(&lb->lock);
+    return NULL;
+}
+
+static Result lb_post(void *ctx, UsbTransferMode mode, void *buf, size_t size, u32 *urb_id) {
+    Loopback *lb = (Loopback*)ctx;
+    if (((uintptr_t)buf & (USB_ALIGN - 1)) != 0) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+    LoopbackDir *d = &lb->dirs[mode];
+    pthread_mutex_lock(&lb->lock);
+    if (d->count == LOOPBACK_QUEUE) {
+        pthread_mutex_unlock(&lb->lock);
+        return MAKERESULT(Module_Libnx, LibnxError_OutOfMemory);
+    }
+    LoopbackUrb *u = &d->q[(d->head + d->count) % LOOPBACK_QUEUE];
+    memset(u, 0, sizeof(*u));
+    u->id = ++d->next_id;
+    u->buf = buf;
+    u->size = size;
+    d->count++;
+    *urb_id = u->id;
+    pthread_cond_broadcast(&lb->cond);
+    pthread_mutex_unlock(&lb->lock);
+    return 0;
+}
+
+static Result lb_wait(void *ctx, UsbTransferMode mode, u32 urb_id, u64 timeout_ns, size_t *transferred) {
+    Loopback *lb = (Loopback*)ctx;
+    LoopbackDir *d = &lb->dirs[mode];
+    struct timespec abs;
+    clock_gettime(CLOCK_REALTIME, &abs);
+    u64 t = (u64)abs.tv_nsec + timeout_ns;
+    abs.tv_sec += (time_t)(t / 1000000000ull);
+    abs.tv_nsec = (long)(t % 1000000000ull);
+
+    pthread_mutex_lock(&lb->lock);
+    Result rc = MAKERESULT(Module_Libnx, LibnxError_NotFound);
+    for (;;) {
+        LoopbackUrb *u = NULL;
+        for (u32 i = 0; i < d->count; i++) {
+            LoopbackUrb *q = &d->q[(d->head + i) % LOOPBACK_QUEUE];
+            if (q->id == urb_id) { u = q; break; }
+        }
+        if (!u) break;
+        if (u->done) {
+            *transferred = u->transferred;
+            rc = u->failed ? MAKERESULT(Module_Libnx, LibnxError_IoError) : 0;
+            // Reap completed transfers from the front
+            while (d->count > 0 && d->q[d->head].done && d->q[d->head].id <= urb_id) {
+                d->head = (d->head + 1) % LOOPBACK_QUEUE;
+                d->count--;
+            }
+            break;
+        }
+        if (pthread_cond_timedwait(&lb->cond, &lb->lock, &abs) == ETIMEDOUT) {
+            rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lb->lock);
+    return rc;
+}
+
+static void lb_cancel(void *ctx, UsbTransferMode mode) {
+    Loopback *lb = (Loopback*)ctx;
+    LoopbackDir *d = &lb->dirs[mode];
+    pthread_mutex_lock(&lb->lock);
+    for (u32 i = 0; i < d->count; i++) {
+        LoopbackUrb *u = &d->q[(d->head + i) % LOOPBACK_QUEUE];
+        if (!u->done && !u->active) { u->done = true; u->failed = true; }
+    }
+    pthread_cond_broadcast(&lb->cond);
+    pthread_mutex_unlock(&lb->lock);
+}
+
+UsbTransport *usb_loopback_create(const UsbLoopbackConfig *config) {
+    Loopback *lb = calloc(1, sizeof(*lb));
+    if (!lb) return NULL;
+    if (config) lb->config = *config;
+    pthread_mutex_init(&lb->lock, NULL);
+    pthread_cond_init(&lb->cond, NULL);
+    lb->transport.post = lb_post;
+    lb->transport.wait = lb_wait;
+    lb->transport.cancel = lb_cancel;
+    lb->transport.ctx = lb;
+    for (int i = 0; i < 2; i++) {
+        lb->dirs[i].lb = lb;
+        lb->dirs[i].mode = (UsbTransferMode)i;
+        if (pthread_create(&lb->dirs[i].thread, NULL, host_thread, &lb->dirs[i]) != 0) {
+            lb->stop = true;
+            pthread_cond_broadcast(&lb->cond);
+            if (i == 1) pthread_join(lb->dirs[0].thread, NULL);
+            pthread_cond_destroy(&lb->cond);
+            pthread_mutex_destroy(&lb->lock);
+            free(lb);
+            return NULL;
+        }
+    }
+    return &lb->transport;
+}
+
+void usb_loopback_destroy(UsbTransport *t) {
+    if (!t) return;
+    Loopback *lb = (Loopback*)t->ctx;
+    pthread_mutex_lock(&lb->lock);
+    lb->stop = true;
+    pthread_cond_broadcast(&lb->cond);
+    pthread_mutex_unlock(&lb->lock);
+    for (int i = 0; i < 2; i++) pthread_join(lb->dirs[i].thread, NULL);
+    pthread_cond_destroy(&lb->cond);
+    pthread_mutex_destroy(&lb->lock);
+    free(lb);
+}
@@ -0,0 +1,24 @@
+// usb_loopback.h - host stand-in for the usb:ds bulk endpoints
+#ifndef USB_LOOPBACK_H
+#define USB_LOOPBACK_H
+
+#include "usb_transport.h"
+
+// A "host" thread per direction completes posted transfers in order at a
+// simulated link rate and hands the bytes to/from the callbacks, so the
+// pipeline in usb_transport.c runs without hardware. Host builds only.
+typedef struct {
+    u64 bytes_per_sec;          // link rate per direction, 0 = unlimited
+    u32 latency_us;             // turnaround added to every transfer
+    // Device -> host data. Return non-zero to fail the transfer.
+    int (*host_rx)(void *user, const void *data, size_t len);
+    // Host -> device data: fill up to len bytes, return the count (a short
+    // count ends the transfer early, like a short packet)
+    size_t (*host_tx)(void *user, void *data, size_t len);
+    void *user;
+} UsbLoopbackConfig;
+
+UsbTransport *usb_loopback_create(const UsbLoopbackConfig *config);
+void usb_loopback_destroy(UsbTransport *t);
+
+#endif // USB_LOOPBACK_H